@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <calc_proto_ser.h>
+#include <calc_service.h>
+#include <calc_batch.h>
+
+/**
+ * Benchmark of the columnar batches against the text protocol, for the same requests evaluated
+ * by the same service. It is not part of the tests (build it in release mode to get real numbers):
+ *
+ *    cmake -DCMAKE_BUILD_TYPE=Release ... && ./calcbatch/bench/calc_batch_bench [rows]
+ *
+ * The scenarios:
+ *
+ *  - text: the work of a server for a pipelined client, without the sockets. The requests are
+ *    already serialized in memory, they are deserialized in chunks of 4KB (through the batch
+ *    request callback), evaluated one by one and their responses are serialized in memory.
+ *  - eval: calc_batch_eval on the chunks of the file mapped in memory, the responses stay in
+ *    memory.
+ *  - file: calc_batch_run from a file of requests (mapped in memory) to a file of responses, as
+ *    batch_calc_server does.
+ *
+ * The methods of the rows are random (ADD, SUB, MUL and DIV), so most of the blocks of a chunk mix
+ * the four methods.
+*/
+
+#define DEFAULT_ROWS 4000000
+#define CHUNK_SIZE 4096
+
+struct calc_service_t* svc;
+
+// Responses of the text scenario, serialized one after the other
+struct calc_proto_ser_t* resp_ser;
+char* resp_text;
+long resp_len;
+
+void eval_text_batch(void* context, const struct calc_proto_req_t* reqs, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    struct calc_proto_resp_t resp;
+    resp.req_id = reqs[i].id;
+    resp.status = STATUS_OK;
+    resp.result = 0.0;
+    switch (reqs[i].method)
+    {
+      case ADD:
+        resp.result = calc_service_add(svc, reqs[i].operand1, reqs[i].operand2, FALSE);
+        break;
+      case SUB:
+        resp.result = calc_service_sub(svc, reqs[i].operand1, reqs[i].operand2, FALSE);
+        break;
+      case MUL:
+        resp.result = calc_service_mul(svc, reqs[i].operand1, reqs[i].operand2, FALSE);
+        break;
+      case DIV:
+        if (calc_service_div(svc, reqs[i].operand1, reqs[i].operand2, &resp.result))
+        {
+          resp.status = STATUS_DIV_BY_ZERO;
+        }
+        break;
+      default:
+        resp.status = STATUS_INVALID_METHOD;
+    }
+    resp_len += calc_proto_ser_server_serialize_to(resp_ser, &resp, resp_text + resp_len,
+        CALC_PROTO_MAX_MSG_LEN);
+  }
+}
+
+double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void report(const char* name, long rows, double elapsed, double text_elapsed)
+{
+  printf("%-6s %8.1f ns/row %8.2f Mrow/s %8.1fx\n", name, elapsed * 1e9 / rows,
+      rows / elapsed / 1e6, text_elapsed / elapsed);
+}
+
+int main(int argc, char** argv)
+{
+  long rows = argc > 1 ? atol(argv[1]) : DEFAULT_ROWS;
+
+  svc = calc_service_new();
+  calc_service_ctor(svc);
+
+  // The requests, with a mix of integers, few decimals and full precision operands
+  struct calc_proto_req_t* reqs =
+      (struct calc_proto_req_t*)malloc(rows * sizeof(struct calc_proto_req_t));
+  srand(1620);
+  for (long i = 0; i < rows; i++)
+  {
+    reqs[i].id = i;
+    reqs[i].method = ADD + 2 * (rand() % 4);
+    switch (i % 3)
+    {
+      case 0:
+        reqs[i].operand1 = rand() % 10000;
+        reqs[i].operand2 = rand() % 10000;
+        break;
+      case 1:
+        reqs[i].operand1 = (rand() % 1000000) / 100.0;
+        reqs[i].operand2 = -(rand() % 1000000) / 1000.0;
+        break;
+      default:
+        reqs[i].operand1 = (double)rand() / RAND_MAX;
+        reqs[i].operand2 = (double)rand() / RAND_MAX * 100.0;
+    }
+  }
+
+  // The same requests as text and as a batch file
+  struct calc_proto_ser_t* ser = calc_proto_ser_new();
+  calc_proto_ser_ctor(ser, NULL, 256);
+  char* text = (char*)malloc(rows * CALC_PROTO_MAX_MSG_LEN);
+  long text_len = 0;
+  for (long i = 0; i < rows; i++)
+  {
+    text_len += calc_proto_ser_client_serialize_to(ser, &reqs[i], text + text_len,
+        CALC_PROTO_MAX_MSG_LEN);
+  }
+
+  FILE* in = tmpfile();
+  struct calc_batch_writer_t writer;
+  calc_batch_writer_ctor(&writer, fileno(in), CALC_BATCH_REQUESTS, CALC_BATCH_CHUNK_ROWS);
+  for (long start = 0; start < rows; start += CALC_BATCH_CHUNK_ROWS)
+  {
+    int n = rows - start < CALC_BATCH_CHUNK_ROWS ? rows - start : CALC_BATCH_CHUNK_ROWS;
+    struct calc_batch_reqs_t chunk;
+    calc_batch_writer_reqs(&writer, n, &chunk);
+    for (int i = 0; i < n; i++)
+    {
+      chunk.ids[i] = reqs[start + i].id;
+      chunk.methods[i] = reqs[start + i].method;
+      chunk.op1[i] = reqs[start + i].operand1;
+      chunk.op2[i] = reqs[start + i].operand2;
+    }
+    calc_batch_writer_commit(&writer);
+  }
+  calc_batch_writer_finish(&writer);
+  calc_batch_writer_dtor(&writer);
+  long file_len = lseek(fileno(in), 0, SEEK_CUR);
+  printf("%ld rows, text %.1f MB, batch %.1f MB\n", rows, text_len / 1e6, file_len / 1e6);
+
+  // text
+  resp_ser = calc_proto_ser_new();
+  calc_proto_ser_ctor(resp_ser, NULL, 256);
+  resp_text = (char*)malloc(rows * CALC_PROTO_MAX_MSG_LEN);
+  resp_len = 0;
+  struct calc_proto_ser_t* decoder = calc_proto_ser_new();
+  calc_proto_ser_ctor(decoder, NULL, 256);
+  calc_proto_ser_set_req_batch_callback(decoder, eval_text_batch);
+  double start = now_sec();
+  for (long offset = 0; offset < text_len; offset += CHUNK_SIZE)
+  {
+    struct buffer_t buf;
+    buf.data = text + offset;
+    buf.len = text_len - offset < CHUNK_SIZE ? text_len - offset : CHUNK_SIZE;
+    calc_proto_ser_server_deserialize(decoder, buf, NULL);
+  }
+  double text_elapsed = now_sec() - start;
+  report("text", rows, text_elapsed, text_elapsed);
+
+  // eval, on the chunks of the mapping of the file (the responses stay in memory)
+  struct calc_batch_resps_t resps;
+  resps.ids = (int32_t*)malloc(CALC_BATCH_CHUNK_ROWS * sizeof(int32_t));
+  resps.status = (int32_t*)malloc(CALC_BATCH_CHUNK_ROWS * sizeof(int32_t));
+  resps.results = (double*)malloc(CALC_BATCH_CHUNK_ROWS * sizeof(double));
+  lseek(fileno(in), 0, SEEK_SET);
+  start = now_sec();
+  struct calc_batch_reader_t reader;
+  calc_batch_reader_ctor(&reader, fileno(in));
+  struct calc_batch_reqs_t chunk;
+  while (calc_batch_reader_next_reqs(&reader, &chunk) > 0)
+  {
+    calc_batch_eval(svc, &chunk, &resps);
+  }
+  calc_batch_reader_dtor(&reader);
+  report("eval", rows, now_sec() - start, text_elapsed);
+
+  // file
+  FILE* out = tmpfile();
+  lseek(fileno(in), 0, SEEK_SET);
+  start = now_sec();
+  long evaluated = calc_batch_run(svc, fileno(in), fileno(out));
+  report("file", evaluated, now_sec() - start, text_elapsed);
+
+  fclose(in);
+  fclose(out);
+  free(resps.ids);
+  free(resps.status);
+  free(resps.results);
+  free(resp_text);
+  free(text);
+  free(reqs);
+  calc_proto_ser_dtor(decoder);
+  calc_proto_ser_delete(decoder);
+  calc_proto_ser_dtor(resp_ser);
+  calc_proto_ser_delete(resp_ser);
+  calc_proto_ser_dtor(ser);
+  calc_proto_ser_delete(ser);
+  calc_service_dtor(svc);
+  calc_service_delete(svc);
+  return 0;
+}
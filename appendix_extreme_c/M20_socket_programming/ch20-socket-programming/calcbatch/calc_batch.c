@@ -0,0 +1,697 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <calc_proto_ser.h>
+#include <calc_service.h>
+
+#include "calc_batch.h"
+
+// Rows of a chunk evaluated together, small enough for their temporary columns to stay in the
+// first level cache
+#define CALC_BATCH_BLOCK 256
+
+// Methods evaluated with the bulk methods of the service (the ones without memory)
+#define CALC_BATCH_BULK (1u << ADD | 1u << SUB | 1u << MUL | 1u << DIV)
+
+/**
+ * Bytes of a column padded to a multiple of 8, so the next one is aligned for doubles
+ *
+ * @param len Bytes of the column
+ *
+ * @return Padded length
+*/
+static size_t calc_batch_pad(size_t len)
+{
+  return (len + 7) & ~(size_t)7;
+}
+
+/**
+ * Bytes of a chunk of requests
+ *
+ * @param rows Rows of the chunk
+ *
+ * @return Bytes of the chunk, its header included
+*/
+size_t calc_batch_reqs_size(int rows)
+{
+  return 8 + calc_batch_pad(4 * (size_t)rows) + calc_batch_pad(rows) + 16 * (size_t)rows;
+}
+
+/**
+ * Bytes of a chunk of responses
+ *
+ * @param rows Rows of the chunk
+ *
+ * @return Bytes of the chunk, its header included
+*/
+size_t calc_batch_resps_size(int rows)
+{
+  return 8 + 2 * calc_batch_pad(4 * (size_t)rows) + 8 * (size_t)rows;
+}
+
+/**
+ * Find the columns of a chunk of requests
+ *
+ * @param chunk First byte of the chunk (its header)
+ * @param rows Rows of the chunk
+ * @param reqs Columns found
+*/
+static void calc_batch_map_reqs(char* chunk, int rows, struct calc_batch_reqs_t* reqs)
+{
+  reqs->rows = rows;
+  reqs->ids = (int32_t*)(chunk + 8);
+  reqs->methods = (uint8_t*)(chunk + 8 + calc_batch_pad(4 * (size_t)rows));
+  reqs->op1 = (double*)((char*)reqs->methods + calc_batch_pad(rows));
+  reqs->op2 = reqs->op1 + rows;
+}
+
+/**
+ * Find the columns of a chunk of responses
+ *
+ * @param chunk First byte of the chunk (its header)
+ * @param rows Rows of the chunk
+ * @param resps Columns found
+*/
+static void calc_batch_map_resps(char* chunk, int rows, struct calc_batch_resps_t* resps)
+{
+  resps->rows = rows;
+  resps->ids = (int32_t*)(chunk + 8);
+  resps->status = (int32_t*)(chunk + 8 + calc_batch_pad(4 * (size_t)rows));
+  resps->results = (double*)((char*)resps->status + calc_batch_pad(4 * (size_t)rows));
+}
+
+/**
+ * Read until the buffer is full or the input ends (a pipe or a socket gives any amount per read)
+ *
+ * @param fd File descriptor
+ * @param buf Destination
+ * @param len Bytes wanted
+ *
+ * @return Bytes read (less than len if the input ended), or -1 if the read failed
+*/
+static long calc_batch_read_full(int fd, char* buf, size_t len)
+{
+  size_t done = 0;
+  while (done < len)
+  {
+    ssize_t ret = read(fd, buf + done, len - done);
+    if (ret == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (ret == -1)
+    {
+      return -1;
+    }
+    if (ret == 0)
+    {
+      break;
+    }
+    done += ret;
+  }
+  return done;
+}
+
+/**
+ * Write the whole buffer (a pipe or a socket can take only a part of it per write)
+ *
+ * @param fd File descriptor
+ * @param buf Bytes to write
+ * @param len Number of bytes
+ *
+ * @return 0, or -1 if the write failed
+*/
+static int calc_batch_write_full(int fd, const char* buf, size_t len)
+{
+  size_t done = 0;
+  while (done < len)
+  {
+    ssize_t ret = write(fd, buf + done, len - done);
+    if (ret == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (ret == -1)
+    {
+      return -1;
+    }
+    done += ret;
+  }
+  return 0;
+}
+
+/**
+ * Allocate a reader
+ *
+ * @return Pointer to the reader
+*/
+struct calc_batch_reader_t* calc_batch_reader_new()
+{
+  return (struct calc_batch_reader_t*)malloc(sizeof(struct calc_batch_reader_t));
+}
+
+/**
+ * Free a reader
+ *
+ * @param reader Pointer to the reader
+*/
+void calc_batch_reader_delete(struct calc_batch_reader_t* reader)
+{
+  free(reader);
+}
+
+/**
+ * Start reading a batch. A regular file is mapped in memory (from the current position of the
+ * descriptor), anything else is read chunk by chunk in a buffer.
+ *
+ * @param reader Pointer to the reader
+ * @param fd File descriptor of the batch (not closed by the reader)
+ *
+ * @return 0, or -1 if the batch doesn't start with a valid header
+*/
+int calc_batch_reader_ctor(struct calc_batch_reader_t* reader, int fd)
+{
+  reader->fd = fd;
+  reader->map = NULL;
+  reader->map_len = 0;
+  reader->offset = 0;
+  reader->released = 0;
+  reader->buf = NULL;
+  reader->ended = 0;
+
+  struct stat st;
+  off_t start = lseek(fd, 0, SEEK_CUR);
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && start >= 0 &&
+      st.st_size - start >= (off_t)sizeof(struct calc_batch_header_t))
+  {
+    char* map = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED)
+    {
+      // The chunks are used once and in order, the kernel can read ahead
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      reader->map = map;
+      reader->map_len = st.st_size;
+      reader->offset = start;
+      memcpy(&reader->header, map + start, sizeof(struct calc_batch_header_t));
+      reader->offset += sizeof(struct calc_batch_header_t);
+    }
+  }
+  if (!reader->map && calc_batch_read_full(fd, (char*)&reader->header,
+      sizeof(struct calc_batch_header_t)) != sizeof(struct calc_batch_header_t))
+  {
+    return -1;
+  }
+
+  struct calc_batch_header_t* header = &reader->header;
+  if (memcmp(header->magic, CALC_BATCH_MAGIC, sizeof(header->magic)) ||
+      (header->kind != CALC_BATCH_REQUESTS && header->kind != CALC_BATCH_RESPONSES) ||
+      header->chunk_rows < 1 || header->chunk_rows > CALC_BATCH_MAX_CHUNK_ROWS)
+  {
+    return -1;
+  }
+  if (!reader->map)
+  {
+    int rows = header->chunk_rows;
+    reader->buf = (char*)malloc(header->kind == CALC_BATCH_REQUESTS ?
+        calc_batch_reqs_size(rows) : calc_batch_resps_size(rows));
+  }
+  return 0;
+}
+
+/**
+ * Release the mapping or the buffer of a reader
+ *
+ * @param reader Pointer to the reader
+*/
+void calc_batch_reader_dtor(struct calc_batch_reader_t* reader)
+{
+  if (reader->map)
+  {
+    munmap(reader->map, reader->map_len);
+  }
+  free(reader->buf);
+}
+
+/**
+ * Take the next chunk of a batch
+ *
+ * @param reader Pointer to the reader
+ * @param kind Kind of batch expected
+ * @param chunk First byte of the chunk (in the mapping or in the buffer of the reader)
+ *
+ * @return Rows of the chunk, 0 at the end of the batch, or -1 if the chunk is not valid
+*/
+static int calc_batch_reader_next(struct calc_batch_reader_t* reader, calc_batch_kind_t kind,
+    char** chunk)
+{
+  if (reader->header.kind != kind)
+  {
+    return -1;
+  }
+  if (reader->ended)
+  {
+    return 0;
+  }
+
+  uint32_t header[2];
+  if (reader->map)
+  {
+    // The previous chunks won't be used again, their pages leave the memory of the process (the
+    // mapping of a big file would take as much memory as the file otherwise)
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t used = reader->offset & ~(page - 1);
+    if (used > reader->released)
+    {
+      madvise(reader->map + reader->released, used - reader->released, MADV_DONTNEED);
+      reader->released = used;
+    }
+    if (reader->map_len - reader->offset < sizeof(header))
+    {
+      return -1;
+    }
+    memcpy(header, reader->map + reader->offset, sizeof(header));
+  }
+  else if (calc_batch_read_full(reader->fd, (char*)header, sizeof(header)) != sizeof(header))
+  {
+    return -1;
+  }
+
+  int rows = header[0];
+  if (header[0] > reader->header.chunk_rows)
+  {
+    return -1;
+  }
+  if (rows == 0)
+  {
+    reader->ended = 1;
+    return 0;
+  }
+
+  size_t size = kind == CALC_BATCH_REQUESTS ?
+      calc_batch_reqs_size(rows) : calc_batch_resps_size(rows);
+  if (reader->map)
+  {
+    if (reader->map_len - reader->offset < size)
+    {
+      return -1;
+    }
+    *chunk = reader->map + reader->offset;
+    reader->offset += size;
+    return rows;
+  }
+  memcpy(reader->buf, header, sizeof(header));
+  if (calc_batch_read_full(reader->fd, reader->buf + sizeof(header), size - sizeof(header)) !=
+      (long)(size - sizeof(header)))
+  {
+    return -1;
+  }
+  *chunk = reader->buf;
+  return rows;
+}
+
+/**
+ * Take the next chunk of a batch of requests
+ *
+ * @param reader Pointer to the reader
+ * @param reqs Columns of the chunk (valid until the next call)
+ *
+ * @return Rows of the chunk, 0 at the end of the batch, or -1 if the chunk is not valid
+*/
+int calc_batch_reader_next_reqs(struct calc_batch_reader_t* reader, struct calc_batch_reqs_t* reqs)
+{
+  char* chunk;
+  int rows = calc_batch_reader_next(reader, CALC_BATCH_REQUESTS, &chunk);
+  if (rows > 0)
+  {
+    calc_batch_map_reqs(chunk, rows, reqs);
+  }
+  return rows;
+}
+
+/**
+ * Take the next chunk of a batch of responses
+ *
+ * @param reader Pointer to the reader
+ * @param resps Columns of the chunk (valid until the next call)
+ *
+ * @return Rows of the chunk, 0 at the end of the batch, or -1 if the chunk is not valid
+*/
+int calc_batch_reader_next_resps(struct calc_batch_reader_t* reader,
+    struct calc_batch_resps_t* resps)
+{
+  char* chunk;
+  int rows = calc_batch_reader_next(reader, CALC_BATCH_RESPONSES, &chunk);
+  if (rows > 0)
+  {
+    calc_batch_map_resps(chunk, rows, resps);
+  }
+  return rows;
+}
+
+/**
+ * Allocate a writer
+ *
+ * @return Pointer to the writer
+*/
+struct calc_batch_writer_t* calc_batch_writer_new()
+{
+  return (struct calc_batch_writer_t*)malloc(sizeof(struct calc_batch_writer_t));
+}
+
+/**
+ * Free a writer
+ *
+ * @param writer Pointer to the writer
+*/
+void calc_batch_writer_delete(struct calc_batch_writer_t* writer)
+{
+  free(writer);
+}
+
+/**
+ * Start writing a batch, its header is written here
+ *
+ * @param writer Pointer to the writer
+ * @param fd File descriptor of the batch (not closed by the writer)
+ * @param kind Requests or responses
+ * @param chunk_rows Maximum rows of a chunk (CALC_BATCH_CHUNK_ROWS if it is not valid)
+ *
+ * @return 0, or -1 if the header couldn't be written
+*/
+int calc_batch_writer_ctor(struct calc_batch_writer_t* writer, int fd, calc_batch_kind_t kind,
+    int chunk_rows)
+{
+  if (chunk_rows < 1 || chunk_rows > CALC_BATCH_MAX_CHUNK_ROWS)
+  {
+    chunk_rows = CALC_BATCH_CHUNK_ROWS;
+  }
+  writer->fd = fd;
+  writer->kind = kind;
+  writer->chunk_rows = chunk_rows;
+  writer->rows = 0;
+  writer->buf = (char*)calloc(1, kind == CALC_BATCH_REQUESTS ?
+      calc_batch_reqs_size(chunk_rows) : calc_batch_resps_size(chunk_rows));
+
+  struct calc_batch_header_t header;
+  memcpy(header.magic, CALC_BATCH_MAGIC, sizeof(header.magic));
+  header.kind = kind;
+  header.chunk_rows = chunk_rows;
+  return calc_batch_write_full(fd, (const char*)&header, sizeof(header));
+}
+
+/**
+ * Release the buffer of a writer (the end of the batch isn't written, see
+ * calc_batch_writer_finish)
+ *
+ * @param writer Pointer to the writer
+*/
+void calc_batch_writer_dtor(struct calc_batch_writer_t* writer)
+{
+  free(writer->buf);
+}
+
+/**
+ * Columns of the next chunk of a batch of requests
+ *
+ * @param writer Pointer to the writer
+ * @param rows Rows of the chunk (at most the chunk_rows of the writer)
+ * @param reqs Columns to fill, in the buffer of the writer
+*/
+void calc_batch_writer_reqs(struct calc_batch_writer_t* writer, int rows,
+    struct calc_batch_reqs_t* reqs)
+{
+  writer->rows = rows;
+  calc_batch_map_reqs(writer->buf, rows, reqs);
+
+  // The padding doesn't take the bytes of the previous chunk to the output
+  memset(reqs->ids + rows, 0, (char*)reqs->methods - (char*)(reqs->ids + rows));
+  memset(reqs->methods + rows, 0, (char*)reqs->op1 - (char*)(reqs->methods + rows));
+}
+
+/**
+ * Columns of the next chunk of a batch of responses
+ *
+ * @param writer Pointer to the writer
+ * @param rows Rows of the chunk (at most the chunk_rows of the writer)
+ * @param resps Columns to fill, in the buffer of the writer
+*/
+void calc_batch_writer_resps(struct calc_batch_writer_t* writer, int rows,
+    struct calc_batch_resps_t* resps)
+{
+  writer->rows = rows;
+  calc_batch_map_resps(writer->buf, rows, resps);
+  memset(resps->ids + rows, 0, (char*)resps->status - (char*)(resps->ids + rows));
+  memset(resps->status + rows, 0, (char*)resps->results - (char*)(resps->status + rows));
+}
+
+/**
+ * Write the chunk filled by the caller
+ *
+ * @param writer Pointer to the writer
+ *
+ * @return 0, or -1 if the chunk couldn't be written
+*/
+int calc_batch_writer_commit(struct calc_batch_writer_t* writer)
+{
+  int rows = writer->rows;
+  if (rows == 0)
+  {
+    return 0;
+  }
+  uint32_t header[2] = {(uint32_t)rows, 0};
+  memcpy(writer->buf, header, sizeof(header));
+  writer->rows = 0;
+  return calc_batch_write_full(writer->fd, writer->buf, writer->kind == CALC_BATCH_REQUESTS ?
+      calc_batch_reqs_size(rows) : calc_batch_resps_size(rows));
+}
+
+/**
+ * Write the end of the batch (the empty chunk)
+ *
+ * @param writer Pointer to the writer
+ *
+ * @return 0, or -1 if it couldn't be written
+*/
+int calc_batch_writer_finish(struct calc_batch_writer_t* writer)
+{
+  uint32_t header[2] = {0, 0};
+  return calc_batch_write_full(writer->fd, (const char*)header, sizeof(header));
+}
+
+/**
+ * Evaluate a column of a method without memory with the bulk method of the service
+ *
+ * @param svc Service
+ * @param method ADD, SUB, MUL or DIV
+ * @param a Operands 1
+ * @param b Operands 2
+ * @param out Results
+ * @param zero_mask Bits of the divisions by zero (only for DIV)
+ * @param n Number of rows
+*/
+static void calc_batch_bulk(struct calc_service_t* svc, int method, const double* a,
+    const double* b, double* out, uint64_t* zero_mask, int n)
+{
+  switch (method)
+  {
+    case ADD:
+      calc_service_add_n(svc, a, b, out, n);
+      break;
+    case SUB:
+      calc_service_sub_n(svc, a, b, out, n);
+      break;
+    case MUL:
+      calc_service_mul_n(svc, a, b, out, n);
+      break;
+    case DIV:
+      calc_service_div_n(svc, a, b, out, zero_mask, n);
+      break;
+  }
+}
+
+/**
+ * Evaluate a block of rows of a chunk. The rows of the methods without memory are evaluated
+ * column by column with the bulk methods of the service: if the block has a single method, the
+ * results are written directly, otherwise every method present is evaluated for the whole block
+ * and every row takes the result of its method. The rows of the other methods use the memory of
+ * the service, so they are evaluated one by one and in order afterwards (they don't depend on the
+ * rows of the bulk methods).
+ *
+ * @param svc Service
+ * @param reqs Columns of the requests
+ * @param resps Columns of the responses
+ * @param start First row of the block
+ * @param n Rows of the block (at most CALC_BATCH_BLOCK)
+*/
+static void calc_batch_eval_block(struct calc_service_t* svc, const struct calc_batch_reqs_t* reqs,
+    struct calc_batch_resps_t* resps, int start, int n)
+{
+  const uint8_t* methods = reqs->methods + start;
+  const double* a = reqs->op1 + start;
+  const double* b = reqs->op2 + start;
+  int32_t* status = resps->status + start;
+  double* results = resps->results + start;
+
+  // Methods of the block, a bit per method (the unknown ones share the last bit)
+  uint32_t present = 0;
+  for (int i = 0; i < n; i++)
+  {
+    present |= 1u << (methods[i] <= DIV ? methods[i] : 31);
+  }
+
+  uint64_t zero_mask[CALC_BATCH_BLOCK / 64];
+  if (present == 1u << ADD || present == 1u << SUB || present == 1u << MUL)
+  {
+    calc_batch_bulk(svc, methods[0], a, b, results, zero_mask, n);
+    for (int i = 0; i < n; i++)
+    {
+      status[i] = STATUS_OK;
+    }
+  }
+  else if (present == 1u << DIV)
+  {
+    calc_service_div_n(svc, a, b, results, zero_mask, n);
+    for (int i = 0; i < n; i++)
+    {
+      status[i] = STATUS_DIV_BY_ZERO * (b[i] == 0.0);
+    }
+  }
+  else if (present & CALC_BATCH_BULK)
+  {
+    static const method_t bulk[4] = {ADD, SUB, MUL, DIV};
+    double columns[4][CALC_BATCH_BLOCK];
+    for (int j = 0; j < 4; j++)
+    {
+      if (present & 1u << bulk[j])
+      {
+        calc_batch_bulk(svc, bulk[j], a, b, columns[j], zero_mask, n);
+      }
+      else
+      {
+        memset(columns[j], 0, n * sizeof(double));
+      }
+    }
+
+    // Every row takes the result of its method (selections, without branches)
+    for (int i = 0; i < n; i++)
+    {
+      uint8_t method = methods[i];
+      double result = columns[0][i];
+      result = method == SUB ? columns[1][i] : result;
+      result = method == MUL ? columns[2][i] : result;
+      result = method == DIV ? columns[3][i] : result;
+      results[i] = result;
+      status[i] = STATUS_DIV_BY_ZERO * ((method == DIV) & (b[i] == 0.0));
+    }
+  }
+
+  // The rest of the methods, in the order of the rows
+  if (present & ~CALC_BATCH_BULK)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      double result = 0.0;
+      int32_t code = STATUS_OK;
+      switch (methods[i])
+      {
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+          continue;
+        case GETMEM:
+          result = calc_service_get_mem(svc);
+          break;
+        case RESMEM:
+          calc_service_reset_mem(svc);
+          break;
+        case ADDM:
+          result = calc_service_add(svc, a[i], b[i], TRUE);
+          break;
+        case SUBM:
+          result = calc_service_sub(svc, a[i], b[i], TRUE);
+          break;
+        case MULM:
+          result = calc_service_mul(svc, a[i], b[i], TRUE);
+          break;
+        default:
+          code = STATUS_INVALID_METHOD;
+      }
+      results[i] = result;
+      status[i] = code;
+    }
+  }
+}
+
+/**
+ * Evaluate a chunk of requests. The responses have the same rows, in the same order.
+ *
+ * @param svc Service (its memory is used by the memory methods, as in the servers)
+ * @param reqs Columns of the requests
+ * @param resps Columns of the responses, with room for reqs->rows rows
+*/
+void calc_batch_eval(struct calc_service_t* svc, const struct calc_batch_reqs_t* reqs,
+    struct calc_batch_resps_t* resps)
+{
+  int rows = reqs->rows;
+  resps->rows = rows;
+  memcpy(resps->ids, reqs->ids, rows * sizeof(int32_t));
+  for (int start = 0; start < rows; start += CALC_BATCH_BLOCK)
+  {
+    int n = rows - start < CALC_BATCH_BLOCK ? rows - start : CALC_BATCH_BLOCK;
+    calc_batch_eval_block(svc, reqs, resps, start, n);
+  }
+}
+
+/**
+ * Evaluate a whole batch of requests, chunk by chunk: every chunk of requests becomes a chunk of
+ * responses with the same rows, so the memory used doesn't depend on the size of the batch.
+ *
+ * @param svc Service
+ * @param in_fd Batch of requests (a file is mapped in memory)
+ * @param out_fd Destination of the batch of responses
+ *
+ * @return Number of requests evaluated, or -1 if the input is not valid or the output can't be
+ *         written
+*/
+long calc_batch_run(struct calc_service_t* svc, int in_fd, int out_fd)
+{
+  struct calc_batch_reader_t reader;
+  if (calc_batch_reader_ctor(&reader, in_fd) == -1)
+  {
+    calc_batch_reader_dtor(&reader);
+    return -1;
+  }
+  struct calc_batch_writer_t writer;
+  long total = calc_batch_writer_ctor(&writer, out_fd, CALC_BATCH_RESPONSES,
+      reader.header.chunk_rows);
+
+  struct calc_batch_reqs_t reqs;
+  struct calc_batch_resps_t resps;
+  int rows = 0;
+  while (total != -1 && (rows = calc_batch_reader_next_reqs(&reader, &reqs)) > 0)
+  {
+    calc_batch_writer_resps(&writer, rows, &resps);
+    calc_batch_eval(svc, &reqs, &resps);
+    if (calc_batch_writer_commit(&writer) == -1)
+    {
+      total = -1;
+      break;
+    }
+    total += rows;
+  }
+  if (rows == -1 || (total != -1 && calc_batch_writer_finish(&writer) == -1))
+  {
+    total = -1;
+  }
+
+  calc_batch_writer_dtor(&writer);
+  calc_batch_reader_dtor(&reader);
+  return total;
+}
@@ -0,0 +1,131 @@
+#ifndef CALC_BATCH_H
+#define CALC_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <calc_service.h>
+
+/**
+ * Columnar batches, for the offline jobs that evaluate millions of operations at once. The text
+ * protocol spends most of its time looking for delimiters and converting numbers, and the server
+ * evaluates the requests one by one. A batch keeps the requests as columns instead (all the ids,
+ * then all the methods, then all the first and second operands), in the binary form of the
+ * machine, so nothing is parsed and the bulk methods of the service (see calc_service_add_n) go
+ * through whole columns. The responses are written back as columns too.
+ *
+ *    Batch:  <header> <chunk> <chunk> ... <end>
+ *    Header: <magic:8 = "CALCBAT1"><kind:u32><chunk_rows:u32>
+ *    Chunk:  <rows:u32><reserved:u32><columns>
+ *    End:    a chunk with 0 rows
+ *
+ *    Columns of the requests:  <ids:i32 * rows><methods:u8 * rows><op1:f64 * rows><op2:f64 * rows>
+ *    Columns of the responses: <ids:i32 * rows><status:i32 * rows><results:f64 * rows>
+ *
+ * Every column starts at a multiple of 8 bytes (the smaller ones are padded), so the columns of a
+ * file mapped in memory can be used in place. The numbers are in the byte order of the machine
+ * (the magic would not match on a machine with the other order).
+ *
+ * The chunks keep the memory bounded: a reader needs a single chunk at a time, and a writer can
+ * send the first chunks before it knows how many rows there will be (the end is marked by the
+ * empty chunk), so a batch can come from a pipe or a socket as well as from a file. Files are
+ * mapped in memory instead of read, and the chunks already used are released from the mapping.
+ *
+ *    $ batch_calc_server requests.bin responses.bin
+*/
+
+#define CALC_BATCH_MAGIC "CALCBAT1"
+#define CALC_BATCH_CHUNK_ROWS 65536       // Rows of a chunk by default
+#define CALC_BATCH_MAX_CHUNK_ROWS 1048576 // Biggest chunk accepted by a reader
+
+typedef enum {
+  CALC_BATCH_REQUESTS = 1,
+  CALC_BATCH_RESPONSES = 2
+} calc_batch_kind_t;
+
+// First bytes of a batch
+struct calc_batch_header_t
+{
+  char magic[8];
+  uint32_t kind;        // calc_batch_kind_t
+  uint32_t chunk_rows;  // Maximum rows of a chunk
+};
+
+// Columns of a chunk of requests (the ones of a reader are read only)
+struct calc_batch_reqs_t
+{
+  int rows;
+  int32_t* ids;
+  uint8_t* methods;  // Values of method_t
+  double* op1;
+  double* op2;
+};
+
+// Columns of a chunk of responses
+struct calc_batch_resps_t
+{
+  int rows;
+  int32_t* ids;
+  int32_t* status;   // STATUS_* codes
+  double* results;
+};
+
+// Bytes of a chunk (its header included)
+size_t calc_batch_reqs_size(int rows);
+size_t calc_batch_resps_size(int rows);
+
+// Reader of a batch from a file descriptor (mapped in memory if it is a regular file)
+struct calc_batch_reader_t
+{
+  int fd;
+  struct calc_batch_header_t header;
+  char* map;        // Mapping of the file (NULL for a pipe or a socket)
+  size_t map_len;
+  size_t offset;    // Next chunk in the mapping
+  size_t released;  // Bytes of the mapping already released
+  char* buf;        // Chunk read from a pipe or a socket
+  int ended;
+};
+
+struct calc_batch_reader_t* calc_batch_reader_new();
+void calc_batch_reader_delete(struct calc_batch_reader_t*);
+int calc_batch_reader_ctor(struct calc_batch_reader_t*, int fd);
+void calc_batch_reader_dtor(struct calc_batch_reader_t*);
+
+// Next chunk of the batch, returns its rows (0 at the end of the batch, -1 if it is not valid)
+int calc_batch_reader_next_reqs(struct calc_batch_reader_t*, struct calc_batch_reqs_t*);
+int calc_batch_reader_next_resps(struct calc_batch_reader_t*, struct calc_batch_resps_t*);
+
+// Writer of a batch, the chunks are filled in its buffer and written one by one
+struct calc_batch_writer_t
+{
+  int fd;
+  calc_batch_kind_t kind;
+  int chunk_rows;
+  int rows;   // Rows of the chunk being filled
+  char* buf;
+};
+
+struct calc_batch_writer_t* calc_batch_writer_new();
+void calc_batch_writer_delete(struct calc_batch_writer_t*);
+int calc_batch_writer_ctor(struct calc_batch_writer_t*, int fd, calc_batch_kind_t kind,
+    int chunk_rows);
+void calc_batch_writer_dtor(struct calc_batch_writer_t*);
+
+// Columns of the next chunk (at most chunk_rows), to be filled by the caller and then committed
+void calc_batch_writer_reqs(struct calc_batch_writer_t*, int rows, struct calc_batch_reqs_t*);
+void calc_batch_writer_resps(struct calc_batch_writer_t*, int rows, struct calc_batch_resps_t*);
+int calc_batch_writer_commit(struct calc_batch_writer_t*);
+
+// Write the end of the batch
+int calc_batch_writer_finish(struct calc_batch_writer_t*);
+
+// Evaluation of a chunk of requests with a service (the memory methods keep their order)
+void calc_batch_eval(struct calc_service_t*, const struct calc_batch_reqs_t*,
+    struct calc_batch_resps_t*);
+
+// Evaluation of a whole batch, from a file descriptor to another, returns the number of requests
+// evaluated or -1 if the input is not valid or the output can't be written
+long calc_batch_run(struct calc_service_t*, int in_fd, int out_fd);
+
+#endif
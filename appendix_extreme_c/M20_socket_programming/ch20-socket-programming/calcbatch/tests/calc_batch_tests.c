@@ -0,0 +1,189 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <cmocka.h>
+
+#include <calc_proto_ser.h>
+#include <calc_service.h>
+#include <calc_batch.h>
+
+struct calc_service_t* svc = NULL;
+struct calc_service_t* ref = NULL;
+FILE* in = NULL;
+FILE* out = NULL;
+
+// Write a batch of requests, row i has the method methods[i % count]
+void write_reqs(int fd, int rows, int chunk_rows, const uint8_t* methods, int count) {
+  struct calc_batch_writer_t* writer = calc_batch_writer_new();
+  assert_int_equal(calc_batch_writer_ctor(writer, fd, CALC_BATCH_REQUESTS, chunk_rows), 0);
+  for (int start = 0; start < rows; start += chunk_rows) {
+    int n = rows - start < chunk_rows ? rows - start : chunk_rows;
+    struct calc_batch_reqs_t reqs;
+    calc_batch_writer_reqs(writer, n, &reqs);
+    for (int i = 0; i < n; i++) {
+      int row = start + i;
+      reqs.ids[i] = row;
+      reqs.methods[i] = methods[row % count];
+      reqs.op1[i] = row * 0.5;
+      reqs.op2[i] = row % 7 - 3;
+    }
+    assert_int_equal(calc_batch_writer_commit(writer), 0);
+  }
+  assert_int_equal(calc_batch_writer_finish(writer), 0);
+  calc_batch_writer_dtor(writer);
+  calc_batch_writer_delete(writer);
+}
+
+// The response of a request evaluated alone, as the servers do
+void expected(uint8_t method, double a, double b, int* status, double* result) {
+  *status = STATUS_OK;
+  *result = 0.0;
+  switch (method) {
+    case GETMEM: *result = calc_service_get_mem(ref); break;
+    case RESMEM: calc_service_reset_mem(ref); break;
+    case ADD: *result = calc_service_add(ref, a, b, FALSE); break;
+    case ADDM: *result = calc_service_add(ref, a, b, TRUE); break;
+    case SUB: *result = calc_service_sub(ref, a, b, FALSE); break;
+    case SUBM: *result = calc_service_sub(ref, a, b, TRUE); break;
+    case MUL: *result = calc_service_mul(ref, a, b, FALSE); break;
+    case MULM: *result = calc_service_mul(ref, a, b, TRUE); break;
+    case DIV:
+      if (calc_service_div(ref, a, b, result) == CALC_SVC_ERROR_DIV_BY_ZERO) {
+        *status = STATUS_DIV_BY_ZERO;
+      }
+      break;
+    default: *status = STATUS_INVALID_METHOD;
+  }
+}
+
+// Read the batch of responses and check every row against the requests
+void check_resps(int fd, int rows, const uint8_t* methods, int count) {
+  struct calc_batch_reader_t* reader = calc_batch_reader_new();
+  assert_int_equal(calc_batch_reader_ctor(reader, fd), 0);
+  assert_int_equal(reader->header.kind, CALC_BATCH_RESPONSES);
+  int row = 0;
+  int n;
+  struct calc_batch_resps_t resps;
+  while ((n = calc_batch_reader_next_resps(reader, &resps)) > 0) {
+    for (int i = 0; i < n; i++, row++) {
+      int status;
+      double result;
+      expected(methods[row % count], row * 0.5, row % 7 - 3, &status, &result);
+      assert_int_equal(resps.ids[i], row);
+      assert_int_equal(resps.status[i], status);
+      assert_true(resps.results[i] == result);
+    }
+  }
+  assert_int_equal(n, 0);
+  assert_int_equal(row, rows);
+  calc_batch_reader_dtor(reader);
+  calc_batch_reader_delete(reader);
+}
+
+void calc_batch__file_round_trip(void** state) {
+  uint8_t methods[] = {ADD, SUB, MUL, DIV};
+  write_reqs(fileno(in), 10000, 1000, methods, 4);
+  fflush(in);
+  lseek(fileno(in), 0, SEEK_SET);
+  assert_int_equal(calc_batch_run(svc, fileno(in), fileno(out)), 10000);
+  lseek(fileno(out), 0, SEEK_SET);
+  check_resps(fileno(out), 10000, methods, 4);
+}
+
+void calc_batch__single_method_chunks(void** state) {
+  // Whole blocks of a single method go straight to the bulk methods
+  for (int m = ADD; m <= DIV; m += 2) {
+    uint8_t method = m;
+    rewind(in);
+    rewind(out);
+    write_reqs(fileno(in), 700, 700, &method, 1);
+    lseek(fileno(in), 0, SEEK_SET);
+    assert_int_equal(calc_batch_run(svc, fileno(in), fileno(out)), 700);
+    lseek(fileno(out), 0, SEEK_SET);
+    check_resps(fileno(out), 700, &method, 1);
+  }
+}
+
+void calc_batch__memory_keeps_order(void** state) {
+  uint8_t methods[] = {ADDM, ADD, GETMEM, MULM, DIV, SUBM, RESMEM, MUL, ADDM, 42, NONE};
+  write_reqs(fileno(in), 3000, 512, methods, 11);
+  lseek(fileno(in), 0, SEEK_SET);
+  assert_int_equal(calc_batch_run(svc, fileno(in), fileno(out)), 3000);
+  lseek(fileno(out), 0, SEEK_SET);
+  check_resps(fileno(out), 3000, methods, 11);
+}
+
+void calc_batch__pipes(void** state) {
+  // Without a file, the chunks are read one by one
+  int req_pipe[2];
+  int resp_pipe[2];
+  assert_int_equal(pipe(req_pipe), 0);
+  assert_int_equal(pipe(resp_pipe), 0);
+  uint8_t methods[] = {DIV, ADDM, SUB};
+  write_reqs(req_pipe[1], 500, 64, methods, 3);
+  close(req_pipe[1]);
+  assert_int_equal(calc_batch_run(svc, req_pipe[0], resp_pipe[1]), 500);
+  close(resp_pipe[1]);
+  check_resps(resp_pipe[0], 500, methods, 3);
+  close(req_pipe[0]);
+  close(resp_pipe[0]);
+}
+
+void calc_batch__invalid_input(void** state) {
+  // Not a batch
+  fputs("1#ADD#1#2$", in);
+  fflush(in);
+  lseek(fileno(in), 0, SEEK_SET);
+  assert_int_equal(calc_batch_run(svc, fileno(in), fileno(out)), -1);
+
+  // A batch without its end
+  uint8_t method = ADD;
+  rewind(in);
+  write_reqs(fileno(in), 100, 50, &method, 1);
+  assert_int_equal(ftruncate(fileno(in), lseek(fileno(in), 0, SEEK_CUR) - 8), 0);
+  lseek(fileno(in), 0, SEEK_SET);
+  assert_int_equal(calc_batch_run(svc, fileno(in), fileno(out)), -1);
+
+  // A chunk bigger than announced by the header
+  rewind(in);
+  write_reqs(fileno(in), 10, 10, &method, 1);
+  uint32_t chunk_rows = 5;
+  assert_int_equal(pwrite(fileno(in), &chunk_rows, 4, 12), 4);
+  lseek(fileno(in), 0, SEEK_SET);
+  assert_int_equal(calc_batch_run(svc, fileno(in), fileno(out)), -1);
+}
+
+int setup(void** state) {
+  svc = calc_service_new();
+  calc_service_ctor(svc);
+  ref = calc_service_new();
+  calc_service_ctor(ref);
+  in = tmpfile();
+  out = tmpfile();
+  return 0;
+}
+
+int teardown(void** state) {
+  fclose(in);
+  fclose(out);
+  calc_service_dtor(svc);
+  calc_service_delete(svc);
+  calc_service_dtor(ref);
+  calc_service_delete(ref);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(calc_batch__file_round_trip, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_batch__single_method_chunks, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_batch__memory_keeps_order, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_batch__pipes, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_batch__invalid_input, setup, teardown)
+  };
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <calc_proto_ser.h>
+#include <calc_proto_num.h>
+
+/**
+ * Micro-benchmark for the serialization process of the calculator protocol. It is not part of the
+ * tests, as the numbers depend on the machine (build it in release mode to get real numbers):
+ *
+ *    cmake -DCMAKE_BUILD_TYPE=Release ... && ./calcser/bench/calc_proto_bench [messages]
+ *
+ * Every scenario encodes and decodes the same set of requests:
+ *
+ *  - legacy: the previous path of calc_proto_ser.c, with sprintf("%lf") and sscanf("%lf").
+ *  - codec: the number codec of calc_proto_num.h.
+ *
+ * The legacy scenario also counts how many operands didn't survive the round trip.
+ *
+ * The last two scenarios measure the decoder of calc_proto_ser.c with pipelined requests, which
+ * are received in chunks of 4KB (like a read of a busy connection):
+ *
+ *  - deserialize: every request is delivered through the request callback.
+ *  - batch: the requests are delivered through the batch request callback.
+ *  - split: like deserialize, but with reads of random size (1 to 64 characters), so most of the
+ *    messages are received in parts and go through the buffer of the serializer.
+*/
+
+#define DEFAULT_MESSAGES 2000000
+#define DISTINCT_REQUESTS 4096
+#define CHUNK_SIZE 4096
+
+// Functions of the previous implementation, kept here only as the baseline
+
+void legacy_serialize_double(char* str, double num)
+{
+  char tmp[512];
+  sprintf(tmp, "%lf", num);
+  strcpy(str, tmp);
+  int i = strlen(str) - 1;
+  while (i >= 0 && str[i] == '0') i--;
+  if (i >= 0) str[i + 1] = '\0';
+  if (i >= 0 && str[i] == '.') str[i] = '\0';
+}
+
+int legacy_encode(const struct calc_proto_req_t* req, char* dst)
+{
+  char op1[512], op2[512];
+  legacy_serialize_double(op1, req->operand1);
+  legacy_serialize_double(op2, req->operand2);
+  return sprintf(dst, "%d#%s#%s#%s$", req->id, method_to_str(req->method), op1, op2);
+}
+
+int legacy_decode(char* msg, struct calc_proto_req_t* req)
+{
+  char* fields[4];
+  char* ptr = msg;
+  for (int i = 0; i < 4; i++)
+  {
+    fields[i] = ptr;
+    ptr = strpbrk(ptr, "#$");
+    if (!ptr) return 0;
+    *ptr++ = '\0';
+  }
+  req->method = str_to_method(fields[1]);
+  return sscanf(fields[0], "%d", &req->id) == 1 &&
+         sscanf(fields[2], "%lf", &req->operand1) == 1 &&
+         sscanf(fields[3], "%lf", &req->operand2) == 1;
+}
+
+// Same work, but with the number codec
+
+int codec_encode(struct calc_proto_ser_t* ser, const struct calc_proto_req_t* req, char* dst)
+{
+  return calc_proto_ser_client_serialize_to(ser, req, dst, CALC_PROTO_MAX_MSG_LEN);
+}
+
+int codec_decode(char* msg, int len, struct calc_proto_req_t* req)
+{
+  const char* fields[4];
+  int lens[4];
+  const char* ptr = msg;
+  const char* end = msg + len;
+  for (int i = 0; i < 4; i++)
+  {
+    const char* delim = ptr;
+    while (delim < end && *delim != '#' && *delim != '$') delim++;
+    if (delim == end) return 0;
+    fields[i] = ptr;
+    lens[i] = delim - ptr;
+    ptr = delim + 1;
+  }
+  char method[8];
+  if (lens[1] >= (int)sizeof(method)) return 0;
+  memcpy(method, fields[1], lens[1]);
+  method[lens[1]] = '\0';
+  req->method = str_to_method(method);
+  return calc_proto_num_parse_int(fields[0], lens[0], &req->id) &&
+         calc_proto_num_parse_double(fields[2], lens[2], &req->operand1) &&
+         calc_proto_num_parse_double(fields[3], lens[3], &req->operand2);
+}
+
+// Callbacks of the deserialization scenarios
+
+long received;
+
+void count_req(void* context, struct calc_proto_req_t req)
+{
+  received++;
+}
+
+void count_req_batch(void* context, const struct calc_proto_req_t* reqs, int count)
+{
+  received += count;
+}
+
+// Helpers of the benchmark
+
+double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void report(const char* name, long messages, double elapsed)
+{
+  printf("%-12s %10.1f ns/msg %10.2f Mmsg/s\n", name, elapsed * 1e9 / messages,
+      messages / elapsed / 1e6);
+}
+
+int main(int argc, char** argv)
+{
+  long messages = argc > 1 ? atol(argv[1]) : DEFAULT_MESSAGES;
+
+  // Requests with a mix of integers, few decimals and full precision operands
+  static struct calc_proto_req_t reqs[DISTINCT_REQUESTS];
+  srand(1620);
+  for (int i = 0; i < DISTINCT_REQUESTS; i++)
+  {
+    reqs[i].id = i;
+    reqs[i].method = ADD + i % (DIV - ADD + 1);
+    switch (i % 3)
+    {
+      case 0:
+        reqs[i].operand1 = rand() % 10000;
+        reqs[i].operand2 = rand() % 10000;
+        break;
+      case 1:
+        reqs[i].operand1 = (rand() % 1000000) / 100.0;
+        reqs[i].operand2 = -(rand() % 1000000) / 1000.0;
+        break;
+      default:
+        reqs[i].operand1 = (double)rand() / RAND_MAX;
+        reqs[i].operand2 = (double)rand() / RAND_MAX * 100.0;
+    }
+  }
+
+  char msg[512];
+  struct calc_proto_req_t out;
+  long lost = 0;
+
+  double start = now_sec();
+  for (long i = 0; i < messages; i++)
+  {
+    const struct calc_proto_req_t* req = &reqs[i % DISTINCT_REQUESTS];
+    legacy_encode(req, msg);
+    legacy_decode(msg, &out);
+    lost += out.operand1 != req->operand1 || out.operand2 != req->operand2;
+  }
+  report("legacy", messages, now_sec() - start);
+  printf("%-12s %ld of %ld requests changed their operands\n", "", lost, messages);
+
+  struct calc_proto_ser_t* ser = calc_proto_ser_new();
+  calc_proto_ser_ctor(ser, NULL, 256);
+  lost = 0;
+  start = now_sec();
+  for (long i = 0; i < messages; i++)
+  {
+    const struct calc_proto_req_t* req = &reqs[i % DISTINCT_REQUESTS];
+    int len = codec_encode(ser, req, msg);
+    codec_decode(msg, len, &out);
+    lost += out.operand1 != req->operand1 || out.operand2 != req->operand2;
+  }
+  report("codec", messages, now_sec() - start);
+  printf("%-12s %ld of %ld requests changed their operands\n", "", lost, messages);
+
+  // All the requests one after the other, as a pipelined client sends them
+  char* stream = (char*)malloc(DISTINCT_REQUESTS * CALC_PROTO_MAX_MSG_LEN);
+  long stream_len = 0;
+  for (int i = 0; i < DISTINCT_REQUESTS; i++)
+  {
+    stream_len += codec_encode(ser, &reqs[i], stream + stream_len);
+  }
+  long rounds = messages / DISTINCT_REQUESTS + 1;
+
+  // Sizes of the reads of the split scenario
+  static int split_sizes[DISTINCT_REQUESTS];
+  for (int i = 0; i < DISTINCT_REQUESTS; i++)
+  {
+    split_sizes[i] = 1 + rand() % 64;
+  }
+
+  const char* names[] = {"deserialize", "batch", "split"};
+  for (int scenario = 0; scenario < 3; scenario++)
+  {
+    struct calc_proto_ser_t* decoder = calc_proto_ser_new();
+    calc_proto_ser_ctor(decoder, NULL, 256);
+    calc_proto_ser_set_req_callback(decoder, count_req);
+    if (scenario == 1)
+    {
+      calc_proto_ser_set_req_batch_callback(decoder, count_req_batch);
+    }
+    received = 0;
+    start = now_sec();
+    for (long r = 0; r < rounds; r++)
+    {
+      long offset = 0;
+      for (int i = 0; offset < stream_len; i++)
+      {
+        int chunk = scenario == 2 ? split_sizes[i % DISTINCT_REQUESTS] : CHUNK_SIZE;
+        struct buffer_t buf;
+        buf.data = stream + offset;
+        buf.len = stream_len - offset < chunk ? stream_len - offset : chunk;
+        calc_proto_ser_server_deserialize(decoder, buf, NULL);
+        offset += buf.len;
+      }
+    }
+    double elapsed = now_sec() - start;
+    report(names[scenario], received, elapsed);
+    printf("%-12s %.0f MB/s\n", "", stream_len * rounds / elapsed / 1e6);
+    calc_proto_ser_dtor(decoder);
+    calc_proto_ser_delete(decoder);
+  }
+  free(stream);
+
+  calc_proto_ser_dtor(ser);
+  calc_proto_ser_delete(ser);
+
+  return 0;
+}
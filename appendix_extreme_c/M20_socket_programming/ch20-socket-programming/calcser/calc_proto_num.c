@@ -0,0 +1,632 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include "calc_proto_num.h"
+
+#define MAX_EXACT_INT 9007199254740992.0 // 2^53, every integer below is an exact double
+#define MAX_EXACT_POW10 22               // 1e22 is the biggest exact power of ten
+#define MAX_MANTISSA_DIGITS 19           // Digits that always fit in a uint64_t
+#define MAX_FIXED_DIGITS 21              // Bigger (or too small) numbers use the exponent form
+
+#define DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFull
+#define DP_EXPONENT_MASK    0x7FF0000000000000ull
+#define DP_HIDDEN_BIT       0x0010000000000000ull
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS    (0x3FF + DP_SIGNIFICAND_SIZE)
+
+// Powers of ten that can be represented exactly as doubles
+static const double POW10[MAX_EXACT_POW10 + 1] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Powers of ten as integers (up to 1e19, the biggest that fits in 64 bits)
+static const uint64_t POW10_INT[MAX_MANTISSA_DIGITS + 1] = {
+  1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull,
+  1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull,
+  100000000000000ull, 1000000000000000ull, 10000000000000000ull, 100000000000000000ull,
+  1000000000000000000ull, 10000000000000000000ull
+};
+
+/**
+ * "Do it yourself" floating point number: f * 2^e, with a 64 bit significand (instead of the 53
+ * bits of a double), used to generate the digits of a double without big numbers arithmetic.
+*/
+struct diy_fp_t {
+  uint64_t f;
+  int e;
+};
+
+// Normalized approximations of 10^k (k = -348, -340, ..., 340) as f * 2^e
+static const struct diy_fp_t CACHED_POWERS[] = {
+  {0xfa8fd5a0081c0288ull, -1220}, {0xbaaee17fa23ebf76ull, -1193},
+  {0x8b16fb203055ac76ull, -1166}, {0xcf42894a5dce35eaull, -1140},
+  {0x9a6bb0aa55653b2dull, -1113}, {0xe61acf033d1a45dfull, -1087},
+  {0xab70fe17c79ac6caull, -1060}, {0xff77b1fcbebcdc4full, -1034},
+  {0xbe5691ef416bd60cull, -1007}, {0x8dd01fad907ffc3cull,  -980},
+  {0xd3515c2831559a83ull,  -954}, {0x9d71ac8fada6c9b5ull,  -927},
+  {0xea9c227723ee8bcbull,  -901}, {0xaecc49914078536dull,  -874},
+  {0x823c12795db6ce57ull,  -847}, {0xc21094364dfb5637ull,  -821},
+  {0x9096ea6f3848984full,  -794}, {0xd77485cb25823ac7ull,  -768},
+  {0xa086cfcd97bf97f4ull,  -741}, {0xef340a98172aace5ull,  -715},
+  {0xb23867fb2a35b28eull,  -688}, {0x84c8d4dfd2c63f3bull,  -661},
+  {0xc5dd44271ad3cdbaull,  -635}, {0x936b9fcebb25c996ull,  -608},
+  {0xdbac6c247d62a584ull,  -582}, {0xa3ab66580d5fdaf6ull,  -555},
+  {0xf3e2f893dec3f126ull,  -529}, {0xb5b5ada8aaff80b8ull,  -502},
+  {0x87625f056c7c4a8bull,  -475}, {0xc9bcff6034c13053ull,  -449},
+  {0x964e858c91ba2655ull,  -422}, {0xdff9772470297ebdull,  -396},
+  {0xa6dfbd9fb8e5b88full,  -369}, {0xf8a95fcf88747d94ull,  -343},
+  {0xb94470938fa89bcfull,  -316}, {0x8a08f0f8bf0f156bull,  -289},
+  {0xcdb02555653131b6ull,  -263}, {0x993fe2c6d07b7facull,  -236},
+  {0xe45c10c42a2b3b06ull,  -210}, {0xaa242499697392d3ull,  -183},
+  {0xfd87b5f28300ca0eull,  -157}, {0xbce5086492111aebull,  -130},
+  {0x8cbccc096f5088ccull,  -103}, {0xd1b71758e219652cull,   -77},
+  {0x9c40000000000000ull,   -50}, {0xe8d4a51000000000ull,   -24},
+  {0xad78ebc5ac620000ull,     3}, {0x813f3978f8940984ull,    30},
+  {0xc097ce7bc90715b3ull,    56}, {0x8f7e32ce7bea5c70ull,    83},
+  {0xd5d238a4abe98068ull,   109}, {0x9f4f2726179a2245ull,   136},
+  {0xed63a231d4c4fb27ull,   162}, {0xb0de65388cc8ada8ull,   189},
+  {0x83c7088e1aab65dbull,   216}, {0xc45d1df942711d9aull,   242},
+  {0x924d692ca61be758ull,   269}, {0xda01ee641a708deaull,   295},
+  {0xa26da3999aef774aull,   322}, {0xf209787bb47d6b85ull,   348},
+  {0xb454e4a179dd1877ull,   375}, {0x865b86925b9bc5c2ull,   402},
+  {0xc83553c5c8965d3dull,   428}, {0x952ab45cfa97a0b3ull,   455},
+  {0xde469fbd99a05fe3ull,   481}, {0xa59bc234db398c25ull,   508},
+  {0xf6c69a72a3989f5cull,   534}, {0xb7dcbf5354e9beceull,   561},
+  {0x88fcf317f22241e2ull,   588}, {0xcc20ce9bd35c78a5ull,   614},
+  {0x98165af37b2153dfull,   641}, {0xe2a0b5dc971f303aull,   667},
+  {0xa8d9d1535ce3b396ull,   694}, {0xfb9b7cd9a4a7443cull,   720},
+  {0xbb764c4ca7a44410ull,   747}, {0x8bab8eefb6409c1aull,   774},
+  {0xd01fef10a657842cull,   800}, {0x9b10a4e5e9913129ull,   827},
+  {0xe7109bfba19c0c9dull,   853}, {0xac2820d9623bf429ull,   880},
+  {0x80444b5e7aa7cf85ull,   907}, {0xbf21e44003acdd2dull,   933},
+  {0x8e679c2f5e44ff8full,   960}, {0xd433179d9c8cb841ull,   986},
+  {0x9e19db92b4e31ba9ull,  1013}, {0xeb96bf6ebadf77d9ull,  1039},
+  {0xaf87023b9bf0ee6bull,  1066},
+};
+
+/**
+ * Private function to check if a character is a decimal digit
+ *
+ * @param c Character to check
+ *
+ * @return TRUE if it is between '0' and '9'
+*/
+bool_t _is_digit(char c)
+{
+  return (unsigned char)(c - '0') <= 9;
+}
+
+/**
+ * Private function to copy a constant string (inf, nan) to the destination
+ *
+ * @param dst Destination of the characters
+ * @param cap Number of characters available in the destination
+ * @param str String to copy
+ *
+ * @return Number of characters written, or -1 if they don't fit
+*/
+int _write_str(char* dst, int cap, const char* str)
+{
+  int len = strlen(str);
+  if (len > cap)
+  {
+    return -1;
+  }
+  memcpy(dst, str, len);
+  return len;
+}
+
+/**
+ * Private functions for the diy_fp_t arithmetic: conversion from a double, normalization (most
+ * significant bit set), and rounded multiplication (the 64 higher bits of the 128 bits product).
+*/
+struct diy_fp_t _diy_fp_from_double(double num)
+{
+  uint64_t bits;
+  memcpy(&bits, &num, sizeof(bits));
+  int biased_e = (int)((bits & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+  uint64_t significand = bits & DP_SIGNIFICAND_MASK;
+
+  struct diy_fp_t fp;
+  if (biased_e != 0)
+  {
+    fp.f = significand + DP_HIDDEN_BIT;
+    fp.e = biased_e - DP_EXPONENT_BIAS;
+  }
+  else
+  {
+    // Subnormal numbers
+    fp.f = significand;
+    fp.e = 1 - DP_EXPONENT_BIAS;
+  }
+  return fp;
+}
+
+struct diy_fp_t _diy_fp_normalize(struct diy_fp_t fp)
+{
+  int shift = __builtin_clzll(fp.f);
+  fp.f <<= shift;
+  fp.e -= shift;
+  return fp;
+}
+
+struct diy_fp_t _diy_fp_mul(struct diy_fp_t a, struct diy_fp_t b)
+{
+  unsigned __int128 product = (unsigned __int128)a.f * b.f;
+  struct diy_fp_t fp;
+  fp.f = (uint64_t)(product >> 64);
+  if ((uint64_t)product & (1ull << 63))
+  {
+    fp.f++;
+  }
+  fp.e = a.e + b.e + 64;
+  return fp;
+}
+
+/**
+ * Private function that moves the last digit generated closer to the real value, while it stays
+ * inside the interval of values that round to the same double.
+*/
+void _grisu_round(char* digits, int count, uint64_t delta, uint64_t rest,
+    uint64_t ten_kappa, uint64_t wp_w)
+{
+  while (rest < wp_w && delta - rest >= ten_kappa &&
+         (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+  {
+    digits[count - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+/**
+ * Private function with the Grisu2 algorithm (Florian Loitsch, "Printing Floating-Point Numbers
+ * Quickly and Accurately with Integers"). It generates the shortest digits (in almost all the
+ * cases) that still identify the positive double passed, this is, num = digits * 10^exp10.
+ *
+ * @param num Positive, finite and not zero value
+ * @param digits Destination of the digits (at least 18 characters)
+ * @param exp10 Pointer to store the decimal exponent
+ *
+ * @return Number of digits generated
+*/
+int _grisu2(double num, char* digits, int* exp10)
+{
+  struct diy_fp_t v = _diy_fp_from_double(num);
+
+  // Boundaries: the middle points with the previous and the next doubles
+  struct diy_fp_t plus;
+  plus.f = (v.f << 1) + 1;
+  plus.e = v.e - 1;
+  plus = _diy_fp_normalize(plus);
+  struct diy_fp_t minus;
+  if (v.f == DP_HIDDEN_BIT)
+  {
+    minus.f = (v.f << 2) - 1;
+    minus.e = v.e - 2;
+  }
+  else
+  {
+    minus.f = (v.f << 1) - 1;
+    minus.e = v.e - 1;
+  }
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  // Cached power of ten that moves the value to the range where the digits are generated
+  double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+  int k = (int)dk;
+  if (dk - k > 0.0)
+  {
+    k++;
+  }
+  int index = (k >> 3) + 1;
+  *exp10 = -(-348 + index * 8);
+  struct diy_fp_t c_mk = CACHED_POWERS[index];
+
+  struct diy_fp_t w = _diy_fp_mul(_diy_fp_normalize(v), c_mk);
+  struct diy_fp_t wp = _diy_fp_mul(plus, c_mk);
+  struct diy_fp_t wm = _diy_fp_mul(minus, c_mk);
+  wm.f++;
+  wp.f--;
+
+  // Digit generation, first with the integer part of wp and then with the fractional part
+  uint64_t delta = wp.f - wm.f;
+  uint64_t one_f = 1ull << -wp.e;
+  uint64_t wp_w = wp.f - w.f;
+  uint32_t p1 = (uint32_t)(wp.f >> -wp.e);
+  uint64_t p2 = wp.f & (one_f - 1);
+  int kappa = 1;
+  while (kappa < 10 && p1 >= POW10_INT[kappa]) kappa++;
+
+  int count = 0;
+  while (kappa > 0)
+  {
+    uint32_t d = p1 / (uint32_t)POW10_INT[kappa - 1];
+    p1 %= (uint32_t)POW10_INT[kappa - 1];
+    if (d || count)
+    {
+      digits[count++] = '0' + d;
+    }
+    kappa--;
+    uint64_t tmp = ((uint64_t)p1 << -wp.e) + p2;
+    if (tmp <= delta)
+    {
+      *exp10 += kappa;
+      _grisu_round(digits, count, delta, tmp, POW10_INT[kappa] << -wp.e, wp_w);
+      return count;
+    }
+  }
+  while (1)
+  {
+    p2 *= 10;
+    delta *= 10;
+    char d = (char)(p2 >> -wp.e);
+    if (d || count)
+    {
+      digits[count++] = '0' + d;
+    }
+    p2 &= one_f - 1;
+    kappa--;
+    if (p2 < delta)
+    {
+      *exp10 += kappa;
+      _grisu_round(digits, count, delta, p2, one_f,
+          -kappa <= MAX_MANTISSA_DIGITS ? wp_w * POW10_INT[-kappa] : 0);
+      return count;
+    }
+  }
+}
+
+/**
+ * Private function that writes the digits generated (value = digits * 10^exp10) in fixed notation
+ * (123.45, 0.001) or, for very big or very small values, in exponent notation (1.5e+300).
+ *
+ * @return Number of characters written, or -1 if they don't fit
+*/
+int _write_digits(char* dst, int cap, bool_t neg, const char* digits, int count, int exp10)
+{
+  char tmp[CALC_PROTO_NUM_MAX_LEN];
+  int len = 0;
+  if (neg)
+  {
+    tmp[len++] = '-';
+  }
+
+  // Position of the decimal point, relative to the first digit
+  int point = count + exp10;
+  if (exp10 >= 0 && point <= MAX_FIXED_DIGITS)
+  {
+    // Integer: digits followed by zeros
+    memcpy(tmp + len, digits, count);
+    len += count;
+    for (int i = 0; i < exp10; i++) tmp[len++] = '0';
+  }
+  else if (point > 0 && point <= MAX_FIXED_DIGITS)
+  {
+    // Decimal point between the digits
+    memcpy(tmp + len, digits, point);
+    len += point;
+    tmp[len++] = '.';
+    memcpy(tmp + len, digits + point, count - point);
+    len += count - point;
+  }
+  else if (point <= 0 && point > -6)
+  {
+    // Small value: 0.000ddd
+    tmp[len++] = '0';
+    tmp[len++] = '.';
+    for (int i = 0; i < -point; i++) tmp[len++] = '0';
+    memcpy(tmp + len, digits, count);
+    len += count;
+  }
+  else
+  {
+    // Exponent notation: d.ddde+xx
+    tmp[len++] = digits[0];
+    if (count > 1)
+    {
+      tmp[len++] = '.';
+      memcpy(tmp + len, digits + 1, count - 1);
+      len += count - 1;
+    }
+    int exponent = point - 1;
+    tmp[len++] = 'e';
+    tmp[len++] = exponent < 0 ? '-' : '+';
+    len += calc_proto_num_write_int(tmp + len, sizeof(tmp) - len,
+        exponent < 0 ? -exponent : exponent);
+  }
+
+  if (len > cap)
+  {
+    return -1;
+  }
+  memcpy(dst, tmp, len);
+  return len;
+}
+
+/**
+ * Private function used for the numbers that can't use the fast path (long mantissas or big
+ * exponents). The syntax is already validated, so strtod only does the conversion.
+ *
+ * NOTE: strtod depends on the locale, the servers and clients never call setlocale, so the "C"
+ * locale (with '.' as decimal point) is always in use.
+ *
+ * @param str Field to convert
+ * @param len Length of the field
+ * @param num Pointer to store the value
+ *
+ * @return TRUE if the conversion is achieved
+*/
+bool_t _parse_double_slow(const char* str, int len, double* num)
+{
+  char tmp[64];
+  if (len >= (int)sizeof(tmp))
+  {
+    return FALSE;
+  }
+  memcpy(tmp, str, len);
+  tmp[len] = '\0';
+
+  char* end;
+  *num = strtod(tmp, &end);
+  return end == tmp + len;
+}
+
+/**
+ * Parse an integer field (id or status) of a message
+ *
+ * @param str Characters of the field (not necessarily null terminated)
+ * @param len Length of the field
+ * @param num Pointer to store the value
+ *
+ * @return TRUE if the whole field is a valid 32 bit integer
+*/
+bool_t calc_proto_num_parse_int(const char* str, int len, int32_t* num)
+{
+  int i = 0;
+  bool_t neg = FALSE;
+  if (i < len && (str[i] == '-' || str[i] == '+'))
+  {
+    neg = str[i] == '-';
+    i++;
+  }
+  if (i == len)
+  {
+    return FALSE;
+  }
+
+  // Accumulate in 64 bits, so the overflow can be detected before it happens
+  int64_t value = 0;
+  for (; i < len; i++)
+  {
+    if (!_is_digit(str[i]))
+    {
+      return FALSE;
+    }
+    value = value * 10 + (str[i] - '0');
+    if (value > (int64_t)INT32_MAX + 1)
+    {
+      return FALSE;
+    }
+  }
+  if (!neg && value > INT32_MAX)
+  {
+    return FALSE;
+  }
+  *num = (int32_t)(neg ? -value : value);
+  return TRUE;
+}
+
+/**
+ * Parse a double field (operands and result) of a message
+ *
+ * @param str Characters of the field (not necessarily null terminated)
+ * @param len Length of the field
+ * @param num Pointer to store the value
+ *
+ * @return TRUE if the whole field is a valid number
+*/
+bool_t calc_proto_num_parse_double(const char* str, int len, double* num)
+{
+  int i = 0;
+  bool_t neg = FALSE;
+  if (i < len && (str[i] == '-' || str[i] == '+'))
+  {
+    neg = str[i] == '-';
+    i++;
+  }
+
+  // Special values (as written by this codec or by printf)
+  int rest = len - i;
+  if (rest > 0 && !_is_digit(str[i]) && str[i] != '.')
+  {
+    if ((rest == 3 && !strncasecmp(str + i, "inf", 3)) ||
+        (rest == 8 && !strncasecmp(str + i, "infinity", 8)))
+    {
+      *num = neg ? -INFINITY : INFINITY;
+      return TRUE;
+    }
+    if (rest == 3 && !strncasecmp(str + i, "nan", 3))
+    {
+      *num = NAN;
+      return TRUE;
+    }
+    return FALSE;
+  }
+
+  // Collect the significant digits in a single integer (mantissa * 10^exp10)
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exp10 = 0;
+  bool_t any_digit = FALSE;
+  bool_t slow = FALSE;
+  for (; i < len && _is_digit(str[i]); i++)
+  {
+    any_digit = TRUE;
+    if (digits == 0 && str[i] == '0') continue;
+    if (digits < MAX_MANTISSA_DIGITS)
+    {
+      mantissa = mantissa * 10 + (str[i] - '0');
+      digits++;
+    }
+    else
+    {
+      slow = TRUE;
+    }
+  }
+  if (i < len && str[i] == '.')
+  {
+    for (i++; i < len && _is_digit(str[i]); i++)
+    {
+      any_digit = TRUE;
+      if (digits == 0 && str[i] == '0')
+      {
+        exp10--;
+        continue;
+      }
+      if (digits < MAX_MANTISSA_DIGITS)
+      {
+        mantissa = mantissa * 10 + (str[i] - '0');
+        digits++;
+        exp10--;
+      }
+      else
+      {
+        slow = TRUE;
+      }
+    }
+  }
+  if (!any_digit)
+  {
+    return FALSE;
+  }
+
+  // Optional exponent
+  if (i < len && (str[i] == 'e' || str[i] == 'E'))
+  {
+    i++;
+    bool_t exp_neg = FALSE;
+    if (i < len && (str[i] == '-' || str[i] == '+'))
+    {
+      exp_neg = str[i] == '-';
+      i++;
+    }
+    if (i == len)
+    {
+      return FALSE;
+    }
+    int exp_value = 0;
+    for (; i < len && _is_digit(str[i]); i++)
+    {
+      if (exp_value < 100000) exp_value = exp_value * 10 + (str[i] - '0');
+    }
+    exp10 += exp_neg ? -exp_value : exp_value;
+  }
+
+  // Garbage after the number
+  if (i != len)
+  {
+    return FALSE;
+  }
+
+  if (mantissa == 0 && !slow)
+  {
+    *num = neg ? -0.0 : 0.0;
+    return TRUE;
+  }
+
+  // Fast path: both values are exact, so the single operation is correctly rounded
+  if (!slow && mantissa <= (uint64_t)MAX_EXACT_INT &&
+      exp10 >= -MAX_EXACT_POW10 && exp10 <= MAX_EXACT_POW10)
+  {
+    double value = (double)mantissa;
+    value = exp10 < 0 ? value / POW10[-exp10] : value * POW10[exp10];
+    *num = neg ? -value : value;
+    return TRUE;
+  }
+  return _parse_double_slow(str, len, num);
+}
+
+/**
+ * Write an integer field (id or status) of a message
+ *
+ * @param dst Destination of the characters
+ * @param cap Number of characters available in the destination
+ * @param num Value to write
+ *
+ * @return Number of characters written, or -1 if they don't fit
+*/
+int calc_proto_num_write_int(char* dst, int cap, int32_t num)
+{
+  // Extract the digits (in reverse order), the unsigned value avoids overflow with INT32_MIN
+  char digits[10];
+  int count = 0;
+  uint32_t value = num < 0 ? 0u - (uint32_t)num : (uint32_t)num;
+  do
+  {
+    digits[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+
+  int len = count + (num < 0 ? 1 : 0);
+  if (len > cap)
+  {
+    return -1;
+  }
+  int i = 0;
+  if (num < 0)
+  {
+    dst[i++] = '-';
+  }
+  while (count > 0) dst[i++] = digits[--count];
+  return len;
+}
+
+/**
+ * Write a double field (operands and result) of a message, using the shortest decimal that
+ * parses back to exactly the same value.
+ *
+ * Integers (very common in a calculator) are written directly, the rest of the values use the
+ * Grisu2 algorithm, which only needs integer arithmetic (no printf and no big numbers).
+ *
+ * @param dst Destination of the characters
+ * @param cap Number of characters available in the destination
+ * @param num Value to write
+ *
+ * @return Number of characters written, or -1 if they don't fit
+*/
+int calc_proto_num_write_double(char* dst, int cap, double num)
+{
+  if (isnan(num))
+  {
+    return _write_str(dst, cap, "nan");
+  }
+  bool_t neg = signbit(num) ? TRUE : FALSE;
+  double abs_num = neg ? -num : num;
+  if (isinf(abs_num))
+  {
+    return _write_str(dst, cap, neg ? "-inf" : "inf");
+  }
+  if (abs_num == 0.0)
+  {
+    return _write_str(dst, cap, neg ? "-0" : "0");
+  }
+
+  if (abs_num < MAX_EXACT_INT && abs_num == (double)(int64_t)abs_num)
+  {
+    int64_t value = (int64_t)num;
+    if (value >= INT32_MIN && value <= INT32_MAX)
+    {
+      return calc_proto_num_write_int(dst, cap, (int32_t)value);
+    }
+  }
+
+  char digits[MAX_MANTISSA_DIGITS];
+  int exp10;
+  int count = _grisu2(abs_num, digits, &exp10);
+  return _write_digits(dst, cap, neg, digits, count, exp10);
+}
@@ -0,0 +1,45 @@
+#ifndef CALC_PROTO_NUM_H
+#define CALC_PROTO_NUM_H
+
+/**
+ * Every field of a message is text, so each request needs to convert numbers from and to strings
+ * several times. Functions like sscanf/sprintf are generic: they parse a format string on every
+ * call, depend on the current locale (the decimal point could be a ',') and "%lf" rounds to six
+ * decimals, so a result like 0.1234567 can't travel through the protocol without losing digits.
+ *
+ * This codec is dedicated to the numbers of the calculator protocol:
+ *
+ *  - Integers (ids and status) are converted digit by digit with overflow detection.
+ *  - Doubles are parsed with the "fast path": when the digits fit in 53 bits and the power of ten
+ *    is exact (up to 1e22), a single multiplication or division gives the correctly rounded
+ *    value. Only unusual inputs (long mantissas, big exponents) fall back to strtod.
+ *  - Doubles are written with the Grisu2 algorithm (integer arithmetic only), which finds the
+ *    shortest decimal (in all but a few cases) that parses back to exactly the same value, so the
+ *    message is as short as possible and there is no precision loss.
+ *
+ * All the functions receive the length of the field, so the text doesn't need to be null
+ * terminated, and the whole field must be a valid number (no garbage after the digits).
+ *
+ *    char out[CALC_PROTO_NUM_MAX_LEN];
+ *    int len = calc_proto_num_write_double(out, sizeof(out), 0.1 + 0.2); // 0.30000000000000004
+ *    double num;
+ *    calc_proto_num_parse_double(out, len, &num);                       // Same bits as before
+*/
+
+#include <stdint.h>
+
+#include <types.h>
+
+// Enough characters for any number written by this codec (-1.2345678901234567e-308 and similar)
+#define CALC_PROTO_NUM_MAX_LEN 32
+
+// Parsing functions (TRUE if the whole field is a valid number)
+bool_t calc_proto_num_parse_int(const char* str, int len, int32_t* num);
+bool_t calc_proto_num_parse_double(const char* str, int len, double* num);
+
+// Writing functions (number of characters written, or -1 if the destination is too small).
+// The output is not null terminated.
+int calc_proto_num_write_int(char* dst, int cap, int32_t num);
+int calc_proto_num_write_double(char* dst, int cap, double num);
+
+#endif
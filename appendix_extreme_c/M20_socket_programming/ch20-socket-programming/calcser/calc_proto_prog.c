@@ -0,0 +1,149 @@
+#include <string.h>
+
+#include "calc_proto_num.h"
+#include "calc_proto_prog.h"
+
+// Tokens of the operations, by instruction (CALC_OP_PUSH has none)
+static const char* const OP_TOKENS[CALC_OP_COUNT] = {
+  NULL, "+", "-", "*", "/", "M+", "M-", "M*", "M", "MC"
+};
+
+// Values taken from the stack by every instruction, and values pushed
+static const int OP_POPS[CALC_OP_COUNT] = {0, 2, 2, 2, 2, 2, 2, 2, 0, 0};
+static const int OP_PUSHES[CALC_OP_COUNT] = {1, 1, 1, 1, 1, 1, 1, 1, 1, 0};
+
+/**
+ * Private function that finds the instruction of an operation token
+ *
+ * @param token Beginning of the token
+ * @param len Length of the token
+ *
+ * @return Instruction, or CALC_OP_PUSH if the token is not an operation (so it must be a number)
+*/
+static calc_op_t _token_op(const char* token, int len)
+{
+  for (int op = CALC_OP_ADD; op < CALC_OP_COUNT; op++)
+  {
+    if ((int)strlen(OP_TOKENS[op]) == len && !memcmp(OP_TOKENS[op], token, len))
+    {
+      return (calc_op_t)op;
+    }
+  }
+  return CALC_OP_PUSH;
+}
+
+/**
+ * Compile the text of a program to bytecode. The depth of the stack is followed token by token,
+ * so the programs that would take more values than the stack has, that would go beyond its
+ * maximum depth, or that wouldn't end with a single value, are rejected here and the interpreter
+ * doesn't need to check them. The programs whose written text (see calc_proto_prog_print) is too
+ * long for a message are rejected as well, so a compiled program can always be sent.
+ *
+ * @param src Text of the program (not null terminated)
+ * @param len Length of the text
+ * @param program Compiled program
+ *
+ * @return TRUE if the program is valid
+*/
+bool_t calc_proto_prog_compile(const char* src, int len, struct calc_program_t* program)
+{
+  const char* ptr = src;
+  const char* end = src + len;
+  int depth = 0;
+  program->len = 0;
+  program->nums_len = 0;
+
+  while (ptr < end)
+  {
+    // Skip the spaces, and find the end of the token
+    if (*ptr == ' ')
+    {
+      ptr++;
+      continue;
+    }
+    const char* token_end = memchr(ptr, ' ', end - ptr);
+    if (!token_end)
+    {
+      token_end = end;
+    }
+    int token_len = token_end - ptr;
+
+    if (program->len == CALC_PROGRAM_MAX_CODE)
+    {
+      return FALSE;
+    }
+    calc_op_t op = _token_op(ptr, token_len);
+    if (op == CALC_OP_PUSH)
+    {
+      if (program->nums_len == CALC_PROGRAM_MAX_NUMS ||
+          !calc_proto_num_parse_double(ptr, token_len, &program->nums[program->nums_len]))
+      {
+        return FALSE;
+      }
+      program->nums_len++;
+    }
+    if (depth < OP_POPS[op])
+    {
+      return FALSE;
+    }
+    depth += OP_PUSHES[op] - OP_POPS[op];
+    if (depth > CALC_PROGRAM_MAX_STACK)
+    {
+      return FALSE;
+    }
+    program->code[program->len++] = (uint8_t)op;
+    ptr = token_end;
+  }
+  if (depth != 1)
+  {
+    return FALSE;
+  }
+  char text[CALC_PROTO_PROG_MAX_TEXT];
+  return calc_proto_prog_print(program, text, sizeof(text)) >= 0;
+}
+
+/**
+ * Write the text of a compiled program, the tokens separated by a space (the clients send the
+ * programs they compiled this way)
+ *
+ * @param program Compiled program
+ * @param dst Destination
+ * @param cap Characters available in the destination
+ *
+ * @return Length of the text, or -1 if it doesn't fit
+*/
+int calc_proto_prog_print(const struct calc_program_t* program, char* dst, int cap)
+{
+  int len = 0;
+  int num = 0;
+  for (int i = 0; i < program->len; i++)
+  {
+    if (i > 0)
+    {
+      if (len >= cap)
+      {
+        return -1;
+      }
+      dst[len++] = ' ';
+    }
+    calc_op_t op = (calc_op_t)program->code[i];
+    if (op == CALC_OP_PUSH)
+    {
+      int written = calc_proto_num_write_double(dst + len, cap - len, program->nums[num++]);
+      if (written < 0)
+      {
+        return -1;
+      }
+      len += written;
+      continue;
+    }
+    int token_len = strlen(OP_TOKENS[op]);
+    if (token_len > cap - len)
+    {
+      return -1;
+    }
+    memcpy(dst + len, OP_TOKENS[op], token_len);
+    len += token_len;
+  }
+  return len;
+}
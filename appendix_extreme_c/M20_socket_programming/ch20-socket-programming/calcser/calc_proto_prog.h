@@ -0,0 +1,48 @@
+#ifndef CALC_PROTO_PROG_H
+#define CALC_PROTO_PROG_H
+
+/**
+ * The EVAL requests carry a program instead of two operands, written in reverse polish notation:
+ * the numbers are pushed in a stack, and every operation takes its operands from the top of the
+ * stack and pushes its result. The tokens are separated by spaces:
+ *
+ *    <number>   Push the number
+ *    + - * /    ADD, SUB, MUL and DIV of the two values at the top
+ *    M+ M- M*   ADDM, SUBM and MULM of the two values at the top (pushes the new memory)
+ *    M          GETMEM (pushes the memory)
+ *    MC         RESMEM (pushes nothing)
+ *
+ * The result of the request is the only value left in the stack at the end:
+ *
+ *    7#EVAL#2 3 + 4 *$             --> 7#0#20$
+ *    8#EVAL#MC 10 0 M+ 3 1 M* +$    --> 8#0#40$   (the memory ends with 30)
+ *
+ * In binary frames the program follows the method, as text too (see calc_proto_ser.h):
+ *
+ *    Request:  <len:u16><id:i32><method:u8 = EVAL><program:len - 5 characters>
+ *
+ * A program is compiled once, when its request is parsed, to the bytecode of calc_program.h.
+ *
+ * The clients send the text written by calc_proto_prog_print, which can be longer than the one
+ * they compiled (1e9 is written 1000000000). The compiler rejects the programs whose written text
+ * wouldn't fit in a text message with any ID, so every compiled program can be sent.
+*/
+
+#include <types.h>
+#include <calc_program.h>
+
+#include "calc_proto_ser.h"
+
+// Longest written program: a message less the null character, the longest ID (-2147483648),
+// #EVAL# and $ (the binary frames have room for a few more characters)
+#define CALC_PROTO_PROG_MAX_TEXT (CALC_PROTO_MAX_MSG_LEN - 19)
+
+// Compile the text of a program (not null terminated), FALSE if it is not valid or if its written
+// text is longer than CALC_PROTO_PROG_MAX_TEXT
+bool_t calc_proto_prog_compile(const char* src, int len, struct calc_program_t* program);
+
+// Write the text of a compiled program (without the null character), returns its length or -1 if
+// it doesn't fit in the destination
+int calc_proto_prog_print(const struct calc_program_t* program, char* dst, int cap);
+
+#endif
@@ -11,6 +11,7 @@ static char SUBM_STR[]   = "SUBM";
 static char MUL_STR[]    = "MUL";
 static char MULM_STR[]   = "MULM";
 static char DIV_STR[]    = "DIV";
+static char EVAL_STR[]   = "EVAL";
 
 /**
  * Function to make a valid convertion of the method
@@ -30,6 +31,7 @@ method_t str_to_method(const char* str)
   if (!strcmp(str, MUL_STR   )) return MUL;
   if (!strcmp(str, MULM_STR  )) return MULM;
   if (!strcmp(str, DIV_STR   )) return DIV;
+  if (!strcmp(str, EVAL_STR  )) return EVAL;
   return 0;
 }
 
@@ -53,6 +55,7 @@ const char* method_to_str(method_t method)
     case MUL:    return MUL_STR;
     case MULM:   return MULM_STR;
     case DIV:    return DIV_STR;
+    case EVAL:   return EVAL_STR;
     default:     return NULL;
   }
 }
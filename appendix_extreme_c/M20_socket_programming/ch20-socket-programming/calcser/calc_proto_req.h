@@ -39,15 +39,19 @@ typedef enum {
   SUBM,   // Subsctract two numbers and also considers the value stored in memory
   MUL,    // Multiply two factors
   MULM,   // Multiply two factos, then the value stored in memory
-  DIV     // Divide the first number into the second one
+  DIV,    // Divide the first number into the second one
+  EVAL    // Run a program of several operations instead (see calc_proto_prog.h)
 } method_t;
 
+struct calc_program_t;
+
 // Struct for request message
 struct calc_proto_req_t {
   int32_t id;
   method_t method;
   double operand1;
   double operand2;
+  const struct calc_program_t* program; // Program of an EVAL request (no operands then)
 };
 
 // Functions related to method identification or traslation
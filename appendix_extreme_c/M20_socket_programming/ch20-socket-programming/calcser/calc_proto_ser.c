@@ -4,288 +4,365 @@
 #include <assert.h>
 
 #include "calc_proto_ser.h"
+#include "calc_proto_num.h"
+#include "calc_proto_prog.h"
 
 #define FIELD_COUNT_PER_REQ_MESSAGE 4
 #define FIELD_COUNT_PER_RESP_MESSAGE 3
+#define FIELD_COUNT_PER_EVAL_MESSAGE 3 // <id>#EVAL#<program>
 #define MESSAGE_DELIMITER '$' // Used for separation of different message
 #define FIELD_DELIMITER '#' // Used for separation of attributes inside a message
+#define MAX_METHOD_LEN 6   // Longest method name (GETMEM)
+
+#define BINARY_LEN_PREFIX 2    // Bytes of the length at the beginning of every frame
+#define BINARY_REQ_PAYLOAD 21  // id (4) + method (1) + operand1 (8) + operand2 (8)
+#define BINARY_RESP_PAYLOAD 13 // req_id (4) + status (1) + result (8)
+#define BINARY_EVAL_HEADER 5   // id (4) + method (1), the program follows
+#define BINARY_MAX_PAYLOAD 64  // Bigger frames are skipped (and reported as invalid)
+
+#define MSG_BUF_INITIAL_SIZE 64 // Initial size of the buffer for messages received in parts
 
 // Structure that defines attributes for serialization/deserialization process
 struct calc_proto_ser_t {
-  char* ring_buf;
+  char* msg_buf;       // Message received in parts (the complete ones are parsed in place)
+  int buf_size;        // Characters reserved for msg_buf (it grows on demand up to buf_len)
   int buf_len;         // Lenght of message
-  int curr_idx;        // Current index of buffer
-  int start_idx;       // Start index of the buffer
+  int msg_len;         // Characters of the incomplete message kept in msg_buf
+  bool_t discarding;   // TRUE while skipping the rest of a message that is too long
   error_cb_t error_cb; // Error callback
   req_cb_t req_cb;     // Request callback (to validate or check for errors)
   resp_cb_t resp_cb;   // Response callback (to validate or check for errors)
   void* context;       // Pointer contextual operation (response/request)
+  calc_proto_mode_t mode; // Wire format in use (text or binary frames)
+  char frame[BINARY_LEN_PREFIX + BINARY_MAX_PAYLOAD]; // Binary frame received in parts
+  int frame_len;       // Bytes of the frame received so far
+  int frame_skip;      // Bytes to discard from an invalid (too long) frame
+  req_batch_cb_t req_batch_cb; // Batch request callback (replaces req_cb when it is set)
+  struct calc_proto_req_t batch[CALC_PROTO_MAX_BATCH]; // Requests waiting to be delivered
+  int batch_len;       // Number of requests in the batch
+  struct calc_program_t* programs; // Programs of the EVAL requests in the batch (allocated with
+                                   // the first EVAL request)
 };
 
-typedef void (*parse_and_notify_func_t)(struct calc_proto_ser_t* ser);
-
+typedef void (*parse_and_notify_func_t)(struct calc_proto_ser_t* ser, const char* msg, int len);
 
 /**
- * Private function to parse a int to a string or char array
+ * Private helpers to append the parts of a message to a destination buffer, each one returns the
+ * new length of the message, or -1 if the destination is too small (or was already full).
  * 
- * @param str Char array or string to store the number converted
- * @param Pointer to int variable to convert.
- * 
- * @return TRUE if the convertion is achieved
+ * @param dst Destination buffer
+ * @param cap Number of characters available in the destination
+ * @param len Current length of the message (or -1 after a previous failure)
 */
-bool_t _parse_int(const char* str,  int* num) 
+int _append_char(char* dst, int cap, int len, char c) 
 {
-  // sscanf reads formatted input from a string, and returns 1 if the reading was achieved
-  // %d as if it was in a print, indicates an integer.
-  if (sscanf(str, "%d", num) == 1) 
+  if (len < 0 || len >= cap) 
   {
-    return TRUE;
+    return -1;
   }
-  return FALSE;
+  dst[len] = c;
+  return len + 1;
 }
 
+int _append_str(char* dst, int cap, int len, const char* str) 
+{
+  if (len < 0 || !str) 
+  {
+    return -1;
+  }
+  int str_len = strlen(str);
+  if (str_len > cap - len) 
+  {
+    return -1;
+  }
+  memcpy(dst + len, str, str_len);
+  return len + str_len;
+}
 
-/**
- * Private function to parse a double to a string or char array
- * 
- * @param str Char array or string to store number converted
- * @param num Pointer to double variable to convert.
- * 
- * @return TRUE if the convertion is achieved
-*/
-bool_t _parse_double(const char* str, double* num) 
+int _append_int(char* dst, int cap, int len, int32_t num) 
 {
-  // sscanf reads formatted input from a string, and returns 1 if the reading was achieved
-  // %lf comes from long float which is equivalent to double in this case
-  if (sscanf(str, "%lf", num) == 1) 
+  if (len < 0) 
   {
-    return TRUE;
+    return -1;
   }
-  return FALSE;
+  int written = calc_proto_num_write_int(dst + len, cap - len, num);
+  return written < 0 ? -1 : len + written;
+}
+
+int _append_double(char* dst, int cap, int len, double num) 
+{
+  if (len < 0) 
+  {
+    return -1;
+  }
+  int written = calc_proto_num_write_double(dst + len, cap - len, num);
+  return written < 0 ? -1 : len + written;
 }
 
 /**
- * Private function to serialize a double number for message sending
+ * Private function that closes a message with the terminating null character (not counted in the
+ * length, but it makes the message a valid string).
  * 
- * @param str Destination string/char array to store serialized number
- * @param num Double value to serialize
+ * @return Length of the message, or -1 if there is no room for the null character
 */
-void _serialize_double(char* str, double num) 
+int _terminate(char* dst, int cap, int len) 
 {
-  char tmp[64];
-
-  // sprintf sends formatted value to string or char array,
-  // in this case $lf refers to long float values (doubles).
-  sprintf(tmp, "%lf", num);
-
-  // Make a copy to the returned value by pointer
-  strcpy(str, tmp);
-
-  // Add termitation character to the string (\0)
-  int i = strlen(str) - 1;
-  while (str[i] == '0' && i >= 0) i--;
-  if (i >= 0) str[i + 1] = '\0';
-  if (i >= 0 && str[i] == '.') str[i] = '\0';
+  if (len < 0 || len >= cap) 
+  {
+    return -1;
+  }
+  dst[len] = '\0';
+  return len;
 }
 
+
 /**
- * Private function for checking if buffer still has space left.
+ * Private function that delivers the requests waiting in the batch (if any) with a single call to
+ * the batch callback.
  * 
  * @param ser Pointer to serialization object in use
- * 
- * @return FALSE if the buffer isn't full, TRUE otherwise
 */
-bool_t _is_buffer_full(struct calc_proto_ser_t* ser) 
+void _flush_req_batch(struct calc_proto_ser_t* ser) 
 {
-  if (ser->start_idx < 0) 
+  if (ser->batch_len == 0) 
   {
-    return FALSE;
+    return;
   }
+  int count = ser->batch_len;
+  ser->batch_len = 0;
+  ser->req_batch_cb(ser->context, ser->batch, count);
+}
 
-  // If the assert result in true, it does nothing. Otherwise, sends an error by using stderr
-  assert(ser->start_idx != ser->curr_idx);
-
-  // Validates that the current index is further that the start index, then calculates the lenght of both
-  // and finally, it is compared to the buffer lenght to determinate if it is full
-  if (ser->start_idx < ser->curr_idx) 
+/**
+ * Private function that notifies an error. The requests waiting in the batch are delivered first,
+ * so the owner receives requests and errors in the same order as they arrived.
+ * 
+ * @param ser Pointer to serialization object in use
+ * @param req_id Id of the request/response with the error (-1 if unknown)
+ * @param error_code Error code to notify
+*/
+void _notify_error(struct calc_proto_ser_t* ser, int req_id, int error_code) 
+{
+  _flush_req_batch(ser);
+  if (ser->error_cb) 
   {
-    return (ser->curr_idx - ser->start_idx) == (ser->buf_len - 1);
+    ser->error_cb(ser->context, req_id, error_code);
   }
-  return (ser->start_idx - ser->curr_idx) == 1;
 }
 
 /**
- * Private function taht validates that the message serialization structure is followed and can
- * be used for the communication.
+ * Private function that notifies a valid request. When a batch callback is set, the request is
+ * kept in the batch (it is delivered when the batch is full or the buffer has been processed),
+ * otherwise the request callback is called right away.
  * 
  * @param ser Pointer to serialization object in use
- * @param fields Double pointer to recognition of fields
- * @param field_count Number of fields to be a valid serialization (vary according response/request)
- * @param error_code Integer value needed for error handling.
- * 
- * @return TRUE if serialization is valid, FALSE otherwise.
- * 
- * @exception Raise error that the delimeter wasn't found and returns FALSE.
+ * @param req Request deserialized
 */
-bool_t _parse_fields(struct calc_proto_ser_t* ser, char** fields,
-    int field_count, int error_code) 
+void _notify_req(struct calc_proto_ser_t* ser, struct calc_proto_req_t req) 
 {
-  int end_idx = ser->curr_idx;
-  int idx = ser->start_idx;
-  char *ptr = ser->ring_buf + ser->start_idx;
-  int field_idx = 0;
-
-  // Loop for validation of correct number of fields
-  while (field_idx < field_count) 
+  if (ser->req_batch_cb) 
   {
-    // Generate and array of fields, ptr will be the guide pointer for the process of replacing
-    fields[field_idx] = ptr;
-
-    // Loop for detecting field delimiters
-    while (*ptr != FIELD_DELIMITER) 
+    ser->batch[ser->batch_len++] = req;
+    if (ser->batch_len == CALC_PROTO_MAX_BATCH) 
     {
-        if (idx == end_idx) 
-        {
-          // If end is reached with no delimiters found, exits and will rise future error.
-          break;
-        }
-        if (idx == (ser->buf_len - 1)) 
-        {
-          // Restart index for checking again.
-          idx = 0;
-        }
-        ptr++; idx++;
+      _flush_req_batch(ser);
     }
-    
-    // Validate index and check that no extra fields passes
-    if (field_idx < (field_count - 1)) 
-    {
-      if (*ptr != FIELD_DELIMITER) 
-      {
-        // Raise error if the field delimiter isn't found
-        if (ser->error_cb) ser->error_cb(ser->context, -1, error_code);
-        return FALSE;
-      }
+    return;
+  }
+  if (!ser->req_cb) 
+  {
+    fprintf(stderr, "Request callback is not set!\n");
+    return;
+  }
+  ser->req_cb(ser->context, req);
+}
 
-      // Replace delimiter with end of line, so it ends char array
-      *ptr = '\0'; ptr++; idx++;
-    } 
-    else 
+/**
+ * Private function that splits a message (without the message delimiter) in its fields. Nothing
+ * is copied, every field points to the message itself, and the delimiters are found with memchr
+ * (which the C library implements with vector instructions).
+ * 
+ * @param msg Message to split (not null terminated)
+ * @param len Length of the message
+ * @param fields Array to store the beginning of every field
+ * @param lens Array to store the length of every field
+ * @param field_count Number of fields expected in the message (vary according response/request)
+ * 
+ * @return TRUE if the message has exactly field_count fields, FALSE otherwise.
+*/
+bool_t _split_fields(const char* msg, int len, const char** fields, int* lens, int field_count) 
+{
+  const char* ptr = msg;
+  const char* end = msg + len;
+  for (int i = 0; i < field_count - 1; i++) 
+  {
+    const char* delim = memchr(ptr, FIELD_DELIMITER, end - ptr);
+    if (!delim) 
     {
-      if (*ptr != MESSAGE_DELIMITER) 
-      {
-        // Raise error if the message delimiter isn't found at the end of the message
-        if (ser->error_cb) ser->error_cb(ser->context, -1, error_code);
-        return FALSE;
-      }
-
-      // Replace delimitater with end of line and check the message length
-      *ptr = '\0';
-      assert(idx == end_idx);
-      if (idx != end_idx) 
-      {
-        if (ser->error_cb) ser->error_cb(ser->context, -1, error_code);
-        return FALSE;
-      }
+      // Missing fields
+      return FALSE;
     }
-    field_idx++;
+    fields[i] = ptr;
+    lens[i] = delim - ptr;
+    ptr = delim + 1;
   }
 
-  // Checks if all the index has been passed.
-  assert(field_idx == field_count);
+  // The last field runs until the end of the message, so it can't contain another delimiter
+  if (memchr(ptr, FIELD_DELIMITER, end - ptr)) 
+  {
+    return FALSE;
+  }
+  fields[field_count - 1] = ptr;
+  lens[field_count - 1] = end - ptr;
   return TRUE;
 }
 
 /**
- * Function that parse and check serialization for a request, while preventing the invalid ones.
+ * Private function that converts a method field (not null terminated) to its enumeration
  * 
- * @param ser Pointer to the serialization object in use.
+ * @param str Beginning of the field
+ * @param len Length of the field
  * 
- * @exception If the context request isn't valid, exits the function
+ * @return Method, or NONE if it isn't valid
 */
-void _parse_req_and_notify(struct calc_proto_ser_t* ser) 
+method_t _parse_method(const char* str, int len) 
 {
-  // Generate pointer of char arrays to fill and identify message fields
-  char* fields[FIELD_COUNT_PER_REQ_MESSAGE];
+  char method[MAX_METHOD_LEN + 1];
+  if (len > MAX_METHOD_LEN) 
+  {
+    return NONE;
+  }
+  memcpy(method, str, len);
+  method[len] = '\0';
+  return str_to_method(method);
+}
 
-  // Call parse function with special configuration for req.
-  if (!_parse_fields(ser, fields, FIELD_COUNT_PER_REQ_MESSAGE, ERROR_INVALID_REQUEST)) 
+/**
+ * Private function that compiles the program of an EVAL request and notifies the request. The
+ * program is kept in the slot of the request in the batch, so it is valid as long as the request
+ * (until the callback returns).
+ * 
+ * @param ser Pointer to the serialization object in use.
+ * @param id Id of the request
+ * @param src Text of the program (not null terminated)
+ * @param len Length of the text
+*/
+void _parse_eval_and_notify(struct calc_proto_ser_t* ser, int32_t id, const char* src, int len) 
+{
+  if (!ser->programs) 
+  {
+    ser->programs = (struct calc_program_t*)malloc(CALC_PROTO_MAX_BATCH *
+        sizeof(struct calc_program_t));
+  }
+  struct calc_program_t* program = &ser->programs[ser->req_batch_cb ? ser->batch_len : 0];
+  if (!calc_proto_prog_compile(src, len, program)) 
   {
+    _notify_error(ser, id, ERROR_INVALID_REQUEST_OPERAND1);
     return;
   }
 
-  // Create and start filling structure of request
   struct calc_proto_req_t req;
+  req.id = id;
+  req.method = EVAL;
+  req.operand1 = 0.0;
+  req.operand2 = 0.0;
+  req.program = program;
+  _notify_req(ser, req);
+}
 
-  // Update attribute of request id.
-  if (!_parse_int(fields[0], &req.id)) 
+/**
+ * Function that parse and check a request, while preventing the invalid ones.
+ * 
+ * @param ser Pointer to the serialization object in use.
+ * @param msg Message to parse (without the message delimiter)
+ * @param len Length of the message
+ * 
+ * @exception If the request isn't valid, the error is notified and the function exits
+*/
+void _parse_req_and_notify(struct calc_proto_ser_t* ser, const char* msg, int len) 
+{
+  // Pointers to the fields, inside the message itself
+  const char* fields[FIELD_COUNT_PER_REQ_MESSAGE];
+  int lens[FIELD_COUNT_PER_REQ_MESSAGE];
+  if (!_split_fields(msg, len, fields, lens, FIELD_COUNT_PER_REQ_MESSAGE)) 
   {
-    if (ser->error_cb) 
+    // An EVAL request has a program instead of the two operands
+    int32_t id;
+    if (_split_fields(msg, len, fields, lens, FIELD_COUNT_PER_EVAL_MESSAGE) &&
+        _parse_method(fields[1], lens[1]) == EVAL &&
+        calc_proto_num_parse_int(fields[0], lens[0], &id)) 
     {
-      // Raise error of invalid request error in case of bad context for ID
-      ser->error_cb(ser->context, -1, ERROR_INVALID_REQUEST_ID);
+      _parse_eval_and_notify(ser, id, fields[2], lens[2]);
       return;
     }
+    _notify_error(ser, -1, ERROR_INVALID_REQUEST);
+    return;
   }
 
-  // Update attribute of method (and check if it is valid)
-  req.method = str_to_method(fields[1]);
-  if (req.method == NONE) 
+  // Create and start filling structure of request
+  struct calc_proto_req_t req;
+  req.program = NULL;
+
+  // Update attribute of request id (the number codec doesn't need null terminated fields)
+  if (!calc_proto_num_parse_int(fields[0], lens[0], &req.id)) 
   {
-    if (ser->error_cb) 
-    {
-      // Raise error of invalid request error in case of bad context for method
-      ser->error_cb(ser->context, req.id, ERROR_INVALID_REQUEST_METHOD);
-      return;
-    }
+    _notify_error(ser, -1, ERROR_INVALID_REQUEST_ID);
+    return;
   }
 
-  // Update attributes related with operands
-  if (!_parse_double(fields[2], &req.operand1)) 
+  // Update attribute of method (and check if it is valid)
+  req.method = _parse_method(fields[1], lens[1]);
+  if (req.method == NONE || req.method == EVAL) 
   {
-    if (ser->error_cb) 
-    {
-      // Raise error of invalid request error in case of bad context for operand 1
-      ser->error_cb(ser->context, req.id, ERROR_INVALID_REQUEST_OPERAND1);
-      return;
-    }
+    _notify_error(ser, req.id, ERROR_INVALID_REQUEST_METHOD);
+    return;
   }
-  if (!_parse_double(fields[3], &req.operand2)) 
+
+  // Update attributes related with operands
+  if (!calc_proto_num_parse_double(fields[2], lens[2], &req.operand1)) 
   {
-    if (ser->error_cb) 
-    {
-      // Raise error of invalid request error in case of bad context for operand 1
-      ser->error_cb(ser->context, req.id, ERROR_INVALID_REQUEST_OPERAND2);
-      return;
-    }
+    _notify_error(ser, req.id, ERROR_INVALID_REQUEST_OPERAND1);
+    return;
   }
-
-  // Final check of request
-  if (!ser->req_cb) 
+  if (!calc_proto_num_parse_double(fields[3], lens[3], &req.operand2)) 
   {
-    fprintf(stderr, "Request callback is not set!\n");
+    _notify_error(ser, req.id, ERROR_INVALID_REQUEST_OPERAND2);
     return;
   }
 
-  // Update request in serialization object
-  ser->req_cb(ser->context, req);
+  _notify_req(ser, req);
 }
 
 /**
- * Function that parse and check serialization for a response, while preventing invalid ones.
+ * Private function to check that a status received belongs to the protocol
  * 
- * @param ser Pointer to serializatio object in use.
+ * @param status Status to check
  * 
- * @exception If the context response isn't valid, it exits the program.
+ * @return TRUE if it is one of the STATUS_* values
 */
-void _parse_resp_and_notify(struct calc_proto_ser_t* ser) 
+bool_t _is_valid_status(status_t status) 
 {
-  // Generate array of pointer to char arrays that fits with response fields
-  char* fields[FIELD_COUNT_PER_RESP_MESSAGE];
+  return (status >= STATUS_OK && status <= STATUS_DIV_BY_ZERO) ||
+         status == STATUS_INTERNAL_ERROR;
+}
 
-  // Parse and check responses
-  if (!_parse_fields(ser, fields, FIELD_COUNT_PER_RESP_MESSAGE, ERROR_INVALID_RESPONSE)) 
+/**
+ * Function that parse and check a response, while preventing invalid ones.
+ * 
+ * @param ser Pointer to serializatio object in use.
+ * @param msg Message to parse (without the message delimiter)
+ * @param len Length of the message
+ * 
+ * @exception If the response isn't valid, the error is notified and the function exits
+*/
+void _parse_resp_and_notify(struct calc_proto_ser_t* ser, const char* msg, int len) 
+{
+  // Pointers to the fields, inside the message itself
+  const char* fields[FIELD_COUNT_PER_RESP_MESSAGE];
+  int lens[FIELD_COUNT_PER_RESP_MESSAGE];
+  if (!_split_fields(msg, len, fields, lens, FIELD_COUNT_PER_RESP_MESSAGE)) 
   {
+    _notify_error(ser, -1, ERROR_INVALID_RESPONSE);
     return;
   }
 
@@ -293,129 +370,351 @@ void _parse_resp_and_notify(struct calc_proto_ser_t* ser)
   struct calc_proto_resp_t resp;
 
   // Update attribute of request id
-  if (!_parse_int(fields[0], &resp.req_id)) 
+  if (!calc_proto_num_parse_int(fields[0], lens[0], &resp.req_id)) 
   {
-    if (ser->error_cb) 
-    {
-      // Raise error for invalid response, in case of ID problems
-      ser->error_cb(ser->context, 0, ERROR_INVALID_RESPONSE_REQ_ID);
-      return;
-    }
+    _notify_error(ser, 0, ERROR_INVALID_RESPONSE_REQ_ID);
+    return;
+  }
+
+  // Update attribute of status (and check if it is valid)
+  if (!calc_proto_num_parse_int(fields[1], lens[1], &resp.status) ||
+      !_is_valid_status(resp.status)) 
+  {
+    _notify_error(ser, resp.req_id, ERROR_INVALID_RESPONSE_STATUS);
+    return;
+  }
+
+  // Update attribute of result
+  if (!calc_proto_num_parse_double(fields[2], lens[2], &resp.result)) 
+  {
+    _notify_error(ser, resp.req_id, ERROR_INVALID_RESPONSE_RESULT);
+    return;
+  }
+
+  // Final check to determinate if response is set
+  if (!ser->resp_cb) 
+  {
+    fprintf(stderr, "Response callback is not set!\n");
+    return;
+  }
+  ser->resp_cb(ser->context, resp);
+}
+
+/**
+ * Private function that makes room in msg_buf for a message of the length passed. The buffer
+ * starts small and doubles its size when needed, but it never goes beyond the maximum length of a
+ * message (the callers check that limit before).
+ * 
+ * @param ser Pointer to serialization object in use
+ * @param len Number of characters needed
+*/
+void _reserve_msg_buf(struct calc_proto_ser_t* ser, int len) 
+{
+  if (len <= ser->buf_size) 
+  {
+    return;
   }
+  int size = ser->buf_size;
+  while (size < len) 
+  {
+    size *= 2;
+  }
+  if (size > ser->buf_len) 
+  {
+    size = ser->buf_len;
+  }
+  ser->msg_buf = (char*)realloc(ser->msg_buf, size * sizeof(char));
+  ser->buf_size = size;
+}
+
+/**
+ * Private deserialization function for text messages. The buffer is processed in three steps:
+ * 
+ *  1. The message left incomplete by the previous calls (kept in msg_buf) is completed with the
+ *     bytes up to the first message delimiter.
+ *  2. Every message complete in the buffer is parsed in place, the message delimiters are found
+ *     with memchr, so there is no per byte work besides the scan.
+ *  3. The beginning of the next message (if any) is copied to msg_buf for the next call.
+ * 
+ * So every byte received is scanned once by memchr, and copied at most once (only when its
+ * message is split between two buffers). As the incomplete message is always moved to the
+ * beginning of msg_buf, a message never wraps around the end of the buffer, and the fields can
+ * be parsed as a contiguous array. There is no recursion, and nothing is parsed twice.
+ * 
+ * A message longer than the maximum length is reported as invalid, and its bytes are discarded
+ * until the next message delimiter.
+ * 
+ * @param ser Pointer to serialization object in use
+ * @param buff Buffer that contains the serialized messages.
+ * @param func Pointer to the function that parses a message
+ * @param error_code Error code used for invalid (too long) messages
+ * @param found Boolean flag to check the request/response.
+*/
+void _deserialize(struct calc_proto_ser_t* ser, struct buffer_t buff,
+    parse_and_notify_func_t func, int error_code, bool_t* found) 
+{
+  const char* ptr = buff.data;
+  const char* end = buff.data + buff.len;
+  int max_msg_len = ser->buf_len - 1;
 
-  // Update attribute of status
-  if (!_parse_int(fields[1], &resp.status)) 
+  // 1. Complete the message pending from the previous calls (or keep discarding a long one)
+  if (ser->msg_len > 0 || ser->discarding) 
   {
-    if (ser->error_cb) 
+    const char* delim = memchr(ptr, MESSAGE_DELIMITER, end - ptr);
+    int len = (delim ? delim : end) - ptr;
+    if (!ser->discarding && ser->msg_len + len > max_msg_len) 
     {
-      // Raise error for invalid response, in case of status problems
-      ser->error_cb(ser->context, resp.req_id, ERROR_INVALID_RESPONSE_STATUS);
-      return;
+      _notify_error(ser, -1, error_code);
+      ser->discarding = TRUE;
+      ser->msg_len = 0;
     }
+    if (ser->discarding) 
+    {
+      ser->discarding = delim ? FALSE : TRUE;
+    } 
+    else 
+    {
+      _reserve_msg_buf(ser, ser->msg_len + len);
+      memcpy(ser->msg_buf + ser->msg_len, ptr, len);
+      ser->msg_len += len;
+      if (delim) 
+      {
+        if (found) *found = TRUE;
+        func(ser, ser->msg_buf, ser->msg_len);
+        ser->msg_len = 0;
+      }
+    }
+    ptr = delim ? delim + 1 : end;
   }
 
-  // Check if status is valid to continue
-  if (resp.status > 4) 
+  // 2. Parse in place all the messages that are complete in the buffer
+  const char* delim;
+  while (ptr < end && (delim = memchr(ptr, MESSAGE_DELIMITER, end - ptr)) != NULL) 
   {
-    if (ser->error_cb) 
+    int len = delim - ptr;
+    if (len > max_msg_len) 
     {
-      // Raise error for invalid response, in case of response status
-      ser->error_cb(ser->context, resp.req_id, ERROR_INVALID_RESPONSE_STATUS);
-      return;
+      _notify_error(ser, -1, error_code);
+    } 
+    else if (len > 0) 
+    {
+      if (found) *found = TRUE;
+      func(ser, ptr, len);
     }
+    ptr = delim + 1;
   }
 
-  // Update attribute of result (in case of valid status)
-  if (!_parse_double(fields[2], &resp.result)) 
+  // 3. Keep the beginning of the next message
+  if (ptr < end) 
   {
-    if (ser->error_cb) 
+    int len = end - ptr;
+    if (len > max_msg_len) 
     {
-      // Raise error for invalid response, in case of result problems
-      ser->error_cb(ser->context, resp.req_id, ERROR_INVALID_RESPONSE_RESULT);
-      return;
+      _notify_error(ser, -1, error_code);
+      ser->discarding = TRUE;
+    } 
+    else 
+    {
+      _reserve_msg_buf(ser, len);
+      memcpy(ser->msg_buf, ptr, len);
+      ser->msg_len = len;
     }
   }
 
-  // Final check to determinate if response is set
+  // The requests of this buffer are delivered before returning to the owner
+  _flush_req_batch(ser);
+}
+
+/**
+ * Private helpers to read and write the fixed-width fields of the binary frames, always in network
+ * byte order (big endian), no matter the architecture.
+*/
+void _put_u16(char* dst, uint16_t num) 
+{
+  dst[0] = (char)(num >> 8);
+  dst[1] = (char)num;
+}
+
+void _put_u32(char* dst, uint32_t num) 
+{
+  for (int i = 3; i >= 0; i--, num >>= 8) dst[i] = (char)num;
+}
+
+void _put_double(char* dst, double num) 
+{
+  uint64_t bits;
+  memcpy(&bits, &num, sizeof(bits));
+  for (int i = 7; i >= 0; i--, bits >>= 8) dst[i] = (char)bits;
+}
+
+uint16_t _get_u16(const char* src) 
+{
+  return (uint16_t)(((unsigned char)src[0] << 8) | (unsigned char)src[1]);
+}
+
+uint32_t _get_u32(const char* src) 
+{
+  uint32_t num = 0;
+  for (int i = 0; i < 4; i++) num = (num << 8) | (unsigned char)src[i];
+  return num;
+}
+
+double _get_double(const char* src) 
+{
+  uint64_t bits = 0;
+  for (int i = 0; i < 8; i++) bits = (bits << 8) | (unsigned char)src[i];
+  double num;
+  memcpy(&num, &bits, sizeof(num));
+  return num;
+}
+
+/**
+ * Function that parses the payload of a binary request frame and notifies it.
+ * 
+ * @param ser Pointer to the serialization object in use.
+ * @param payload Pointer to the payload (after the length prefix)
+ * @param len Length of the payload
+*/
+void _parse_req_frame_and_notify(struct calc_proto_ser_t* ser, const char* payload, int len) 
+{
+  // The program of an EVAL request follows the method, it is compiled like the text ones
+  if (len > BINARY_EVAL_HEADER && (unsigned char)payload[4] == EVAL) 
+  {
+    _parse_eval_and_notify(ser, (int32_t)_get_u32(payload), payload + BINARY_EVAL_HEADER,
+        len - BINARY_EVAL_HEADER);
+    return;
+  }
+  if (len != BINARY_REQ_PAYLOAD) 
+  {
+    _notify_error(ser, -1, ERROR_INVALID_REQUEST);
+    return;
+  }
+
+  struct calc_proto_req_t req;
+  req.program = NULL;
+  req.id = (int32_t)_get_u32(payload);
+  req.method = (method_t)(unsigned char)payload[4];
+  if (req.method == NONE || req.method > DIV) 
+  {
+    _notify_error(ser, req.id, ERROR_INVALID_REQUEST_METHOD);
+    return;
+  }
+  req.operand1 = _get_double(payload + 5);
+  req.operand2 = _get_double(payload + 13);
+
+  _notify_req(ser, req);
+}
+
+/**
+ * Function that parses the payload of a binary response frame and notifies it.
+ * 
+ * @param ser Pointer to the serialization object in use.
+ * @param payload Pointer to the payload (after the length prefix)
+ * @param len Length of the payload
+*/
+void _parse_resp_frame_and_notify(struct calc_proto_ser_t* ser, const char* payload, int len) 
+{
+  if (len != BINARY_RESP_PAYLOAD) 
+  {
+    _notify_error(ser, -1, ERROR_INVALID_RESPONSE);
+    return;
+  }
+
+  struct calc_proto_resp_t resp;
+  resp.req_id = (int32_t)_get_u32(payload);
+  resp.status = (unsigned char)payload[4];
+  if (!_is_valid_status(resp.status)) 
+  {
+    _notify_error(ser, resp.req_id, ERROR_INVALID_RESPONSE_STATUS);
+    return;
+  }
+  resp.result = _get_double(payload + 5);
+
   if (!ser->resp_cb) 
   {
     fprintf(stderr, "Response callback is not set!\n");
     return;
   }
-
-  // Update response in serialization object
   ser->resp_cb(ser->context, resp);
 }
 
 /**
- * Private deserialization function
+ * Private deserialization function for binary frames. The frames complete in the buffer are
+ * parsed in place, only the frames that arrive in several parts are copied to the frame buffer
+ * of the serialization object.
  * 
  * @param ser Pointer to serialization object in use
- * @param buff Buffer that contains the serialized message.
- * @param func Pointer to the function paser_and_notify_func_t
- * @param error_code Feed a error code to consider
- * @param found Boolean flag to check the request.
+ * @param buff Buffer with the bytes received.
+ * @param func Pointer to the function that parses the payload of a frame
+ * @param error_code Error code used for invalid frames
+ * @param found Boolean flag to check the request/response.
 */
-void _deserialize(struct calc_proto_ser_t* ser, struct buffer_t buff,
+void _deserialize_frames(struct calc_proto_ser_t* ser, struct buffer_t buff,
     parse_and_notify_func_t func, int error_code, bool_t* found) 
 {
-  // Check if size of buffer is longer that the expected
-  if (buff.len > ser->buf_len) 
-  {
-      if (ser->error_cb) 
-      {
-        ser->error_cb(ser->context, -1, error_code);
-      }
-      return;
-  }
-
-  // Iteration to check overflow
-  bool_t overflow = FALSE;
   int i = 0;
-  for (; i < buff.len; i++) 
+  while (i < buff.len) 
   {
-    // Update value with buffer
-    ser->ring_buf[ser->curr_idx] = buff.data[i];
+    int avail = buff.len - i;
 
-    // Check if start index is less than the initial position
-    if (_is_buffer_full(ser)) 
+    // Discard the rest of a frame that was too long
+    if (ser->frame_skip > 0) 
     {
-      if (ser->error_cb) 
-      {
-        ser->error_cb(ser->context, -1, error_code);
-      }
-      overflow = TRUE;
-      ser->curr_idx = 0;
-      ser->start_idx = -1;
-      break;
+      int skipped = avail < ser->frame_skip ? avail : ser->frame_skip;
+      ser->frame_skip -= skipped;
+      i += skipped;
+      continue;
     }
-    // Check if it is end of message
-    if (ser->ring_buf[ser->curr_idx] == MESSAGE_DELIMITER &&
-        ser->start_idx >= 0) 
+
+    // Fast path, the whole frame is in the buffer
+    if (ser->frame_len == 0 && avail >= BINARY_LEN_PREFIX) 
     {
-      // Update status of request/response found, then parse and notify
-      if (found) 
+      int payload_len = _get_u16(buff.data + i);
+      if (payload_len > BINARY_MAX_PAYLOAD) 
       {
-        *found = TRUE;
+        _notify_error(ser, -1, error_code);
+        ser->frame_skip = payload_len;
+        i += BINARY_LEN_PREFIX;
+        continue;
       }
-      func(ser);
-      ser->start_idx = -1;
-    } 
-    else if (ser->ring_buf[ser->curr_idx] != MESSAGE_DELIMITER &&
-               ser->start_idx < 0)
+      if (avail >= BINARY_LEN_PREFIX + payload_len) 
+      {
+        if (found) *found = TRUE;
+        func(ser, buff.data + i + BINARY_LEN_PREFIX, payload_len);
+        i += BINARY_LEN_PREFIX + payload_len;
+        continue;
+      }
+    }
+
+    // Partial frame, keep the bytes until it is complete
+    int needed = BINARY_LEN_PREFIX - ser->frame_len;
+    if (ser->frame_len >= BINARY_LEN_PREFIX) 
     {
-      ser->start_idx = ser->curr_idx;
+      needed = BINARY_LEN_PREFIX + _get_u16(ser->frame) - ser->frame_len;
     }
-    ser->curr_idx++;
-    if (ser->curr_idx == ser->buf_len) 
+    int copied = avail < needed ? avail : needed;
+    memcpy(ser->frame + ser->frame_len, buff.data + i, copied);
+    ser->frame_len += copied;
+    i += copied;
+
+    if (ser->frame_len >= BINARY_LEN_PREFIX) 
     {
-      ser->curr_idx = 0;
+      int payload_len = _get_u16(ser->frame);
+      if (payload_len > BINARY_MAX_PAYLOAD) 
+      {
+        _notify_error(ser, -1, error_code);
+        ser->frame_skip = payload_len;
+        ser->frame_len = 0;
+      } 
+      else if (ser->frame_len == BINARY_LEN_PREFIX + payload_len) 
+      {
+        if (found) *found = TRUE;
+        func(ser, ser->frame + BINARY_LEN_PREFIX, payload_len);
+        ser->frame_len = 0;
+      }
     }
   }
-  if (overflow) 
-  {
-    _deserialize(ser, buff, func, error_code, found);
-  }
+  _flush_req_batch(ser);
 }
 
 /**
@@ -443,21 +742,32 @@ void calc_proto_ser_delete(struct calc_proto_ser_t* ser)
  * 
  * @param ser Serialization object in use
  * @param context Generic pointer that specifies context (related with req/res)
- * @param ring_buffer_size Define buffer size (num of character)
+ * @param ring_buffer_size Maximum buffer size (num of character), a message can be one character
+ *                         shorter than this. The buffer grows up to this size only if messages
+ *                         received in parts need it.
 */
 void calc_proto_ser_ctor(struct calc_proto_ser_t* ser, void* context, int ring_buffer_size) 
 {
+  // The buffer is only needed for messages received in parts, so it starts small
   ser->buf_len = ring_buffer_size;
-  ser->ring_buf = (char*)malloc(ser->buf_len * sizeof(char));
+  ser->buf_size = ser->buf_len < MSG_BUF_INITIAL_SIZE ? ser->buf_len : MSG_BUF_INITIAL_SIZE;
+  ser->msg_buf = (char*)malloc(ser->buf_size * sizeof(char));
 
-  ser->curr_idx = 0;
-  ser->start_idx = -1;
+  ser->msg_len = 0;
+  ser->discarding = FALSE;
 
   ser->req_cb = NULL;
+  ser->req_batch_cb = NULL;
+  ser->batch_len = 0;
+  ser->programs = NULL;
   ser->resp_cb = NULL;
   ser->error_cb = NULL;
 
   ser->context = context;
+
+  ser->mode = CALC_PROTO_TEXT;
+  ser->frame_len = 0;
+  ser->frame_skip = 0;
 }
 
 /**
@@ -467,7 +777,25 @@ void calc_proto_ser_ctor(struct calc_proto_ser_t* ser, void* context, int ring_b
 */
 void calc_proto_ser_dtor(struct calc_proto_ser_t* ser) 
 {
-  free(ser->ring_buf);
+  free(ser->msg_buf);
+  free(ser->programs);
+}
+
+/**
+ * Reset the serialization object as if it was just constructed (text format, no message received
+ * in parts, no requests waiting), but keeping its buffer, context and callbacks. Useful for servers
+ * that reuse the same objects for different clients instead of reserving new ones.
+ * 
+ * @param ser Pointer to serialization object in use.
+*/
+void calc_proto_ser_reset(struct calc_proto_ser_t* ser) 
+{
+  ser->msg_len = 0;
+  ser->discarding = FALSE;
+  ser->batch_len = 0;
+  ser->mode = CALC_PROTO_TEXT;
+  ser->frame_len = 0;
+  ser->frame_skip = 0;
 }
 
 /**
@@ -512,6 +840,45 @@ void calc_proto_ser_set_error_callback(struct calc_proto_ser_t* ser, error_cb_t
 {
   ser->error_cb = error_cb;
 }
+
+/**
+ * Setter for the batch request callback. When it is set, the requests deserialized from a buffer
+ * are delivered together (up to CALC_PROTO_MAX_BATCH per call) instead of one by one through the
+ * request callback.
+ * 
+ * @param ser Pointer to serialization object in use
+ * @param req_batch_cb Callback that receives the batches (NULL to go back to the request callback)
+*/
+void calc_proto_ser_set_req_batch_callback(struct calc_proto_ser_t* ser,
+    req_batch_cb_t req_batch_cb) 
+{
+  _flush_req_batch(ser);
+  ser->req_batch_cb = req_batch_cb;
+}
+
+/**
+ * Setter for the wire format (text messages by default)
+ * 
+ * @param ser Pointer to serialization object in use
+ * @param mode Format used to serialize and deserialize from now on
+*/
+void calc_proto_ser_set_mode(struct calc_proto_ser_t* ser, calc_proto_mode_t mode) 
+{
+  ser->mode = mode;
+}
+
+/**
+ * Getter for the wire format
+ * 
+ * @param ser Pointer to serialization object in use
+ * 
+ * @return Format in use
+*/
+calc_proto_mode_t calc_proto_ser_get_mode(struct calc_proto_ser_t* ser) 
+{
+  return ser->mode;
+}
+
 /**
  * Function for response deserialization
  * 
@@ -530,38 +897,83 @@ void calc_proto_ser_server_deserialize(
     *req_found = FALSE;
   }
 
-  // Deserialization process by
+  // Deserialization process according to the wire format
+  if (ser->mode == CALC_PROTO_BINARY) 
+  {
+    _deserialize_frames(ser, buff, _parse_req_frame_and_notify,
+            ERROR_INVALID_REQUEST, req_found);
+    return;
+  }
   _deserialize(ser, buff, _parse_req_and_notify,
           ERROR_INVALID_REQUEST, req_found);
 }
 
+/**
+ * Function for response serialization into a buffer provided by the caller, so no memory is
+ * reserved in the process (the caller can use the stack or a buffer reused between messages).
+ * 
+ * @param ser Pointer to serialization object in use.
+ * @param resp Pointer to a response object that needs to be serialized.
+ * @param dst Destination where the message is written (text messages are null terminated)
+ * @param cap Number of characters available in the destination
+ * 
+ * @return Length of the serialized message, or -1 if it doesn't fit in the destination.
+*/
+int calc_proto_ser_server_serialize_to(
+    struct calc_proto_ser_t* ser,
+    const struct calc_proto_resp_t* resp,
+    char* dst,
+    int cap) 
+{
+  if (ser->mode == CALC_PROTO_BINARY) 
+  {
+    if (cap < BINARY_LEN_PREFIX + BINARY_RESP_PAYLOAD) 
+    {
+      return -1;
+    }
+    _put_u16(dst, BINARY_RESP_PAYLOAD);
+    _put_u32(dst + 2, (uint32_t)resp->req_id);
+    dst[6] = (char)resp->status;
+    _put_double(dst + 7, resp->result);
+    return BINARY_LEN_PREFIX + BINARY_RESP_PAYLOAD;
+  }
+
+  // Append every field with the number codec (no format string to interpret, no locale)
+  int len = _append_int(dst, cap, 0, resp->req_id);
+  len = _append_char(dst, cap, len, FIELD_DELIMITER);
+  len = _append_int(dst, cap, len, (int32_t)resp->status);
+  len = _append_char(dst, cap, len, FIELD_DELIMITER);
+  len = _append_double(dst, cap, len, resp->result);
+  len = _append_char(dst, cap, len, MESSAGE_DELIMITER);
+  return _terminate(dst, cap, len);
+}
+
 /**
  * Function for response serialization
  * 
+ * NOTE: The buffer returned is allocated on the heap, and it must be freed by the caller, so
+ * prefer calc_proto_ser_server_serialize_to on hot paths.
+ * 
  * @param ser Pointer to serialization object in use.
  * @param resp Pointer to a response objectec that needs to be serialized.
  * 
- * @return Serialized message that implements the message and field delimitator.
+ * @return Serialized message that implements the message and field delimitator (len is zero if
+ *         the message couldn't be serialized).
 */
 struct buffer_t calc_proto_ser_server_serialize(
     struct calc_proto_ser_t* ser,
     const struct calc_proto_resp_t* resp) 
 {
-    // Create buffer
+    // Create buffer and reserve memory
     struct buffer_t buff;
-    char resp_result_str[64];
-    
-    // Get response and reserve memory (use private function for double serialization)
-    _serialize_double(resp_result_str, resp->result);
-    buff.data = (char*)malloc(64 * sizeof(char));
-
-    // Sends string (formatted) by using a pointer (like a print that goes to a str)
-    sprintf(buff.data, "%d%c%d%c%s%c", resp->req_id,
-            FIELD_DELIMITER, (int)resp->status, FIELD_DELIMITER,
-      resp_result_str, MESSAGE_DELIMITER);
-
-    // Update length
-    buff.len = strlen(buff.data);
+    buff.data = (char*)malloc(CALC_PROTO_MAX_MSG_LEN * sizeof(char));
+    buff.len = calc_proto_ser_server_serialize_to(ser, resp, buff.data,
+            CALC_PROTO_MAX_MSG_LEN);
+    if (buff.len < 0) 
+    {
+      buff.data[0] = '\0';
+      buff.len = 0;
+    }
     return buff;
 }
 
@@ -580,41 +992,134 @@ void calc_proto_ser_client_deserialize(
   {
     *resp_found = FALSE;
   }
+  if (ser->mode == CALC_PROTO_BINARY) 
+  {
+    _deserialize_frames(ser, buff, _parse_resp_frame_and_notify,
+            ERROR_INVALID_RESPONSE, resp_found);
+    return;
+  }
   _deserialize(ser, buff, _parse_resp_and_notify,
           ERROR_INVALID_RESPONSE, resp_found);
 }
 
+/**
+ * Private function for the serialization of an EVAL request, its program is written as text after
+ * the method (in both formats).
+ * 
+ * @param ser Pointer to serialization object in use
+ * @param req Pointer to the request, with its compiled program
+ * @param dst Destination where the message is written
+ * @param cap Number of characters available in the destination
+ * 
+ * @return Length of the serialized message, or -1 if it doesn't fit in the destination.
+*/
+int _serialize_eval_to(struct calc_proto_ser_t* ser, const struct calc_proto_req_t* req,
+    char* dst, int cap) 
+{
+  if (ser->mode == CALC_PROTO_BINARY) 
+  {
+    int header = BINARY_LEN_PREFIX + BINARY_EVAL_HEADER;
+    int room = BINARY_MAX_PAYLOAD - BINARY_EVAL_HEADER;
+    if (cap - header < room) 
+    {
+      room = cap - header;
+    }
+    int len = room < 0 ? -1 : calc_proto_prog_print(req->program, dst + header, room);
+    if (len < 0) 
+    {
+      return -1;
+    }
+    _put_u16(dst, BINARY_EVAL_HEADER + len);
+    _put_u32(dst + 2, (uint32_t)req->id);
+    dst[6] = (char)EVAL;
+    return header + len;
+  }
+
+  int len = _append_int(dst, cap, 0, req->id);
+  len = _append_char(dst, cap, len, FIELD_DELIMITER);
+  len = _append_str(dst, cap, len, method_to_str(EVAL));
+  len = _append_char(dst, cap, len, FIELD_DELIMITER);
+  if (len >= 0) 
+  {
+    int written = calc_proto_prog_print(req->program, dst + len, cap - len);
+    len = written < 0 ? -1 : len + written;
+  }
+  len = _append_char(dst, cap, len, MESSAGE_DELIMITER);
+  return _terminate(dst, cap, len);
+}
+
+/**
+ * Function for serialization of a request into a buffer provided by the caller, so no memory is
+ * reserved in the process.
+ * 
+ * @param ser Pointer to serialization object in use
+ * @param req Pointer to request made
+ * @param dst Destination where the message is written (text messages are null terminated)
+ * @param cap Number of characters available in the destination
+ * 
+ * @return Length of the serialized message, or -1 if it doesn't fit in the destination.
+*/
+int calc_proto_ser_client_serialize_to(
+    struct calc_proto_ser_t* ser,
+    const struct calc_proto_req_t* req,
+    char* dst,
+    int cap) 
+{
+  if (req->method == EVAL) 
+  {
+    return _serialize_eval_to(ser, req, dst, cap);
+  }
+  if (ser->mode == CALC_PROTO_BINARY) 
+  {
+    if (cap < BINARY_LEN_PREFIX + BINARY_REQ_PAYLOAD) 
+    {
+      return -1;
+    }
+    _put_u16(dst, BINARY_REQ_PAYLOAD);
+    _put_u32(dst + 2, (uint32_t)req->id);
+    dst[6] = (char)req->method;
+    _put_double(dst + 7, req->operand1);
+    _put_double(dst + 15, req->operand2);
+    return BINARY_LEN_PREFIX + BINARY_REQ_PAYLOAD;
+  }
+
+  // Append every field with the number codec (no format string to interpret, no locale)
+  int len = _append_int(dst, cap, 0, req->id);
+  len = _append_char(dst, cap, len, FIELD_DELIMITER);
+  len = _append_str(dst, cap, len, method_to_str(req->method));
+  len = _append_char(dst, cap, len, FIELD_DELIMITER);
+  len = _append_double(dst, cap, len, req->operand1);
+  len = _append_char(dst, cap, len, FIELD_DELIMITER);
+  len = _append_double(dst, cap, len, req->operand2);
+  len = _append_char(dst, cap, len, MESSAGE_DELIMITER);
+  return _terminate(dst, cap, len);
+}
+
 /**
  * Function for serialization of message that follows base structure.
  * 
+ * NOTE: The buffer returned is allocated on the heap, and it must be freed by the caller, so
+ * prefer calc_proto_ser_client_serialize_to on hot paths.
+ * 
  * @param ser Pointer to serialization object in use
  * @param req Pointer to request made
  * 
- * @return Buffer object that includes serialized message
+ * @return Buffer object that includes serialized message (len is zero if the message couldn't be
+ *         serialized).
 */
 struct buffer_t calc_proto_ser_client_serialize(
     struct calc_proto_ser_t* ser,
     const struct calc_proto_req_t* req) 
 {
-  // Base declaration
+  // Manual allocation for string with max of CALC_PROTO_MAX_MSG_LEN characters
   struct buffer_t buff;
-  char req_op1_str[64];
-  char req_op2_str[64];
-
-  // Convert double values to valid strings for serialization
-  _serialize_double(req_op1_str, req->operand1);
-  _serialize_double(req_op2_str, req->operand2);
-
-  // Manual allocation for string with max of 64 characters
-  buff.data = (char*)malloc(64 * sizeof(char));
-
-  // Update formatted string to generate serialization with the proper structure
-  sprintf(buff.data, "%d%c%s%c%s%c%s%c", req->id, FIELD_DELIMITER,
-          method_to_str(req->method), FIELD_DELIMITER,
-          req_op1_str, FIELD_DELIMITER, req_op2_str,
-          MESSAGE_DELIMITER);
-
-  // Update buffer and return
-  buff.len = strlen(buff.data);
+  buff.data = (char*)malloc(CALC_PROTO_MAX_MSG_LEN * sizeof(char));
+  buff.len = calc_proto_ser_client_serialize_to(ser, req, buff.data,
+          CALC_PROTO_MAX_MSG_LEN);
+  if (buff.len < 0) 
+  {
+    buff.data[0] = '\0';
+    buff.len = 0;
+  }
   return buff;
 }
@@ -37,6 +37,35 @@
 
 #define ERROR_UNKNOWN  220
 
+// Upper bound (including the terminating null character) for a serialized message. Callers that
+// provide their own output buffer should reserve at least this amount of characters.
+#define CALC_PROTO_MAX_MSG_LEN 64
+
+/**
+ * Besides the text messages, the serializer can use binary frames, which don't need delimiter
+ * scanning nor string to number conversions. Every frame is length-prefixed, and the fields have a
+ * fixed width (all of them in network byte order, doubles are sent as their raw IEEE 754 bits):
+ * 
+ *    Request:  <len:u16 = 21><id:i32><method:u8><operand1:f64><operand2:f64>
+ *    Response: <len:u16 = 13><req_id:i32><status:u8><result:f64>
+ * 
+ * The EVAL requests are the only ones of variable length, their program follows the method (see
+ * calc_proto_prog.h).
+ * 
+ * The format is negotiated per connection: a client that wants binary frames sends the byte
+ * CALC_PROTO_BINARY_HELLO first (it can't start a text message), and the server answers with the
+ * same byte before the first response. Clients that don't send it keep using the text format.
+*/
+typedef enum {
+  CALC_PROTO_TEXT,   // <id>#<method>#<op1>#<op2>$
+  CALC_PROTO_BINARY  // Length-prefixed frames
+} calc_proto_mode_t;
+
+#define CALC_PROTO_BINARY_HELLO 0xCB
+
+// Maximum number of requests delivered in a single call of the batch request callback
+#define CALC_PROTO_MAX_BATCH 64
+
 // Struct that corresponds to the serialization of a message, saved as a text buffer.
 struct buffer_t {
   char* data;
@@ -50,6 +79,13 @@ typedef void (*req_cb_t)(
         void* owner_obj,
         struct calc_proto_req_t);
 
+// Batch request callback, it receives all the requests found in a buffer at once (the array is
+// only valid during the call). Useful for pipelined clients, that send many requests per read.
+typedef void (*req_batch_cb_t)(
+        void* owner_obj,
+        const struct calc_proto_req_t* reqs,
+        int count);
+
 typedef void (*resp_cb_t)(
         void* owner_obj,
         struct calc_proto_resp_t);
@@ -73,6 +109,10 @@ void calc_proto_ser_ctor(
 void calc_proto_ser_dtor(
         struct calc_proto_ser_t* ser);
 
+// Reset of the deserialization state, so the object can be reused for another client
+void calc_proto_ser_reset(
+        struct calc_proto_ser_t* ser);
+
 
 // Methods related with the serialization
 void* calc_proto_ser_get_context(
@@ -80,12 +120,20 @@ void* calc_proto_ser_get_context(
 void calc_proto_ser_set_req_callback(
         struct calc_proto_ser_t* ser,
         req_cb_t cb);
+void calc_proto_ser_set_req_batch_callback(
+        struct calc_proto_ser_t* ser,
+        req_batch_cb_t cb);
 void calc_proto_ser_set_resp_callback(
         struct calc_proto_ser_t* ser,
         resp_cb_t cb);
 void calc_proto_ser_set_error_callback(
         struct calc_proto_ser_t* ser,
         error_cb_t cb);
+void calc_proto_ser_set_mode(
+        struct calc_proto_ser_t* ser,
+        calc_proto_mode_t mode);
+calc_proto_mode_t calc_proto_ser_get_mode(
+        struct calc_proto_ser_t* ser);
 void calc_proto_ser_server_deserialize(
         struct calc_proto_ser_t* ser,
         struct buffer_t buffer,
@@ -94,6 +142,11 @@ void calc_proto_ser_server_deserialize(
 struct buffer_t calc_proto_ser_server_serialize(
         struct calc_proto_ser_t* ser,
         const struct calc_proto_resp_t* resp);
+int calc_proto_ser_server_serialize_to(
+        struct calc_proto_ser_t* ser,
+        const struct calc_proto_resp_t* resp,
+        char* dst,
+        int cap);
 void calc_proto_ser_client_deserialize(
         struct calc_proto_ser_t* ser,
         struct buffer_t buffer,
@@ -101,5 +154,10 @@ void calc_proto_ser_client_deserialize(
 struct buffer_t calc_proto_ser_client_serialize(
         struct calc_proto_ser_t* ser,
         const struct calc_proto_req_t* req);
+int calc_proto_ser_client_serialize_to(
+        struct calc_proto_ser_t* ser,
+        const struct calc_proto_req_t* req,
+        char* dst,
+        int cap);
 
 #endif
@@ -1,5 +1,7 @@
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <math.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stddef.h>
@@ -7,6 +9,8 @@
 #include <cmocka.h>
 
 #include <calc_proto_ser.h>
+#include <calc_proto_num.h>
+#include <calc_proto_prog.h>
 
 #define TRUE 1
 #define FALSE 0
@@ -19,11 +23,15 @@ int expected_status;
 bool_t err_cb_called;
 bool_t req_cb_called;
 bool_t resp_cb_called;
+int req_cb_count;
+int batch_cb_count;
+int expected_batch_before_error = -1;
 
 struct calc_proto_ser_t* ser = NULL;
 
 void req_cb(void* context, struct calc_proto_req_t req) {
   req_cb_called = TRUE;
+  req_cb_count++;
   assert_int_equal(req.id, 1300);
   assert_int_equal(req.method, GETMEM);
   assert_float_equal(req.operand1, -12.302, 0.01);
@@ -37,8 +45,19 @@ void resp_cb(void* context, struct calc_proto_resp_t resp) {
   assert_float_equal(resp.result, -104.891, 0.01);
 }
 
+void req_batch_cb(void* context, const struct calc_proto_req_t* reqs, int count) {
+  assert_true(count > 0 && count <= CALC_PROTO_MAX_BATCH);
+  batch_cb_count++;
+  for (int i = 0; i < count; i++) {
+    req_cb(context, reqs[i]);
+  }
+}
+
 void error_cb(void* context, int ref_id, int error_code) {
   err_cb_called = TRUE;
+  if (expected_batch_before_error >= 0) {
+    assert_int_equal(req_cb_count, expected_batch_before_error);
+  }
   assert_int_equal(error_code, expected_error_code);
 }
 
@@ -358,6 +377,585 @@ void calc_client_serialize_request(void** state) {
   free(buf.data);
 }
 
+void calc_server_serialize_response_to(void** state) {
+  calc_proto_ser_ctor(ser, NULL, 32);
+  struct calc_proto_resp_t resp;
+  resp.req_id = 153;
+  resp.status = STATUS_INVALID_METHOD;
+  resp.result = -90.5613;
+  char out[CALC_PROTO_MAX_MSG_LEN];
+  int len = calc_proto_ser_server_serialize_to(ser, &resp, out, sizeof(out));
+  assert_int_equal(len, strlen("153#2#-90.5613$"));
+  assert_string_equal(out, "153#2#-90.5613$");
+}
+
+void calc_server_serialize_response_to__truncated(void** state) {
+  calc_proto_ser_ctor(ser, NULL, 32);
+  struct calc_proto_resp_t resp;
+  resp.req_id = 153;
+  resp.status = STATUS_OK;
+  resp.result = -90.5613;
+  char out[CALC_PROTO_MAX_MSG_LEN];
+  assert_int_equal(calc_proto_ser_server_serialize_to(ser, &resp, out, 8), -1);
+  resp.result = -1.2345678901234567e-300;
+  assert_int_equal(calc_proto_ser_server_serialize_to(ser, &resp, out, 24), -1);
+}
+
+void calc_client_serialize_request_to(void** state) {
+  calc_proto_ser_ctor(ser, NULL, 32);
+  struct calc_proto_req_t req;
+  req.id = 153;
+  req.method = SUBM;
+  req.operand1 = 102.34;
+  req.operand2 = -3.4409;
+  char out[CALC_PROTO_MAX_MSG_LEN];
+  int len = calc_proto_ser_client_serialize_to(ser, &req, out, sizeof(out));
+  assert_int_equal(len, strlen("153#SUBM#102.34#-3.4409$"));
+  assert_string_equal(out, "153#SUBM#102.34#-3.4409$");
+  assert_int_equal(calc_proto_ser_client_serialize_to(ser, &req, out, len), -1);
+}
+
+void calc_server_deserialize__many_requests(void** state) {
+  calc_proto_ser_ctor(ser, NULL, 32);
+  char req[] = "1300#GETMEM#-12.302#45.3$";
+  calc_proto_ser_set_req_callback(ser, req_cb);
+  req_cb_count = 0;
+  for (int i = 0; i < 50; i++) {
+    // Different split points, so the requests land everywhere in the buffer
+    int split = i % (sizeof(req) - 1);
+    struct buffer_t buf;
+    buf.data = req;
+    buf.len = split;
+    calc_proto_ser_server_deserialize(ser, buf, NULL);
+    buf.data = req + split;
+    buf.len = strlen(req) - split;
+    calc_proto_ser_server_deserialize(ser, buf, NULL);
+  }
+  assert_int_equal(req_cb_count, 50);
+}
+
+void calc_server_deserialize__batch(void** state) {
+  calc_proto_ser_ctor(ser, NULL, 32);
+  calc_proto_ser_set_req_batch_callback(ser, req_batch_cb);
+  calc_proto_ser_set_error_callback(ser, error_cb);
+
+  // 100 pipelined requests in a single buffer, and the last one split with the next buffer
+  char reqs[100 * 32];
+  int len = 0;
+  for (int i = 0; i < 100; i++) {
+    len += sprintf(reqs + len, "1300#GETMEM#-12.302#45.3$");
+  }
+  req_cb_count = 0;
+  batch_cb_count = 0;
+  err_cb_called = FALSE;
+  struct buffer_t buf;
+  buf.data = reqs;
+  buf.len = len - 3;
+  calc_proto_ser_server_deserialize(ser, buf, NULL);
+  assert_int_equal(req_cb_count, 99);
+  assert_int_equal(batch_cb_count, 2); // CALC_PROTO_MAX_BATCH (64) + 35
+
+  buf.data = reqs + len - 3;
+  buf.len = 3;
+  calc_proto_ser_server_deserialize(ser, buf, NULL);
+  assert_int_equal(req_cb_count, 100);
+  assert_int_equal(batch_cb_count, 3);
+  assert_false(err_cb_called);
+}
+
+void calc_server_deserialize__batch_with_errors(void** state) {
+  calc_proto_ser_ctor(ser, NULL, 32);
+  char reqs[] = "1300#GETMEM#-12.302#45.3$1300#GETMEM#-12.302#45.3$1300#BAD#1#2$"
+                "1300#GETMEM#-12.302#45.3$";
+  calc_proto_ser_set_req_batch_callback(ser, req_batch_cb);
+  calc_proto_ser_set_error_callback(ser, error_cb);
+  req_cb_count = 0;
+  batch_cb_count = 0;
+  expected_error_code = ERROR_INVALID_REQUEST_METHOD;
+
+  // The requests before the error are delivered before it, and the rest after it
+  expected_batch_before_error = 2;
+  struct buffer_t buf;
+  buf.data = reqs;
+  buf.len = strlen(reqs);
+  calc_proto_ser_server_deserialize(ser, buf, NULL);
+  assert_int_equal(req_cb_count, 3);
+  assert_int_equal(batch_cb_count, 2);
+  expected_batch_before_error = -1;
+}
+
+// Events notified by the deserializer, recorded to compare two runs of the fuzz test
+struct fuzz_event_t {
+  int is_error;
+  int id;
+  int code;
+  double operand1;
+  double operand2;
+};
+
+struct fuzz_event_t fuzz_events[4096];
+int fuzz_event_count;
+
+void fuzz_req_cb(void* context, struct calc_proto_req_t req) {
+  assert_true(fuzz_event_count < 4096);
+  struct fuzz_event_t* ev = &fuzz_events[fuzz_event_count++];
+  ev->is_error = FALSE;
+  ev->id = req.id;
+  ev->code = req.method;
+  ev->operand1 = req.operand1;
+  ev->operand2 = req.operand2;
+}
+
+void fuzz_error_cb(void* context, int ref_id, int error_code) {
+  assert_true(fuzz_event_count < 4096);
+  struct fuzz_event_t* ev = &fuzz_events[fuzz_event_count++];
+  memset(ev, 0, sizeof(*ev));
+  ev->is_error = TRUE;
+  ev->id = ref_id;
+  ev->code = error_code;
+}
+
+int fuzz_feed(const char* stream, int len, int max_chunk, struct fuzz_event_t* events) {
+  struct calc_proto_ser_t* fuzz_ser = calc_proto_ser_new();
+  calc_proto_ser_ctor(fuzz_ser, NULL, 128);
+  calc_proto_ser_set_req_callback(fuzz_ser, fuzz_req_cb);
+  calc_proto_ser_set_error_callback(fuzz_ser, fuzz_error_cb);
+  fuzz_event_count = 0;
+  int offset = 0;
+  while (offset < len) {
+    struct buffer_t buf;
+    buf.data = (char*)stream + offset;
+    buf.len = 1 + rand() % max_chunk;
+    if (buf.len > len - offset) buf.len = len - offset;
+    calc_proto_ser_server_deserialize(fuzz_ser, buf, NULL);
+    offset += buf.len;
+  }
+  memcpy(events, fuzz_events, fuzz_event_count * sizeof(struct fuzz_event_t));
+  calc_proto_ser_dtor(fuzz_ser);
+  calc_proto_ser_delete(fuzz_ser);
+  return fuzz_event_count;
+}
+
+void calc_server_deserialize__fuzz(void** state) {
+  // Random messages: valid ones, invalid ones and some longer than the buffer (128 characters)
+  static char stream[1 << 18];
+  static struct fuzz_event_t expected[4096];
+  static struct fuzz_event_t actual[4096];
+  const char* methods[] = {"ADD", "SUBM", "GETMEM", "XX", ""};
+  srand(2024);
+  for (int round = 0; round < 20; round++) {
+    int len = 0;
+    int valid = 0;
+    for (int i = 0; i < 150; i++) {
+      int kind = rand() % 10;
+      if (kind < 6) {
+        len += sprintf(stream + len, "%d#%s#%d.%d#-%de%d$", i, methods[rand() % 3],
+            rand() % 100000, rand() % 1000, rand() % 1000, rand() % 20);
+        valid++;
+      } else if (kind == 6) {
+        len += sprintf(stream + len, "%d#%s#1#2$", i, methods[3 + rand() % 2]);
+      } else if (kind == 7) {
+        len += sprintf(stream + len, "%d#ADD#1#2#3$", i);
+      } else if (kind == 8) {
+        len += sprintf(stream + len, "%d#ADD#1.%0150d#2$", i, 0);
+      } else {
+        len += sprintf(stream + len, "$$");
+      }
+    }
+
+    // The whole stream at once is the reference, then any split must give the same events
+    int expected_count = fuzz_feed(stream, len, len, expected);
+    int reqs = 0;
+    for (int i = 0; i < expected_count; i++) reqs += !expected[i].is_error;
+    assert_int_equal(reqs, valid);
+    int max_chunks[] = {1, 2, 7, 64, 300};
+    for (int c = 0; c < 5; c++) {
+      int actual_count = fuzz_feed(stream, len, max_chunks[c], actual);
+      assert_int_equal(actual_count, expected_count);
+      assert_memory_equal(actual, expected, expected_count * sizeof(struct fuzz_event_t));
+    }
+  }
+}
+
+void calc_server_deserialize__growing_buffer(void** state) {
+  calc_proto_ser_ctor(ser, NULL, 1024);
+  calc_proto_ser_set_req_callback(ser, req_cb);
+  calc_proto_ser_set_error_callback(ser, error_cb);
+
+  // A long (but valid) message received in parts needs more than the initial buffer
+  char req[200];
+  sprintf(req, "1300#GETMEM#-12.302%050d#45.3%050d$", 0, 0);
+  req_cb_count = 0;
+  err_cb_called = FALSE;
+  for (int i = 0; i < (int)strlen(req); i += 10) {
+    struct buffer_t buf;
+    buf.data = req + i;
+    buf.len = strlen(req + i) < 10 ? strlen(req + i) : 10;
+    calc_proto_ser_server_deserialize(ser, buf, NULL);
+  }
+  assert_int_equal(req_cb_count, 1);
+  assert_false(err_cb_called);
+
+  // But the buffer doesn't grow beyond the maximum length of a message
+  char long_req[1200];
+  sprintf(long_req, "1300#GETMEM#-12.302%01100d#45.3$", 0);
+  expected_error_code = ERROR_INVALID_REQUEST;
+  for (int i = 0; i < (int)strlen(long_req); i += 100) {
+    struct buffer_t buf;
+    buf.data = long_req + i;
+    buf.len = strlen(long_req + i) < 100 ? strlen(long_req + i) : 100;
+    calc_proto_ser_server_deserialize(ser, buf, NULL);
+  }
+  assert_true(err_cb_called);
+
+  // The next message is parsed as usual
+  struct buffer_t buf;
+  buf.data = req;
+  buf.len = strlen(req);
+  calc_proto_ser_server_deserialize(ser, buf, NULL);
+  assert_int_equal(req_cb_count, 2);
+}
+
+void calc_server_deserialize__reset(void** state) {
+  calc_proto_ser_ctor(ser, NULL, 32);
+  calc_proto_ser_set_req_callback(ser, req_cb);
+  calc_proto_ser_set_error_callback(ser, error_cb);
+  req_cb_count = 0;
+  err_cb_called = FALSE;
+
+  // A message left in parts by the previous client, and binary frames
+  struct buffer_t buf;
+  buf.data = "99#AD";
+  buf.len = strlen(buf.data);
+  calc_proto_ser_server_deserialize(ser, buf, NULL);
+  calc_proto_ser_set_mode(ser, CALC_PROTO_BINARY);
+
+  // After the reset, nothing of the previous client remains
+  calc_proto_ser_reset(ser);
+  assert_int_equal(calc_proto_ser_get_mode(ser), CALC_PROTO_TEXT);
+  buf.data = "1300#GETMEM#-12.302#45.3$";
+  buf.len = strlen(buf.data);
+  calc_proto_ser_server_deserialize(ser, buf, NULL);
+  assert_int_equal(req_cb_count, 1);
+  assert_false(err_cb_called);
+}
+
+void calc_binary__request_round_trip(void** state) {
+  calc_proto_ser_ctor(ser, NULL, 32);
+  calc_proto_ser_set_mode(ser, CALC_PROTO_BINARY);
+  calc_proto_ser_set_req_callback(ser, req_cb);
+  struct calc_proto_req_t req;
+  req.id = 1300;
+  req.method = GETMEM;
+  req.operand1 = -12.302;
+  req.operand2 = 45.3;
+  char out[2 * CALC_PROTO_MAX_MSG_LEN];
+  int len = calc_proto_ser_client_serialize_to(ser, &req, out, CALC_PROTO_MAX_MSG_LEN);
+  assert_int_equal(len, 23);
+  memcpy(out + len, out, len);
+
+  // Two frames in a single buffer, and then the same frames byte by byte
+  req_cb_count = 0;
+  struct buffer_t buf;
+  buf.data = out;
+  buf.len = 2 * len;
+  calc_proto_ser_server_deserialize(ser, buf, NULL);
+  assert_int_equal(req_cb_count, 2);
+  for (int i = 0; i < 2 * len; i++) {
+    buf.data = out + i;
+    buf.len = 1;
+    calc_proto_ser_server_deserialize(ser, buf, NULL);
+  }
+  assert_int_equal(req_cb_count, 4);
+}
+
+void calc_binary__response_round_trip(void** state) {
+  calc_proto_ser_ctor(ser, NULL, 32);
+  calc_proto_ser_set_mode(ser, CALC_PROTO_BINARY);
+  calc_proto_ser_set_resp_callback(ser, resp_cb);
+  struct calc_proto_resp_t resp;
+  resp.req_id = 1245;
+  resp.status = STATUS_DIV_BY_ZERO;
+  resp.result = -104.891;
+  char out[CALC_PROTO_MAX_MSG_LEN];
+  int len = calc_proto_ser_server_serialize_to(ser, &resp, out, sizeof(out));
+  assert_int_equal(len, 15);
+  assert_int_equal(calc_proto_ser_server_serialize_to(ser, &resp, out, 14), -1);
+
+  struct buffer_t buf;
+  buf.data = out;
+  buf.len = 5;
+  resp_cb_called = FALSE;
+  expected_status = STATUS_DIV_BY_ZERO;
+  calc_proto_ser_client_deserialize(ser, buf, NULL);
+  assert_false(resp_cb_called);
+  buf.data = out + 5;
+  buf.len = len - 5;
+  bool_t found = FALSE;
+  calc_proto_ser_client_deserialize(ser, buf, &found);
+  assert_true(found);
+  assert_true(resp_cb_called);
+}
+
+void calc_binary__invalid_frames(void** state) {
+  calc_proto_ser_ctor(ser, NULL, 32);
+  calc_proto_ser_set_mode(ser, CALC_PROTO_BINARY);
+  calc_proto_ser_set_req_callback(ser, req_cb);
+  calc_proto_ser_set_error_callback(ser, error_cb);
+
+  // A frame longer than the maximum is skipped, and the next one is still parsed
+  char frames[300 + 23];
+  memset(frames, 0, sizeof(frames));
+  frames[0] = 298 >> 8;
+  frames[1] = 298 & 0xFF;
+  struct calc_proto_req_t req;
+  req.id = 1300;
+  req.method = GETMEM;
+  req.operand1 = -12.302;
+  req.operand2 = 45.3;
+  calc_proto_ser_client_serialize_to(ser, &req, frames + 300, 23);
+
+  req_cb_count = 0;
+  err_cb_called = FALSE;
+  expected_error_code = ERROR_INVALID_REQUEST;
+  struct buffer_t buf;
+  buf.data = frames;
+  buf.len = sizeof(frames);
+  calc_proto_ser_server_deserialize(ser, buf, NULL);
+  assert_true(err_cb_called);
+  assert_int_equal(req_cb_count, 1);
+
+  // Unknown method
+  frames[300 + 6] = 42;
+  err_cb_called = FALSE;
+  expected_error_code = ERROR_INVALID_REQUEST_METHOD;
+  buf.data = frames + 300;
+  buf.len = 23;
+  calc_proto_ser_server_deserialize(ser, buf, NULL);
+  assert_true(err_cb_called);
+  assert_int_equal(req_cb_count, 1);
+}
+
+// Text of the programs of the EVAL requests received
+char eval_programs[CALC_PROTO_MAX_BATCH][CALC_PROTO_MAX_MSG_LEN];
+int eval_count;
+
+void eval_req_cb(void* context, struct calc_proto_req_t req) {
+  assert_int_equal(req.method, EVAL);
+  assert_non_null(req.program);
+  int len = calc_proto_prog_print(req.program, eval_programs[eval_count], CALC_PROTO_MAX_MSG_LEN);
+  assert_true(len > 0);
+  eval_programs[eval_count++][len] = '\0';
+}
+
+void eval_req_batch_cb(void* context, const struct calc_proto_req_t* reqs, int count) {
+  for (int i = 0; i < count; i++) {
+    eval_req_cb(context, reqs[i]);
+  }
+}
+
+void calc_eval__text_request(void** state) {
+  calc_proto_ser_ctor(ser, NULL, 64);
+  calc_proto_ser_set_req_callback(ser, eval_req_cb);
+  char req[] = "7#EVAL#2  3 + 4.5 *$8#EVAL#MC 10 0 M+ 3 1 M* + M M-$";
+  struct buffer_t buf;
+  buf.data = req;
+  buf.len = strlen(req);
+  eval_count = 0;
+  calc_proto_ser_server_deserialize(ser, buf, NULL);
+  assert_int_equal(eval_count, 2);
+  assert_string_equal(eval_programs[0], "2 3 + 4.5 *");
+  assert_string_equal(eval_programs[1], "MC 10 0 M+ 3 1 M* + M M-");
+}
+
+void calc_eval__batch(void** state) {
+  // Every request of a batch has its own program
+  calc_proto_ser_ctor(ser, NULL, 64);
+  calc_proto_ser_set_req_batch_callback(ser, eval_req_batch_cb);
+  char req[] = "1#EVAL#1 2 +$2#EVAL#3 4 /$3#EVAL#5 6 -$";
+  struct buffer_t buf;
+  buf.data = req;
+  buf.len = strlen(req);
+  eval_count = 0;
+  calc_proto_ser_server_deserialize(ser, buf, NULL);
+  assert_int_equal(eval_count, 3);
+  assert_string_equal(eval_programs[0], "1 2 +");
+  assert_string_equal(eval_programs[1], "3 4 /");
+  assert_string_equal(eval_programs[2], "5 6 -");
+}
+
+void calc_eval__invalid_programs(void** state) {
+  const char* reqs[] = {
+    "1#EVAL#2 +$",                // Not enough values
+    "1#EVAL#2 3$",                // More than a value at the end
+    "1#EVAL#$",                   // Empty
+    "1#EVAL#2 x +$",              // Unknown token
+    "1#EVAL#1 1 1 1 1 1 1 1 1 1 1 1 1 1 1 1 1$", // Beyond the stack
+    "1#EVAL#1e9 1e9 + 1e9 + 1e9 + 1e9 +$"          // Too long once written
+  };
+  calc_proto_ser_ctor(ser, NULL, 64);
+  calc_proto_ser_set_req_callback(ser, eval_req_cb);
+  calc_proto_ser_set_error_callback(ser, error_cb);
+  eval_count = 0;
+  expected_error_code = ERROR_INVALID_REQUEST_OPERAND1;
+  for (int i = 0; i < sizeof(reqs) / sizeof(reqs[0]); i++) {
+    struct buffer_t buf;
+    buf.data = (char*)reqs[i];
+    buf.len = strlen(reqs[i]);
+    err_cb_called = FALSE;
+    calc_proto_ser_server_deserialize(ser, buf, NULL);
+    assert_true(err_cb_called);
+  }
+
+  // The program takes the place of both operands
+  char req[] = "1#EVAL#1#2$";
+  struct buffer_t buf;
+  buf.data = req;
+  buf.len = strlen(req);
+  err_cb_called = FALSE;
+  expected_error_code = ERROR_INVALID_REQUEST_METHOD;
+  calc_proto_ser_server_deserialize(ser, buf, NULL);
+  assert_true(err_cb_called);
+  assert_int_equal(eval_count, 0);
+}
+
+void calc_eval__longest_program(void** state) {
+  // Every compiled program fits in a message, whatever its ID
+  const char* src = "123456789 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 +";
+  assert_int_equal(strlen(src), CALC_PROTO_PROG_MAX_TEXT);
+  struct calc_program_t program;
+  assert_true(calc_proto_prog_compile(src, strlen(src), &program));
+  calc_proto_ser_ctor(ser, NULL, 64);
+  struct calc_proto_req_t req;
+  req.id = INT32_MIN;
+  req.method = EVAL;
+  req.program = &program;
+  char out[CALC_PROTO_MAX_MSG_LEN];
+  assert_int_equal(calc_proto_ser_client_serialize_to(ser, &req, out, sizeof(out)), 63);
+
+  // A character more is rejected, even if the longer text only appears once written
+  src = "1234567890 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 +";
+  assert_false(calc_proto_prog_compile(src, strlen(src), &program));
+  src = "1e9 1 + 1 +";
+  assert_true(calc_proto_prog_compile(src, strlen(src), &program));
+  src = "1e9 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 +";
+  assert_false(calc_proto_prog_compile(src, strlen(src), &program));
+}
+
+void calc_eval__round_trip(void** state) {
+  struct calc_program_t program;
+  const char* src = "MC 10 0 M+ 3 1 M* +";
+  assert_true(calc_proto_prog_compile(src, strlen(src), &program));
+  assert_int_equal(program.len, 8);
+  assert_int_equal(program.nums_len, 4);
+  struct calc_proto_req_t req;
+  req.id = 8;
+  req.method = EVAL;
+  req.program = &program;
+
+  // Text and binary, the server gets the same program
+  calc_proto_mode_t modes[] = {CALC_PROTO_TEXT, CALC_PROTO_BINARY};
+  int lens[] = {27, 26};
+  for (int i = 0; i < 2; i++) {
+    calc_proto_ser_ctor(ser, NULL, 64);
+    calc_proto_ser_set_mode(ser, modes[i]);
+    calc_proto_ser_set_req_callback(ser, eval_req_cb);
+    char out[CALC_PROTO_MAX_MSG_LEN];
+    int len = calc_proto_ser_client_serialize_to(ser, &req, out, sizeof(out));
+    assert_int_equal(len, lens[i]);
+    assert_int_equal(calc_proto_ser_client_serialize_to(ser, &req, out, len - 1), -1);
+    struct buffer_t buf;
+    buf.data = out;
+    buf.len = len;
+    eval_count = 0;
+    calc_proto_ser_server_deserialize(ser, buf, NULL);
+    assert_int_equal(eval_count, 1);
+    assert_string_equal(eval_programs[0], src);
+    calc_proto_ser_dtor(ser);
+  }
+  calc_proto_ser_ctor(ser, NULL, 64);
+}
+
+void calc_proto_num__parse_int(void** state) {
+  int32_t num;
+  assert_true(calc_proto_num_parse_int("1620", 4, &num));
+  assert_int_equal(num, 1620);
+  assert_true(calc_proto_num_parse_int("-2147483648", 11, &num));
+  assert_int_equal(num, INT32_MIN);
+  assert_true(calc_proto_num_parse_int("16#20", 2, &num));
+  assert_int_equal(num, 16);
+  assert_false(calc_proto_num_parse_int("2147483648", 10, &num));
+  assert_false(calc_proto_num_parse_int("12a", 3, &num));
+  assert_false(calc_proto_num_parse_int("-", 1, &num));
+  assert_false(calc_proto_num_parse_int("", 0, &num));
+}
+
+void calc_proto_num__parse_double(void** state) {
+  double num;
+  assert_true(calc_proto_num_parse_double("-90.5613", 8, &num));
+  assert_true(num == -90.5613);
+  assert_true(calc_proto_num_parse_double("0.30000000000000004", 19, &num));
+  assert_true(num == 0.1 + 0.2);
+  assert_true(calc_proto_num_parse_double("1e+300", 6, &num));
+  assert_true(num == 1e300);
+  assert_true(calc_proto_num_parse_double("12345678901234567890123", 23, &num));
+  assert_true(num == 12345678901234567890123.0);
+  assert_true(calc_proto_num_parse_double(".5", 2, &num));
+  assert_true(num == 0.5);
+  assert_true(calc_proto_num_parse_double("-inf", 4, &num));
+  assert_true(num == -INFINITY);
+  assert_false(calc_proto_num_parse_double("hello", 5, &num));
+  assert_false(calc_proto_num_parse_double("1.2.3", 5, &num));
+  assert_false(calc_proto_num_parse_double("1e", 2, &num));
+  assert_false(calc_proto_num_parse_double(".", 1, &num));
+}
+
+void calc_proto_num__write(void** state) {
+  char out[CALC_PROTO_NUM_MAX_LEN + 1];
+  int len = calc_proto_num_write_int(out, sizeof(out), INT32_MIN);
+  out[len] = '\0';
+  assert_string_equal(out, "-2147483648");
+  len = calc_proto_num_write_double(out, sizeof(out), 320.0);
+  out[len] = '\0';
+  assert_string_equal(out, "320");
+  len = calc_proto_num_write_double(out, sizeof(out), 0.001);
+  out[len] = '\0';
+  assert_string_equal(out, "0.001");
+  len = calc_proto_num_write_double(out, sizeof(out), 0.1 + 0.2);
+  out[len] = '\0';
+  assert_string_equal(out, "0.30000000000000004");
+  len = calc_proto_num_write_double(out, sizeof(out), 0.1234567);
+  out[len] = '\0';
+  assert_string_equal(out, "0.1234567");
+  len = calc_proto_num_write_double(out, sizeof(out), -1e300);
+  out[len] = '\0';
+  assert_string_equal(out, "-1e+300");
+  assert_int_equal(calc_proto_num_write_double(out, 3, 0.1234567), -1);
+}
+
+void calc_proto_num__round_trip(void** state) {
+  char out[CALC_PROTO_NUM_MAX_LEN];
+  srand(1620);
+  for (int i = 0; i < 200000; i++) {
+    double num;
+    switch (i % 4) {
+      case 0: num = (double)rand() / RAND_MAX * 1000.0; break;
+      case 1: num = (rand() % 2000000 - 1000000) / 100.0; break;
+      case 2: num = ((double)rand() / RAND_MAX - 0.5) * 1e18; break;
+      default: {
+        uint64_t bits = ((uint64_t)rand() << 33) ^ ((uint64_t)rand() << 11) ^ rand();
+        memcpy(&num, &bits, sizeof(num));
+        if (num != num) continue;
+      }
+    }
+    int len = calc_proto_num_write_double(out, sizeof(out), num);
+    assert_true(len > 0);
+    double parsed;
+    assert_true(calc_proto_num_parse_double(out, len, &parsed));
+    assert_memory_equal(&parsed, &num, sizeof(num));
+  }
+}
+
 int setup(void** state) {
   ser = calc_proto_ser_new();
   return 0;
@@ -387,7 +985,28 @@ int main(int argc, char** argv) {
     cmocka_unit_test_setup_teardown(calc_client_deserialize__single_response, setup, teardown),
     cmocka_unit_test_setup_teardown(calc_client_deserialize__multipart_request_2, setup, teardown),
     cmocka_unit_test_setup_teardown(calc_server_serialize_response, setup, teardown),
-    cmocka_unit_test_setup_teardown(calc_client_serialize_request, setup, teardown)
+    cmocka_unit_test_setup_teardown(calc_client_serialize_request, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_server_serialize_response_to, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_server_serialize_response_to__truncated, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_client_serialize_request_to, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_server_deserialize__many_requests, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_server_deserialize__batch, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_server_deserialize__batch_with_errors, setup, teardown),
+    cmocka_unit_test(calc_server_deserialize__fuzz),
+    cmocka_unit_test_setup_teardown(calc_server_deserialize__growing_buffer, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_server_deserialize__reset, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_binary__request_round_trip, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_binary__response_round_trip, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_binary__invalid_frames, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_eval__text_request, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_eval__batch, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_eval__invalid_programs, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_eval__longest_program, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_eval__round_trip, setup, teardown),
+    cmocka_unit_test(calc_proto_num__parse_int),
+    cmocka_unit_test(calc_proto_num__parse_double),
+    cmocka_unit_test(calc_proto_num__write),
+    cmocka_unit_test(calc_proto_num__round_trip)
   };
   return cmocka_run_group_tests(tests, NULL, NULL);
 }
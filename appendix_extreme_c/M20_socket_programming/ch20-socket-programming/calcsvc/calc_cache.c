@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "calc_cache.h"
+
+// Position of the hand of the clock in the sets. Every thread has its own, so the evictions don't
+// write a counter shared by all the threads.
+static _Thread_local unsigned calc_cache_hand = 0;
+
+/**
+ * Allocate a cache
+ *
+ * @return Pointer to the cache
+*/
+struct calc_cache_t* calc_cache_new()
+{
+  return (struct calc_cache_t*)malloc(sizeof(struct calc_cache_t));
+}
+
+/**
+ * Free a cache
+ *
+ * @param cache Pointer to the cache
+*/
+void calc_cache_delete(struct calc_cache_t* cache)
+{
+  free(cache);
+}
+
+/**
+ * Initialize an empty cache. The slots are aligned to their sets, so a set never takes more than
+ * two cache lines.
+ *
+ * @param cache Pointer to the cache
+ * @param slots Minimum number of results kept (rounded up to a power of two)
+*/
+void calc_cache_ctor(struct calc_cache_t* cache, size_t slots)
+{
+  size_t size = CALC_CACHE_WAYS;
+  while (size < slots)
+  {
+    size <<= 1;
+  }
+  size_t set_bytes = CALC_CACHE_WAYS * sizeof(struct calc_cache_slot_t);
+  cache->slots = (struct calc_cache_slot_t*)aligned_alloc(set_bytes,
+      size * sizeof(struct calc_cache_slot_t));
+  cache->mask = size - 1;
+  for (size_t i = 0; i < size; i++)
+  {
+    struct calc_cache_slot_t* slot = &cache->slots[i];
+    atomic_init(&slot->seq, 0);
+    atomic_init(&slot->op, 0);
+    atomic_init(&slot->status, 0);
+    atomic_init(&slot->ref, 0);
+    atomic_init(&slot->a, 0);
+    atomic_init(&slot->b, 0);
+    atomic_init(&slot->result, 0);
+  }
+}
+
+/**
+ * Destroy a cache
+ *
+ * @param cache Pointer to the cache
+*/
+void calc_cache_dtor(struct calc_cache_t* cache)
+{
+  free(cache->slots);
+}
+
+/**
+ * Set of a key. The bits of the operands are mixed with multiplications and shifts, so the
+ * operands that only differ in their low bits (the integers, for example) go to different sets.
+ *
+ * @param cache Pointer to the cache
+ * @param op Operation
+ * @param a Bits of the first operand
+ * @param b Bits of the second operand
+ *
+ * @return First slot of the set
+*/
+static struct calc_cache_slot_t* calc_cache_set(struct calc_cache_t* cache, int op, uint64_t a,
+    uint64_t b)
+{
+  uint64_t hash = a * 0x9E3779B97F4A7C15ull;
+  hash ^= (b + (uint64_t)op) * 0xC2B2AE3D27D4EB4Full;
+  hash ^= hash >> 29;
+  hash *= 0xBF58476D1CE4E5B9ull;
+  hash ^= hash >> 32;
+  return &cache->slots[hash & cache->mask & ~(size_t)(CALC_CACHE_WAYS - 1)];
+}
+
+/**
+ * Find the result of an operation. The fields of a slot are read between two readings of its
+ * sequence, and they are only valid if it is even and the same in both.
+ *
+ * @param cache Pointer to the cache
+ * @param op Operation (not 0)
+ * @param a First operand
+ * @param b Second operand
+ * @param status Status of the operation
+ * @param result Result of the operation
+ *
+ * @return TRUE if the result was in the cache
+*/
+bool_t calc_cache_get(struct calc_cache_t* cache, int op, double a, double b, int* status,
+    double* result)
+{
+  uint64_t a_bits, b_bits;
+  memcpy(&a_bits, &a, sizeof(a_bits));
+  memcpy(&b_bits, &b, sizeof(b_bits));
+  struct calc_cache_slot_t* set = calc_cache_set(cache, op, a_bits, b_bits);
+
+  for (int i = 0; i < CALC_CACHE_WAYS; i++)
+  {
+    struct calc_cache_slot_t* slot = &set[i];
+    uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if ((seq & 1) ||
+        atomic_load_explicit(&slot->op, memory_order_relaxed) != op ||
+        atomic_load_explicit(&slot->a, memory_order_relaxed) != a_bits ||
+        atomic_load_explicit(&slot->b, memory_order_relaxed) != b_bits)
+    {
+      continue;
+    }
+    int slot_status = atomic_load_explicit(&slot->status, memory_order_relaxed);
+    uint64_t bits = atomic_load_explicit(&slot->result, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq)
+    {
+      continue;
+    }
+
+    // The bit is only written when it changes, so the hits of many threads keep the line shared
+    if (!atomic_load_explicit(&slot->ref, memory_order_relaxed))
+    {
+      atomic_store_explicit(&slot->ref, 1, memory_order_relaxed);
+    }
+    *status = slot_status;
+    memcpy(result, &bits, sizeof(bits));
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/**
+ * Choose the slot of a full set that is replaced. The hand of the clock goes around the set: a
+ * slot with the reference bit gets a second chance (the bit is cleared), the first one without it
+ * is the victim. After two turns there is always one, unless new hits set the bits again, and
+ * then the slot under the hand is taken anyway.
+ *
+ * @param set First slot of the set
+ *
+ * @return Slot replaced
+*/
+static struct calc_cache_slot_t* calc_cache_evict(struct calc_cache_slot_t* set)
+{
+  struct calc_cache_slot_t* slot = NULL;
+  for (int i = 0; i < 2 * CALC_CACHE_WAYS; i++)
+  {
+    slot = &set[calc_cache_hand++ % CALC_CACHE_WAYS];
+    if (!atomic_load_explicit(&slot->ref, memory_order_relaxed))
+    {
+      break;
+    }
+    atomic_store_explicit(&slot->ref, 0, memory_order_relaxed);
+  }
+  return slot;
+}
+
+/**
+ * Keep the result of an operation, in an empty slot of its set or in the place of the result
+ * chosen by the clock. The writer makes the sequence of the slot odd with a compare and swap, so
+ * two writers never write the same slot: the one that loses drops its result (the next miss of
+ * the key will bring it again).
+ *
+ * @param cache Pointer to the cache
+ * @param op Operation (not 0)
+ * @param a First operand
+ * @param b Second operand
+ * @param status Status of the operation
+ * @param result Result of the operation
+*/
+void calc_cache_put(struct calc_cache_t* cache, int op, double a, double b, int status,
+    double result)
+{
+  uint64_t a_bits, b_bits, bits;
+  memcpy(&a_bits, &a, sizeof(a_bits));
+  memcpy(&b_bits, &b, sizeof(b_bits));
+  memcpy(&bits, &result, sizeof(bits));
+  struct calc_cache_slot_t* set = calc_cache_set(cache, op, a_bits, b_bits);
+
+  // Another thread could have kept the same result since the lookup
+  struct calc_cache_slot_t* victim = NULL;
+  for (int i = 0; i < CALC_CACHE_WAYS; i++)
+  {
+    int slot_op = atomic_load_explicit(&set[i].op, memory_order_relaxed);
+    if (!slot_op)
+    {
+      victim = &set[i];
+      break;
+    }
+    if (slot_op == op && atomic_load_explicit(&set[i].a, memory_order_relaxed) == a_bits &&
+        atomic_load_explicit(&set[i].b, memory_order_relaxed) == b_bits)
+    {
+      return;
+    }
+  }
+  if (!victim)
+  {
+    victim = calc_cache_evict(set);
+  }
+
+  uint32_t seq = atomic_load_explicit(&victim->seq, memory_order_relaxed);
+  if ((seq & 1) || !atomic_compare_exchange_strong_explicit(&victim->seq, &seq, seq + 1,
+      memory_order_relaxed, memory_order_relaxed))
+  {
+    return;
+  }
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&victim->op, (uint8_t)op, memory_order_relaxed);
+  atomic_store_explicit(&victim->a, a_bits, memory_order_relaxed);
+  atomic_store_explicit(&victim->b, b_bits, memory_order_relaxed);
+  atomic_store_explicit(&victim->status, (int8_t)status, memory_order_relaxed);
+  atomic_store_explicit(&victim->result, bits, memory_order_relaxed);
+  atomic_store_explicit(&victim->ref, 0, memory_order_relaxed);
+  atomic_store_explicit(&victim->seq, seq + 2, memory_order_release);
+}
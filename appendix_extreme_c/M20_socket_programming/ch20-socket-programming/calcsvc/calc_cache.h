@@ -0,0 +1,67 @@
+#ifndef CALC_CACHE_H
+#define CALC_CACHE_H
+
+/**
+ * The operations without memory (ADD, SUB, MUL and DIV) always give the same result for the same
+ * operands, so a server whose clients repeat the same requests can keep the results and answer
+ * them again without the service. A cache is a table of results shared by all the threads, with a
+ * fixed number of slots chosen at its creation: when it is full, every new result replaces an old
+ * one.
+ *
+ * The key of a result is the operation and the bits of both operands (so 0.0 and -0.0 are
+ * different keys, and a NaN finds its own result). The status is kept with the result, a division
+ * by zero is answered from the cache as well.
+ *
+ * The slots take 32 bytes, and a key can only be in the CALC_CACHE_WAYS slots of its set: a group
+ * aligned to two cache lines, which the adjacent line prefetcher brings together. A lookup never
+ * touches more memory than that. The victim of a full set is chosen with the CLOCK algorithm: a
+ * hit sets the reference bit of its slot, and the hand of the clock goes around the set clearing
+ * the bits until it finds a slot without it, so the results used since the last pass survive.
+ *
+ * There is no lock. Every slot has a sequence number, odd while a thread writes the slot: the
+ * writers take the slot with a compare and swap (and give up their result if another writer has
+ * it), and a reader takes the result only if the sequence was even and didn't change while it read
+ * the slot. A lookup doesn't write anything but the reference bit, and only when it isn't set.
+*/
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <types.h>
+
+#define CALC_CACHE_WAYS 4                // Slots of a set (128 bytes)
+#define CALC_CACHE_MAX_SLOTS (1L << 26)  // Largest cache (2 GB)
+
+struct calc_cache_slot_t
+{
+  _Atomic uint32_t seq;     // Odd while the slot is written
+  _Atomic uint8_t op;       // Operation of the key, 0 if the slot is empty
+  _Atomic int8_t status;    // Status of the operation (from -128 to 127)
+  _Atomic uint8_t ref;      // Reference bit of the CLOCK
+  _Atomic uint64_t a;       // Bits of the operands
+  _Atomic uint64_t b;
+  _Atomic uint64_t result;  // Bits of the result
+} __attribute__((aligned(32)));
+
+struct calc_cache_t
+{
+  struct calc_cache_slot_t* slots;
+  size_t mask;  // Slots - 1
+};
+
+struct calc_cache_t* calc_cache_new();
+void calc_cache_delete(struct calc_cache_t*);
+
+// Empty cache of the given slots at least (rounded up to a power of two)
+void calc_cache_ctor(struct calc_cache_t*, size_t slots);
+void calc_cache_dtor(struct calc_cache_t*);
+
+// Result of an operation (not 0) and its status, FALSE if it is not in the cache
+bool_t calc_cache_get(struct calc_cache_t*, int op, double a, double b, int* status,
+    double* result);
+
+// Keep the result of an operation (not 0), it can be dropped if its set is being written
+void calc_cache_put(struct calc_cache_t*, int op, double a, double b, int status, double result);
+
+#endif
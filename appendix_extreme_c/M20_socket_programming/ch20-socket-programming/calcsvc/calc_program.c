@@ -0,0 +1,77 @@
+#include "calc_service.h"
+#include "calc_program.h"
+
+/**
+ * Run a compiled program against a service. The stack lives in the frame of the function and the
+ * loop only dispatches on the instruction, the checks were done by the compiler. The arithmetic of
+ * the instructions without memory is done right here (it is the same as the one of the service),
+ * the memory instructions go through the service, so they use its own memory or its register.
+ *
+ * @param program Compiled program (see calc_proto_prog_compile)
+ * @param svc Service whose memory is used
+ * @param result Value left in the stack
+ *
+ * @return CALC_SVC_OK, or CALC_SVC_ERROR_DIV_BY_ZERO if a division had a zero divisor (the rest of
+ *         the program is not run)
+*/
+int calc_program_run(const struct calc_program_t* program, struct calc_service_t* svc,
+    double* result)
+{
+  double stack[CALC_PROGRAM_MAX_STACK];
+  int depth = 0;
+  const double* num = program->nums;
+  const uint8_t* code = program->code;
+  const uint8_t* end = code + program->len;
+
+  for (; code < end; code++)
+  {
+    switch ((calc_op_t)*code)
+    {
+      case CALC_OP_PUSH:
+        stack[depth++] = *num++;
+        break;
+      case CALC_OP_ADD:
+        depth--;
+        stack[depth - 1] = stack[depth - 1] + stack[depth];
+        break;
+      case CALC_OP_SUB:
+        depth--;
+        stack[depth - 1] = stack[depth - 1] - stack[depth];
+        break;
+      case CALC_OP_MUL:
+        depth--;
+        stack[depth - 1] = stack[depth - 1] * stack[depth];
+        break;
+      case CALC_OP_DIV:
+        depth--;
+        if (stack[depth] == 0.0)
+        {
+          return CALC_SVC_ERROR_DIV_BY_ZERO;
+        }
+        stack[depth - 1] = stack[depth - 1] / stack[depth];
+        break;
+      case CALC_OP_ADDM:
+        depth--;
+        stack[depth - 1] = calc_service_add(svc, stack[depth - 1], stack[depth], TRUE);
+        break;
+      case CALC_OP_SUBM:
+        depth--;
+        stack[depth - 1] = calc_service_sub(svc, stack[depth - 1], stack[depth], TRUE);
+        break;
+      case CALC_OP_MULM:
+        depth--;
+        stack[depth - 1] = calc_service_mul(svc, stack[depth - 1], stack[depth], TRUE);
+        break;
+      case CALC_OP_GETMEM:
+        stack[depth++] = calc_service_get_mem(svc);
+        break;
+      case CALC_OP_RESMEM:
+        calc_service_reset_mem(svc);
+        break;
+      default:
+        break;
+    }
+  }
+  *result = stack[depth - 1];
+  return CALC_SVC_OK;
+}
@@ -0,0 +1,54 @@
+#ifndef CALC_PROGRAM_H
+#define CALC_PROGRAM_H
+
+/**
+ * A program chains several operations of the service in a single request (EVAL), so a calculation
+ * of many steps costs a single round trip instead of one per step. The programs are sent in
+ * reverse polish notation (see calc_proto_prog.h), and the parser compiles them once into the
+ * bytecode below: an array of instructions of a byte and the numbers they push. The interpreter
+ * runs the instructions against a service with an operand stack.
+ *
+ *    Text:     2 3 + 4 *            ((2 + 3) * 4)
+ *    Bytecode: PUSH PUSH ADD PUSH MUL, numbers 2 3 4
+ *
+ * The compiler checks the depth of the stack of every instruction, so a compiled program never
+ * takes more operands than the stack has, never goes beyond CALC_PROGRAM_MAX_STACK, and ends with
+ * its result alone in the stack. The interpreter doesn't check anything but the divisions.
+*/
+
+#include <stdint.h>
+
+#define CALC_PROGRAM_MAX_CODE 32    // Instructions of a program
+#define CALC_PROGRAM_MAX_NUMS 16    // Numbers pushed by a program
+#define CALC_PROGRAM_MAX_STACK 16   // Depth of the operand stack
+
+// Instructions of the bytecode
+typedef enum {
+  CALC_OP_PUSH,    // Push the next number of the program
+  CALC_OP_ADD,     // Pop b and a, push a + b
+  CALC_OP_SUB,     // Pop b and a, push a - b
+  CALC_OP_MUL,     // Pop b and a, push a * b
+  CALC_OP_DIV,     // Pop b and a, push a / b (the program fails if b is zero)
+  CALC_OP_ADDM,    // Pop b and a, push the memory updated as ADDM does
+  CALC_OP_SUBM,    // Pop b and a, push the memory updated as SUBM does
+  CALC_OP_MULM,    // Pop b and a, push the memory updated as MULM does
+  CALC_OP_GETMEM,  // Push the memory
+  CALC_OP_RESMEM,  // Reset the memory (the stack doesn't change)
+  CALC_OP_COUNT
+} calc_op_t;
+
+// Compiled program
+struct calc_program_t
+{
+  uint8_t len;       // Instructions
+  uint8_t nums_len;  // Numbers
+  uint8_t code[CALC_PROGRAM_MAX_CODE];
+  double nums[CALC_PROGRAM_MAX_NUMS];
+};
+
+struct calc_service_t;
+
+// Run a program, returns CALC_SVC_OK or CALC_SVC_ERROR_DIV_BY_ZERO
+int calc_program_run(const struct calc_program_t*, struct calc_service_t*, double* result);
+
+#endif
@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "calc_registers.h"
+
+/**
+ * Allocate a table of registers
+ *
+ * @return Pointer to the table
+*/
+struct calc_registers_t* calc_registers_new()
+{
+  return (struct calc_registers_t*)aligned_alloc(64, sizeof(struct calc_registers_t));
+}
+
+/**
+ * Free a table of registers
+ *
+ * @param regs Pointer to the table
+*/
+void calc_registers_delete(struct calc_registers_t* regs)
+{
+  free(regs);
+}
+
+/**
+ * Initialize an empty table
+ *
+ * @param regs Pointer to the table
+*/
+void calc_registers_ctor(struct calc_registers_t* regs)
+{
+  pthread_mutex_init(&regs->lock, NULL);
+  for (int i = 0; i < CALC_REGISTERS_CAPACITY; i++)
+  {
+    atomic_init(&regs->regs[i].bits, 0);
+    atomic_init(&regs->regs[i].used, 0);
+    regs->regs[i].name[0] = '\0';
+  }
+}
+
+/**
+ * Destroy a table (its registers can't be used any more)
+ *
+ * @param regs Pointer to the table
+*/
+void calc_registers_dtor(struct calc_registers_t* regs)
+{
+  pthread_mutex_destroy(&regs->lock);
+}
+
+/**
+ * Slot of a name in the table (FNV-1a hash)
+ *
+ * @param name Name of the register
+ *
+ * @return First slot to look at, the next ones follow it
+*/
+static unsigned calc_registers_slot(const char* name)
+{
+  uint32_t hash = 2166136261u;
+  for (const char* c = name; *c; c++)
+  {
+    hash = (hash ^ (unsigned char)*c) * 16777619u;
+  }
+  return hash & (CALC_REGISTERS_CAPACITY - 1);
+}
+
+/**
+ * Look for the register of a name, without the lock
+ *
+ * @param regs Pointer to the table
+ * @param name Name of the register
+ * @param free_slot First slot without a register found, or -1 if the table is full
+ *
+ * @return The register, or NULL if there is none with the name
+*/
+static struct calc_register_t* calc_registers_find(struct calc_registers_t* regs,
+    const char* name, int* free_slot)
+{
+  unsigned slot = calc_registers_slot(name);
+  for (int i = 0; i < CALC_REGISTERS_CAPACITY; i++)
+  {
+    struct calc_register_t* reg = &regs->regs[(slot + i) & (CALC_REGISTERS_CAPACITY - 1)];
+    if (!atomic_load_explicit(&reg->used, memory_order_acquire))
+    {
+      *free_slot = (slot + i) & (CALC_REGISTERS_CAPACITY - 1);
+      return NULL;
+    }
+    if (!strcmp(reg->name, name))
+    {
+      return reg;
+    }
+  }
+  *free_slot = -1;
+  return NULL;
+}
+
+/**
+ * Register of a name, created the first time (the registers are never removed, so the pointer is
+ * valid as long as the table)
+ *
+ * @param regs Pointer to the table
+ * @param name Name of the register
+ *
+ * @return The register, or NULL if the name is too long or the table is full
+*/
+struct calc_register_t* calc_registers_get(struct calc_registers_t* regs, const char* name)
+{
+  if (strlen(name) >= CALC_REGISTER_NAME_LEN)
+  {
+    return NULL;
+  }
+  int free_slot;
+  struct calc_register_t* reg = calc_registers_find(regs, name, &free_slot);
+  if (reg)
+  {
+    return reg;
+  }
+
+  // Another thread could be creating the same one, so look again with the lock
+  pthread_mutex_lock(&regs->lock);
+  reg = calc_registers_find(regs, name, &free_slot);
+  if (!reg && free_slot != -1)
+  {
+    reg = &regs->regs[free_slot];
+    strcpy(reg->name, name);
+    atomic_store_explicit(&reg->bits, 0, memory_order_relaxed);
+    atomic_store_explicit(&reg->used, 1, memory_order_release);
+  }
+  pthread_mutex_unlock(&regs->lock);
+  return reg;
+}
+
+/**
+ * Value of a register
+ *
+ * @param reg Pointer to the register
+ *
+ * @return Value written by the last update
+*/
+double calc_register_load(struct calc_register_t* reg)
+{
+  uint64_t bits = atomic_load_explicit(&reg->bits, memory_order_acquire);
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/**
+ * Replace the value of a register
+ *
+ * @param reg Pointer to the register
+ * @param value New value
+*/
+void calc_register_store(struct calc_register_t* reg, double value)
+{
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  atomic_store_explicit(&reg->bits, bits, memory_order_release);
+}
+
+/**
+ * Update a register with the operation of a memory method. The new value is computed from the
+ * value read and written only if the register still has it, otherwise the compare and swap gives
+ * the value written in the meantime and the operation is done again with it.
+ *
+ * @param reg Pointer to the register
+ * @param op Operation of the memory method
+ * @param value Result of the operands
+ *
+ * @return New value of the register
+*/
+double calc_register_update(struct calc_register_t* reg, calc_register_op_t op, double value)
+{
+  uint64_t old_bits = atomic_load_explicit(&reg->bits, memory_order_relaxed);
+  uint64_t new_bits;
+  double result;
+  do
+  {
+    double mem;
+    memcpy(&mem, &old_bits, sizeof(mem));
+    switch (op)
+    {
+      case CALC_REGISTER_ADD:
+        result = value + mem;
+        break;
+      case CALC_REGISTER_SUB:
+        result = value - mem;
+        break;
+      default:
+        result = value * mem;
+    }
+    memcpy(&new_bits, &result, sizeof(new_bits));
+  } while (!atomic_compare_exchange_weak_explicit(&reg->bits, &old_bits, new_bits,
+      memory_order_acq_rel, memory_order_relaxed));
+  return result;
+}
@@ -0,0 +1,64 @@
+#ifndef CALC_REGISTERS_H
+#define CALC_REGISTERS_H
+
+/**
+ * Every service has its own memory, so the memory methods of a client never see the ones of the
+ * others. A register is a memory shared by many services, for the running totals of many clients:
+ * a service attached to a register (see calc_service_set_register) uses it for ADDM, SUBM, MULM,
+ * GETMEM and RESMEM instead of its own memory.
+ *
+ * The services of many threads update the same register at the same time, so its value is an
+ * atomic 64 bits word (the bits of the double). An update reads the value, computes the new one and
+ * replaces it with a compare and swap only if nobody changed it in between, otherwise it tries
+ * again with the new value. There is no lock: a thread never waits for another one that was
+ * preempted in the middle of an update, and GETMEM always reads a value that some update wrote.
+ *
+ * The registers are found by name in a table. Every register takes its own cache line, so the
+ * updates of a register don't slow down the ones of its neighbours. The table only takes a lock to
+ * create a register, the lookups of the existing ones don't.
+*/
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define CALC_REGISTERS_CAPACITY 1024  // Registers of a table (a power of two)
+#define CALC_REGISTER_NAME_LEN 32     // Longest name, the terminating null included
+
+// Operations of the memory methods, with the value of the operands (a + b, a - b or a * b)
+typedef enum {
+  CALC_REGISTER_ADD,  // mem = value + mem
+  CALC_REGISTER_SUB,  // mem = value - mem
+  CALC_REGISTER_MUL   // mem = value * mem
+} calc_register_op_t;
+
+struct calc_register_t
+{
+  _Atomic uint64_t bits;               // Value, as the bits of a double
+  _Atomic int used;                    // The name is set (published after the name)
+  char name[CALC_REGISTER_NAME_LEN];
+} __attribute__((aligned(64)));
+
+struct calc_registers_t
+{
+  pthread_mutex_t lock;  // Creation of registers
+  struct calc_register_t regs[CALC_REGISTERS_CAPACITY];
+};
+
+struct calc_registers_t* calc_registers_new();
+void calc_registers_delete(struct calc_registers_t*);
+void calc_registers_ctor(struct calc_registers_t*);
+void calc_registers_dtor(struct calc_registers_t*);
+
+// Register of a name, created (with 0.0) the first time. NULL if the name is too long or the table
+// is full.
+struct calc_register_t* calc_registers_get(struct calc_registers_t*, const char* name);
+
+// Value of a register, and its replacement
+double calc_register_load(struct calc_register_t*);
+void calc_register_store(struct calc_register_t*, double value);
+
+// Atomic update of a register, returns the new value
+double calc_register_update(struct calc_register_t*, calc_register_op_t op, double value);
+
+#endif
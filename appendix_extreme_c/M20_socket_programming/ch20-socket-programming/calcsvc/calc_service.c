@@ -1,6 +1,8 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "calc_service.h"
+#include "calc_registers.h"
 
 /**
  * When you are ready and understand this part, you can go to the part that talks about unix domain
@@ -8,10 +10,21 @@
  * stream server.
 */
 
+// The bulk methods are compiled twice on x86-64, for the baseline (SSE2, 2 doubles per
+// instruction) and for AVX2 (4 doubles per instruction), and the loader picks the version that
+// the CPU supports. Other architectures use their own vector unit (NEON on ARM64) directly. The
+// loops are only vectorized by optimized builds (-O3, the Release build type).
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CALC_SVC_BULK __attribute__((target_clones("avx2", "default")))
+#else
+#define CALC_SVC_BULK
+#endif
+
 // Attribute structure for the service
 struct calc_service_t 
 {
   double mem;
+  struct calc_register_t* reg;  // Shared memory, NULL to use mem
 };
 
 /**
@@ -42,6 +55,7 @@ void calc_service_delete(struct calc_service_t* svc)
 void calc_service_ctor(struct calc_service_t* svc) 
 {
   svc->mem = 0.0;
+  svc->reg = NULL;
 }
 
 /**
@@ -51,6 +65,30 @@ void calc_service_ctor(struct calc_service_t* svc)
 */
 void calc_service_dtor(struct calc_service_t* svc) {}
 
+/**
+ * Attach the service to a shared register (see calc_registers.h), the memory methods use it
+ * instead of the memory of the service from now on.
+ * 
+ * @param svc Pointer to service object in use
+ * @param reg Register shared with other services, or NULL to go back to the own memory
+*/
+void calc_service_set_register(struct calc_service_t* svc, struct calc_register_t* reg) 
+{
+  svc->reg = reg;
+}
+
+/**
+ * Getter to the shared register of the service
+ * 
+ * @param svc Pointer to service object in use
+ * 
+ * @return Register attached, or NULL if the service uses its own memory
+*/
+struct calc_register_t* calc_service_get_register(struct calc_service_t* svc) 
+{
+  return svc->reg;
+}
+
 /**
  * Reset memory (upate to zero)
  * 
@@ -58,6 +96,11 @@ void calc_service_dtor(struct calc_service_t* svc) {}
 */
 void calc_service_reset_mem(struct calc_service_t* svc) 
 {
+  if (svc->reg) 
+  {
+    calc_register_store(svc->reg, 0.0);
+    return;
+  }
   svc->mem = 0.0;
 }
 
@@ -70,6 +113,10 @@ void calc_service_reset_mem(struct calc_service_t* svc)
 */
 double calc_service_get_mem(struct calc_service_t* svc) 
 {
+  if (svc->reg) 
+  {
+    return calc_register_load(svc->reg);
+  }
   return svc->mem;
 }
 
@@ -92,6 +139,10 @@ double calc_service_add(struct calc_service_t* svc, double a, double b,
   {
     return result;
   }
+  if (svc->reg) 
+  {
+    return calc_register_update(svc->reg, CALC_REGISTER_ADD, result);
+  }
   svc->mem = result + svc->mem;
   return svc->mem;
 }
@@ -115,6 +166,10 @@ double calc_service_sub(struct calc_service_t* svc, double a, double b,
   {
     return result;
   }
+  if (svc->reg) 
+  {
+    return calc_register_update(svc->reg, CALC_REGISTER_SUB, result);
+  }
   svc->mem = result - svc->mem;
   return svc->mem;
 }
@@ -138,6 +193,10 @@ double calc_service_mul(struct calc_service_t* svc, double a, double b,
   {
     return result;
   }
+  if (svc->reg) 
+  {
+    return calc_register_update(svc->reg, CALC_REGISTER_MUL, result);
+  }
   svc->mem = result * svc->mem;
   return svc->mem;
 }
@@ -161,3 +220,105 @@ int calc_service_div(struct calc_service_t* svc, double a, double b, double* res
   *result = a / b;
   return CALC_SVC_OK;
 }
+
+/**
+ * Bulk addition, out[i] = a[i] + b[i]. The arrays must not overlap (except out with a or b being
+ * the same array), so the loop has no dependency between elements and it is vectorized.
+ * 
+ * @param svc Pointer to service object in use (the memory isn't used)
+ * @param a Operands 1
+ * @param b Operands 2
+ * @param out Results
+ * @param n Number of elements
+*/
+CALC_SVC_BULK
+void calc_service_add_n(struct calc_service_t* svc, const double* a, const double* b, double* out,
+    size_t n) 
+{
+  for (size_t i = 0; i < n; i++) 
+  {
+    out[i] = a[i] + b[i];
+  }
+}
+
+/**
+ * Bulk substraction, out[i] = a[i] - b[i] (see calc_service_add_n)
+ * 
+ * @param svc Pointer to service object in use (the memory isn't used)
+ * @param a Operands 1
+ * @param b Operands 2
+ * @param out Results
+ * @param n Number of elements
+*/
+CALC_SVC_BULK
+void calc_service_sub_n(struct calc_service_t* svc, const double* a, const double* b, double* out,
+    size_t n) 
+{
+  for (size_t i = 0; i < n; i++) 
+  {
+    out[i] = a[i] - b[i];
+  }
+}
+
+/**
+ * Bulk multiplication, out[i] = a[i] * b[i] (see calc_service_add_n)
+ * 
+ * @param svc Pointer to service object in use (the memory isn't used)
+ * @param a Operands 1
+ * @param b Operands 2
+ * @param out Results
+ * @param n Number of elements
+*/
+CALC_SVC_BULK
+void calc_service_mul_n(struct calc_service_t* svc, const double* a, const double* b, double* out,
+    size_t n) 
+{
+  for (size_t i = 0; i < n; i++) 
+  {
+    out[i] = a[i] * b[i];
+  }
+}
+
+/**
+ * Bulk division, out[i] = a[i] / b[i]. A branch per element would stop the vectorization, so all
+ * the divisions are done (a division by zero doesn't trap, it just gives an infinity or a NaN) and
+ * the results of the zero divisors are replaced by 0.0 afterwards. The divisions by zero are
+ * reported in a mask with a bit per element (bit i % 64 of the word i / 64).
+ * 
+ * @param svc Pointer to service object in use (the memory isn't used)
+ * @param a Dividends
+ * @param b Divisors
+ * @param out Results (0.0 for the divisions by zero)
+ * @param zero_mask Bits of the divisions by zero, (n + 63) / 64 words
+ * @param n Number of elements
+ * 
+ * @return Number of divisions by zero (0 if all the elements have a valid result)
+*/
+CALC_SVC_BULK
+size_t calc_service_div_n(struct calc_service_t* svc, const double* a, const double* b,
+    double* out, uint64_t* zero_mask, size_t n) 
+{
+  for (size_t i = 0; i < n; i++) 
+  {
+    // The result is cleared with its bits, a condition would be a branch for the compiler
+    double result = a[i] / b[i];
+    uint64_t bits;
+    memcpy(&bits, &result, sizeof(bits));
+    bits &= -(uint64_t)(b[i] != 0.0);
+    memcpy(&out[i], &bits, sizeof(bits));
+  }
+
+  size_t zeros = 0;
+  for (size_t block = 0; block < n; block += 64) 
+  {
+    size_t end = n - block < 64 ? n : block + 64;
+    uint64_t mask = 0;
+    for (size_t i = block; i < end; i++) 
+    {
+      mask |= (uint64_t)(b[i] == 0.0) << (i - block);
+    }
+    zero_mask[block / 64] = mask;
+    zeros += __builtin_popcountll(mask);
+  }
+  return zeros;
+}
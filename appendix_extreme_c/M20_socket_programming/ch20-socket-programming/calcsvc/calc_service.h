@@ -13,6 +13,9 @@
  *
  * Now, go to the 'calc_service.c' to understand better the functions implemented.
 */
+#include <stddef.h>
+#include <stdint.h>
+
 #include <types.h>
 
 // Calculation status
@@ -21,6 +24,7 @@ static const int CALC_SVC_ERROR_DIV_BY_ZERO = -1;
 
 // Forward declaration
 struct calc_service_t;
+struct calc_register_t;
 
 // Memory management function
 struct calc_service_t* calc_service_new();
@@ -30,6 +34,10 @@ void calc_service_delete(struct calc_service_t*);
 void calc_service_ctor(struct calc_service_t*);
 void calc_service_dtor(struct calc_service_t*);
 
+// Memory shared with other services (see calc_registers.h), NULL for the own memory
+void calc_service_set_register(struct calc_service_t*, struct calc_register_t*);
+struct calc_register_t* calc_service_get_register(struct calc_service_t*);
+
 // Methods of the service class
 void calc_service_reset_mem(struct calc_service_t*);
 double calc_service_get_mem(struct calc_service_t*);
@@ -42,4 +50,15 @@ double calc_service_mul(struct calc_service_t*, double, double b,
 int calc_service_div(struct calc_service_t*, double,
         double, double*);
 
+// Bulk methods, one operation per element of the arrays (without memory, so the elements are
+// independent and the compiler can evaluate several of them with a single SIMD instruction)
+void calc_service_add_n(struct calc_service_t*, const double* a, const double* b, double* out,
+    size_t n);
+void calc_service_sub_n(struct calc_service_t*, const double* a, const double* b, double* out,
+    size_t n);
+void calc_service_mul_n(struct calc_service_t*, const double* a, const double* b, double* out,
+    size_t n);
+size_t calc_service_div_n(struct calc_service_t*, const double* a, const double* b, double* out,
+    uint64_t* zero_mask, size_t n);
+
 #endif
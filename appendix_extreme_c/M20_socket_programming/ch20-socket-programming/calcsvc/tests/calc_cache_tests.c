@@ -0,0 +1,136 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <cmocka.h>
+
+#include <calc_service.h>
+#include <calc_cache.h>
+
+#define EPSILON 0.000001
+#define THREADS 8
+#define OPERATIONS 200000
+#define KEYS 64
+
+#define OP_ADD 3
+#define OP_DIV 9
+
+struct calc_cache_t* cache = NULL;
+
+void calc_cache__get_and_put(void** state) {
+  calc_cache_ctor(cache, 1024);
+  int status = -1;
+  double result = 0.0;
+  assert_false(calc_cache_get(cache, OP_ADD, 1.5, 2.0, &status, &result));
+  calc_cache_put(cache, OP_ADD, 1.5, 2.0, CALC_SVC_OK, 3.5);
+  assert_true(calc_cache_get(cache, OP_ADD, 1.5, 2.0, &status, &result));
+  assert_int_equal(status, CALC_SVC_OK);
+  assert_float_equal(result, 3.5, EPSILON);
+
+  // Other operation, other operands
+  assert_false(calc_cache_get(cache, OP_DIV, 1.5, 2.0, &status, &result));
+  assert_false(calc_cache_get(cache, OP_ADD, 2.0, 1.5, &status, &result));
+}
+
+void calc_cache__div_by_zero(void** state) {
+  calc_cache_ctor(cache, 1024);
+  int status = -1;
+  double result = -1.0;
+  calc_cache_put(cache, OP_DIV, 1.0, 0.0, CALC_SVC_ERROR_DIV_BY_ZERO, 0.0);
+  assert_true(calc_cache_get(cache, OP_DIV, 1.0, 0.0, &status, &result));
+  assert_int_equal(status, CALC_SVC_ERROR_DIV_BY_ZERO);
+  assert_float_equal(result, 0.0, EPSILON);
+
+  // The keys are the bits of the operands, -0.0 is not 0.0
+  assert_false(calc_cache_get(cache, OP_DIV, 1.0, -0.0, &status, &result));
+}
+
+void calc_cache__clock_eviction(void** state) {
+  // A single set, the results used since the last eviction are kept
+  calc_cache_ctor(cache, CALC_CACHE_WAYS);
+  int status;
+  double result;
+  for (int i = 0; i < CALC_CACHE_WAYS; i++) {
+    calc_cache_put(cache, OP_ADD, i, 0.0, CALC_SVC_OK, i);
+  }
+  assert_true(calc_cache_get(cache, OP_ADD, 0.0, 0.0, &status, &result));
+  assert_true(calc_cache_get(cache, OP_ADD, 2.0, 0.0, &status, &result));
+  calc_cache_put(cache, OP_ADD, 100.0, 0.0, CALC_SVC_OK, 100.0);
+  calc_cache_put(cache, OP_ADD, 101.0, 0.0, CALC_SVC_OK, 101.0);
+  assert_true(calc_cache_get(cache, OP_ADD, 0.0, 0.0, &status, &result));
+  assert_true(calc_cache_get(cache, OP_ADD, 2.0, 0.0, &status, &result));
+  assert_true(calc_cache_get(cache, OP_ADD, 100.0, 0.0, &status, &result));
+  assert_float_equal(result, 100.0, EPSILON);
+  assert_true(calc_cache_get(cache, OP_ADD, 101.0, 0.0, &status, &result));
+  assert_false(calc_cache_get(cache, OP_ADD, 1.0, 0.0, &status, &result));
+  assert_false(calc_cache_get(cache, OP_ADD, 3.0, 0.0, &status, &result));
+}
+
+void* get_and_put(void* arg) {
+  unsigned seed = (unsigned)(size_t)arg;
+  long* hits = (long*)calloc(1, sizeof(long));
+  for (int i = 0; i < OPERATIONS; i++) {
+    double a = rand_r(&seed) % KEYS;
+    double b = rand_r(&seed) % 3;
+    int status;
+    double result;
+    if (calc_cache_get(cache, OP_DIV, a, b, &status, &result)) {
+      // A hit is never a mix of two results
+      if (b == 0.0) {
+        assert_int_equal(status, CALC_SVC_ERROR_DIV_BY_ZERO);
+      } else {
+        assert_int_equal(status, CALC_SVC_OK);
+        assert_float_equal(result, a / b, EPSILON);
+      }
+      (*hits)++;
+      continue;
+    }
+    if (b == 0.0) {
+      calc_cache_put(cache, OP_DIV, a, b, CALC_SVC_ERROR_DIV_BY_ZERO, 0.0);
+    } else {
+      calc_cache_put(cache, OP_DIV, a, b, CALC_SVC_OK, a / b);
+    }
+  }
+  return hits;
+}
+
+void calc_cache__concurrent(void** state) {
+  // Fewer slots than keys, the threads replace the results of the others all the time
+  calc_cache_ctor(cache, KEYS);
+  pthread_t threads[THREADS];
+  for (int i = 0; i < THREADS; i++) {
+    pthread_create(&threads[i], NULL, get_and_put, (void*)(size_t)(i + 1));
+  }
+  long hits = 0;
+  for (int i = 0; i < THREADS; i++) {
+    long* thread_hits;
+    pthread_join(threads[i], (void**)&thread_hits);
+    hits += *thread_hits;
+    free(thread_hits);
+  }
+  assert_true(hits > 0);
+}
+
+int setup(void** state) {
+  cache = calc_cache_new();
+  return 0;
+}
+
+int teardown(void** state) {
+  calc_cache_dtor(cache);
+  calc_cache_delete(cache);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(calc_cache__get_and_put, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_cache__div_by_zero, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_cache__clock_eviction, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_cache__concurrent, setup, teardown)
+  };
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,114 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <cmocka.h>
+
+#include <calc_service.h>
+#include <calc_registers.h>
+
+#define EPSILON 0.000001
+#define THREADS 16
+#define UPDATES 20000
+
+struct calc_registers_t* regs = NULL;
+
+void calc_registers__get_by_name(void** state) {
+  struct calc_register_t* total = calc_registers_get(regs, "total");
+  assert_non_null(total);
+  assert_ptr_equal(calc_registers_get(regs, "total"), total);
+  assert_ptr_not_equal(calc_registers_get(regs, "other"), total);
+  assert_float_equal(calc_register_load(total), 0.0, EPSILON);
+
+  // Names too long or a full table
+  char name[CALC_REGISTER_NAME_LEN + 1];
+  memset(name, 'x', CALC_REGISTER_NAME_LEN);
+  name[CALC_REGISTER_NAME_LEN] = '\0';
+  assert_null(calc_registers_get(regs, name));
+  for (int i = 2; i < CALC_REGISTERS_CAPACITY; i++) {
+    sprintf(name, "reg%d", i);
+    assert_non_null(calc_registers_get(regs, name));
+  }
+  assert_null(calc_registers_get(regs, "one_too_many"));
+  assert_ptr_equal(calc_registers_get(regs, "total"), total);
+}
+
+void calc_registers__shared_by_services(void** state) {
+  struct calc_register_t* total = calc_registers_get(regs, "total");
+  struct calc_service_t* first = calc_service_new();
+  struct calc_service_t* second = calc_service_new();
+  calc_service_ctor(first);
+  calc_service_ctor(second);
+  calc_service_set_register(first, total);
+  calc_service_set_register(second, total);
+
+  // The same operations as the memory of a single service
+  assert_float_equal(calc_service_add(first, 1.0, 2.0, TRUE), 3.0, EPSILON);
+  assert_float_equal(calc_service_add(second, 4.0, 0.0, TRUE), 7.0, EPSILON);
+  assert_float_equal(calc_service_mul(first, 2.0, 1.0, TRUE), 14.0, EPSILON);
+  assert_float_equal(calc_service_sub(second, 20.0, 0.0, TRUE), 6.0, EPSILON);
+  assert_float_equal(calc_service_get_mem(first), 6.0, EPSILON);
+  assert_float_equal(calc_service_add(first, 1.0, 1.0, FALSE), 2.0, EPSILON);
+  calc_service_reset_mem(second);
+  assert_float_equal(calc_service_get_mem(first), 0.0, EPSILON);
+
+  // Back to its own memory
+  calc_service_set_register(first, NULL);
+  calc_service_add(first, 5.0, 0.0, TRUE);
+  assert_float_equal(calc_register_load(total), 0.0, EPSILON);
+  assert_float_equal(calc_service_get_mem(first), 5.0, EPSILON);
+
+  calc_service_dtor(first);
+  calc_service_delete(first);
+  calc_service_dtor(second);
+  calc_service_delete(second);
+}
+
+void* add_ones(void* arg) {
+  struct calc_service_t* svc = calc_service_new();
+  calc_service_ctor(svc);
+  calc_service_set_register(svc, calc_registers_get(regs, (const char*)arg));
+  for (int i = 0; i < UPDATES; i++) {
+    calc_service_add(svc, 1.0, 0.0, TRUE);
+  }
+  calc_service_dtor(svc);
+  calc_service_delete(svc);
+  return NULL;
+}
+
+void calc_registers__no_lost_updates(void** state) {
+  // The threads create the register at the same time too
+  pthread_t threads[THREADS];
+  for (int i = 0; i < THREADS; i++) {
+    pthread_create(&threads[i], NULL, add_ones, "contended");
+  }
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  assert_float_equal(calc_register_load(calc_registers_get(regs, "contended")),
+      THREADS * UPDATES, EPSILON);
+}
+
+int setup(void** state) {
+  regs = calc_registers_new();
+  calc_registers_ctor(regs);
+  return 0;
+}
+
+int teardown(void** state) {
+  calc_registers_dtor(regs);
+  calc_registers_delete(regs);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(calc_registers__get_by_name, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_registers__shared_by_services, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_registers__no_lost_updates, setup, teardown)
+  };
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -7,6 +7,7 @@
 #include <cmocka.h>
 
 #include <calc_service.h>
+#include <calc_program.h>
 
 #define EPSILON 0.000001
 
@@ -97,6 +98,94 @@ void calc_service__div_by_zero(void** state) {
   assert_float_equal(result, 0.0, EPSILON);
 }
 
+void calc_service__bulk(void** state) {
+  calc_service_ctor(svc);
+  double a[100], b[100], out[100];
+  for (int i = 0; i < 100; i++) {
+    a[i] = i * 1.5;
+    b[i] = 100 - i;
+  }
+  calc_service_add_n(svc, a, b, out, 100);
+  for (int i = 0; i < 100; i++) {
+    assert_float_equal(out[i], calc_service_add(svc, a[i], b[i], FALSE), EPSILON);
+  }
+  calc_service_sub_n(svc, a, b, out, 99);
+  for (int i = 0; i < 99; i++) {
+    assert_float_equal(out[i], calc_service_sub(svc, a[i], b[i], FALSE), EPSILON);
+  }
+  calc_service_mul_n(svc, a, b, a, 100);
+  for (int i = 0; i < 100; i++) {
+    assert_float_equal(a[i], i * 1.5 * (100 - i), EPSILON);
+  }
+  assert_float_equal(0.0, calc_service_get_mem(svc), EPSILON);
+}
+
+void calc_service__bulk_div_by_zero(void** state) {
+  calc_service_ctor(svc);
+  double a[70], b[70], out[70];
+  uint64_t mask[2];
+  for (int i = 0; i < 70; i++) {
+    a[i] = -7.81;
+    b[i] = (i == 3 || i == 65) ? 0.0 : -2.3;
+  }
+  assert_int_equal(calc_service_div_n(svc, a, b, out, mask, 70), 2);
+  assert_true(mask[0] == (uint64_t)1 << 3);
+  assert_true(mask[1] == (uint64_t)1 << 1);
+  for (int i = 0; i < 70; i++) {
+    assert_float_equal(out[i], (i == 3 || i == 65) ? 0.0 : 3.395652, EPSILON);
+  }
+  assert_int_equal(calc_service_div_n(svc, a, b, out, mask, 3), 0);
+  assert_true(mask[0] == 0);
+}
+
+// Program of the given instructions, the numbers are taken in order by the pushes
+struct calc_program_t make_program(const uint8_t* code, int len, const double* nums, int nums_len) {
+  struct calc_program_t program;
+  program.len = len;
+  program.nums_len = nums_len;
+  memcpy(program.code, code, len);
+  memcpy(program.nums, nums, nums_len * sizeof(double));
+  return program;
+}
+
+void calc_program__arithmetic(void** state) {
+  calc_service_ctor(svc);
+  // (2 + 3) * 4 - 10 / 4
+  uint8_t code[] = {CALC_OP_PUSH, CALC_OP_PUSH, CALC_OP_ADD, CALC_OP_PUSH, CALC_OP_MUL,
+      CALC_OP_PUSH, CALC_OP_PUSH, CALC_OP_DIV, CALC_OP_SUB};
+  double nums[] = {2.0, 3.0, 4.0, 10.0, 4.0};
+  struct calc_program_t program = make_program(code, sizeof(code), nums, 5);
+  double result = 0.0;
+  assert_int_equal(calc_program_run(&program, svc, &result), CALC_SVC_OK);
+  assert_float_equal(result, 17.5, EPSILON);
+  assert_float_equal(calc_service_get_mem(svc), 0.0, EPSILON);
+}
+
+void calc_program__memory(void** state) {
+  calc_service_ctor(svc);
+  calc_service_add(svc, 7.0, 0.0, TRUE);
+  // MC 10 0 M+ 3 1 M* + M M-, the same as the requests one by one
+  uint8_t code[] = {CALC_OP_RESMEM, CALC_OP_PUSH, CALC_OP_PUSH, CALC_OP_ADDM, CALC_OP_PUSH,
+      CALC_OP_PUSH, CALC_OP_MULM, CALC_OP_ADD, CALC_OP_GETMEM, CALC_OP_SUBM};
+  double nums[] = {10.0, 0.0, 3.0, 1.0};
+  struct calc_program_t program = make_program(code, sizeof(code), nums, 4);
+  double result = 0.0;
+  assert_int_equal(calc_program_run(&program, svc, &result), CALC_SVC_OK);
+  assert_float_equal(result, -20.0, EPSILON);
+  assert_float_equal(calc_service_get_mem(svc), -20.0, EPSILON);
+}
+
+void calc_program__div_by_zero(void** state) {
+  calc_service_ctor(svc);
+  // 1 0 / stops the program, the memory is not updated
+  uint8_t code[] = {CALC_OP_PUSH, CALC_OP_PUSH, CALC_OP_DIV, CALC_OP_PUSH, CALC_OP_ADDM};
+  double nums[] = {1.0, 0.0, 5.0};
+  struct calc_program_t program = make_program(code, sizeof(code), nums, 3);
+  double result = 0.0;
+  assert_int_equal(calc_program_run(&program, svc, &result), CALC_SVC_ERROR_DIV_BY_ZERO);
+  assert_float_equal(calc_service_get_mem(svc), 0.0, EPSILON);
+}
+
 int setup(void** state) {
   svc =  calc_service_new();
   return 0;
@@ -117,7 +206,12 @@ int main(int argc, char** argv) {
     cmocka_unit_test_setup_teardown(calc_service__mul_without_memory, setup, teardown),
     cmocka_unit_test_setup_teardown(calc_service__mul_with_memory, setup, teardown),
     cmocka_unit_test_setup_teardown(calc_service__div, setup, teardown),
-    cmocka_unit_test_setup_teardown(calc_service__div_by_zero, setup, teardown)
+    cmocka_unit_test_setup_teardown(calc_service__div_by_zero, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_service__bulk, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_service__bulk_div_by_zero, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_program__arithmetic, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_program__memory, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_program__div_by_zero, setup, teardown)
   };
   return cmocka_run_group_tests(tests, NULL, NULL);
 }
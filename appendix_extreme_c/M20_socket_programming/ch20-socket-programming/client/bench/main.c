@@ -0,0 +1,744 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include <calc_proto_ser.h>
+#include <calc_proto_prog.h>
+#include <hdr_histogram.h>
+
+/**
+ * The interactive clients are good to learn the protocol, but they can't tell how fast a server
+ * is. This load generator opens several connections to a calculator server and measures the
+ * throughput and the latency of every request, in one of two ways:
+ *
+ * - Closed loop (default): every connection keeps 'depth' requests in flight, it sends them in a
+ *   single write, waits for all the responses, and repeats. It finds the highest throughput, but
+ *   a slow response delays the next requests, so the latency of a loaded server looks better than
+ *   it is (the "coordinated omission" of Gil Tene).
+ * - Open loop (-r): the connections send requests at a fixed total rate, no matter how many
+ *   responses are pending, and every latency is measured from the moment the request should have
+ *   been sent. Running it at increasing rates shows where the latency of the server explodes.
+ *
+ *    calc_bench [-t tcp|unix|udp] [-a host|path] [-p port] [-c conns] [-d depth] [-r rate]
+ *               [-m mix] [-s seconds] [-H file] [-b]
+ *
+ * The latencies go to an HDR histogram per connection (see hdr_histogram.h). The summary prints
+ * the p50, p99 and p99.9, and -H writes the whole percentile distribution to a file ('-' for the
+ * standard output). The mix chooses the methods of the requests with weights, the memory methods
+ * included, and the option -b negotiates the binary frames instead of the text messages:
+ *
+ *    ./calc_bench -t tcp -c 4 -d 64                        // Text messages over TCP
+ *    ./calc_bench -t tcp -c 4 -d 64 -b                     // Binary frames over TCP
+ *    ./calc_bench -t unix -c 4 -r 100000 -H unix.hgrm      // 100k req/s, full distribution
+ *    ./calc_bench -t unix -m add=4,mul=2,div=1,addm=1      // Weighted mix of methods
+ *
+ * The EVAL requests of the mix all send the program EVAL_PROGRAM, which does the work of four
+ * ADD, SUB, MUL and DIV requests in a single round trip.
+*/
+
+#define MAX_DEPTH 1024
+#define RECV_BUFFER_SIZE 65536
+#define MAX_MIX 1000
+#define EVAL_PROGRAM "2 3 + 4 * 1 - 5 /"
+
+// Send times kept per connection in open loop (the requests in flight can't be more)
+#define OPEN_LOOP_RING 65536
+
+// Latencies up to 10 s (in nanoseconds) with 3 significant digits
+#define HIST_HIGHEST 10000000000L
+#define HIST_DIGITS 3
+
+// Options of the benchmark
+struct bench_options_t
+{
+  const char* transport;
+  const char* address;
+  int port;
+  int conns;
+  int depth;
+  double rate;          // Total requests per second in open loop, 0 for closed loop
+  int seconds;
+  int binary;
+  const char* hist_file;
+  method_t mix[MAX_MIX]; // Every method appears as many times as its weight
+  int mix_len;
+  struct calc_program_t program; // Program of the EVAL requests
+};
+
+// State of every connection. The responses are read by the thread of the connection, and in
+// open loop the requests are written by a second thread.
+struct bench_conn_t
+{
+  const struct bench_options_t* opts;
+  int index;
+  int sd;
+  struct calc_proto_ser_t* ser;
+  pthread_t thread;
+  pthread_t sender;
+  uint64_t random;
+  struct hdr_histogram_t* hist;
+  _Atomic int64_t* sent_at;    // Send time of every request, by ID (a ring)
+  int ring_mask;
+  int64_t now;                 // Time of the last read, the arrival time of its responses
+  atomic_long sent;
+  atomic_long answered;
+  atomic_int sender_done;
+  long responses;
+  long errors;
+  long lost;
+};
+
+atomic_int stop = 0;
+
+/**
+ * Current time in nanoseconds (monotonic)
+*/
+int64_t bench_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * Response callback, it records the latency of the request
+ *
+ * @param obj Pointer to the connection
+ * @param resp Response received
+*/
+void bench_on_response(void* obj, struct calc_proto_resp_t resp)
+{
+  struct bench_conn_t* conn = (struct bench_conn_t*)obj;
+  int64_t sent_at = atomic_load_explicit(&conn->sent_at[resp.req_id & conn->ring_mask],
+      memory_order_acquire);
+  hdr_histogram_record(conn->hist, conn->now - sent_at);
+  atomic_store_explicit(&conn->answered, atomic_load_explicit(&conn->answered,
+      memory_order_relaxed) + 1, memory_order_release);
+  conn->responses++;
+  if (resp.status != STATUS_OK && resp.status != STATUS_DIV_BY_ZERO)
+  {
+    conn->errors++;
+  }
+}
+
+/**
+ * Error callback, invalid responses are counted as errors
+ *
+ * @param obj Pointer to the connection
+ * @param req_id Request ID (if known)
+ * @param error_code Error code raised by the serializer
+*/
+void bench_on_error(void* obj, int req_id, int error_code)
+{
+  struct bench_conn_t* conn = (struct bench_conn_t*)obj;
+  atomic_store_explicit(&conn->answered, atomic_load_explicit(&conn->answered,
+      memory_order_relaxed) + 1, memory_order_release);
+  conn->errors++;
+}
+
+/**
+ * Create a socket connected to the server according to the options
+ *
+ * @param opts Options of the benchmark
+ *
+ * @return Socket descriptor, or -1 in case of error
+*/
+int bench_connect(const struct bench_options_t* opts)
+{
+  int sd;
+  if (!strcmp(opts->transport, "unix"))
+  {
+    sd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, opts->address, sizeof(addr.sun_path) - 1);
+    if (sd == -1 || connect(sd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+    {
+      fprintf(stderr, "Could not connect: %s\n", strerror(errno));
+      return -1;
+    }
+    return sd;
+  }
+
+  sd = socket(AF_INET, strcmp(opts->transport, "udp") ? SOCK_STREAM : SOCK_DGRAM, 0);
+  struct hostent* host_entry = gethostbyname(opts->address);
+  if (sd == -1 || !host_entry)
+  {
+    fprintf(stderr, "Could not resolve the host '%s'\n", opts->address);
+    return -1;
+  }
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr = *((struct in_addr*)host_entry->h_addr);
+  addr.sin_port = htons(opts->port);
+  if (connect(sd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+  {
+    fprintf(stderr, "Could not connect: %s\n", strerror(errno));
+    return -1;
+  }
+  return sd;
+}
+
+/**
+ * Parse the mix of methods, a list of methods with optional weights: "add=4,mul=2,div,addm"
+ *
+ * @param opts Options where the mix is stored
+ * @param text Mix given in the command line
+ *
+ * @return 0 on success, -1 if the mix is not valid
+*/
+int bench_parse_mix(struct bench_options_t* opts, const char* text)
+{
+  char copy[256];
+  strncpy(copy, text, sizeof(copy) - 1);
+  copy[sizeof(copy) - 1] = '\0';
+  opts->mix_len = 0;
+  char* saveptr = NULL;
+  for (char* item = strtok_r(copy, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr))
+  {
+    int weight = 1;
+    char* equal = strchr(item, '=');
+    if (equal)
+    {
+      *equal = '\0';
+      weight = atoi(equal + 1);
+    }
+    for (char* c = item; *c; c++)
+    {
+      *c = toupper((unsigned char)*c);
+    }
+    method_t method = str_to_method(item);
+    if (method == NONE || weight < 0 || opts->mix_len + weight > MAX_MIX)
+    {
+      return -1;
+    }
+    for (int i = 0; i < weight; i++)
+    {
+      opts->mix[opts->mix_len++] = method;
+    }
+  }
+  return opts->mix_len > 0 ? 0 : -1;
+}
+
+/**
+ * Fill a request of the workload, with a method of the mix chosen at random (every connection has
+ * its own generator, so the sequence is the same in every run)
+ *
+ * @param conn Connection that sends the request
+ * @param req Request to fill
+ * @param id Identifier of the request
+*/
+void bench_make_req(struct bench_conn_t* conn, struct calc_proto_req_t* req, int id)
+{
+  // xorshift64
+  conn->random ^= conn->random << 13;
+  conn->random ^= conn->random >> 7;
+  conn->random ^= conn->random << 17;
+  req->id = id;
+  req->method = conn->opts->mix[conn->random % conn->opts->mix_len];
+  req->operand1 = id % 1000;
+  req->operand2 = 1.5 + id % 7;
+  req->program = &conn->opts->program;
+}
+
+/**
+ * Write the whole buffer (a stream socket could accept less bytes than requested)
+ *
+ * @return 0 on success, -1 on error
+*/
+int bench_write_all(int sd, const char* data, int len)
+{
+  while (len > 0)
+  {
+    int ret = write(sd, data, len);
+    if (ret == -1)
+    {
+      return -1;
+    }
+    data += ret;
+    len -= ret;
+  }
+  return 0;
+}
+
+/**
+ * Read once from the socket and deliver the responses found, all of them with the same arrival
+ * time
+ *
+ * @param conn Connection in use
+ * @param in Buffer for the data read
+ * @param size Size of the buffer
+ *
+ * @return The value returned by read
+*/
+int bench_read_responses(struct bench_conn_t* conn, char* in, int size)
+{
+  int ret = read(conn->sd, in, size);
+  if (ret <= 0)
+  {
+    return ret;
+  }
+  conn->now = bench_now();
+
+  // Binary replies of a datagram carry the hello byte before the frame
+  int prefix = conn->opts->binary && !strcmp(conn->opts->transport, "udp") ? 1 : 0;
+  struct buffer_t buf;
+  buf.data = in + prefix;
+  buf.len = ret - prefix;
+  calc_proto_ser_client_deserialize(conn->ser, buf, NULL);
+  return ret;
+}
+
+/**
+ * Serialize the next request of the connection in 'out', remembering when it is sent
+ *
+ * @param conn Connection in use
+ * @param out Where the request is serialized (the datagrams start with the hello byte in binary)
+ * @param cap Space available
+ * @param sent_at Time of the request (the planned one in open loop)
+ *
+ * @return Bytes written
+*/
+int bench_serialize_next(struct bench_conn_t* conn, char* out, int cap, int64_t sent_at)
+{
+  long id = atomic_load_explicit(&conn->sent, memory_order_relaxed);
+  struct calc_proto_req_t req;
+  bench_make_req(conn, &req, (int)id);
+  atomic_store_explicit(&conn->sent_at[id & conn->ring_mask], sent_at, memory_order_release);
+  atomic_store_explicit(&conn->sent, id + 1, memory_order_relaxed);
+
+  int prefix = 0;
+  if (conn->opts->binary && !strcmp(conn->opts->transport, "udp"))
+  {
+    out[0] = (char)CALC_PROTO_BINARY_HELLO;
+    prefix = 1;
+  }
+  return prefix + calc_proto_ser_client_serialize_to(conn->ser, &req, out + prefix, cap - prefix);
+}
+
+/**
+ * Closed loop of a stream connection: write 'depth' requests at once and wait for their responses
+ *
+ * @param conn Connection in use
+*/
+void bench_stream_loop(struct bench_conn_t* conn)
+{
+  static __thread char out[MAX_DEPTH * CALC_PROTO_MAX_MSG_LEN];
+  static __thread char in[RECV_BUFFER_SIZE];
+  while (!atomic_load(&stop))
+  {
+    int64_t now = bench_now();
+    int len = 0;
+    for (int i = 0; i < conn->opts->depth; i++)
+    {
+      len += bench_serialize_next(conn, out + len, sizeof(out) - len, now);
+    }
+    if (bench_write_all(conn->sd, out, len) == -1)
+    {
+      fprintf(stderr, "Error while writing! %s\n", strerror(errno));
+      return;
+    }
+    while (atomic_load(&conn->answered) < atomic_load(&conn->sent))
+    {
+      if (bench_read_responses(conn, in, sizeof(in)) <= 0)
+      {
+        fprintf(stderr, "Connection closed by the server\n");
+        return;
+      }
+    }
+  }
+}
+
+/**
+ * Closed loop of a datagram "connection": one datagram per request, lost responses are detected
+ * with a receive timeout.
+ *
+ * @param conn Connection in use
+*/
+void bench_datagram_loop(struct bench_conn_t* conn)
+{
+  char out[CALC_PROTO_MAX_MSG_LEN + 1];
+  char in[CALC_PROTO_MAX_MSG_LEN + 1];
+  while (!atomic_load(&stop))
+  {
+    int64_t now = bench_now();
+    for (int i = 0; i < conn->opts->depth; i++)
+    {
+      int len = bench_serialize_next(conn, out, sizeof(out), now);
+      if (write(conn->sd, out, len) == -1)
+      {
+        fprintf(stderr, "Error while writing! %s\n", strerror(errno));
+        return;
+      }
+    }
+    long expected = conn->responses + conn->errors + conn->opts->depth;
+    while (conn->responses + conn->errors < expected)
+    {
+      if (bench_read_responses(conn, in, sizeof(in)) <= 0)
+      {
+        // Timeout, the rest of the responses (or requests) were dropped
+        conn->lost += expected - conn->responses - conn->errors;
+        break;
+      }
+    }
+
+    // The responses that arrive late are not waited for again
+    atomic_store(&conn->answered, atomic_load(&conn->sent));
+  }
+}
+
+/**
+ * Sender of the open loop: every 1 / rate seconds a request is due, and all the requests due are
+ * sent together (in one write on a stream). If the server falls behind the requests keep their
+ * planned time, so the time they wait to be sent counts in their latency.
+ *
+ * @param obj Pointer to the connection
+ *
+ * @return NULL when the benchmark finishes
+*/
+void* bench_open_loop_sender(void* obj)
+{
+  static __thread char out[MAX_DEPTH * CALC_PROTO_MAX_MSG_LEN];
+  struct bench_conn_t* conn = (struct bench_conn_t*)obj;
+  const struct bench_options_t* opts = conn->opts;
+  int datagram = !strcmp(opts->transport, "udp");
+  double interval = 1e9 * opts->conns / opts->rate;
+
+  // The connections start at different moments of the interval, so they don't send together
+  int64_t start = bench_now();
+  long due = 0;
+  double first = interval * conn->index / opts->conns;
+  while (!atomic_load(&stop))
+  {
+    int64_t now = bench_now();
+    int len = 0;
+    int count = 0;
+    int64_t planned;
+    while ((planned = start + (int64_t)(first + interval * due)) <= now && count < MAX_DEPTH)
+    {
+      // A stream can't lose responses, so its ring only fills if the server stops answering
+      if (!datagram && atomic_load_explicit(&conn->sent, memory_order_relaxed) -
+          atomic_load_explicit(&conn->answered, memory_order_acquire) > conn->ring_mask)
+      {
+        break;
+      }
+      if (datagram)
+      {
+        len = bench_serialize_next(conn, out, sizeof(out), planned);
+        if (write(conn->sd, out, len) == -1 && errno != ENOBUFS)
+        {
+          fprintf(stderr, "Error while writing! %s\n", strerror(errno));
+          atomic_store(&conn->sender_done, 1);
+          return NULL;
+        }
+        len = 0;
+      }
+      else
+      {
+        len += bench_serialize_next(conn, out + len, sizeof(out) - len, planned);
+      }
+      due++;
+      count++;
+    }
+    if (len > 0 && bench_write_all(conn->sd, out, len) == -1)
+    {
+      fprintf(stderr, "Error while writing! %s\n", strerror(errno));
+      break;
+    }
+
+    // Sleep until the next request is due (or a bit, if the ring is full)
+    if (planned > now || count == 0)
+    {
+      struct timespec wake;
+      int64_t until = planned > now ? planned : now + 50000;
+      wake.tv_sec = until / 1000000000L;
+      wake.tv_nsec = until % 1000000000L;
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+    }
+  }
+  atomic_store(&conn->sender_done, 1);
+  return NULL;
+}
+
+/**
+ * Receiver of the open loop. After the end of the benchmark it waits up to one second for the
+ * responses pending, the ones that don't arrive are counted as lost.
+ *
+ * @param conn Connection in use
+*/
+void bench_open_loop(struct bench_conn_t* conn)
+{
+  static __thread char in[RECV_BUFFER_SIZE];
+  struct timeval timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 100000;
+  setsockopt(conn->sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  pthread_create(&conn->sender, NULL, bench_open_loop_sender, conn);
+  int64_t deadline = 0;
+  while (1)
+  {
+    if (atomic_load(&conn->sender_done))
+    {
+      if (atomic_load(&conn->answered) >= atomic_load(&conn->sent))
+      {
+        break;
+      }
+      if (!deadline)
+      {
+        deadline = bench_now() + 1000000000L;
+      }
+      else if (bench_now() > deadline)
+      {
+        break;
+      }
+    }
+    int ret = bench_read_responses(conn, in, sizeof(in));
+    if (ret == 0 || (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+    {
+      fprintf(stderr, "Connection closed by the server\n");
+      atomic_store(&stop, 1);
+      break;
+    }
+  }
+  pthread_join(conn->sender, NULL);
+  conn->lost = atomic_load(&conn->sent) - atomic_load(&conn->answered);
+}
+
+/**
+ * Thread of a connection
+ *
+ * @param obj Pointer to the connection
+ *
+ * @return NULL when the benchmark finishes
+*/
+void* bench_conn_thread(void* obj)
+{
+  struct bench_conn_t* conn = (struct bench_conn_t*)obj;
+  if (conn->opts->rate > 0)
+  {
+    bench_open_loop(conn);
+  }
+  else if (!strcmp(conn->opts->transport, "udp"))
+  {
+    bench_datagram_loop(conn);
+  }
+  else
+  {
+    bench_stream_loop(conn);
+  }
+  return NULL;
+}
+
+/**
+ * Print how the tool is used and exit
+*/
+void usage(const char* name)
+{
+  fprintf(stderr, "Usage: %s [-t tcp|unix|udp] [-a host|path] [-p port] [-c conns] "
+      "[-d depth] [-r rate] [-m mix] [-s seconds] [-H file] [-b]\n", name);
+  fprintf(stderr, "  -d depth    Requests in flight per connection (closed loop)\n");
+  fprintf(stderr, "  -r rate     Total requests per second (open loop)\n");
+  fprintf(stderr, "  -m mix      Methods and weights, default add,sub,mul,div\n");
+  fprintf(stderr, "  -H file     Write the latency distribution ('-' for the standard output)\n");
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  struct bench_options_t opts;
+  opts.transport = "tcp";
+  opts.address = NULL;
+  opts.port = 0;
+  opts.conns = 1;
+  opts.depth = 16;
+  opts.rate = 0;
+  opts.seconds = 5;
+  opts.binary = 0;
+  opts.hist_file = NULL;
+  bench_parse_mix(&opts, "add,sub,mul,div");
+  calc_proto_prog_compile(EVAL_PROGRAM, strlen(EVAL_PROGRAM), &opts.program);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:a:p:c:d:r:m:s:H:b")) != -1)
+  {
+    switch (opt)
+    {
+      case 't': opts.transport = optarg; break;
+      case 'a': opts.address = optarg; break;
+      case 'p': opts.port = atoi(optarg); break;
+      case 'c': opts.conns = atoi(optarg); break;
+      case 'd': opts.depth = atoi(optarg); break;
+      case 'r': opts.rate = atof(optarg); break;
+      case 's': opts.seconds = atoi(optarg); break;
+      case 'H': opts.hist_file = optarg; break;
+      case 'b': opts.binary = 1; break;
+      case 'm':
+        if (bench_parse_mix(&opts, optarg) == -1)
+        {
+          fprintf(stderr, "Invalid mix of methods '%s'\n", optarg);
+          usage(argv[0]);
+        }
+        break;
+      default: usage(argv[0]);
+    }
+  }
+  if (strcmp(opts.transport, "tcp") && strcmp(opts.transport, "unix") &&
+      strcmp(opts.transport, "udp"))
+  {
+    usage(argv[0]);
+  }
+  if (opts.conns < 1 || opts.depth < 1 || opts.depth > MAX_DEPTH || opts.seconds < 1 ||
+      opts.rate < 0)
+  {
+    usage(argv[0]);
+  }
+
+  // Same defaults as the servers of this project
+  if (!opts.address)
+  {
+    opts.address = strcmp(opts.transport, "unix") ? "localhost" : "/tmp/calc_svc.sock";
+  }
+  if (!opts.port)
+  {
+    opts.port = strcmp(opts.transport, "udp") ? 6666 : 9999;
+  }
+
+  // The closed loop only needs the send times of one round of requests
+  int ring = OPEN_LOOP_RING;
+  if (opts.rate == 0)
+  {
+    for (ring = 2; ring < opts.depth; ring *= 2);
+  }
+
+  struct bench_conn_t* conns = calloc(opts.conns, sizeof(struct bench_conn_t));
+  for (int i = 0; i < opts.conns; i++)
+  {
+    conns[i].opts = &opts;
+    conns[i].index = i;
+    conns[i].random = 0x9E3779B97F4A7C15ULL * (i + 1);
+    conns[i].hist = hdr_histogram_new();
+    hdr_histogram_ctor(conns[i].hist, HIST_HIGHEST, HIST_DIGITS);
+    conns[i].sent_at = (_Atomic int64_t*)calloc(ring, sizeof(_Atomic int64_t));
+    conns[i].ring_mask = ring - 1;
+    atomic_init(&conns[i].sent, 0);
+    atomic_init(&conns[i].answered, 0);
+    atomic_init(&conns[i].sender_done, 0);
+    conns[i].sd = bench_connect(&opts);
+    if (conns[i].sd == -1)
+    {
+      exit(1);
+    }
+    if (!strcmp(opts.transport, "udp"))
+    {
+      struct timeval timeout;
+      timeout.tv_sec = 0;
+      timeout.tv_usec = 200000;
+      setsockopt(conns[i].sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    conns[i].ser = calc_proto_ser_new();
+    calc_proto_ser_ctor(conns[i].ser, &conns[i], RECV_BUFFER_SIZE);
+    calc_proto_ser_set_resp_callback(conns[i].ser, bench_on_response);
+    calc_proto_ser_set_error_callback(conns[i].ser, bench_on_error);
+
+    // Binary frames over a stream: send the hello and wait for the server to acknowledge it
+    if (opts.binary)
+    {
+      calc_proto_ser_set_mode(conns[i].ser, CALC_PROTO_BINARY);
+    }
+    if (opts.binary && strcmp(opts.transport, "udp"))
+    {
+      char hello = (char)CALC_PROTO_BINARY_HELLO;
+      char ack = 0;
+      if (write(conns[i].sd, &hello, 1) != 1 || read(conns[i].sd, &ack, 1) != 1 ||
+          ack != hello)
+      {
+        fprintf(stderr, "The server doesn't support binary frames\n");
+        exit(1);
+      }
+    }
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < opts.conns; i++)
+  {
+    pthread_create(&conns[i].thread, NULL, bench_conn_thread, &conns[i]);
+  }
+  sleep(opts.seconds);
+  atomic_store(&stop, 1);
+
+  long responses = 0, errors = 0, lost = 0;
+  struct hdr_histogram_t* hist = hdr_histogram_new();
+  hdr_histogram_ctor(hist, HIST_HIGHEST, HIST_DIGITS);
+  for (int i = 0; i < opts.conns; i++)
+  {
+    pthread_join(conns[i].thread, NULL);
+    responses += conns[i].responses;
+    errors += conns[i].errors;
+    lost += conns[i].lost;
+    hdr_histogram_add(hist, conns[i].hist);
+    close(conns[i].sd);
+    calc_proto_ser_dtor(conns[i].ser);
+    calc_proto_ser_delete(conns[i].ser);
+    hdr_histogram_dtor(conns[i].hist);
+    hdr_histogram_delete(conns[i].hist);
+    free(conns[i].sent_at);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  // The distribution goes first, so the summary stays the last line of the output
+  if (opts.hist_file)
+  {
+    FILE* out = strcmp(opts.hist_file, "-") ? fopen(opts.hist_file, "w") : stdout;
+    if (out)
+    {
+      hdr_histogram_print(hist, out, 5, 1000.0);
+      if (out != stdout)
+      {
+        fclose(out);
+      }
+    }
+    else
+    {
+      fprintf(stderr, "Could not write '%s': %s\n", opts.hist_file, strerror(errno));
+    }
+  }
+
+  char load[64];
+  if (opts.rate > 0)
+  {
+    snprintf(load, sizeof(load), "rate=%.0f", opts.rate);
+  }
+  else
+  {
+    snprintf(load, sizeof(load), "depth=%d", opts.depth);
+  }
+  printf("%s/%s conns=%d %s: %ld responses in %.2f s = %.0f req/s (errors: %ld, lost: %ld), "
+      "latency us p50 %.1f p99 %.1f p99.9 %.1f max %.1f\n", opts.transport,
+      opts.binary ? "binary" : "text", opts.conns, load, responses, elapsed, responses / elapsed,
+      errors, lost, hdr_histogram_value_at_percentile(hist, 50.0) / 1000.0,
+      hdr_histogram_value_at_percentile(hist, 99.0) / 1000.0,
+      hdr_histogram_value_at_percentile(hist, 99.9) / 1000.0,
+      hdr_histogram_max(hist) / 1000.0);
+  hdr_histogram_dtor(hist);
+  hdr_histogram_delete(hist);
+  free(conns);
+  return 0;
+}
@@ -0,0 +1,464 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include "calc_client.h"
+
+/**
+ * Three things make the client fast:
+ *
+ * - Pipelining: a submit only serializes the request and returns, the responses are read by a
+ *   thread of the client.
+ * - Write coalescing: the thread that finds nobody writing becomes the writer, and keeps writing
+ *   until the output buffer is empty. The requests that other threads submit meanwhile are only
+ *   appended to the buffer, so they leave in the next write, together. Without load every request
+ *   is written at once (no timers, no extra latency).
+ * - Out of order matching: every request waits in the slot 'id & mask', so the response of any of
+ *   them is found without searching. A request can't take a slot still in use, which limits the
+ *   distance between the oldest and the newest IDs in flight.
+*/
+
+#define RECV_BUFFER_SIZE 65536
+
+// Request in flight
+struct calc_client_slot_t
+{
+  int used;
+  int id;
+  calc_client_cb_t cb;
+  void* arg;
+};
+
+struct calc_client_t
+{
+  int sd;
+  struct calc_proto_ser_t* ser;
+  pthread_t reader;
+
+  pthread_mutex_t lock;                // Protects everything below
+  pthread_cond_t space;                // Signaled when a request gets its response
+  int waiters;                         // Submits waiting for space
+  struct calc_client_slot_t* slots;
+  int mask;
+  int max_inflight;
+  int inflight;
+  int next_id;
+  char* out;                           // Requests serialized, not written yet
+  char* spare;                         // Buffer being written by the writer
+  int out_len;
+  int writing;
+  int closed;
+};
+
+/**
+ * Complete a future (callback of calc_client_submit_future)
+*/
+void calc_future_complete(void* arg, int status, const struct calc_proto_resp_t* resp)
+{
+  struct calc_future_t* future = (struct calc_future_t*)arg;
+  pthread_mutex_lock(&future->lock);
+  future->status = status;
+  if (resp)
+  {
+    future->resp = *resp;
+  }
+  future->done = 1;
+  pthread_cond_signal(&future->cond);
+  pthread_mutex_unlock(&future->lock);
+}
+
+void calc_future_ctor(struct calc_future_t* future)
+{
+  pthread_mutex_init(&future->lock, NULL);
+  pthread_cond_init(&future->cond, NULL);
+  future->done = 0;
+  future->status = CALC_CLIENT_OK;
+  memset(&future->resp, 0, sizeof(future->resp));
+}
+
+void calc_future_dtor(struct calc_future_t* future)
+{
+  pthread_cond_destroy(&future->cond);
+  pthread_mutex_destroy(&future->lock);
+}
+
+/**
+ * Wait for the response of a future
+ *
+ * @param future Future given to calc_client_submit_future
+ * @param resp Set to the response
+ *
+ * @return CALC_CLIENT_OK, or the error of the request (see calc_client.h)
+*/
+int calc_future_wait(struct calc_future_t* future, struct calc_proto_resp_t* resp)
+{
+  pthread_mutex_lock(&future->lock);
+  while (!future->done)
+  {
+    pthread_cond_wait(&future->cond, &future->lock);
+  }
+  *resp = future->resp;
+  int status = future->status;
+  pthread_mutex_unlock(&future->lock);
+  return status;
+}
+
+/**
+ * Release the slot of a request (the lock must be held)
+ *
+ * @param client Client
+ * @param id ID of the request
+ * @param cb Set to the callback of the request
+ * @param arg Set to the argument of the callback
+ *
+ * @return 1 if the request was in flight, 0 if the ID is unknown
+*/
+static int calc_client_release_locked(struct calc_client_t* client, int id, calc_client_cb_t* cb,
+    void** arg)
+{
+  struct calc_client_slot_t* slot = &client->slots[id & client->mask];
+  if (!slot->used || slot->id != id)
+  {
+    return 0;
+  }
+  *cb = slot->cb;
+  *arg = slot->arg;
+  slot->used = 0;
+  client->inflight--;
+  if (client->waiters)
+  {
+    pthread_cond_broadcast(&client->space);
+  }
+  return 1;
+}
+
+/**
+ * Response callback of the serializer (on the reader thread)
+ *
+ * @param obj Pointer to the client
+ * @param resp Response received
+*/
+static void calc_client_on_response(void* obj, struct calc_proto_resp_t resp)
+{
+  struct calc_client_t* client = (struct calc_client_t*)obj;
+  calc_client_cb_t cb;
+  void* arg;
+  pthread_mutex_lock(&client->lock);
+  int found = calc_client_release_locked(client, resp.req_id, &cb, &arg);
+  pthread_mutex_unlock(&client->lock);
+  if (found)
+  {
+    cb(arg, CALC_CLIENT_OK, &resp);
+  }
+}
+
+/**
+ * Error callback of the serializer, the request fails if its ID is known
+ *
+ * @param obj Pointer to the client
+ * @param req_id Request ID (if known)
+ * @param error_code Error code raised by the serializer
+*/
+static void calc_client_on_error(void* obj, int req_id, int error_code)
+{
+  struct calc_client_t* client = (struct calc_client_t*)obj;
+  calc_client_cb_t cb;
+  void* arg;
+  pthread_mutex_lock(&client->lock);
+  int found = calc_client_release_locked(client, req_id, &cb, &arg);
+  pthread_mutex_unlock(&client->lock);
+  if (found)
+  {
+    cb(arg, CALC_CLIENT_ERROR_PROTOCOL, NULL);
+  }
+}
+
+/**
+ * Reader thread: it delivers the responses until the connection is closed, and then fails the
+ * requests left
+ *
+ * @param obj Pointer to the client
+ *
+ * @return NULL
+*/
+static void* calc_client_reader(void* obj)
+{
+  struct calc_client_t* client = (struct calc_client_t*)obj;
+  char* buf = (char*)malloc(RECV_BUFFER_SIZE);
+  while (1)
+  {
+    int ret = read(client->sd, buf, RECV_BUFFER_SIZE);
+    if (ret <= 0)
+    {
+      if (ret == -1 && errno == EINTR)
+      {
+        continue;
+      }
+      break;
+    }
+    struct buffer_t b;
+    b.data = buf;
+    b.len = ret;
+    calc_proto_ser_client_deserialize(client->ser, b, NULL);
+  }
+  free(buf);
+
+  // No more responses, the callbacks are called without the lock
+  int size = client->mask + 1;
+  struct calc_client_slot_t* left = (struct calc_client_slot_t*)malloc(
+      size * sizeof(struct calc_client_slot_t));
+  int count = 0;
+  pthread_mutex_lock(&client->lock);
+  client->closed = 1;
+  for (int i = 0; i < size; i++)
+  {
+    if (client->slots[i].used)
+    {
+      left[count++] = client->slots[i];
+      client->slots[i].used = 0;
+    }
+  }
+  client->inflight = 0;
+  pthread_cond_broadcast(&client->space);
+  pthread_mutex_unlock(&client->lock);
+  for (int i = 0; i < count; i++)
+  {
+    left[i].cb(left[i].arg, CALC_CLIENT_ERROR_CLOSED, NULL);
+  }
+  free(left);
+  return NULL;
+}
+
+struct calc_client_t* calc_client_new()
+{
+  return (struct calc_client_t*)malloc(sizeof(struct calc_client_t));
+}
+
+void calc_client_delete(struct calc_client_t* client)
+{
+  free(client);
+}
+
+int calc_client_ctor(struct calc_client_t* client, int sd, calc_proto_mode_t mode,
+    int max_inflight)
+{
+  if (max_inflight < 1)
+  {
+    max_inflight = 1;
+  }
+
+  // Binary frames: send the hello and wait for the server to acknowledge it
+  if (mode == CALC_PROTO_BINARY)
+  {
+    char hello = (char)CALC_PROTO_BINARY_HELLO;
+    char ack = 0;
+    if (write(sd, &hello, 1) != 1 || read(sd, &ack, 1) != 1 || ack != hello)
+    {
+      return -1;
+    }
+  }
+
+  client->sd = sd;
+  client->ser = calc_proto_ser_new();
+  calc_proto_ser_ctor(client->ser, client, RECV_BUFFER_SIZE);
+  calc_proto_ser_set_mode(client->ser, mode);
+  calc_proto_ser_set_resp_callback(client->ser, calc_client_on_response);
+  calc_proto_ser_set_error_callback(client->ser, calc_client_on_error);
+
+  // Twice the slots of the requests in flight, so a late response rarely blocks a new request
+  int size = 2;
+  while (size < 2 * max_inflight)
+  {
+    size *= 2;
+  }
+  client->slots = (struct calc_client_slot_t*)calloc(size, sizeof(struct calc_client_slot_t));
+  client->mask = size - 1;
+  client->max_inflight = max_inflight;
+  client->inflight = 0;
+  client->next_id = 0;
+  client->waiters = 0;
+
+  // The requests waiting to be written are in flight too, so they always fit in the buffers
+  client->out = (char*)malloc(client->max_inflight * CALC_PROTO_MAX_MSG_LEN);
+  client->spare = (char*)malloc(client->max_inflight * CALC_PROTO_MAX_MSG_LEN);
+  client->out_len = 0;
+  client->writing = 0;
+  client->closed = 0;
+  pthread_mutex_init(&client->lock, NULL);
+  pthread_cond_init(&client->space, NULL);
+  pthread_create(&client->reader, NULL, calc_client_reader, client);
+  return 0;
+}
+
+void calc_client_dtor(struct calc_client_t* client)
+{
+  // The reader finds the end of the stream and fails the requests without response
+  shutdown(client->sd, SHUT_RDWR);
+  pthread_join(client->reader, NULL);
+  close(client->sd);
+  pthread_cond_destroy(&client->space);
+  pthread_mutex_destroy(&client->lock);
+  free(client->out);
+  free(client->spare);
+  free(client->slots);
+  calc_proto_ser_dtor(client->ser);
+  calc_proto_ser_delete(client->ser);
+}
+
+/**
+ * Write the whole buffer (a stream socket could accept less bytes than requested). A connection
+ * closed by the server is an error, not a SIGPIPE that kills the program.
+ *
+ * @return 0 on success, -1 on error
+*/
+static int calc_client_write_all(int sd, const char* data, int len)
+{
+  while (len > 0)
+  {
+    int ret = send(sd, data, len, MSG_NOSIGNAL);
+    if (ret == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return -1;
+    }
+    data += ret;
+    len -= ret;
+  }
+  return 0;
+}
+
+/**
+ * Submit a request. The client sets its ID, and calls 'cb' with the response (on the reader
+ * thread). It waits while there are 'max_inflight' requests without response.
+ *
+ * @param client Client
+ * @param req Request, the ID is set by the client
+ * @param cb Callback of the response
+ * @param arg Argument of the callback
+ *
+ * @return The ID of the request, -1 if the connection is closed, or CALC_CLIENT_ERROR_TOO_LONG if
+ *         the request doesn't fit in a message (the callback isn't called in both cases)
+*/
+int calc_client_submit(struct calc_client_t* client, struct calc_proto_req_t* req,
+    calc_client_cb_t cb, void* arg)
+{
+  pthread_mutex_lock(&client->lock);
+  while (!client->closed && (client->inflight >= client->max_inflight ||
+      client->slots[client->next_id & client->mask].used))
+  {
+    client->waiters++;
+    pthread_cond_wait(&client->space, &client->lock);
+    client->waiters--;
+  }
+  if (client->closed)
+  {
+    pthread_mutex_unlock(&client->lock);
+    return -1;
+  }
+
+  int id = client->next_id;
+  client->next_id = id == INT32_MAX ? 0 : id + 1;
+  req->id = id;
+  int len = calc_proto_ser_client_serialize_to(client->ser, req, client->out + client->out_len,
+      CALC_PROTO_MAX_MSG_LEN);
+  if (len < 0)
+  {
+    pthread_mutex_unlock(&client->lock);
+    return CALC_CLIENT_ERROR_TOO_LONG;
+  }
+  struct calc_client_slot_t* slot = &client->slots[id & client->mask];
+  slot->used = 1;
+  slot->id = id;
+  slot->cb = cb;
+  slot->arg = arg;
+  client->inflight++;
+  client->out_len += len;
+
+  // Somebody else is writing, it takes this request in its next write
+  if (client->writing)
+  {
+    pthread_mutex_unlock(&client->lock);
+    return id;
+  }
+
+  // Become the writer until there is nothing left to write
+  client->writing = 1;
+  while (client->out_len > 0 && !client->closed)
+  {
+    char* data = client->out;
+    int data_len = client->out_len;
+    client->out = client->spare;
+    client->spare = data;
+    client->out_len = 0;
+    pthread_mutex_unlock(&client->lock);
+    int ret = calc_client_write_all(client->sd, data, data_len);
+    pthread_mutex_lock(&client->lock);
+    if (ret == -1)
+    {
+      // The reader finds the end of the stream, and fails the requests in flight
+      client->closed = 1;
+      pthread_cond_broadcast(&client->space);
+      shutdown(client->sd, SHUT_RDWR);
+    }
+  }
+  client->writing = 0;
+  pthread_mutex_unlock(&client->lock);
+  return id;
+}
+
+/**
+ * Submit a request whose response is waited for with calc_future_wait
+ *
+ * @param client Client
+ * @param req Request, the ID is set by the client
+ * @param future Future built with calc_future_ctor
+ *
+ * @return The ID of the request, -1 if the connection is closed (the future is completed with
+ *         CALC_CLIENT_ERROR_CLOSED), or CALC_CLIENT_ERROR_TOO_LONG if the request doesn't fit in a
+ *         message (the future is completed with it)
+*/
+int calc_client_submit_future(struct calc_client_t* client, struct calc_proto_req_t* req,
+    struct calc_future_t* future)
+{
+  int id = calc_client_submit(client, req, calc_future_complete, future);
+  if (id == -1)
+  {
+    calc_future_complete(future, CALC_CLIENT_ERROR_CLOSED, NULL);
+  }
+  else if (id == CALC_CLIENT_ERROR_TOO_LONG)
+  {
+    calc_future_complete(future, CALC_CLIENT_ERROR_TOO_LONG, NULL);
+  }
+  return id;
+}
+
+/**
+ * Number of requests without response
+*/
+int calc_client_inflight(struct calc_client_t* client)
+{
+  pthread_mutex_lock(&client->lock);
+  int inflight = client->inflight;
+  pthread_mutex_unlock(&client->lock);
+  return inflight;
+}
+
+/**
+ * Tell if the connection was closed (the submits fail from then on)
+*/
+int calc_client_closed(struct calc_client_t* client)
+{
+  pthread_mutex_lock(&client->lock);
+  int closed = client->closed;
+  pthread_mutex_unlock(&client->lock);
+  return closed;
+}
@@ -0,0 +1,81 @@
+#ifndef CALC_CLIENT_H
+#define CALC_CLIENT_H
+
+#include <pthread.h>
+
+#include <calc_proto_ser.h>
+
+/**
+ * Asynchronous client of the calculator, for programs (not people) that need many calculations:
+ * the requests are submitted without waiting for their responses, so one connection keeps many of
+ * them in flight. Every response arrives to a callback, or to a future that the caller waits for.
+ *
+ *    struct calc_client_t* client = calc_client_new();
+ *    calc_client_ctor(client, sd, CALC_PROTO_BINARY, 256);  // sd: connected stream socket
+ *
+ *    struct calc_proto_req_t req;
+ *    req.method = MUL; req.operand1 = 16; req.operand2 = 20;
+ *    calc_client_submit(client, &req, on_result, NULL);     // on_result runs on another thread
+ *
+ *    struct calc_future_t future;
+ *    calc_future_ctor(&future);
+ *    calc_client_submit_future(client, &req, &future);
+ *    struct calc_proto_resp_t resp;
+ *    if (calc_future_wait(&future, &resp) == CALC_CLIENT_OK) ...
+ *    calc_future_dtor(&future);
+ *
+ * The client chooses the ID of every request, and matches the responses by ID, so the server can
+ * answer in any order. The requests submitted while another thread writes are sent in the same
+ * write, and a submit waits if there are already 'max_inflight' requests without response.
+*/
+
+// Outcome of a request, the status of the calculation itself is in the response
+#define CALC_CLIENT_OK              0
+#define CALC_CLIENT_ERROR_PROTOCOL -1 // The response couldn't be deserialized
+#define CALC_CLIENT_ERROR_CLOSED   -2 // The connection was closed before the response
+#define CALC_CLIENT_ERROR_TOO_LONG -3 // The request doesn't fit in a message (it isn't sent)
+
+// Callback of a request, 'resp' is only valid during the call (and only if the status is OK). It
+// runs on the thread that reads the responses, so it must not wait for anything (nor submit new
+// requests, as the submit could wait for the responses that this thread has to read).
+typedef void (*calc_client_cb_t)(void* arg, int status, const struct calc_proto_resp_t* resp);
+
+// Future, a response that a thread can wait for
+struct calc_future_t
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int done;
+  int status;
+  struct calc_proto_resp_t resp;
+};
+
+void calc_future_ctor(struct calc_future_t*);
+void calc_future_dtor(struct calc_future_t*);
+int calc_future_wait(struct calc_future_t*, struct calc_proto_resp_t* resp);
+
+// Callback that completes the future given as 'arg'
+void calc_future_complete(void* arg, int status, const struct calc_proto_resp_t* resp);
+
+// Forward declaration
+struct calc_client_t;
+
+// Memory management function
+struct calc_client_t* calc_client_new();
+void calc_client_delete(struct calc_client_t*);
+
+// Constructor (the client owns the socket from now on, returns -1 if the server doesn't accept
+// the mode) and destructor (the requests without response fail with CALC_CLIENT_ERROR_CLOSED)
+int calc_client_ctor(struct calc_client_t*, int sd, calc_proto_mode_t mode, int max_inflight);
+void calc_client_dtor(struct calc_client_t*);
+
+// Methods of the client, they return the ID given to the request, -1 if the connection is closed,
+// or CALC_CLIENT_ERROR_TOO_LONG if the request can't be serialized (the connection is still fine)
+int calc_client_submit(struct calc_client_t*, struct calc_proto_req_t* req, calc_client_cb_t cb,
+    void* arg);
+int calc_client_submit_future(struct calc_client_t*, struct calc_proto_req_t* req,
+    struct calc_future_t* future);
+int calc_client_inflight(struct calc_client_t*);
+int calc_client_closed(struct calc_client_t*);
+
+#endif
@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common_client_core.h"
+#include "calc_client_pool.h"
+
+/**
+ * Every connection is either up (it has a client and takes requests) or down (it doesn't take
+ * requests, and the pool thread reconnects it). The submits run in parallel on the connections
+ * that are up, holding the read side of the lock of the connection. Only the pool thread takes
+ * the write side, to destroy a broken client or to install a new one, so a submit never finds a
+ * client being destroyed.
+ *
+ * The pool thread wakes up every CHECK_INTERVAL_MS to find the connections closed without traffic,
+ * or earlier if a submit finds one (or a reconnection is due).
+*/
+
+#define CHECK_INTERVAL_MS 100
+#define RETRY_MIN_MS 10
+#define RETRY_MAX_MS 1000
+
+#define POOL_CONN_DOWN 0
+#define POOL_CONN_UP   1
+
+struct pool_conn_t
+{
+  pthread_rwlock_t lock;         // Read: submits using the client, write: the pool thread
+  struct calc_client_t* client;  // NULL while the connection is down
+  atomic_int state;
+  atomic_long requests;          // Requests submitted
+  atomic_long reconnects;        // Only the pool thread writes the fields below
+  atomic_int failures;           // Connection attempts failed in a row
+  atomic_int last_error;         // errno of the last attempt
+  long retry_at;                 // Time of the next attempt (ms)
+};
+
+struct calc_client_pool_t
+{
+  char* address;
+  int port;
+  calc_proto_mode_t mode;
+  int max_inflight;
+  int size;
+  struct pool_conn_t* conns;
+  atomic_uint next;              // Connection of the next submit (round robin)
+  pthread_t thread;
+  pthread_mutex_t lock;          // Protects the flags below
+  pthread_cond_t wakeup;
+  int stop;
+  int pending;                   // A submit found a broken connection
+};
+
+/**
+ * Current time in milliseconds (monotonic)
+*/
+static long pool_now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/**
+ * Wake up the pool thread to repair a connection
+*/
+static void pool_wake(struct calc_client_pool_t* pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  pool->pending = 1;
+  pthread_cond_signal(&pool->wakeup);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Open a connection (on the pool thread, or in the constructor)
+ *
+ * @param pool Pool
+ * @param conn Connection that is down, without client
+*/
+static void pool_connect(struct calc_client_pool_t* pool, struct pool_conn_t* conn)
+{
+  struct calc_client_t* client = NULL;
+  int sd = connect_stream(pool->address, pool->port);
+  if (sd != -1)
+  {
+    client = calc_client_new();
+    if (calc_client_ctor(client, sd, pool->mode, pool->max_inflight) == -1)
+    {
+      calc_client_delete(client);
+      close(sd);
+      client = NULL;
+      errno = EPROTO;
+    }
+  }
+  if (!client)
+  {
+    // Exponential backoff: 10 ms, 20 ms, 40 ms, ... up to 1 s
+    int failures = atomic_load(&conn->failures);
+    long delay = RETRY_MIN_MS << (failures < 10 ? failures : 10);
+    conn->retry_at = pool_now_ms() + (delay < RETRY_MAX_MS ? delay : RETRY_MAX_MS);
+    atomic_store(&conn->last_error, errno);
+    atomic_store(&conn->failures, failures + 1);
+    return;
+  }
+  pthread_rwlock_wrlock(&conn->lock);
+  conn->client = client;
+  atomic_store(&conn->state, POOL_CONN_UP);
+  pthread_rwlock_unlock(&conn->lock);
+  atomic_store(&conn->failures, 0);
+  atomic_store(&conn->last_error, 0);
+}
+
+/**
+ * Check all the connections: the broken ones are destroyed, and the ones due are reconnected
+ *
+ * @param pool Pool
+ *
+ * @return Time of the next reconnection due (ms), or 0 if there is none
+*/
+static long pool_maintain(struct calc_client_pool_t* pool)
+{
+  long next_retry = 0;
+  for (int i = 0; i < pool->size; i++)
+  {
+    struct pool_conn_t* conn = &pool->conns[i];
+    if (atomic_load(&conn->state) == POOL_CONN_UP)
+    {
+      pthread_rwlock_rdlock(&conn->lock);
+      int closed = calc_client_closed(conn->client);
+      pthread_rwlock_unlock(&conn->lock);
+      if (!closed)
+      {
+        continue;
+      }
+      atomic_store(&conn->state, POOL_CONN_DOWN);
+    }
+    if (conn->client)
+    {
+      // The requests in flight fail in the destructor of the client
+      pthread_rwlock_wrlock(&conn->lock);
+      struct calc_client_t* client = conn->client;
+      conn->client = NULL;
+      pthread_rwlock_unlock(&conn->lock);
+      calc_client_dtor(client);
+      calc_client_delete(client);
+      conn->retry_at = pool_now_ms();
+      atomic_fetch_add(&conn->reconnects, 1);
+    }
+    if (pool_now_ms() >= conn->retry_at)
+    {
+      pool_connect(pool, conn);
+    }
+    if (atomic_load(&conn->state) == POOL_CONN_DOWN &&
+        (!next_retry || conn->retry_at < next_retry))
+    {
+      next_retry = conn->retry_at;
+    }
+  }
+  return next_retry;
+}
+
+/**
+ * Loop of the pool thread
+ *
+ * @param obj Pointer to the pool
+ *
+ * @return NULL when the pool is destroyed
+*/
+static void* pool_loop(void* obj)
+{
+  struct calc_client_pool_t* pool = (struct calc_client_pool_t*)obj;
+  long next_retry = 0;
+  pthread_mutex_lock(&pool->lock);
+  while (!pool->stop)
+  {
+    long wake_at = pool_now_ms() + CHECK_INTERVAL_MS;
+    if (next_retry && next_retry < wake_at)
+    {
+      wake_at = next_retry;
+    }
+    struct timespec deadline;
+    deadline.tv_sec = wake_at / 1000;
+    deadline.tv_nsec = (wake_at % 1000) * 1000000L;
+    while (!pool->stop && !pool->pending &&
+        pthread_cond_timedwait(&pool->wakeup, &pool->lock, &deadline) != ETIMEDOUT);
+    if (pool->stop)
+    {
+      break;
+    }
+    pool->pending = 0;
+    pthread_mutex_unlock(&pool->lock);
+    next_retry = pool_maintain(pool);
+    pthread_mutex_lock(&pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+struct calc_client_pool_t* calc_client_pool_new()
+{
+  return (struct calc_client_pool_t*)malloc(sizeof(struct calc_client_pool_t));
+}
+
+void calc_client_pool_delete(struct calc_client_pool_t* pool)
+{
+  free(pool);
+}
+
+int calc_client_pool_ctor(struct calc_client_pool_t* pool, const char* address, int port,
+    int size, calc_proto_mode_t mode, int max_inflight)
+{
+  pool->address = strdup(address);
+  pool->port = port;
+  pool->mode = mode;
+  pool->max_inflight = max_inflight;
+  pool->size = size < 1 ? 1 : size;
+  pool->stop = 0;
+  pool->pending = 0;
+  atomic_init(&pool->next, 0);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&pool->wakeup, &attr);
+  pthread_condattr_destroy(&attr);
+
+  // The connections are opened now, the ones that fail are retried by the pool thread
+  int opened = 0;
+  pool->conns = (struct pool_conn_t*)calloc(pool->size, sizeof(struct pool_conn_t));
+  for (int i = 0; i < pool->size; i++)
+  {
+    struct pool_conn_t* conn = &pool->conns[i];
+    pthread_rwlock_init(&conn->lock, NULL);
+    atomic_init(&conn->state, POOL_CONN_DOWN);
+    atomic_init(&conn->requests, 0);
+    atomic_init(&conn->reconnects, 0);
+    atomic_init(&conn->failures, 0);
+    atomic_init(&conn->last_error, 0);
+    pool_connect(pool, conn);
+    opened += atomic_load(&conn->state) == POOL_CONN_UP;
+  }
+  pthread_create(&pool->thread, NULL, pool_loop, pool);
+  return opened;
+}
+
+void calc_client_pool_dtor(struct calc_client_pool_t* pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_signal(&pool->wakeup);
+  pthread_mutex_unlock(&pool->lock);
+  pthread_join(pool->thread, NULL);
+  for (int i = 0; i < pool->size; i++)
+  {
+    if (pool->conns[i].client)
+    {
+      calc_client_dtor(pool->conns[i].client);
+      calc_client_delete(pool->conns[i].client);
+    }
+    pthread_rwlock_destroy(&pool->conns[i].lock);
+  }
+  free(pool->conns);
+  free(pool->address);
+  pthread_cond_destroy(&pool->wakeup);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+/**
+ * Submit a request on the next healthy connection
+ *
+ * @param pool Pool
+ * @param req Request, the ID is set by the connection that sends it
+ * @param cb Callback of the response (see calc_client_submit)
+ * @param arg Argument of the callback
+ *
+ * @return The ID of the request in its connection, -1 if no connection is up, or another
+ *         negative error of calc_client_submit if the request can't be sent (CALC_CLIENT_ERROR_*,
+ *         the callback isn't called)
+*/
+int calc_client_pool_submit(struct calc_client_pool_t* pool, struct calc_proto_req_t* req,
+    calc_client_cb_t cb, void* arg)
+{
+  unsigned start = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed);
+  for (int i = 0; i < pool->size; i++)
+  {
+    struct pool_conn_t* conn = &pool->conns[(start + i) % pool->size];
+    if (atomic_load(&conn->state) != POOL_CONN_UP)
+    {
+      continue;
+    }
+    int id = -1;
+    bool_t closed = TRUE;
+    pthread_rwlock_rdlock(&conn->lock);
+    if (conn->client)
+    {
+      id = calc_client_submit(conn->client, req, cb, arg);
+      closed = id < 0 && calc_client_closed(conn->client);
+
+      // Marked down while the failed client is still installed: the pool thread sets the
+      // connection up again under the write lock, so this store never hides a new client
+      if (closed)
+      {
+        atomic_store(&conn->state, POOL_CONN_DOWN);
+        pool_wake(pool);
+      }
+    }
+    pthread_rwlock_unlock(&conn->lock);
+    if (id >= 0)
+    {
+      atomic_fetch_add_explicit(&conn->requests, 1, memory_order_relaxed);
+      return id;
+    }
+    if (!closed)
+    {
+      // The request itself can't be sent (see calc_client_submit), the connection is fine and
+      // the other ones would fail in the same way
+      return id;
+    }
+
+    // The request wasn't sent, so it can go to the next connection
+  }
+  return -1;
+}
+
+/**
+ * Submit a request whose response is waited for with calc_future_wait
+ *
+ * @return The ID of the request, or a negative error as calc_client_pool_submit (the future is
+ *         completed with CALC_CLIENT_ERROR_CLOSED if no connection is up, or with the error)
+*/
+int calc_client_pool_submit_future(struct calc_client_pool_t* pool, struct calc_proto_req_t* req,
+    struct calc_future_t* future)
+{
+  int id = calc_client_pool_submit(pool, req, calc_future_complete, future);
+  if (id == -1)
+  {
+    calc_future_complete(future, CALC_CLIENT_ERROR_CLOSED, NULL);
+  }
+  else if (id < 0)
+  {
+    calc_future_complete(future, id, NULL);
+  }
+  return id;
+}
+
+/**
+ * Number of connections up
+*/
+int calc_client_pool_healthy(struct calc_client_pool_t* pool)
+{
+  int healthy = 0;
+  for (int i = 0; i < pool->size; i++)
+  {
+    healthy += atomic_load(&pool->conns[i].state) == POOL_CONN_UP;
+  }
+  return healthy;
+}
+
+/**
+ * Number of connections lost (and reconnected, or being reconnected) since the start
+*/
+long calc_client_pool_reconnects(struct calc_client_pool_t* pool)
+{
+  long reconnects = 0;
+  for (int i = 0; i < pool->size; i++)
+  {
+    reconnects += atomic_load(&pool->conns[i].reconnects);
+  }
+  return reconnects;
+}
+
+/**
+ * Print the state of every connection
+ *
+ * @param pool Pool
+ * @param out Where the state is printed
+*/
+void calc_client_pool_print_stats(struct calc_client_pool_t* pool, FILE* out)
+{
+  for (int i = 0; i < pool->size; i++)
+  {
+    struct pool_conn_t* conn = &pool->conns[i];
+    int up = atomic_load(&conn->state) == POOL_CONN_UP;
+    fprintf(out, "connection %d: %s, %ld requests, %ld reconnects", i, up ? "up" : "down",
+        atomic_load(&conn->requests), atomic_load(&conn->reconnects));
+    int error = atomic_load(&conn->last_error);
+    if (!up && error)
+    {
+      fprintf(out, " (%d attempts failed: %s)", atomic_load(&conn->failures), strerror(error));
+    }
+    fprintf(out, "\n");
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef CALC_CLIENT_POOL_H
+#define CALC_CLIENT_POOL_H
+
+#include <stdio.h>
+
+#include "calc_client.h"
+
+/**
+ * Pool of persistent connections to a calculator server, shared by all the threads of a program.
+ * Every connection is an asynchronous client (see calc_client.h), so a few sockets carry the
+ * requests of many threads, and nobody pays for a connect per call.
+ *
+ *    struct calc_client_pool_t* pool = calc_client_pool_new();
+ *    calc_client_pool_ctor(pool, "localhost", 6666, 4, CALC_PROTO_BINARY, 256);
+ *    ...
+ *    calc_client_pool_submit(pool, &req, on_result, NULL);   // From any thread
+ *
+ * The requests go to the healthy connections in turns. A connection that the server closes is
+ * taken out of the pool at once and reconnected in the background, waiting more and more between
+ * the attempts while they fail (from 10 ms up to 1 s).
+ *
+ * NOTE: The requests in flight on a connection that breaks fail with CALC_CLIENT_ERROR_CLOSED,
+ * the pool doesn't send them again, as it can't know if the server executed them. And as the
+ * server keeps the memory of the calculator per connection, the methods with memory (ADDM, GETMEM,
+ * ...) need a client of their own instead of the pool.
+*/
+
+// Forward declaration
+struct calc_client_pool_t;
+
+// Memory management function
+struct calc_client_pool_t* calc_client_pool_new();
+void calc_client_pool_delete(struct calc_client_pool_t*);
+
+// Constructor (the address and port are the ones of connect_stream, it returns the connections
+// opened, the others are retried in the background) and destructor
+int calc_client_pool_ctor(struct calc_client_pool_t*, const char* address, int port, int size,
+    calc_proto_mode_t mode, int max_inflight);
+void calc_client_pool_dtor(struct calc_client_pool_t*);
+
+// Methods of the pool, the submits return the ID of the request, -1 if no connection is up, or
+// another CALC_CLIENT_ERROR_* if the request itself can't be sent (no connection is marked down)
+int calc_client_pool_submit(struct calc_client_pool_t*, struct calc_proto_req_t* req,
+    calc_client_cb_t cb, void* arg);
+int calc_client_pool_submit_future(struct calc_client_pool_t*, struct calc_proto_req_t* req,
+    struct calc_future_t* future);
+int calc_client_pool_healthy(struct calc_client_pool_t*);
+long calc_client_pool_reconnects(struct calc_client_pool_t*);
+void calc_client_pool_print_stats(struct calc_client_pool_t*, FILE* out);
+
+#endif
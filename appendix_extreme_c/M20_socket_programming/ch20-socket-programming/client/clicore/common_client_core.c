@@ -5,6 +5,11 @@
 #include <pthread.h>
 #include <unistd.h>
 
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
 #include "common_client_core.h"
 
 /**
@@ -222,3 +227,59 @@ void parse_client_input(char* buf, struct calc_proto_req_t* req, int *brk, int *
   req->operand1 = op1;
   req->operand2 = op2;
 }
+
+/**
+ * Create a stream socket connected to the server, used by the clients that open their connections
+ * by themselves (see calc_client_pool.c).
+ * 
+ * @param address Host name for TCP, path of the socket file for Unix sockets
+ * @param port TCP port, or 0 for a Unix socket
+ * 
+ * @return Socket descriptor, or -1 in case of error (errno tells why)
+*/
+int connect_stream(const char* address, int port)
+{
+  int sd;
+  int ret;
+  if (!port)
+  {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, address, sizeof(addr.sun_path) - 1);
+    sd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sd == -1)
+    {
+      return -1;
+    }
+    ret = connect(sd, (struct sockaddr*)&addr, sizeof(addr));
+  }
+  else
+  {
+    struct hostent* host_entry = gethostbyname(address);
+    if (!host_entry)
+    {
+      errno = EHOSTUNREACH;
+      return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr = *((struct in_addr*)host_entry->h_addr);
+    addr.sin_port = htons(port);
+    sd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sd == -1)
+    {
+      return -1;
+    }
+    ret = connect(sd, (struct sockaddr*)&addr, sizeof(addr));
+  }
+  if (ret == -1)
+  {
+    int error = errno;
+    close(sd);
+    errno = error;
+    return -1;
+  }
+  return sd;
+}
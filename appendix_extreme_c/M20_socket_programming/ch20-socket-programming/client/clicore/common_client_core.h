@@ -26,4 +26,7 @@ void on_response(void* obj, struct calc_proto_resp_t resp);
 
 void parse_client_input(char* buf, struct calc_proto_req_t* req, int *brk, int*cnt);
 
+// Connection to a stream server: TCP if the port is given, the Unix socket 'address' otherwise
+int connect_stream(const char* address, int port);
+
 #endif
@@ -93,15 +93,23 @@ void datagram_client_loop(int conn_sd)
       continue;
     }
 
-    // Serialize request processed
-    struct buffer_t buf = calc_proto_ser_client_serialize(context.ser, &req);
+    // Serialize request processed (into a buffer on the stack)
+    char out[CALC_PROTO_MAX_MSG_LEN];
+    struct buffer_t buf;
+    buf.data = out;
+    buf.len = calc_proto_ser_client_serialize_to(context.ser, &req, out, sizeof(out));
+    if (buf.len < 0) 
+    {
+      fprintf(stderr, "Request is too long to be sent!\n");
+      printf("? (type quit to exit) "); fflush(stdout);
+      continue;
+    }
     
     // Write response into socket file descriptor 
     // We could use `write` since we already know the destination.
     int ret = write(context.sd, buf.data, buf.len);
 
     // Check for error during writting
-    free(buf.data);
     if (ret == -1) 
     {
       fprintf(stderr, "Error while writing! %s\n", strerror(errno));
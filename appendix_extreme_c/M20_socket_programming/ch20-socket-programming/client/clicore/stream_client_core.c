@@ -93,9 +93,17 @@ void stream_client_loop(int conn_sd)
       continue;
     }
 
-    // Serialize request and write into the socket file descriptor
-    struct buffer_t ser_req =
-        calc_proto_ser_client_serialize(context.ser, &req);
+    // Serialize request (into a buffer on the stack) and write into the socket file descriptor
+    char out[CALC_PROTO_MAX_MSG_LEN];
+    struct buffer_t ser_req;
+    ser_req.data = out;
+    ser_req.len = calc_proto_ser_client_serialize_to(context.ser, &req, out, sizeof(out));
+    if (ser_req.len < 0) 
+    {
+      fprintf(stderr, "Request is too long to be sent!\n");
+      printf("? (type quit to exit) "); fflush(stdout);
+      continue;
+    }
     int ret = write(context.sd, ser_req.data, ser_req.len);
     
     // Check if the writting process was succesfully achieved
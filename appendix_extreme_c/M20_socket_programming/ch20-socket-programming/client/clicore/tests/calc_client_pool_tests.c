@@ -0,0 +1,315 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <cmocka.h>
+
+#include <calc_client_pool.h>
+#include <calc_program.h>
+
+#define EPSILON 0.000001
+#define SOCK_FILE "/tmp/calc_client_pool_tests.sock"
+#define MAX_CONNS 64
+
+/**
+ * Fake server listening on a Unix socket: every connection has a thread that answers the
+ * requests (the sum of the operands), and the test can break all the connections at once.
+*/
+int listen_sd = -1;
+pthread_t acceptor;
+atomic_int accepted;
+int conn_sds[MAX_CONNS];
+pthread_mutex_t conns_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct fake_conn_t {
+  struct calc_proto_ser_t* ser;
+  int sd;
+};
+
+void fake_on_request(void* obj, struct calc_proto_req_t req) {
+  struct fake_conn_t* conn = (struct fake_conn_t*)obj;
+  struct calc_proto_resp_t resp;
+  resp.req_id = req.id;
+  resp.status = STATUS_OK;
+  resp.result = req.operand1 + req.operand2;
+  char out[CALC_PROTO_MAX_MSG_LEN];
+  int len = calc_proto_ser_server_serialize_to(conn->ser, &resp, out, sizeof(out));
+  send(conn->sd, out, len, MSG_NOSIGNAL);
+}
+
+void* fake_conn_loop(void* obj) {
+  struct fake_conn_t conn;
+  conn.sd = (int)(long)obj;
+  conn.ser = calc_proto_ser_new();
+  calc_proto_ser_ctor(conn.ser, &conn, 4096);
+  calc_proto_ser_set_req_callback(conn.ser, fake_on_request);
+  char in[4096];
+  int ret;
+  while ((ret = read(conn.sd, in, sizeof(in))) > 0) {
+    struct buffer_t buf;
+    buf.data = in;
+    buf.len = ret;
+    calc_proto_ser_server_deserialize(conn.ser, buf, NULL);
+  }
+  calc_proto_ser_dtor(conn.ser);
+  calc_proto_ser_delete(conn.ser);
+  return NULL;
+}
+
+void* fake_accept_loop(void* obj) {
+  int sd;
+  while ((sd = accept(listen_sd, NULL, NULL)) != -1) {
+    pthread_mutex_lock(&conns_lock);
+    conn_sds[atomic_load(&accepted) % MAX_CONNS] = sd;
+    atomic_fetch_add(&accepted, 1);
+    pthread_mutex_unlock(&conns_lock);
+    pthread_t thread;
+    pthread_create(&thread, NULL, fake_conn_loop, (void*)(long)sd);
+    pthread_detach(thread);
+  }
+  return NULL;
+}
+
+void fake_server_start() {
+  unlink(SOCK_FILE);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, SOCK_FILE, sizeof(addr.sun_path) - 1);
+  listen_sd = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert_int_equal(bind(listen_sd, (struct sockaddr*)&addr, sizeof(addr)), 0);
+  assert_int_equal(listen(listen_sd, 16), 0);
+  pthread_create(&acceptor, NULL, fake_accept_loop, NULL);
+}
+
+void fake_server_break_connections() {
+  pthread_mutex_lock(&conns_lock);
+  int count = atomic_load(&accepted);
+  for (int i = 0; i < count && i < MAX_CONNS; i++) {
+    shutdown(conn_sds[i], SHUT_RDWR);
+  }
+  pthread_mutex_unlock(&conns_lock);
+}
+
+void fake_server_stop() {
+  fake_server_break_connections();
+  shutdown(listen_sd, SHUT_RDWR);
+  pthread_join(acceptor, NULL);
+  close(listen_sd);
+  unlink(SOCK_FILE);
+}
+
+struct calc_client_pool_t* pool = NULL;
+
+int add(double a, double b, double* result) {
+  struct calc_future_t future;
+  calc_future_ctor(&future);
+  struct calc_proto_req_t req;
+  req.method = ADD;
+  req.operand1 = a;
+  req.operand2 = b;
+  calc_client_pool_submit_future(pool, &req, &future);
+  struct calc_proto_resp_t resp;
+  int status = calc_future_wait(&future, &resp);
+  calc_future_dtor(&future);
+  *result = resp.result;
+  return status;
+}
+
+int wait_accepted(int expected) {
+  for (int i = 0; i < 500 && atomic_load(&accepted) < expected; i++) {
+    usleep(10000);
+  }
+  return atomic_load(&accepted);
+}
+
+int wait_healthy(int expected) {
+  for (int i = 0; i < 500 && calc_client_pool_healthy(pool) != expected; i++) {
+    usleep(10000);
+  }
+  return calc_client_pool_healthy(pool);
+}
+
+void calc_client_pool__shares_connections(void** state) {
+  atomic_init(&accepted, 0);
+  fake_server_start();
+  assert_int_equal(calc_client_pool_ctor(pool, SOCK_FILE, 0, 3, CALC_PROTO_TEXT, 32), 3);
+  for (int i = 0; i < 30; i++) {
+    double result;
+    assert_int_equal(add(i, 0.25, &result), CALC_CLIENT_OK);
+    assert_float_equal(result, i + 0.25, EPSILON);
+  }
+
+  // Only the connections of the pool were opened, whatever the number of calls
+  assert_int_equal(wait_accepted(3), 3);
+  calc_client_pool_dtor(pool);
+  fake_server_stop();
+}
+
+void calc_client_pool__reconnects(void** state) {
+  atomic_init(&accepted, 0);
+  fake_server_start();
+  assert_int_equal(calc_client_pool_ctor(pool, SOCK_FILE, 0, 2, CALC_PROTO_TEXT, 32), 2);
+
+  // The server breaks every connection, the pool notices and opens new ones
+  assert_int_equal(wait_accepted(2), 2);
+  fake_server_break_connections();
+  for (int i = 0; i < 500 && calc_client_pool_reconnects(pool) < 2; i++) {
+    usleep(10000);
+  }
+  assert_int_equal(calc_client_pool_reconnects(pool), 2);
+  assert_int_equal(wait_healthy(2), 2);
+  assert_int_equal(wait_accepted(4), 4);
+  double result;
+  assert_int_equal(add(1, 2, &result), CALC_CLIENT_OK);
+  assert_float_equal(result, 3, EPSILON);
+  calc_client_pool_dtor(pool);
+  fake_server_stop();
+}
+
+void calc_client_pool__server_down(void** state) {
+  atomic_init(&accepted, 0);
+  unlink(SOCK_FILE);
+  assert_int_equal(calc_client_pool_ctor(pool, SOCK_FILE, 0, 2, CALC_PROTO_TEXT, 32), 0);
+  double result;
+  assert_int_equal(add(1, 2, &result), CALC_CLIENT_ERROR_CLOSED);
+
+  // The attempts go on in the background until the server is there
+  usleep(50000);
+  fake_server_start();
+  assert_int_equal(wait_healthy(2), 2);
+  assert_int_equal(add(1, 2, &result), CALC_CLIENT_OK);
+  calc_client_pool_dtor(pool);
+  fake_server_stop();
+}
+
+#define SUBMITTERS 4
+#define BREAKS 10
+
+atomic_int submitting;
+_Thread_local int slow_unlocks = 0;
+
+/**
+ * The test is linked with --wrap=pthread_rwlock_unlock: the submitters sleep after releasing the
+ * lock of a connection, so the pool thread has time to reconnect it before the submit goes on.
+*/
+int __real_pthread_rwlock_unlock(pthread_rwlock_t* lock);
+
+int __wrap_pthread_rwlock_unlock(pthread_rwlock_t* lock) {
+  int ret = __real_pthread_rwlock_unlock(lock);
+  if (slow_unlocks) {
+    usleep(20000);
+  }
+  return ret;
+}
+
+void* submit_loop(void* arg) {
+  // The requests fail while the connections are broken, some of them find a closed client
+  slow_unlocks = 1;
+  while (atomic_load(&submitting)) {
+    double result;
+    add(1, 2, &result);
+  }
+  return NULL;
+}
+
+void calc_client_pool__reconnects_while_submitting(void** state) {
+  atomic_init(&accepted, 0);
+  atomic_init(&submitting, 1);
+  fake_server_start();
+  assert_int_equal(calc_client_pool_ctor(pool, SOCK_FILE, 0, 2, CALC_PROTO_TEXT, 32), 2);
+  assert_int_equal(wait_accepted(2), 2);
+  pthread_t submitters[SUBMITTERS];
+  for (int i = 0; i < SUBMITTERS; i++) {
+    pthread_create(&submitters[i], NULL, submit_loop, NULL);
+  }
+
+  // Every break costs a reconnection of each connection, and nothing else
+  for (int i = 1; i <= BREAKS; i++) {
+    fake_server_break_connections();
+    for (int j = 0; j < 500 && calc_client_pool_reconnects(pool) < 2 * i; j++) {
+      usleep(10000);
+    }
+    assert_int_equal(wait_healthy(2), 2);
+    assert_int_equal(wait_accepted(2 * (i + 1)), 2 * (i + 1));
+  }
+  atomic_store(&submitting, 0);
+  for (int i = 0; i < SUBMITTERS; i++) {
+    pthread_join(submitters[i], NULL);
+  }
+
+  // A connection marked down by mistake would be reconnected by one of the next checks
+  usleep(300000);
+  assert_int_equal(calc_client_pool_reconnects(pool), 2 * BREAKS);
+  assert_int_equal(atomic_load(&accepted), 2 * (BREAKS + 1));
+  assert_int_equal(calc_client_pool_healthy(pool), 2);
+  calc_client_pool_dtor(pool);
+  fake_server_stop();
+}
+
+void calc_client_pool__request_too_long(void** state) {
+  atomic_init(&accepted, 0);
+  fake_server_start();
+  assert_int_equal(calc_client_pool_ctor(pool, SOCK_FILE, 0, 2, CALC_PROTO_TEXT, 32), 2);
+
+  // A program whose text doesn't fit in a message (built by hand, the compiler rejects it)
+  struct calc_program_t program;
+  program.len = 0;
+  program.nums_len = CALC_PROGRAM_MAX_NUMS;
+  for (int i = 0; i < CALC_PROGRAM_MAX_NUMS; i++) {
+    program.nums[i] = 1.2345678901234567;
+    program.code[program.len++] = CALC_OP_PUSH;
+    if (i > 0) {
+      program.code[program.len++] = CALC_OP_ADD;
+    }
+  }
+  struct calc_proto_req_t req;
+  req.method = EVAL;
+  req.program = &program;
+  struct calc_future_t future;
+  calc_future_ctor(&future);
+  assert_int_equal(calc_client_pool_submit_future(pool, &req, &future),
+      CALC_CLIENT_ERROR_TOO_LONG);
+  struct calc_proto_resp_t resp;
+  assert_int_equal(calc_future_wait(&future, &resp), CALC_CLIENT_ERROR_TOO_LONG);
+  calc_future_dtor(&future);
+
+  // The connections weren't marked down
+  assert_int_equal(calc_client_pool_healthy(pool), 2);
+  assert_int_equal(calc_client_pool_reconnects(pool), 0);
+  double result;
+  assert_int_equal(add(1, 2, &result), CALC_CLIENT_OK);
+  assert_float_equal(result, 3, EPSILON);
+  assert_int_equal(wait_accepted(2), 2);
+  calc_client_pool_dtor(pool);
+  fake_server_stop();
+}
+
+int setup(void** state) {
+  pool = calc_client_pool_new();
+  return 0;
+}
+
+int teardown(void** state) {
+  calc_client_pool_delete(pool);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(calc_client_pool__shares_connections, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_client_pool__reconnects, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_client_pool__server_down, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_client_pool__reconnects_while_submitting, setup,
+        teardown),
+    cmocka_unit_test_setup_teardown(calc_client_pool__request_too_long, setup, teardown)
+  };
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,234 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <cmocka.h>
+
+#include <calc_client.h>
+#include <calc_program.h>
+
+#define EPSILON 0.000001
+#define MAX_REQS 4096
+
+/**
+ * Fake server on the other end of a socket pair: it adds the operands of every request, and
+ * answers the requests of every read in reverse order (or never, if 'answer' is 0).
+*/
+struct fake_server_t {
+  int sd;
+  int answer;
+  pthread_t thread;
+  struct calc_proto_ser_t* ser;
+  struct calc_proto_req_t reqs[MAX_REQS];
+  int count;
+};
+
+void fake_server_on_request(void* obj, struct calc_proto_req_t req) {
+  struct fake_server_t* server = (struct fake_server_t*)obj;
+  server->reqs[server->count++] = req;
+}
+
+void* fake_server_loop(void* obj) {
+  struct fake_server_t* server = (struct fake_server_t*)obj;
+  static char in[65536];
+  static char out[MAX_REQS * CALC_PROTO_MAX_MSG_LEN];
+  server->ser = calc_proto_ser_new();
+  calc_proto_ser_ctor(server->ser, server, sizeof(in));
+  calc_proto_ser_set_req_callback(server->ser, fake_server_on_request);
+  int ret;
+  while ((ret = read(server->sd, in, sizeof(in))) > 0) {
+    int offset = 0;
+    if ((unsigned char)in[0] == CALC_PROTO_BINARY_HELLO) {
+      calc_proto_ser_set_mode(server->ser, CALC_PROTO_BINARY);
+      write(server->sd, in, 1);
+      offset = 1;
+    }
+    server->count = 0;
+    struct buffer_t buf;
+    buf.data = in + offset;
+    buf.len = ret - offset;
+    calc_proto_ser_server_deserialize(server->ser, buf, NULL);
+    if (!server->answer) {
+      continue;
+    }
+    int len = 0;
+    for (int i = server->count - 1; i >= 0; i--) {
+      struct calc_proto_resp_t resp;
+      resp.req_id = server->reqs[i].id;
+      resp.status = STATUS_OK;
+      resp.result = server->reqs[i].operand1 + server->reqs[i].operand2;
+      len += calc_proto_ser_server_serialize_to(server->ser, &resp, out + len, sizeof(out) - len);
+    }
+    write(server->sd, out, len);
+  }
+  calc_proto_ser_dtor(server->ser);
+  calc_proto_ser_delete(server->ser);
+  close(server->sd);
+  return NULL;
+}
+
+struct fake_server_t server;
+struct calc_client_t* client = NULL;
+
+void start(calc_proto_mode_t mode, int answer, int max_inflight) {
+  int sds[2];
+  assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, sds), 0);
+  server.sd = sds[1];
+  server.answer = answer;
+  pthread_create(&server.thread, NULL, fake_server_loop, &server);
+  assert_int_equal(calc_client_ctor(client, sds[0], mode, max_inflight), 0);
+}
+
+void stop() {
+  calc_client_dtor(client);
+  pthread_join(server.thread, NULL);
+}
+
+void submit_futures(int count) {
+  struct calc_future_t futures[100];
+  for (int i = 0; i < count; i++) {
+    struct calc_proto_req_t req;
+    req.method = ADD;
+    req.operand1 = i;
+    req.operand2 = 0.5;
+    calc_future_ctor(&futures[i]);
+    assert_int_equal(calc_client_submit_future(client, &req, &futures[i]), req.id);
+  }
+  for (int i = 0; i < count; i++) {
+    struct calc_proto_resp_t resp;
+    assert_int_equal(calc_future_wait(&futures[i], &resp), CALC_CLIENT_OK);
+    assert_float_equal(resp.result, i + 0.5, EPSILON);
+    calc_future_dtor(&futures[i]);
+  }
+  assert_int_equal(calc_client_inflight(client), 0);
+}
+
+void calc_client__futures_out_of_order(void** state) {
+  start(CALC_PROTO_TEXT, 1, 128);
+  submit_futures(100);
+  stop();
+}
+
+void calc_client__binary_frames(void** state) {
+  start(CALC_PROTO_BINARY, 1, 16);
+  submit_futures(100);
+  stop();
+}
+
+atomic_int completed;
+atomic_int wrong;
+
+void count_result(void* arg, int status, const struct calc_proto_resp_t* resp) {
+  double expected = (double)(long)arg;
+  if (status != CALC_CLIENT_OK || resp->result != expected + 0.5) {
+    atomic_fetch_add(&wrong, 1);
+  }
+  atomic_fetch_add(&completed, 1);
+}
+
+void* submitter(void* obj) {
+  for (long i = 0; i < 5000; i++) {
+    struct calc_proto_req_t req;
+    req.method = ADD;
+    req.operand1 = i;
+    req.operand2 = 0.5;
+    calc_client_submit(client, &req, count_result, (void*)i);
+  }
+  return NULL;
+}
+
+void calc_client__callbacks_from_many_threads(void** state) {
+  atomic_init(&completed, 0);
+  atomic_init(&wrong, 0);
+  start(CALC_PROTO_TEXT, 1, 64);
+  pthread_t threads[4];
+  for (int i = 0; i < 4; i++) {
+    pthread_create(&threads[i], NULL, submitter, NULL);
+  }
+  for (int i = 0; i < 4; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  while (atomic_load(&completed) < 4 * 5000) {
+    sched_yield();
+  }
+  assert_int_equal(atomic_load(&wrong), 0);
+  stop();
+}
+
+void calc_client__close_fails_pending(void** state) {
+  start(CALC_PROTO_TEXT, 0, 8);
+  struct calc_future_t future;
+  calc_future_ctor(&future);
+  struct calc_proto_req_t req;
+  req.method = MUL;
+  req.operand1 = 2;
+  req.operand2 = 3;
+  calc_client_submit_future(client, &req, &future);
+  assert_int_equal(calc_client_inflight(client), 1);
+
+  // The server goes away without answering
+  shutdown(server.sd, SHUT_RDWR);
+  struct calc_proto_resp_t resp;
+  assert_int_equal(calc_future_wait(&future, &resp), CALC_CLIENT_ERROR_CLOSED);
+  calc_future_dtor(&future);
+  assert_int_equal(calc_client_submit(client, &req, count_result, NULL), -1);
+  stop();
+}
+
+void calc_client__request_too_long(void** state) {
+  // A program whose text doesn't fit in a message (built by hand, the compiler rejects it)
+  start(CALC_PROTO_TEXT, 1, 8);
+  struct calc_program_t program;
+  program.len = 0;
+  program.nums_len = CALC_PROGRAM_MAX_NUMS;
+  for (int i = 0; i < CALC_PROGRAM_MAX_NUMS; i++) {
+    program.nums[i] = 1.2345678901234567;
+    program.code[program.len++] = CALC_OP_PUSH;
+    if (i > 0) {
+      program.code[program.len++] = CALC_OP_ADD;
+    }
+  }
+  struct calc_proto_req_t req;
+  req.method = EVAL;
+  req.program = &program;
+  struct calc_future_t future;
+  calc_future_ctor(&future);
+  assert_int_equal(calc_client_submit_future(client, &req, &future), CALC_CLIENT_ERROR_TOO_LONG);
+  struct calc_proto_resp_t resp;
+  assert_int_equal(calc_future_wait(&future, &resp), CALC_CLIENT_ERROR_TOO_LONG);
+  calc_future_dtor(&future);
+
+  // The connection is still fine
+  assert_false(calc_client_closed(client));
+  assert_int_equal(calc_client_inflight(client), 0);
+  submit_futures(10);
+  stop();
+}
+
+int setup(void** state) {
+  client = calc_client_new();
+  return 0;
+}
+
+int teardown(void** state) {
+  calc_client_delete(client);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(calc_client__futures_out_of_order, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_client__binary_frames, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_client__callbacks_from_many_threads, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_client__close_fails_pending, setup, teardown),
+    cmocka_unit_test_setup_teardown(calc_client__request_too_long, setup, teardown)
+  };
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
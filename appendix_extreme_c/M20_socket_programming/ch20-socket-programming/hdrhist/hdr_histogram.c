@@ -0,0 +1,355 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "hdr_histogram.h"
+
+/**
+ * With 'sub_bits' bits per sub-bucket, the counts are laid out as:
+ *
+ * - The first bucket: one count per value from 0 to sub_count - 1 (exact values).
+ * - Bucket b (from 1): the values with the highest bit at position b + sub_bits - 1, that is from
+ *   half << b to (sub_count << b) - 1, in 'half' sub-buckets of width 1 << b.
+ *
+ * Only the upper half of the sub-buckets is stored for the buckets after the first one, as the
+ * lower half would cover the values of the previous bucket.
+*/
+
+struct hdr_histogram_t
+{
+  int64_t highest;
+  int digits;
+  int sub_bits;
+  int64_t sub_count;
+  int64_t half;
+  int buckets;      // Buckets after the first one
+  int len;          // Number of counts
+  int64_t* counts;
+  int64_t total;
+  int64_t min;
+  int64_t max;
+};
+
+/**
+ * Position of the highest bit set (the value can't be 0)
+*/
+static int hdr_msb(int64_t value)
+{
+  return 63 - __builtin_clzll((unsigned long long)value);
+}
+
+/**
+ * Index of the count where a value is recorded
+ *
+ * @param hist Histogram
+ * @param value Value between 0 and the highest trackable value
+ *
+ * @return The index
+*/
+static int hdr_index_of(const struct hdr_histogram_t* hist, int64_t value)
+{
+  if (value < hist->sub_count)
+  {
+    return (int)value;
+  }
+  int bucket = hdr_msb(value) - hist->sub_bits + 1;
+  int64_t sub = value >> bucket;
+  return (int)(hist->sub_count + (bucket - 1) * hist->half + (sub - hist->half));
+}
+
+/**
+ * Lowest value recorded in a count, and the width of its range
+ *
+ * @param hist Histogram
+ * @param index Index of the count
+ * @param width Set to the number of values that share the count
+ *
+ * @return The lowest value of the count
+*/
+static int64_t hdr_value_of(const struct hdr_histogram_t* hist, int index, int64_t* width)
+{
+  if (index < hist->sub_count)
+  {
+    *width = 1;
+    return index;
+  }
+  int64_t rest = index - hist->sub_count;
+  int bucket = (int)(rest / hist->half) + 1;
+  int64_t sub = rest % hist->half + hist->half;
+  *width = (int64_t)1 << bucket;
+  return sub << bucket;
+}
+
+/**
+ * Highest value recorded in a count (never above the maximum recorded)
+*/
+static int64_t hdr_highest_of(const struct hdr_histogram_t* hist, int index)
+{
+  int64_t width;
+  int64_t value = hdr_value_of(hist, index, &width) + width - 1;
+  return value < hist->max ? value : hist->max;
+}
+
+struct hdr_histogram_t* hdr_histogram_new()
+{
+  return (struct hdr_histogram_t*)malloc(sizeof(struct hdr_histogram_t));
+}
+
+void hdr_histogram_delete(struct hdr_histogram_t* hist)
+{
+  free(hist);
+}
+
+void hdr_histogram_ctor(struct hdr_histogram_t* hist, int64_t highest, int digits)
+{
+  if (digits < 1)
+  {
+    digits = 1;
+  }
+  if (digits > 5)
+  {
+    digits = 5;
+  }
+
+  // Enough sub-buckets to tell apart two values that differ in the last digit kept
+  int64_t distinct = 2;
+  for (int i = 0; i < digits; i++)
+  {
+    distinct *= 10;
+  }
+  hist->sub_bits = 1;
+  while (((int64_t)1 << hist->sub_bits) < distinct)
+  {
+    hist->sub_bits++;
+  }
+  hist->sub_count = (int64_t)1 << hist->sub_bits;
+  hist->half = hist->sub_count / 2;
+  hist->highest = highest < hist->sub_count ? hist->sub_count - 1 : highest;
+  hist->digits = digits;
+  hist->buckets = hdr_msb(hist->highest) - hist->sub_bits + 1;
+  if (hist->buckets < 0)
+  {
+    hist->buckets = 0;
+  }
+  hist->len = (int)(hist->sub_count + hist->buckets * hist->half);
+  hist->counts = (int64_t*)calloc(hist->len, sizeof(int64_t));
+  hist->total = 0;
+  hist->min = INT64_MAX;
+  hist->max = 0;
+}
+
+void hdr_histogram_dtor(struct hdr_histogram_t* hist)
+{
+  free(hist->counts);
+}
+
+/**
+ * Record a value several times
+ *
+ * @param hist Histogram
+ * @param value Value to record
+ * @param count Number of times
+*/
+void hdr_histogram_record_n(struct hdr_histogram_t* hist, int64_t value, int64_t count)
+{
+  if (value < 0)
+  {
+    value = 0;
+  }
+  if (value > hist->highest)
+  {
+    value = hist->highest;
+  }
+  hist->counts[hdr_index_of(hist, value)] += count;
+  hist->total += count;
+  if (value < hist->min)
+  {
+    hist->min = value;
+  }
+  if (value > hist->max)
+  {
+    hist->max = value;
+  }
+}
+
+void hdr_histogram_record(struct hdr_histogram_t* hist, int64_t value)
+{
+  hdr_histogram_record_n(hist, value, 1);
+}
+
+void hdr_histogram_reset(struct hdr_histogram_t* hist)
+{
+  memset(hist->counts, 0, hist->len * sizeof(int64_t));
+  hist->total = 0;
+  hist->min = INT64_MAX;
+  hist->max = 0;
+}
+
+/**
+ * Add the values of another histogram, used to merge the histograms that every thread keeps on
+ * its own
+ *
+ * @param hist Histogram that receives the values
+ * @param other Histogram with the same highest value and digits
+*/
+void hdr_histogram_add(struct hdr_histogram_t* hist, const struct hdr_histogram_t* other)
+{
+  for (int i = 0; i < hist->len && i < other->len; i++)
+  {
+    hist->counts[i] += other->counts[i];
+  }
+  hist->total += other->total;
+  if (other->min < hist->min)
+  {
+    hist->min = other->min;
+  }
+  if (other->max > hist->max)
+  {
+    hist->max = other->max;
+  }
+}
+
+int64_t hdr_histogram_total(const struct hdr_histogram_t* hist)
+{
+  return hist->total;
+}
+
+int64_t hdr_histogram_min(const struct hdr_histogram_t* hist)
+{
+  return hist->total ? hist->min : 0;
+}
+
+int64_t hdr_histogram_max(const struct hdr_histogram_t* hist)
+{
+  return hist->max;
+}
+
+/**
+ * Mean of the values, taking the middle of every count as its value
+*/
+double hdr_histogram_mean(const struct hdr_histogram_t* hist)
+{
+  if (!hist->total)
+  {
+    return 0;
+  }
+  double sum = 0;
+  for (int i = 0; i < hist->len; i++)
+  {
+    if (hist->counts[i])
+    {
+      int64_t width;
+      int64_t value = hdr_value_of(hist, i, &width);
+      sum += (double)hist->counts[i] * (value + width / 2);
+    }
+  }
+  return sum / hist->total;
+}
+
+/**
+ * Value below (or equal to) which a percentage of the values are
+ *
+ * @param hist Histogram
+ * @param percentile Percentage, from 0 to 100
+ *
+ * @return The highest value of the count that reaches the percentage (the values of a count are
+ *         equivalent), or 0 if the histogram is empty
+*/
+int64_t hdr_histogram_value_at_percentile(const struct hdr_histogram_t* hist, double percentile)
+{
+  if (!hist->total)
+  {
+    return 0;
+  }
+  if (percentile <= 0)
+  {
+    return hist->min;
+  }
+  int64_t target = (int64_t)ceil(percentile * hist->total / 100.0);
+  if (target > hist->total)
+  {
+    target = hist->total;
+  }
+  int64_t seen = 0;
+  for (int i = 0; i < hist->len; i++)
+  {
+    seen += hist->counts[i];
+    if (seen >= target)
+    {
+      return hdr_highest_of(hist, i);
+    }
+  }
+  return hist->max;
+}
+
+/**
+ * Print the percentile distribution, with more lines near 100% (the tail is what matters for
+ * latencies): every half of the distance to 100% is divided in 'ticks_per_half' steps, so there
+ * are lines for 0%, 10%, ..., 50%, 55%, ..., 75%, 77.5%, ... The lines can be plotted with the
+ * tools of HdrHistogram.
+ *
+ * @param hist Histogram
+ * @param out Where the distribution is printed
+ * @param ticks_per_half Steps in every half of the distance to 100%
+ * @param scale Divisor of the values printed
+*/
+void hdr_histogram_print(const struct hdr_histogram_t* hist, FILE* out, int ticks_per_half,
+    double scale)
+{
+  fprintf(out, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount",
+      "1/(1-Percentile)");
+
+  // Walk the counts once, advancing the percentile levels reached by every count
+  int halving = 0;
+  int tick = 0;
+  double level = 0;
+  int64_t seen = 0;
+  for (int i = 0; i < hist->len && hist->total; i++)
+  {
+    if (!hist->counts[i])
+    {
+      continue;
+    }
+    seen += hist->counts[i];
+    int reached = 0;
+    while (ldexp(1.0, -halving) * hist->total >= 1 && ceil(level / 100 * hist->total) <= seen)
+    {
+      reached = 1;
+      if (++tick == ticks_per_half)
+      {
+        tick = 0;
+        halving++;
+      }
+      level = 100 * (1 - ldexp(1.0, -halving)) + 100 * ldexp(1.0, -halving - 1) * tick /
+          ticks_per_half;
+    }
+
+    // The last line (100%) is printed after the loop
+    if (reached && seen < hist->total)
+    {
+      double fraction = (double)seen / hist->total;
+      fprintf(out, "%12.3f %14.12f %10ld %14.2f\n", hdr_highest_of(hist, i) / scale, fraction,
+          (long)seen, 1 / (1 - fraction));
+    }
+  }
+  fprintf(out, "%12.3f %14.12f %10ld\n", hist->max / scale, 1.0, (long)hist->total);
+
+  double mean = hdr_histogram_mean(hist);
+  double variance = 0;
+  for (int i = 0; i < hist->len; i++)
+  {
+    if (hist->counts[i])
+    {
+      int64_t width;
+      double delta = hdr_value_of(hist, i, &width) + width / 2 - mean;
+      variance += hist->counts[i] * delta * delta;
+    }
+  }
+  variance = hist->total ? variance / hist->total : 0;
+  fprintf(out, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean / scale,
+      sqrt(variance) / scale);
+  fprintf(out, "#[Max     = %12.3f, Total count    = %12ld]\n", hist->max / scale,
+      (long)hist->total);
+  fprintf(out, "#[Buckets = %12d, SubBuckets     = %12ld]\n", hist->buckets + 1,
+      (long)hist->sub_count);
+}
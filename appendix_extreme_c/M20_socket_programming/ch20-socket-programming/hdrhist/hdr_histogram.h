@@ -0,0 +1,55 @@
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * High Dynamic Range histogram: it records integer values (latencies in nanoseconds, for instance)
+ * between 0 and a highest trackable value, keeping a fixed number of significant digits for all of
+ * them. A latency of 2 us and one of 2 s are both recorded with an error below 0.1% (3 digits),
+ * while the memory is fixed from the beginning and recording a value is only a few instructions.
+ *
+ * The values are grouped in buckets, one per power of two, and every bucket is divided in the same
+ * number of sub-buckets (linear). So a bucket that covers bigger values has wider sub-buckets, and
+ * the relative error stays the same. The layout follows the HdrHistogram of Gil Tene.
+ *
+ *    struct hdr_histogram_t* hist = hdr_histogram_new();
+ *    hdr_histogram_ctor(hist, 10000000000, 3);           // Up to 10 s (in ns), 3 digits
+ *    hdr_histogram_record(hist, latency_ns);
+ *    ...
+ *    printf("p99: %ld ns\n", hdr_histogram_value_at_percentile(hist, 99.0));
+*/
+
+// Forward declaration
+struct hdr_histogram_t;
+
+// Memory management function
+struct hdr_histogram_t* hdr_histogram_new();
+void hdr_histogram_delete(struct hdr_histogram_t*);
+
+// Constructor (digits from 1 to 5) and destructor
+void hdr_histogram_ctor(struct hdr_histogram_t*, int64_t highest, int digits);
+void hdr_histogram_dtor(struct hdr_histogram_t*);
+
+// Methods to record values: bigger values are recorded as the highest, negative ones as 0
+void hdr_histogram_record(struct hdr_histogram_t*, int64_t value);
+void hdr_histogram_record_n(struct hdr_histogram_t*, int64_t value, int64_t count);
+void hdr_histogram_reset(struct hdr_histogram_t*);
+
+// Add all the values of another histogram (it must have the same highest value and digits)
+void hdr_histogram_add(struct hdr_histogram_t*, const struct hdr_histogram_t* other);
+
+// Methods to read the distribution
+int64_t hdr_histogram_total(const struct hdr_histogram_t*);
+int64_t hdr_histogram_min(const struct hdr_histogram_t*);
+int64_t hdr_histogram_max(const struct hdr_histogram_t*);
+double hdr_histogram_mean(const struct hdr_histogram_t*);
+int64_t hdr_histogram_value_at_percentile(const struct hdr_histogram_t*, double percentile);
+
+// Print the percentile distribution in the text format of HdrHistogram (.hgrm files), dividing
+// the values by 'scale' (1000 prints nanoseconds as microseconds, for instance)
+void hdr_histogram_print(const struct hdr_histogram_t*, FILE* out, int ticks_per_half,
+    double scale);
+
+#endif
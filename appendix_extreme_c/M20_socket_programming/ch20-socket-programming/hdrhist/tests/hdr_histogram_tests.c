@@ -0,0 +1,114 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <hdr_histogram.h>
+
+#define HIGHEST 10000000000L // 10 s in nanoseconds
+
+struct hdr_histogram_t* hist = NULL;
+
+void hdr_histogram__exact_small_values(void** state) {
+  hdr_histogram_ctor(hist, HIGHEST, 3);
+  assert_int_equal(hdr_histogram_total(hist), 0);
+  assert_int_equal(hdr_histogram_value_at_percentile(hist, 50.0), 0);
+  for (int i = 1; i <= 1000; i++) {
+    hdr_histogram_record(hist, i);
+  }
+  assert_int_equal(hdr_histogram_total(hist), 1000);
+  assert_int_equal(hdr_histogram_min(hist), 1);
+  assert_int_equal(hdr_histogram_max(hist), 1000);
+  assert_int_equal(hdr_histogram_value_at_percentile(hist, 0.0), 1);
+  assert_int_equal(hdr_histogram_value_at_percentile(hist, 50.0), 500);
+  assert_int_equal(hdr_histogram_value_at_percentile(hist, 99.0), 990);
+  assert_int_equal(hdr_histogram_value_at_percentile(hist, 99.9), 999);
+  assert_int_equal(hdr_histogram_value_at_percentile(hist, 100.0), 1000);
+  assert_float_equal(hdr_histogram_mean(hist), 500.5, 0.001);
+  hdr_histogram_dtor(hist);
+}
+
+void hdr_histogram__relative_error(void** state) {
+  hdr_histogram_ctor(hist, HIGHEST, 3);
+
+  // Every magnitude keeps 3 significant digits: the median is 'value' plus less than 0.1%
+  for (long value = 3; value < HIGHEST / 10; value = value * 7 + 1) {
+    hdr_histogram_reset(hist);
+    hdr_histogram_record_n(hist, value, 100);
+    hdr_histogram_record(hist, value * 10);
+    long median = hdr_histogram_value_at_percentile(hist, 50.0);
+    assert_true(median >= value);
+    assert_true(median - value <= value / 1000);
+  }
+  hdr_histogram_dtor(hist);
+}
+
+void hdr_histogram__clamps_out_of_range(void** state) {
+  hdr_histogram_ctor(hist, 1000000, 2);
+  hdr_histogram_record(hist, -5);
+  hdr_histogram_record(hist, 1000000 * 10L);
+  assert_int_equal(hdr_histogram_total(hist), 2);
+  assert_int_equal(hdr_histogram_min(hist), 0);
+  assert_int_equal(hdr_histogram_max(hist), 1000000);
+  assert_int_equal(hdr_histogram_value_at_percentile(hist, 100.0), 1000000);
+  hdr_histogram_dtor(hist);
+}
+
+void hdr_histogram__add(void** state) {
+  hdr_histogram_ctor(hist, HIGHEST, 3);
+  struct hdr_histogram_t* other = hdr_histogram_new();
+  hdr_histogram_ctor(other, HIGHEST, 3);
+  hdr_histogram_record_n(hist, 100, 90);
+  hdr_histogram_record_n(other, 5000000, 10);
+  hdr_histogram_add(hist, other);
+  assert_int_equal(hdr_histogram_total(hist), 100);
+  assert_int_equal(hdr_histogram_min(hist), 100);
+  assert_int_equal(hdr_histogram_max(hist), 5000000);
+  assert_int_equal(hdr_histogram_value_at_percentile(hist, 90.0), 100);
+  assert_int_equal(hdr_histogram_value_at_percentile(hist, 91.0), 5000000);
+  hdr_histogram_dtor(other);
+  hdr_histogram_delete(other);
+  hdr_histogram_dtor(hist);
+}
+
+void hdr_histogram__print(void** state) {
+  hdr_histogram_ctor(hist, HIGHEST, 3);
+  for (int i = 1; i <= 10000; i++) {
+    hdr_histogram_record(hist, i * 1000L);
+  }
+  char text[16384];
+  FILE* out = fmemopen(text, sizeof(text), "w");
+  hdr_histogram_print(hist, out, 5, 1000.0);
+  fclose(out);
+
+  // The distribution is printed in microseconds, and ends with the maximum at 100%
+  assert_non_null(strstr(text, "Percentile"));
+  assert_non_null(strstr(text, "    5001.215 0.500100000000       5001           2.00\n"));
+  assert_non_null(strstr(text, "   10000.000 1.000000000000      10000\n"));
+  assert_non_null(strstr(text, "Total count    =        10000]"));
+  hdr_histogram_dtor(hist);
+}
+
+int setup(void** state) {
+  hist = hdr_histogram_new();
+  return 0;
+}
+
+int teardown(void** state) {
+  hdr_histogram_delete(hist);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(hdr_histogram__exact_small_values, setup, teardown),
+    cmocka_unit_test_setup_teardown(hdr_histogram__relative_error, setup, teardown),
+    cmocka_unit_test_setup_teardown(hdr_histogram__clamps_out_of_range, setup, teardown),
+    cmocka_unit_test_setup_teardown(hdr_histogram__add, setup, teardown),
+    cmocka_unit_test_setup_teardown(hdr_histogram__print, setup, teardown)
+  };
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <calc_service.h>
+#include <calc_batch.h>
+
+/**
+ * The batch server evaluates columnar batches (see calcbatch/calc_batch.h) instead of the messages
+ * of the text protocol. It is meant for the offline jobs, that have all their requests at once and
+ * only need all their responses back.
+ *
+ * With two paths it evaluates a file of requests into a file of responses, the file of requests is
+ * mapped in memory ("-" reads the standard input or writes the standard output):
+ *
+ *    ./batch_calc_server requests.bin responses.bin
+ *    ssh host cat requests.bin | ./batch_calc_server - - > responses.bin
+ *
+ * With -s path it serves the batches in a Unix socket: every connection sends a batch of requests
+ * and receives the batch of responses on the same connection, chunk by chunk (the client has to
+ * read the responses while it sends the requests, as a pipelined client does). Every connection
+ * has its own thread and its own service, so the memory of a job is not shared with other jobs:
+ *
+ *    ./batch_calc_server -s /tmp/calc_batch.sock
+*/
+
+/**
+ * Print the options of the server and exit
+ *
+ * @param name Name of the program
+*/
+void usage(const char* name)
+{
+  fprintf(stderr, "Usage: %s <requests|-> <responses|->\n"
+      "       %s -s <socket_path>\n", name, name);
+  exit(1);
+}
+
+/**
+ * Evaluate the batch of a connection, and close it
+ *
+ * @param arg Socket descriptor of the connection (as an intptr_t)
+ *
+ * @return NULL
+*/
+void* serve_batch(void* arg)
+{
+  int sd = (int)(intptr_t)arg;
+  struct calc_service_t* svc = calc_service_new();
+  calc_service_ctor(svc);
+  if (calc_batch_run(svc, sd, sd) == -1)
+  {
+    fprintf(stderr, "WARN: Invalid batch or closed connection\n");
+  }
+  calc_service_dtor(svc);
+  calc_service_delete(svc);
+  close(sd);
+  return NULL;
+}
+
+/**
+ * Serve the batches of the connections of a Unix socket, forever
+ *
+ * @param sock_file Path of the socket file
+*/
+void serve_socket(const char* sock_file)
+{
+  int server_sd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server_sd == -1)
+  {
+    fprintf(stderr, "Could not create socket: %s\n", strerror(errno));
+    exit(1);
+  }
+  unlink(sock_file);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, sock_file, sizeof(addr.sun_path) - 1);
+  if (bind(server_sd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+      listen(server_sd, 10) == -1)
+  {
+    close(server_sd);
+    fprintf(stderr, "Could not bind the address: %s\n", strerror(errno));
+    exit(1);
+  }
+
+  // A client that leaves makes the write fail, it must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+  while (1)
+  {
+    int client_sd = accept(server_sd, NULL, NULL);
+    if (client_sd == -1)
+    {
+      if (errno != EINTR)
+      {
+        fprintf(stderr, "Could not accept the client: %s\n", strerror(errno));
+      }
+      continue;
+    }
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, serve_batch, (void*)(intptr_t)client_sd))
+    {
+      close(client_sd);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const char* sock_file = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:")) != -1)
+  {
+    switch (opt)
+    {
+      case 's': sock_file = optarg; break;
+      default: usage(argv[0]);
+    }
+  }
+  if (sock_file)
+  {
+    serve_socket(sock_file);
+    return 0;
+  }
+  if (argc - optind != 2)
+  {
+    usage(argv[0]);
+  }
+
+  const char* in_path = argv[optind];
+  const char* out_path = argv[optind + 1];
+  int in_fd = strcmp(in_path, "-") ? open(in_path, O_RDONLY) : STDIN_FILENO;
+  if (in_fd == -1)
+  {
+    fprintf(stderr, "Could not open %s: %s\n", in_path, strerror(errno));
+    exit(1);
+  }
+  int out_fd = strcmp(out_path, "-") ? open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) :
+      STDOUT_FILENO;
+  if (out_fd == -1)
+  {
+    fprintf(stderr, "Could not open %s: %s\n", out_path, strerror(errno));
+    exit(1);
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  struct calc_service_t* svc = calc_service_new();
+  calc_service_ctor(svc);
+  long rows = calc_batch_run(svc, in_fd, out_fd);
+  calc_service_dtor(svc);
+  calc_service_delete(svc);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (rows == -1)
+  {
+    fprintf(stderr, "Invalid batch in %s, or could not write %s\n", in_path, out_path);
+    exit(1);
+  }
+  double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  fprintf(stderr, "%ld requests in %.3f s (%.1f M/s)\n", rows, elapsed,
+      elapsed > 0 ? rows / elapsed / 1e6 : 0.0);
+  close(in_fd);
+  close(out_fd);
+  return 0;
+}
@@ -3,14 +3,26 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <pthread.h>
 
 #include <sys/socket.h>
 
 #include <calc_proto_ser.h>
 #include <calc_service.h>
+#include <calc_registers.h>
+#include <calc_program.h>
+#include <calc_cache.h>
 
 #include "common_server_core.h"
+#include "server_stats.h"
+
+// Registers of the process, and the one shared by the memory methods of the clients
+static struct calc_registers_t* mem_registers = NULL;
+static struct calc_register_t* shared_mem = NULL;
+
+// Results of the operations without memory, shared by all the clients (NULL if disabled)
+static struct calc_cache_t* result_cache = NULL;
 
 /**
  * Error callback function that will update status and handle the errors in the response object.
@@ -41,6 +53,14 @@ void error_callback(void* obj, int ref_id, int error_code)
       break;
   }
 
+  // The codes of the requests are counted one by one, the rest together
+  int index = error_code - ERROR_INVALID_REQUEST;
+  if (index < 0 || index >= STATS_ERRORS - 1)
+  {
+    index = STATS_ERRORS - 1;
+  }
+  server_stats_add(&server_stats_thread()->errors[index], 1);
+
   // Generate responses that notifies the situation
   struct calc_proto_resp_t resp;
   resp.req_id = ref_id;
@@ -50,59 +70,464 @@ void error_callback(void* obj, int ref_id, int error_code)
 }
 
 /**
- * Callback for manage request received
+ * Share a register among the memory methods of all the clients. It must be called before the
+ * first client is served.
  * 
- * @param obj Generic pointer that referst to the client conext related with the request
- * @param req Request object passed 
+ * @param name Name of the register
+ * 
+ * @return 0, or -1 if the name is too long
 */
-void request_callback(void* obj, struct calc_proto_req_t req) 
+int share_mem_register(const char* name)
+{
+  if (!mem_registers) 
+  {
+    mem_registers = calc_registers_new();
+    calc_registers_ctor(mem_registers);
+  }
+  shared_mem = calc_registers_get(mem_registers, name);
+  return shared_mem ? 0 : -1;
+}
+
+/**
+ * Attach the service of a new client to the shared register, so its memory methods update the
+ * running totals of all the clients
+ * 
+ * @param svc Service of the client
+*/
+void attach_mem_register(struct calc_service_t* svc)
+{
+  calc_service_set_register(svc, shared_mem);
+}
+
+/**
+ * Keep the results of the ADD, SUB, MUL and DIV requests of all the clients in a cache, so the
+ * repeated ones are answered without the service. It must be called before the first client is
+ * served.
+ * 
+ * @param slots Results kept (rounded up to a power of two)
+ * 
+ * @return 0, or -1 if the number of slots is not valid
+*/
+int enable_result_cache(long slots)
+{
+  if (slots < 1 || slots > CALC_CACHE_MAX_SLOTS)
+  {
+    return -1;
+  }
+  result_cache = calc_cache_new();
+  calc_cache_ctor(result_cache, slots);
+  return 0;
+}
+
+/**
+ * Private function that tells if the result of a request can be kept in the cache (the methods
+ * that read or write the memory give a different result every time)
+ * 
+ * @param method Method of the request
+ * 
+ * @return TRUE for ADD, SUB, MUL and DIV when the cache is enabled
+*/
+static bool_t _is_cacheable(method_t method)
+{
+  return result_cache &&
+      (method == ADD || method == SUB || method == MUL || method == DIV);
+}
+
+/**
+ * Private function that answers a request with the cache of results, counting the hits and the
+ * misses
+ * 
+ * @param req Request (a cacheable one)
+ * @param resp Response filled if the result was in the cache
+ * 
+ * @return TRUE if the request was answered
+*/
+static bool_t _lookup_cached_result(const struct calc_proto_req_t* req,
+    struct calc_proto_resp_t* resp)
+{
+  struct server_stats_t* stats = server_stats_thread();
+  int status;
+  double result;
+  if (!calc_cache_get(result_cache, req->method, req->operand1, req->operand2, &status, &result))
+  {
+    server_stats_add(&stats->cache_misses, 1);
+    return FALSE;
+  }
+  server_stats_add(&stats->cache_hits, 1);
+  resp->req_id = req->id;
+  resp->status = status;
+  resp->result = result;
+  return TRUE;
+}
+
+/**
+ * Select the wire format of a connection (or a datagram). A client that wants binary frames sends
+ * CALC_PROTO_BINARY_HELLO as its first byte, which can't be the beginning of a text message, so
+ * the old text clients keep working without changes.
+ * 
+ * @param context Pointer to the client context that owns the serialization object
+ * @param buf First bytes received from the client
+ * 
+ * @return Number of bytes consumed by the negotiation (1 if binary frames were requested)
+*/
+int negotiate_wire_mode(struct client_context_t* context, struct buffer_t buf)
+{
+  context->negotiated = 1;
+  if (buf.len > 0 && (unsigned char)buf.data[0] == CALC_PROTO_BINARY_HELLO) 
+  {
+    calc_proto_ser_set_mode(context->ser, CALC_PROTO_BINARY);
+    return 1;
+  }
+  calc_proto_ser_set_mode(context->ser, CALC_PROTO_TEXT);
+  return 0;
+}
+
+/**
+ * Serialize a response in the buffer passed (usually on the stack of the writer), so the hot path
+ * doesn't need to reserve memory. If the result can't be represented in a message, an internal
+ * error response is serialized instead, so the client still gets an answer for its request.
+ * 
+ * @param context Pointer to the client context that owns the serialization object
+ * @param resp Pointer to the response to serialize
+ * @param dst Destination buffer
+ * @param cap Number of characters available in the destination
+ * 
+ * @return Length of the serialized message, or -1 if nothing could be serialized
+*/
+int serialize_resp(struct client_context_t* context, const struct calc_proto_resp_t* resp,
+    char* dst, int cap)
+{
+  int len = calc_proto_ser_server_serialize_to(context->ser, resp, dst, cap);
+  if (len < 0) 
+  {
+    struct calc_proto_resp_t err_resp;
+    err_resp.req_id = resp->req_id;
+    err_resp.status = STATUS_INTERNAL_ERROR;
+    err_resp.result = 0.0;
+    len = calc_proto_ser_server_serialize_to(context->ser, &err_resp, dst, cap);
+  }
+  return len;
+}
+
+/**
+ * Serialize a response at the end of the output buffer of the context. Nothing is sent here, the
+ * owner of the context calls flush_resps when the whole read has been processed, so all the
+ * responses go out with a single system call. If the buffer has no room for another message, the
+ * responses waiting are flushed first, and if the socket doesn't take them the buffer grows (the
+ * responses of the requests already read can't be dropped, and the owner stops reading at
+ * RESP_HIGH_WATER, so it doesn't grow without limit).
+ * 
+ * @param context Pointer to the client context with the output buffer
+ * @param resp Pointer to the response to serialize
+ * 
+ * @return Length of the serialized message, or -1 if nothing could be serialized
+*/
+int queue_resp(struct client_context_t* context, const struct calc_proto_resp_t* resp)
+{
+  if (context->out_cap - context->out_len < CALC_PROTO_MAX_MSG_LEN) 
+  {
+    context->flush_resps(context);
+    if (context->out_cap - context->out_len < CALC_PROTO_MAX_MSG_LEN) 
+    {
+      context->out_cap *= 2;
+      context->out = (char*)realloc(context->out, context->out_cap);
+    }
+  }
+  int len = serialize_resp(context, resp, context->out + context->out_len,
+      context->out_cap - context->out_len);
+  if (len > 0) 
+  {
+    context->out_len += len;
+  }
+  return len;
+}
+
+/**
+ * Send the responses waiting in the output buffer, as many bytes as the socket takes without
+ * blocking. What can't be sent now is moved to the beginning of the buffer, and the owner of the
+ * context sends it when the socket is writable again, so a client that doesn't read its responses
+ * never blocks the thread that serves it. MSG_NOSIGNAL turns a client that left into an error of
+ * this connection, instead of a SIGPIPE that would kill the whole server.
+ * 
+ * @param context Pointer to the client context with the output buffer
+ * @param sd Socket of the client
+ * 
+ * @return Number of bytes sent, or -1 if the connection failed (only this client is affected)
+*/
+int send_resps(struct client_context_t* context, int sd)
+{
+  int sent = 0;
+  while (sent < context->out_len) 
+  {
+    int ret = send(sd, context->out + sent, context->out_len - sent,
+        MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (ret >= 0) 
+    {
+      sent += ret;
+    }
+    else if (errno == EAGAIN || errno == EWOULDBLOCK) 
+    {
+      break;
+    }
+    else if (errno != EINTR) 
+    {
+      server_stats_add(&server_stats_thread()->write_errors, 1);
+      return -1;
+    }
+  }
+  memmove(context->out, context->out + sent, context->out_len - sent);
+  context->out_len -= sent;
+  server_stats_add(&server_stats_thread()->bytes_out, sent);
+  return sent;
+}
+
+/**
+ * Evaluate a request against the calculator service
+ * 
+ * @param svc Service object of the client
+ * @param req Request to evaluate
+ * @param resp Response filled with the status and the result of the operation
+*/
+void execute_request(struct calc_service_t* svc, const struct calc_proto_req_t* req,
+    struct calc_proto_resp_t* resp)
 {
-  struct client_context_t* context = (struct client_context_t*)obj;
   int status = STATUS_OK;
   double result = 0.0;
+  method_t counted = (unsigned)req->method < STATS_METHODS ? req->method : NONE;
+  server_stats_add(&server_stats_thread()->requests[counted], 1);
+  bool_t cacheable = _is_cacheable(req->method);
+  if (cacheable && _lookup_cached_result(req, resp))
+  {
+    return;
+  }
 
   // Analize case and make the proper operation to formulate the response
-  switch (req.method) 
+  switch (req->method) 
   {
     case GETMEM:
-      result = calc_service_get_mem(context->svc);
+      result = calc_service_get_mem(svc);
       break;
     case RESMEM:
-      calc_service_reset_mem(context->svc);
+      calc_service_reset_mem(svc);
       break;
     case ADD:
     case ADDM:
-      result = calc_service_add(context->svc, req.operand1,
-          req.operand2, req.method == ADDM);
+      result = calc_service_add(svc, req->operand1,
+          req->operand2, req->method == ADDM);
       break;
     case SUB:
     case SUBM:
-      result = calc_service_sub(context->svc, req.operand1,
-          req.operand2, req.method == SUBM);
+      result = calc_service_sub(svc, req->operand1,
+          req->operand2, req->method == SUBM);
       break;
     case MUL:
     case MULM:
-      result = calc_service_mul(context->svc, req.operand1,
-          req.operand2, req.method == MULM);
+      result = calc_service_mul(svc, req->operand1,
+          req->operand2, req->method == MULM);
       break;
     case DIV: 
     {
-      status = calc_service_div(context->svc, req.operand1,
-          req.operand2, &result);
+      status = calc_service_div(svc, req->operand1,
+          req->operand2, &result);
       if (status == CALC_SVC_ERROR_DIV_BY_ZERO) 
       {
         status = STATUS_DIV_BY_ZERO;
       }
       break;
     }
+    case EVAL:
+    {
+      status = calc_program_run(req->program, svc, &result);
+      if (status == CALC_SVC_ERROR_DIV_BY_ZERO)
+      {
+        status = STATUS_DIV_BY_ZERO;
+      }
+      break;
+    }
     default:
       status = STATUS_INVALID_METHOD;
   }
 
+  resp->req_id = req->id;
+  resp->status = status;
+  resp->result = result;
+  if (cacheable)
+  {
+    calc_cache_put(result_cache, req->method, req->operand1, req->operand2, status, result);
+  }
+}
+
+/**
+ * Evaluate the requests of a batch. The ADD, SUB, MUL and DIV requests don't use the memory of the
+ * service, so their order doesn't matter: they are grouped by method and evaluated with the bulk
+ * methods of the service (see calc_service_add_n), which do several of them per instruction. The
+ * requests that use the memory are evaluated one by one, in their order. Small batches aren't
+ * worth the grouping, they are evaluated one by one too. With the cache of results enabled, only
+ * the requests that miss it go to the bulk methods, and their results are kept.
+ * 
+ * @param svc Service object of the client
+ * @param reqs Requests to evaluate (at most CALC_PROTO_MAX_BATCH)
+ * @param resps Responses filled with the status and the result of every request
+ * @param count Number of requests
+*/
+void execute_requests(struct calc_service_t* svc, const struct calc_proto_req_t* reqs,
+    struct calc_proto_resp_t* resps, int count)
+{
+  if (count < EXECUTE_BULK_MIN) 
+  {
+    for (int i = 0; i < count; i++) 
+    {
+      execute_request(svc, &reqs[i], &resps[i]);
+    }
+    return;
+  }
+
+  // Operands of the requests of every bulk method, gathered in arrays (and where their responses go)
+  static const method_t methods[4] = {ADD, SUB, MUL, DIV};
+  double a[4][CALC_PROTO_MAX_BATCH];
+  double b[4][CALC_PROTO_MAX_BATCH];
+  unsigned char index[4][CALC_PROTO_MAX_BATCH];
+  int sizes[4] = {0, 0, 0, 0};
+  struct server_stats_t* stats = server_stats_thread();
+  for (int i = 0; i < count; i++) 
+  {
+    int bulk;
+    switch (reqs[i].method) 
+    {
+      case ADD: bulk = 0; break;
+      case SUB: bulk = 1; break;
+      case MUL: bulk = 2; break;
+      case DIV: bulk = 3; break;
+      default:
+        execute_request(svc, &reqs[i], &resps[i]);
+        continue;
+    }
+    if (result_cache && _lookup_cached_result(&reqs[i], &resps[i])) 
+    {
+      server_stats_add(&stats->requests[reqs[i].method], 1);
+      continue;
+    }
+    int pos = sizes[bulk]++;
+    a[bulk][pos] = reqs[i].operand1;
+    b[bulk][pos] = reqs[i].operand2;
+    index[bulk][pos] = (unsigned char)i;
+  }
+
+  double out[CALC_PROTO_MAX_BATCH];
+  uint64_t zero_mask[(CALC_PROTO_MAX_BATCH + 63) / 64];
+  for (int bulk = 0; bulk < 4; bulk++) 
+  {
+    int size = sizes[bulk];
+    if (size == 0) 
+    {
+      continue;
+    }
+    server_stats_add(&stats->requests[methods[bulk]], size);
+
+    size_t zeros = 0;
+    switch (methods[bulk]) 
+    {
+      case ADD: calc_service_add_n(svc, a[bulk], b[bulk], out, size); break;
+      case SUB: calc_service_sub_n(svc, a[bulk], b[bulk], out, size); break;
+      case MUL: calc_service_mul_n(svc, a[bulk], b[bulk], out, size); break;
+      default: zeros = calc_service_div_n(svc, a[bulk], b[bulk], out, zero_mask, size);
+    }
+    for (int i = 0; i < size; i++) 
+    {
+      struct calc_proto_resp_t* resp = &resps[index[bulk][i]];
+      resp->req_id = reqs[index[bulk][i]].id;
+      resp->status = STATUS_OK;
+      resp->result = out[i];
+      if (zeros && (zero_mask[i / 64] >> (i % 64) & 1)) 
+      {
+        resp->status = STATUS_DIV_BY_ZERO;
+      }
+      if (result_cache) 
+      {
+        calc_cache_put(result_cache, methods[bulk], a[bulk][i], b[bulk][i], resp->status,
+            resp->result);
+      }
+    }
+  }
+}
+
+/**
+ * Evaluate the request traced of a sampled read, stamping the stages of its evaluation
+ * 
+ * @param context Pointer to the client context with the span of the trace
+ * @param req Request to evaluate
+ * @param resp Response filled with the status and the result of the operation
+*/
+void execute_traced_request(struct client_context_t* context, const struct calc_proto_req_t* req,
+    struct calc_proto_resp_t* resp)
+{
+  server_trace_decoded(&context->trace, req);
+  server_trace_stamp(&context->trace, TRACE_SERVICE_BEGIN);
+  execute_request(context->svc, req, resp);
+  server_trace_stamp(&context->trace, TRACE_SERVICE_END);
+}
+
+/**
+ * Callback for manage request received
+ * 
+ * @param obj Generic pointer that referst to the client conext related with the request
+ * @param req Request object passed 
+*/
+void request_callback(void* obj, struct calc_proto_req_t req) 
+{
+  struct client_context_t* context = (struct client_context_t*)obj;
+  struct server_stats_t* stats = server_stats_thread();
+
   // Instance response object and pass the response by updating the context
   struct calc_proto_resp_t resp;
-  resp.req_id = req.id;
-  resp.status = status;
-  resp.result = result;
-  context->write_resp(context, &resp);
+  if (!stats->timing && context->trace.state != TRACE_SAMPLED)
+  {
+    execute_request(context->svc, &req, &resp);
+    context->write_resp(context, &resp);
+    return;
+  }
+
+  // The read is being timed or traced, a batch of one request does the same
+  request_batch_callback(obj, &req, 1);
+}
+
+/**
+ * Callback for the requests deserialized from a single read. All the requests are evaluated
+ * first, and then the responses are written one after the other, so they end in the output buffer
+ * of the context and the client gets them with a single write.
+ * 
+ * @param obj Generic pointer that referst to the client conext related with the requests
+ * @param reqs Requests deserialized (at most CALC_PROTO_MAX_BATCH)
+ * @param count Number of requests
+*/
+void request_batch_callback(void* obj, const struct calc_proto_req_t* reqs, int count) 
+{
+  struct client_context_t* context = (struct client_context_t*)obj;
+  struct server_stats_t* stats = server_stats_thread();
+  long start = stats->timing ? server_stats_now() : 0;
+
+  // The first request of a sampled read is traced (see server_trace.h)
+  struct calc_proto_resp_t resps[CALC_PROTO_MAX_BATCH];
+  int traced = context->trace.state == TRACE_SAMPLED;
+  if (traced) 
+  {
+    execute_traced_request(context, &reqs[0], &resps[0]);
+  }
+  execute_requests(context->svc, reqs + traced, resps + traced, count - traced);
+  long executed = stats->timing ? server_stats_now() : 0;
+  for (int i = 0; i < count; i++) 
+  {
+    context->write_resp(context, &resps[i]);
+    if (traced && i == 0) 
+    {
+      server_trace_serialized(&context->trace);
+    }
+  }
+
+  // The read is being timed (see server_stats.h)
+  if (stats->timing) 
+  {
+    stats->service_ns += executed - start;
+    stats->write_ns += server_stats_now() - executed;
+  }
 }
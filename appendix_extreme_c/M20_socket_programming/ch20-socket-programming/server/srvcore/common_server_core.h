@@ -3,13 +3,32 @@
 
 #include <sys/socket.h>
 
+#include "server_trace.h"
+
 struct client_addr_t;
 struct client_context_t;
+struct calc_proto_req_t;
+struct calc_proto_resp_t;
+struct calc_service_t;
+
+// Size of the buffers used to read requests and to keep the responses waiting to be written. A
+// pipelined client gets the responses of all the requests of a read with a single write.
+#define READ_BUFFER_SIZE 4096
+#define RESP_BUFFER_SIZE 4096
+
+// Responses waiting to be sent that stop the reads of a client. The responses of the requests
+// already read are always kept (the output buffer grows for them), but no more requests are read
+// until the client takes some of them, so a slow client can't make the server keep an unbounded
+// output.
+#define RESP_HIGH_WATER (64 * 1024)
 
 // Create custom type that refers to a generic pointer to a function that receives two
 // parameters (the client ccontext and the response object).
 typedef void (*write_resp_func_t)(struct client_context_t*, struct calc_proto_resp_t*);
 
+// Function that sends the responses waiting in the output buffer of the context
+typedef void (*flush_resps_func_t)(struct client_context_t*);
+
 
 // Attributes for client context
 
@@ -19,6 +38,12 @@ struct client_context_t
   struct calc_proto_ser_t* ser; // Serialization oobject
   struct calc_service_t* svc;   // Service object
   write_resp_func_t write_resp; // Function that will update response
+  flush_resps_func_t flush_resps; // Function that sends the responses waiting in out
+  int negotiated;               // Flag, the wire format was already selected
+  char* out;                    // Serialized responses waiting to be sent
+  int out_len;                  // Characters waiting in out
+  int out_cap;                  // Capacity of out
+  struct trace_span_t trace;    // Request traced (see server_trace.h)
 };
 
 typedef void (*write_resp_func_t)(struct client_context_t*, struct calc_proto_resp_t*);
@@ -27,6 +52,46 @@ typedef void (*write_resp_func_t)(struct client_context_t*, struct calc_proto_re
 
 void error_callback(void* obj, int ref_id, int error_code);
 void request_callback(void* obj, struct calc_proto_req_t req);
+void request_batch_callback(void* obj, const struct calc_proto_req_t* reqs, int count);
+
+// Evaluation of a request against the service, the response is filled but not written
+void execute_request(struct calc_service_t* svc, const struct calc_proto_req_t* req,
+    struct calc_proto_resp_t* resp);
+
+// Evaluation of the requests of a batch, grouped by method for the bulk methods of the service when
+// there are at least EXECUTE_BULK_MIN of them
+#define EXECUTE_BULK_MIN 32
+void execute_requests(struct calc_service_t* svc, const struct calc_proto_req_t* reqs,
+    struct calc_proto_resp_t* resps, int count);
+
+// Evaluation of the request traced of a sampled read (see server_trace.h)
+void execute_traced_request(struct client_context_t* context, const struct calc_proto_req_t* req,
+    struct calc_proto_resp_t* resp);
+
+// Register (see calc_registers.h) shared by the memory methods of all the clients, instead of a
+// memory per client (-M name). Returns -1 if the name is not valid.
+int share_mem_register(const char* name);
+
+// Attach the service of a new client to the shared register (nothing if there is none)
+void attach_mem_register(struct calc_service_t* svc);
+
+// Cache (see calc_cache.h) of the results of the ADD, SUB, MUL and DIV requests of all the clients
+// (-C slots). Returns -1 if the number of slots is not valid.
+int enable_result_cache(long slots);
+
+// Selection of the wire format (text or binary frames) with the first bytes received
+int negotiate_wire_mode(struct client_context_t* context, struct buffer_t buf);
+
+// Serialization of responses into a buffer provided by the caller (no heap usage)
+int serialize_resp(struct client_context_t* context, const struct calc_proto_resp_t* resp,
+    char* dst, int cap);
+
+// Serialization of a response at the end of the output buffer of the context (the buffer is
+// flushed first if there is no room for another message, and grows if it is still full)
+int queue_resp(struct client_context_t* context, const struct calc_proto_resp_t* resp);
+
+// Send of the output buffer without blocking, what the socket doesn't take is kept in the buffer
+int send_resps(struct client_context_t* context, int sd);
 
 // extern implies that the definition is implied to be somewhere else and the linker will solve it
 // In this case, the socket adress definition is used for the stream/datagram communication
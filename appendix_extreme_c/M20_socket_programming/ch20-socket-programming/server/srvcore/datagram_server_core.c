@@ -1,3 +1,5 @@
+#define _GNU_SOURCE // recvmmsg and sendmmsg
+
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
@@ -5,6 +7,7 @@
 #include <stdlib.h>
 #include <pthread.h>
 
+#include <sched.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
@@ -13,6 +16,7 @@
 
 #include "common_server_core.h"
 #include "datagram_server_core.h"
+#include "server_stats.h"
 
 /**
  * The datagram server would be a single-threaded program as it only receives a
@@ -43,7 +47,40 @@ struct client_addr_t {
 
 
 /**
- * Write response by using datagram
+ * Send the responses waiting in the output buffer with a single datagram
+ * 
+ * @param context Pointer to the client context (including socket info)
+*/
+void datagram_flush_resps(struct client_context_t* context) 
+{
+  if (context->out_len == 0) 
+  {
+    server_trace_flushed(&context->trace, 1);
+    return;
+  }
+
+  // Use socket file descriptor to send information and check if it is ok. A datagram that can't
+  // be sent is dropped (as the network could do), the client asks again when it doesn't get its
+  // responses, and the server keeps serving the rest of the clients.
+  int ret = sendto(context->addr->server_sd, context->out, context->out_len,
+      0, context->addr->sockaddr, context->addr->socklen);
+  if (ret == -1 || ret < context->out_len) 
+  {
+    server_stats_add(&server_stats_thread()->write_errors, 1);
+    fprintf(stderr, "WARN: Could not write to client: %s\n",
+            ret == -1 ? strerror(errno) : "less bytes were written");
+  }
+  else 
+  {
+    server_stats_add(&server_stats_thread()->bytes_out, ret);
+  }
+  server_trace_flushed(&context->trace, 1);
+  context->out_len = 0;
+}
+
+/**
+ * Write response in the output buffer of the context, all the responses of a datagram are sent
+ * back in a single datagram (see datagram_flush_resps).
  * 
  * @param context Pointer to the client context (including socket info)
  * @param resp Pointer to response object to write and send
@@ -51,34 +88,163 @@ struct client_addr_t {
 void datagram_write_resp(struct client_context_t* context,
         struct calc_proto_resp_t* resp) 
 {
-  // Serialize response obtained and check if it was done correctly
-  struct buffer_t buf =
-      calc_proto_ser_server_serialize(context->ser, resp);
-  if (buf.len == 0) 
+  // Binary datagrams start with the hello byte, so every datagram describes its own format (the
+  // buffer is flushed here if it is full, so the byte isn't separated from its response)
+  if (context->out_cap - context->out_len <= CALC_PROTO_MAX_MSG_LEN) 
+  {
+    datagram_flush_resps(context);
+  }
+  if (context->out_len == 0 &&
+      calc_proto_ser_get_mode(context->ser) == CALC_PROTO_BINARY) 
+  {
+    context->out[context->out_len++] = (char)CALC_PROTO_BINARY_HELLO;
+  }
+
+  // Serialize response obtained (in the output buffer) and check if it was done correctly
+  if (queue_resp(context, resp) <= 0) 
   {
-    close(context->addr->server_sd);
     fprintf(stderr, "Internal error while serializing object.\n");
-    exit(1);
   }
+}
 
-  // Use socket file descriptor to send information and check if it is ok
-  // It will close the file descriptor if something goes wrong
-  int ret = sendto(context->addr->server_sd, buf.data, buf.len,
-      0, context->addr->sockaddr, context->addr->socklen);
-  free(buf.data);
-  if (ret == -1) 
+/**
+ * Objects needed to handle a datagram. Reserving (and freeing) all of them for every datagram was
+ * the most expensive part of the loop, so the server keeps a pool of them and resets them between
+ * datagrams instead. The datagrams are independent, so a reset object is as good as a new one.
+*/
+struct datagram_slot_t {
+  struct client_context_t context;
+  struct client_addr_t addr;
+  char out[RESP_BUFFER_SIZE];
+};
+
+struct datagram_pool_t {
+  struct datagram_slot_t* slots;
+  int size;
+};
+
+/**
+ * Reserve the pool and all the objects of its slots (the only allocations of the server)
+ * 
+ * @param pool Pointer to the pool to initialize
+ * @param size Number of slots
+ * @param server_sd Socket descriptor of the server, used to send the responses
+*/
+void datagram_pool_ctor(struct datagram_pool_t* pool, int size, int server_sd) 
+{
+  pool->size = size;
+  pool->slots = (struct datagram_slot_t*)malloc(size * sizeof(struct datagram_slot_t));
+  for (int i = 0; i < size; i++) 
   {
-    fprintf(stderr, "Could not write to client: %s\n",
-            strerror(errno));
-    close(context->addr->server_sd);
-    exit(1);
-  } 
-  else if (ret < buf.len) 
+    struct datagram_slot_t* slot = &pool->slots[i];
+    struct client_context_t* context = &slot->context;
+
+    // Socket address of the client
+    slot->addr.server_sd = server_sd;
+    slot->addr.sockaddr = sockaddr_new();
+    context->addr = &slot->addr;
+
+    // Serialization object and callbacks
+    context->ser = calc_proto_ser_new();
+    calc_proto_ser_ctor(context->ser, context, 256);
+    calc_proto_ser_set_req_callback(context->ser, request_callback);
+    calc_proto_ser_set_req_batch_callback(context->ser, request_batch_callback);
+    calc_proto_ser_set_error_callback(context->ser, error_callback);
+
+    // Service object
+    context->svc = calc_service_new();
+    calc_service_ctor(context->svc);
+    attach_mem_register(context->svc);
+
+    // Writing response functions and the output buffer
+    context->write_resp = &datagram_write_resp;
+    context->flush_resps = &datagram_flush_resps;
+    context->out = slot->out;
+    context->out_cap = sizeof(slot->out);
+    context->trace.state = TRACE_IDLE;
+  }
+}
+
+/**
+ * Destroy the objects of the pool
+ * 
+ * @param pool Pointer to the pool in use
+*/
+void datagram_pool_dtor(struct datagram_pool_t* pool) 
+{
+  for (int i = 0; i < pool->size; i++) 
+  {
+    struct client_context_t* context = &pool->slots[i].context;
+    calc_service_dtor(context->svc);
+    calc_service_delete(context->svc);
+    calc_proto_ser_dtor(context->ser);
+    calc_proto_ser_delete(context->ser);
+    free(context->addr->sockaddr);
+  }
+  free(pool->slots);
+}
+
+/**
+ * Reset a slot of the pool before receiving a new datagram in it. Every datagram starts with the
+ * memory at zero, unless the memory is a register shared by all the clients (-M), which keeps
+ * their running totals.
+ * 
+ * @param slot Pointer to the slot to reset
+ * 
+ * @return Context of the slot, ready for a new datagram
+*/
+struct client_context_t* datagram_slot_reset(struct datagram_slot_t* slot) 
+{
+  struct client_context_t* context = &slot->context;
+  slot->addr.socklen = sockaddr_sizeof();
+  calc_proto_ser_reset(context->ser);
+  if (!calc_service_get_register(context->svc)) 
+  {
+    calc_service_reset_mem(context->svc);
+  }
+  context->negotiated = 0;
+  context->out_len = 0;
+  context->trace.state = TRACE_IDLE;
+  return context;
+}
+
+/**
+ * Handle the datagram received in the context passed. The responses are left in the output buffer
+ * of the context, the caller sends them (see datagram_flush_resps).
+ * 
+ * @param context Pointer to the context of the datagram
+ * @param data Bytes received
+ * @param len Number of bytes received
+*/
+void datagram_handle(struct client_context_t* context, char* data, int len) 
+{
+  struct server_stats_t* stats = server_stats_thread();
+  server_stats_add(&stats->bytes_in, len);
+  server_stats_read_begin(stats);
+  server_trace_read(&context->trace, context->addr->server_sd);
+
+  // Analize request (including deserialization)
+  bool_t req_found = FALSE;
+  struct buffer_t buf;
+  buf.data = data;
+  buf.len = len;
+
+  // Every datagram selects its own wire format
+  int consumed = negotiate_wire_mode(context, buf);
+  buf.data += consumed;
+  buf.len -= consumed;
+  calc_proto_ser_server_deserialize(context->ser, buf, &req_found);
+
+  // Send invalid response status in case of errors
+  if (!req_found) 
   {
-    fprintf(stderr, "WARN: Less bytes were written!\n");
-    close(context->addr->server_sd);
-    exit(1);
+    struct calc_proto_resp_t resp;
+    resp.req_id = -1;
+    resp.status = ERROR_INVALID_RESPONSE;
+    resp.result = 0.0;
+    context->write_resp(context, &resp);
   }
+  server_stats_read_decoded(stats);
 }
 
 /**
@@ -88,16 +254,20 @@ void datagram_write_resp(struct client_context_t* context,
 */
 void serve_forever(int server_sd) 
 {
-  char buffer[64];
+  // All the objects are reserved here, the loop doesn't use the heap at all
+  struct datagram_pool_t pool;
+  datagram_pool_ctor(&pool, 1, server_sd);
+  struct server_stats_t* stats = server_stats_thread();
+
+  char buffer[READ_BUFFER_SIZE];
   while (1) 
   {
-    // Instance new socket adress
-    struct sockaddr* sockaddr = sockaddr_new();
-    socklen_t socklen = sockaddr_sizeof();
+    // Take the objects of the pool, as they were left clean
+    struct client_context_t* context = datagram_slot_reset(&pool.slots[0]);
 
     // Read bytes from incoming socket file descriptor (FD) and validate
-    int read_nr_bytes = recvfrom(server_sd, buffer,
-            sizeof(buffer), 0, sockaddr, &socklen);
+    int read_nr_bytes = recvfrom(server_sd, buffer, sizeof(buffer), 0,
+            context->addr->sockaddr, &context->addr->socklen);
     if (read_nr_bytes == -1) 
     {
       close(server_sd);
@@ -106,50 +276,206 @@ void serve_forever(int server_sd)
       exit(1);
     }
 
-    // Generate context (related with servr)
-    struct client_context_t context;
-    context.addr = (struct client_addr_t*)
-        malloc(sizeof(struct client_addr_t));
-    context.addr->server_sd = server_sd;
-    context.addr->sockaddr = sockaddr;
-    context.addr->socklen = socklen;
-
-    // Instance new serialization object in the context and update callbacks
-    context.ser = calc_proto_ser_new();
-    calc_proto_ser_ctor(context.ser, &context, 256);
-    calc_proto_ser_set_req_callback(context.ser, request_callback);
-    calc_proto_ser_set_error_callback(context.ser, error_callback);
-
-    // Create new service
-    context.svc = calc_service_new();
-    calc_service_ctor(context.svc);
-
-    // Link contex with writing response function
-    context.write_resp = &datagram_write_resp;
-
-    // Analize request (including deserialization)
-    bool_t req_found = FALSE;
-    struct buffer_t buf;
-    buf.data = buffer;
-    buf.len = read_nr_bytes;
-    calc_proto_ser_server_deserialize(context.ser, buf, &req_found);
-
-    // Send invalid response status in case of errors
-    if (!req_found) 
+    datagram_handle(context, buffer, read_nr_bytes);
+
+    // All the responses of the datagram go back together
+    datagram_flush_resps(context);
+    server_stats_read_end(stats);
+  }
+  datagram_pool_dtor(&pool);
+}
+
+/**
+ * Same server as serve_forever, but the datagrams are received and answered in batches: a single
+ * 'recvmmsg' call receives up to batch_size datagrams (it waits only for the first one, and takes
+ * the rest if they are already queued), and a single 'sendmmsg' call sends all their responses.
+ * Under load, this divides the number of system calls per datagram by the batch size, while with
+ * low traffic every batch has just one datagram, so there is no extra latency.
+ * 
+ * @param server_sd Info of the file descriptor to use
+ * @param batch_size Maximum number of datagrams received at once
+*/
+void serve_forever_batched(int server_sd, int batch_size) 
+{
+  // All the objects are reserved here (one slot of the pool per datagram of the batch)
+  struct datagram_pool_t pool;
+  datagram_pool_ctor(&pool, batch_size, server_sd);
+  char* buffers = (char*)malloc(batch_size * READ_BUFFER_SIZE);
+  struct server_stats_t* stats = server_stats_thread();
+  struct mmsghdr* in_msgs = (struct mmsghdr*)calloc(batch_size, sizeof(struct mmsghdr));
+  struct iovec* in_iovs = (struct iovec*)calloc(batch_size, sizeof(struct iovec));
+  struct mmsghdr* out_msgs = (struct mmsghdr*)calloc(batch_size, sizeof(struct mmsghdr));
+  struct iovec* out_iovs = (struct iovec*)calloc(batch_size, sizeof(struct iovec));
+
+  while (1) 
+  {
+    // Every datagram of the batch is received in its own slot (address included)
+    for (int i = 0; i < batch_size; i++) 
+    {
+      struct client_context_t* context = datagram_slot_reset(&pool.slots[i]);
+      in_iovs[i].iov_base = buffers + i * READ_BUFFER_SIZE;
+      in_iovs[i].iov_len = READ_BUFFER_SIZE;
+      in_msgs[i].msg_hdr.msg_name = context->addr->sockaddr;
+      in_msgs[i].msg_hdr.msg_namelen = context->addr->socklen;
+      in_msgs[i].msg_hdr.msg_iov = &in_iovs[i];
+      in_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int count = recvmmsg(server_sd, in_msgs, batch_size, MSG_WAITFORONE, NULL);
+    if (count == -1) 
+    {
+      close(server_sd);
+      fprintf(stderr, "Could not read from datagram socket: %s\n",
+              strerror(errno));
+      exit(1);
+    }
+
+    // Handle all the datagrams, and collect their responses
+    int out_count = 0;
+    for (int i = 0; i < count; i++) 
+    {
+      struct client_context_t* context = &pool.slots[i].context;
+      context->addr->socklen = in_msgs[i].msg_hdr.msg_namelen;
+      datagram_handle(context, in_iovs[i].iov_base, in_msgs[i].msg_len);
+
+      // The responses of the batch are sent together, the write time of a datagram is only the
+      // serialization of its responses
+      server_stats_read_end(stats);
+      if (context->out_len == 0) 
+      {
+        continue;
+      }
+      out_iovs[out_count].iov_base = context->out;
+      out_iovs[out_count].iov_len = context->out_len;
+      out_msgs[out_count].msg_hdr.msg_name = context->addr->sockaddr;
+      out_msgs[out_count].msg_hdr.msg_namelen = context->addr->socklen;
+      out_msgs[out_count].msg_hdr.msg_iov = &out_iovs[out_count];
+      out_msgs[out_count].msg_hdr.msg_iovlen = 1;
+      out_count++;
+    }
+
+    // Send all the responses (sendmmsg can stop before the end, so it is called until all of
+    // them are sent)
+    int sent = 0;
+    while (sent < out_count) 
+    {
+      int ret = sendmmsg(server_sd, out_msgs + sent, out_count - sent, 0);
+      if (ret == -1 && errno == EINTR) 
+      {
+        continue;
+      }
+      if (ret == -1) 
+      {
+        // The first datagram couldn't be sent, it is dropped (see datagram_flush_resps)
+        server_stats_add(&stats->write_errors, 1);
+        fprintf(stderr, "WARN: Could not write to client: %s\n",
+                strerror(errno));
+        sent++;
+        continue;
+      }
+      for (int i = sent; i < sent + ret; i++) 
+      {
+        server_stats_add(&stats->bytes_out, out_msgs[i].msg_len);
+      }
+      sent += ret;
+    }
+    for (int i = 0; i < count; i++) 
+    {
+      server_trace_flushed(&pool.slots[i].context.trace, 1);
+    }
+  }
+
+  free(out_iovs);
+  free(out_msgs);
+  free(in_iovs);
+  free(in_msgs);
+  free(buffers);
+  datagram_pool_dtor(&pool);
+}
+
+// Arguments of a worker of the sharded server
+struct datagram_worker_t {
+  pthread_t thread;
+  int index;
+  int server_sd;
+  int batch_size;
+  int pin_cpus;
+};
+
+/**
+ * Loop of a worker of the sharded server, the same loop as the single threaded server but on the
+ * socket of the worker.
+ * 
+ * @param arg Pointer to the datagram_worker_t of the worker
+ * 
+ * @return NULL (the loop never ends)
+*/
+void* datagram_worker_loop(void* arg) 
+{
+  struct datagram_worker_t* worker = (struct datagram_worker_t*)arg;
+
+  // Pin the worker to a CPU, so its socket, its objects and its cache lines stay on the same core
+  if (worker->pin_cpus) 
+  {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(worker->index % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+    int result = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (result) 
+    {
+      fprintf(stderr, "WARN: Could not pin worker %d: %s\n", worker->index,
+              strerror(result));
+    }
+  }
+
+  if (worker->batch_size > 1) 
+  {
+    serve_forever_batched(worker->server_sd, worker->batch_size);
+  } 
+  else 
+  {
+    serve_forever(worker->server_sd);
+  }
+  return NULL;
+}
+
+/**
+ * Sharded version of the datagram server: every worker thread has its own socket bound to the same
+ * address with SO_REUSEPORT, and the kernel distributes the datagrams among the sockets (hashing
+ * the address of the client). As the datagrams are independent, the workers share nothing, no
+ * locks are needed and the throughput grows with the number of cores.
+ * 
+ * @param open_socket Function that creates every socket (bound and with SO_REUSEPORT)
+ * @param workers Number of worker threads
+ * @param batch_size Maximum number of datagrams received at once by every worker
+ * @param pin_cpus Non zero to pin every worker to a different CPU
+*/
+void serve_forever_sharded(open_socket_func_t open_socket, int workers, int batch_size,
+    int pin_cpus) 
+{
+  // All the sockets are bound before starting, so no datagram arrives to a closed shard
+  struct datagram_worker_t* pool = (struct datagram_worker_t*)
+      malloc(workers * sizeof(struct datagram_worker_t));
+  for (int i = 0; i < workers; i++) 
+  {
+    pool[i].index = i;
+    pool[i].server_sd = open_socket(1);
+    pool[i].batch_size = batch_size;
+    pool[i].pin_cpus = pin_cpus;
+  }
+  for (int i = 0; i < workers; i++) 
+  {
+    int result = pthread_create(&pool[i].thread, NULL, &datagram_worker_loop, &pool[i]);
+    if (result) 
     {
-      struct calc_proto_resp_t resp;
-      resp.req_id = -1;
-      resp.status = ERROR_INVALID_RESPONSE;
-      resp.result = 0.0;
-      context.write_resp(&context, &resp);
+      fprintf(stderr, "Could not start the worker thread.\n");
+      exit(1);
     }
+  }
 
-    // Destroy and delete objects used in functions
-    calc_service_dtor(context.svc);
-    calc_service_delete(context.svc);
-    calc_proto_ser_dtor(context.ser);
-    calc_proto_ser_delete(context.ser);
-    free(context.addr->sockaddr);
-    free(context.addr);
+  // The workers never end
+  for (int i = 0; i < workers; i++) 
+  {
+    pthread_join(pool[i].thread, NULL);
   }
+  free(pool);
 }
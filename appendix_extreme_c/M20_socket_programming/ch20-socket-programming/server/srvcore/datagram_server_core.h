@@ -2,5 +2,12 @@
 #define DATAGRAM_SERVER_CORE_H
 
 void serve_forever(int server_sd);
+void serve_forever_batched(int server_sd, int batch_size);
+
+// Function that creates a bound server socket (reuse_port allows several sockets on the same port)
+typedef int (*open_socket_func_t)(int reuse_port);
+
+void serve_forever_sharded(open_socket_func_t open_socket, int workers, int batch_size,
+    int pin_cpus);
 
 #endif
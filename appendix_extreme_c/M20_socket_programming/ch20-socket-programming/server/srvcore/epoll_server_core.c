@@ -0,0 +1,984 @@
+#define _GNU_SOURCE // accept4
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <calc_proto_ser.h>
+#include <calc_service.h>
+#include <calc_program.h>
+
+#include "common_server_core.h"
+#include "executor.h"
+#include "epoll_server_core.h"
+#include "server_stats.h"
+
+/**
+ * As the comments of 'accept_forever' say, a thread per client is not the only option. Here a
+ * single thread serves all the clients with an event loop (a "reactor"):
+ *
+ * 1. All the sockets are non-blocking, so a read or a write never stops the thread.
+ * 2. The sockets are registered in an epoll instance, which tells the loop which of them are
+ *    ready. They are registered as edge-triggered (EPOLLET): epoll notifies only when the state
+ *    changes, so the loop must read (or accept) until EAGAIN every time it is notified.
+ * 3. Every connection keeps its own state (serialization object, service and pending output), as
+ *    a request can arrive in several parts mixed with the requests of other clients.
+ *
+ * An idle connection costs only its state (no thread, no stack), so thousands of clients can be
+ * served by a single thread without context switches.
+ *
+ * A single loop uses a single core, so 'accept_forever_reactors' runs several loops (one per
+ * thread, ideally one per core). The main thread accepts the clients and hands every socket to one
+ * of the reactors through a pipe, and from then on the connection belongs to that reactor: its
+ * state is only touched by the reactor thread, so no locks are needed.
+ *
+ * The reactors can also hand the evaluation of the requests to an executor (a pool of threads
+ * with work stealing, see executor.h), so the event loops only read, decode and write. The
+ * requests of a read become a job of the connection, and the jobs of a connection run one after
+ * the other (the connection is a "strand"): the responses keep their order, and the service of the
+ * connection (with its memory) is only used by one thread at a time. The finished jobs go back to
+ * the reactor of the connection, which writes their responses.
+*/
+
+#define MAX_EVENTS 64
+#define EXEC_JOB_ITEMS CALC_PROTO_MAX_BATCH  // Requests of a job of the executor
+#define EXEC_MAX_INFLIGHT 4  // Jobs of a connection in the executor before its reads stop
+
+// Client adress attributes only related with the socket descriptor
+struct client_addr_t
+{
+  int sd;
+};
+
+// An event loop, with the counters of its work (only the reactor writes them, other threads can
+// read them at any time)
+struct reactor_t
+{
+  pthread_t thread;
+  int index;
+  int epoll_fd;
+  int listen_sd;        // Listening socket when the reactor accepts by itself, -1 otherwise
+  int handoff_fds[2];   // Pipe that brings the sockets accepted by the main thread
+  atomic_long connections;  // Connections open now (counted when they are accepted)
+  atomic_long accepted;     // Connections received since the start
+  atomic_long requests;     // Responses written (valid requests and errors)
+  atomic_long bytes_in;     // Bytes read from the clients
+  atomic_long bytes_out;    // Bytes sent to the clients
+  struct executor_t* executor;    // Evaluates the requests (NULL to evaluate them in the loop)
+  int done_fd;                    // Eventfd that signals the jobs finished by the executor
+  pthread_mutex_t done_lock;      // Protects the list of the finished jobs
+  struct exec_job_t* done_head;
+  struct exec_job_t* done_tail;
+  struct epoll_conn_t* released;  // Connections closed during the current batch of events
+};
+
+// State of a connection served by the event loop
+struct epoll_conn_t
+{
+  struct client_context_t context;
+  struct client_addr_t addr;
+  struct reactor_t* reactor; // Event loop that owns the connection
+  int write_blocked;  // The socket can't take more bytes, the output waits for EPOLLOUT
+  int closed;         // The connection failed, it is released after the current batch of events
+  int unregistered;   // The socket was closed, the state waits for the jobs in the executor
+  struct epoll_conn_t* next_released; // Next connection of the list of released ones
+
+  // Strand of the connection in the executor (only used with an executor)
+  struct task_t task;
+  pthread_mutex_t strand_lock;   // Protects the jobs waiting and the scheduled flag
+  struct exec_job_t* jobs_head;  // Jobs waiting for the strand
+  struct exec_job_t* jobs_tail;
+  int scheduled;                 // The strand is in the executor
+  struct exec_job_t* building;   // Job receiving the requests of the current read
+  int inflight;                  // Jobs submitted and not written yet
+  int exec_paused;               // Too many jobs in the executor, reads wait until they finish
+};
+
+// Request of a job, or a response already known (errors of the deserialization)
+struct exec_item_t
+{
+  struct calc_proto_req_t req;
+  struct calc_proto_resp_t resp;
+  int ready;
+};
+
+// Requests of a connection evaluated together by the executor
+struct exec_job_t
+{
+  struct exec_job_t* next;
+  struct epoll_conn_t* conn;
+  int count;
+  int traced;             // Item of the request traced (-1 if none, see server_trace.h)
+  long trace_service[2];  // Beginning and end of its evaluation
+  struct exec_item_t items[EXEC_JOB_ITEMS];
+  struct calc_program_t* programs;  // Copies of the programs of the EVAL items (by item, or NULL)
+};
+
+/**
+ * Send as many bytes of the output buffer as the socket accepts. What can't be sent now stays at
+ * the beginning of the buffer, and it is sent when epoll reports the socket as writable again
+ * (meanwhile the reads go on, until the output reaches RESP_HIGH_WATER).
+ *
+ * @param context Pointer to the client context of the connection
+*/
+void epoll_flush_resps(struct client_context_t* context)
+{
+  struct epoll_conn_t* conn = (struct epoll_conn_t*)context;
+  if (!conn->closed && !conn->write_blocked)
+  {
+    int sent = send_resps(context, context->addr->sd);
+    if (sent == -1)
+    {
+      // Only this client is affected, the rest of the connections keep working
+      conn->closed = 1;
+    }
+    else
+    {
+      atomic_fetch_add_explicit(&conn->reactor->bytes_out, sent, memory_order_relaxed);
+      conn->write_blocked = context->out_len > 0;
+    }
+  }
+  if (conn->closed)
+  {
+    context->out_len = 0;
+  }
+  server_trace_flushed(&context->trace, context->out_len == 0);
+}
+
+/**
+ * Write a response in the output buffer of the connection
+ *
+ * @param context Pointer to the client context of the connection
+ * @param resp Pointer to response calculated
+*/
+void epoll_write_resp(struct client_context_t* context, struct calc_proto_resp_t* resp)
+{
+  struct epoll_conn_t* conn = (struct epoll_conn_t*)context;
+  atomic_fetch_add_explicit(&conn->reactor->requests, 1, memory_order_relaxed);
+  if (queue_resp(context, resp) <= 0)
+  {
+    fprintf(stderr, "Internal error while serializing response\n");
+    conn->closed = 1;
+  }
+}
+
+/**
+ * Submit the job being built to the strand of the connection. The strand is submitted to the
+ * executor only if it isn't there already, so a single thread runs the jobs of the connection.
+ *
+ * @param conn Connection
+*/
+void exec_submit_job(struct epoll_conn_t* conn)
+{
+  struct exec_job_t* job = conn->building;
+  if (!job)
+  {
+    return;
+  }
+  conn->building = NULL;
+  conn->inflight++;
+  job->next = NULL;
+
+  pthread_mutex_lock(&conn->strand_lock);
+  if (conn->jobs_tail)
+  {
+    conn->jobs_tail->next = job;
+  }
+  else
+  {
+    conn->jobs_head = job;
+  }
+  conn->jobs_tail = job;
+  int schedule = !conn->scheduled;
+  conn->scheduled = 1;
+  pthread_mutex_unlock(&conn->strand_lock);
+
+  if (schedule)
+  {
+    executor_submit(conn->reactor->executor, &conn->task);
+  }
+}
+
+/**
+ * Take the next free item of the job being built (a full job is submitted first)
+ *
+ * @param conn Connection
+ *
+ * @return Item
+*/
+struct exec_item_t* exec_job_add(struct epoll_conn_t* conn)
+{
+  if (conn->building && conn->building->count == EXEC_JOB_ITEMS)
+  {
+    exec_submit_job(conn);
+  }
+  if (!conn->building)
+  {
+    conn->building = (struct exec_job_t*)malloc(sizeof(struct exec_job_t));
+    conn->building->conn = conn;
+    conn->building->count = 0;
+    conn->building->traced = -1;
+    conn->building->programs = NULL;
+  }
+  return &conn->building->items[conn->building->count++];
+}
+
+/**
+ * Release a job and the copies of its programs
+ *
+ * @param job Job, or NULL
+*/
+void exec_job_free(struct exec_job_t* job)
+{
+  if (job)
+  {
+    free(job->programs);
+  }
+  free(job);
+}
+
+/**
+ * Callbacks of the deserialization with an executor, the requests are added to the job of the
+ * read instead of being evaluated
+*/
+void exec_request_callback(void* obj, struct calc_proto_req_t req)
+{
+  struct epoll_conn_t* conn = (struct epoll_conn_t*)obj;
+  struct exec_item_t* item = exec_job_add(conn);
+  item->req = req;
+  item->ready = 0;
+
+  // The program of an EVAL request is valid only during the callback, the job keeps a copy
+  if (req.method == EVAL)
+  {
+    struct exec_job_t* job = conn->building;
+    if (!job->programs)
+    {
+      job->programs = (struct calc_program_t*)malloc(
+          EXEC_JOB_ITEMS * sizeof(struct calc_program_t));
+    }
+    job->programs[job->count - 1] = *req.program;
+    item->req.program = &job->programs[job->count - 1];
+  }
+
+  // The request traced of a sampled read is stamped by the executor (see exec_strand_run)
+  if (conn->context.trace.state == TRACE_SAMPLED)
+  {
+    server_trace_decoded(&conn->context.trace, &req);
+    conn->building->traced = conn->building->count - 1;
+  }
+}
+
+void exec_request_batch_callback(void* obj, const struct calc_proto_req_t* reqs, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    exec_request_callback(obj, reqs[i]);
+  }
+}
+
+/**
+ * Write a response that doesn't need the executor (the errors of the deserialization). It goes in
+ * the job too, so it keeps its place among the responses of the connection.
+ *
+ * @param context Pointer to the client context of the connection
+ * @param resp Pointer to response
+*/
+void exec_write_resp(struct client_context_t* context, struct calc_proto_resp_t* resp)
+{
+  struct exec_item_t* item = exec_job_add((struct epoll_conn_t*)context);
+  item->resp = *resp;
+  item->ready = 1;
+}
+
+/**
+ * Give a finished job back to the reactor of its connection
+ *
+ * @param reactor Reactor of the connection
+ * @param job Finished job
+*/
+void reactor_complete(struct reactor_t* reactor, struct exec_job_t* job)
+{
+  job->next = NULL;
+  pthread_mutex_lock(&reactor->done_lock);
+  int was_empty = reactor->done_head == NULL;
+  if (reactor->done_tail)
+  {
+    reactor->done_tail->next = job;
+  }
+  else
+  {
+    reactor->done_head = job;
+  }
+  reactor->done_tail = job;
+  pthread_mutex_unlock(&reactor->done_lock);
+
+  // The reactor takes all the jobs of the list when it wakes up, a single signal is enough
+  if (was_empty)
+  {
+    uint64_t one = 1;
+    if (write(reactor->done_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+    {
+      fprintf(stderr, "Could not wake up the reactor: %s\n", strerror(errno));
+    }
+  }
+}
+
+/**
+ * Run the next job of a connection (task of the executor). If the connection has more jobs, the
+ * strand is submitted again, so the jobs of other connections get their turn too.
+ *
+ * @param task Task of the strand (member of the epoll_conn_t)
+*/
+void exec_strand_run(struct task_t* task)
+{
+  struct epoll_conn_t* conn =
+      (struct epoll_conn_t*)((char*)task - offsetof(struct epoll_conn_t, task));
+  struct reactor_t* reactor = conn->reactor;
+
+  pthread_mutex_lock(&conn->strand_lock);
+  struct exec_job_t* job = conn->jobs_head;
+  conn->jobs_head = job->next;
+  if (!conn->jobs_head)
+  {
+    conn->jobs_tail = NULL;
+  }
+  pthread_mutex_unlock(&conn->strand_lock);
+
+  // The jobs are sampled like the reads (see server_stats.h), all their time is service time
+  struct server_stats_t* stats = server_stats_thread();
+  server_stats_read_begin(stats);
+  for (int i = 0; i < job->count; i++)
+  {
+    if (job->items[i].ready)
+    {
+      continue;
+    }
+    if (i == job->traced)
+    {
+      job->trace_service[0] = server_stats_now();
+    }
+    execute_request(conn->context.svc, &job->items[i].req, &job->items[i].resp);
+    if (i == job->traced)
+    {
+      job->trace_service[1] = server_stats_now();
+    }
+  }
+  if (stats->timing)
+  {
+    server_stats_record(stats, STATS_TIME_SERVICE, server_stats_now() - stats->mark);
+    stats->timing = 0;
+  }
+
+  // Decide before giving the job back: once the reactor has the last job, it can release the
+  // connection
+  pthread_mutex_lock(&conn->strand_lock);
+  int more = conn->jobs_head != NULL;
+  if (!more)
+  {
+    conn->scheduled = 0;
+  }
+  pthread_mutex_unlock(&conn->strand_lock);
+
+  reactor_complete(reactor, job);
+  if (more)
+  {
+    executor_submit(reactor->executor, task);
+  }
+}
+
+/**
+ * Unregister and close a connection, and release its state (when the executor has no job of it).
+ * Other events of the same batch can still point to the connection (the completions of the
+ * executor close the connections of other sockets), so the state is only put in the list of the
+ * reactor, and it is freed after the batch (see reactor_free_released).
+ *
+ * @param conn Connection to close
+*/
+void epoll_conn_close(struct epoll_conn_t* conn)
+{
+  if (!conn->unregistered)
+  {
+    epoll_ctl(conn->reactor->epoll_fd, EPOLL_CTL_DEL, conn->addr.sd, NULL);
+    close(conn->addr.sd);
+    atomic_fetch_sub_explicit(&conn->reactor->connections, 1, memory_order_relaxed);
+    server_stats_add(&server_stats_thread()->connections, -1);
+    conn->unregistered = 1;
+  }
+
+  // The jobs in the executor still use the service, the state is released with the last one
+  if (conn->inflight > 0)
+  {
+    return;
+  }
+  conn->next_released = conn->reactor->released;
+  conn->reactor->released = conn;
+}
+
+/**
+ * Free the state of the connections closed during a batch of events, when no event points to
+ * them any more
+ *
+ * @param reactor Event loop
+*/
+void reactor_free_released(struct reactor_t* reactor)
+{
+  while (reactor->released)
+  {
+    struct epoll_conn_t* conn = reactor->released;
+    reactor->released = conn->next_released;
+    if (reactor->executor)
+    {
+      exec_job_free(conn->building);
+      pthread_mutex_destroy(&conn->strand_lock);
+    }
+    calc_service_dtor(conn->context.svc);
+    calc_service_delete(conn->context.svc);
+    calc_proto_ser_dtor(conn->context.ser);
+    calc_proto_ser_delete(conn->context.ser);
+    free(conn->context.out);
+    free(conn);
+  }
+}
+
+/**
+ * Create the state of a new connection and register its socket in the event loop
+ *
+ * @param reactor Event loop that owns the connection
+ * @param sd Socket of the client (already non-blocking)
+*/
+void epoll_conn_open(struct reactor_t* reactor, int sd)
+{
+  struct epoll_conn_t* conn = (struct epoll_conn_t*)calloc(1, sizeof(struct epoll_conn_t));
+  struct client_context_t* context = &conn->context;
+  conn->addr.sd = sd;
+  conn->reactor = reactor;
+  context->addr = &conn->addr;
+  struct server_stats_t* stats = server_stats_thread();
+  server_stats_add(&stats->connections, 1);
+  server_stats_add(&stats->accepted, 1);
+
+  // Instance new serialization object
+  context->ser = calc_proto_ser_new();
+  calc_proto_ser_ctor(context->ser, context, 256);
+  calc_proto_ser_set_req_callback(context->ser, request_callback);
+  calc_proto_ser_set_req_batch_callback(context->ser, request_batch_callback);
+  calc_proto_ser_set_error_callback(context->ser, error_callback);
+
+  // Instance new calculation service object
+  context->svc = calc_service_new();
+  calc_service_ctor(context->svc);
+  attach_mem_register(context->svc);
+
+  context->write_resp = &epoll_write_resp;
+  context->flush_resps = &epoll_flush_resps;
+  context->negotiated = 0;
+  context->out_cap = RESP_BUFFER_SIZE;
+  context->out = (char*)malloc(context->out_cap);
+  context->out_len = 0;
+
+  // With an executor the requests are only collected in jobs, and the responses of the errors go
+  // in the jobs too
+  if (reactor->executor)
+  {
+    calc_proto_ser_set_req_callback(context->ser, exec_request_callback);
+    calc_proto_ser_set_req_batch_callback(context->ser, exec_request_batch_callback);
+    context->write_resp = &exec_write_resp;
+    conn->task.run = &exec_strand_run;
+    pthread_mutex_init(&conn->strand_lock, NULL);
+  }
+
+  // Readable and writable events, edge-triggered
+  struct epoll_event event;
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.ptr = conn;
+  if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, sd, &event) == -1)
+  {
+    fprintf(stderr, "Could not register the client: %s\n", strerror(errno));
+    epoll_conn_close(conn);
+  }
+}
+
+/**
+ * Read everything available in the socket of a connection (edge-triggered, so until EAGAIN), and
+ * answer the requests. If the client doesn't take the responses, the reads stop when they reach
+ * RESP_HIGH_WATER until the socket is writable again, so a slow client can't make the server keep
+ * an unbounded output.
+ *
+ * @param conn Connection with bytes to read
+*/
+void epoll_conn_read(struct epoll_conn_t* conn)
+{
+  struct client_context_t* context = &conn->context;
+  struct server_stats_t* stats = server_stats_thread();
+  char buffer[READ_BUFFER_SIZE];
+  while (!conn->closed && context->out_len < RESP_HIGH_WATER && !conn->exec_paused)
+  {
+    int ret = read(conn->addr.sd, buffer, sizeof(buffer));
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      break;
+    }
+    if (ret == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (ret <= 0)
+    {
+      conn->closed = 1;
+      break;
+    }
+
+    atomic_fetch_add_explicit(&conn->reactor->bytes_in, ret, memory_order_relaxed);
+    server_stats_add(&stats->bytes_in, ret);
+    server_stats_read_begin(stats);
+    server_trace_read(&context->trace, conn->addr.sd);
+    struct buffer_t buf;
+    buf.data = buffer; buf.len = ret;
+
+    // The first byte of the connection selects the wire format (see client_handler)
+    if (!context->negotiated && negotiate_wire_mode(context, buf))
+    {
+      context->out[context->out_len++] = (char)CALC_PROTO_BINARY_HELLO;
+      buf.data++; buf.len--;
+    }
+    calc_proto_ser_server_deserialize(context->ser, buf, NULL);
+    if (conn->reactor->executor)
+    {
+      exec_submit_job(conn);
+      conn->exec_paused = conn->inflight >= EXEC_MAX_INFLIGHT;
+    }
+    server_stats_read_decoded(stats);
+    epoll_flush_resps(context);
+    server_stats_read_end(stats);
+  }
+}
+
+/**
+ * Write the responses of the jobs finished by the executor. The reads of a connection paused by
+ * its jobs are resumed here.
+ *
+ * @param reactor Event loop
+*/
+void reactor_take_completions(struct reactor_t* reactor)
+{
+  uint64_t value;
+  while (read(reactor->done_fd, &value, sizeof(value)) == -1 && errno == EINTR);
+
+  pthread_mutex_lock(&reactor->done_lock);
+  struct exec_job_t* job = reactor->done_head;
+  reactor->done_head = NULL;
+  reactor->done_tail = NULL;
+  pthread_mutex_unlock(&reactor->done_lock);
+
+  while (job)
+  {
+    struct exec_job_t* next = job->next;
+    struct epoll_conn_t* conn = job->conn;
+    conn->inflight--;
+    if (!conn->closed)
+    {
+      for (int i = 0; i < job->count; i++)
+      {
+        epoll_write_resp(&conn->context, &job->items[i].resp);
+        if (i == job->traced)
+        {
+          conn->context.trace.stamps[TRACE_SERVICE_BEGIN] = job->trace_service[0];
+          conn->context.trace.stamps[TRACE_SERVICE_END] = job->trace_service[1];
+          server_trace_serialized(&conn->context.trace);
+        }
+      }
+      epoll_flush_resps(&conn->context);
+    }
+    exec_job_free(job);
+
+    if (!conn->closed && conn->exec_paused && conn->inflight < EXEC_MAX_INFLIGHT)
+    {
+      conn->exec_paused = 0;
+      epoll_conn_read(conn);
+    }
+    if (conn->closed)
+    {
+      epoll_conn_close(conn);
+    }
+    job = next;
+  }
+}
+
+/**
+ * Accept all the pending clients of the listening socket (edge-triggered, so until EAGAIN)
+ *
+ * @param reactor Event loop that owns the listening socket
+*/
+void epoll_accept_all(struct reactor_t* reactor)
+{
+  while (1)
+  {
+    int client_sd = accept4(reactor->listen_sd, NULL, NULL, SOCK_NONBLOCK);
+    if (client_sd == -1)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        return;
+      }
+      if (errno == EINTR || errno == ECONNABORTED)
+      {
+        continue;
+      }
+
+      // Running out of descriptors, for instance, shouldn't stop the clients already connected
+      fprintf(stderr, "Could not accept the client: %s\n", strerror(errno));
+      return;
+    }
+    atomic_fetch_add_explicit(&reactor->connections, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&reactor->accepted, 1, memory_order_relaxed);
+    epoll_conn_open(reactor, client_sd);
+  }
+}
+
+/**
+ * Take all the sockets handed to the reactor by the main thread (until EAGAIN)
+ *
+ * @param reactor Event loop that receives the sockets
+*/
+void epoll_take_handoffs(struct reactor_t* reactor)
+{
+  int client_sd;
+  while (1)
+  {
+    int ret = read(reactor->handoff_fds[0], &client_sd, sizeof(client_sd));
+    if (ret == sizeof(client_sd))
+    {
+      epoll_conn_open(reactor, client_sd);
+    }
+    else if (ret == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    else
+    {
+      return;
+    }
+  }
+}
+
+/**
+ * Register a descriptor of the reactor itself (the listening socket or the handoff pipe)
+ *
+ * @param reactor Event loop
+ * @param fd Descriptor to register (it is made non-blocking)
+ * @param ptr Pointer used to recognize the events of the descriptor
+*/
+void reactor_register(struct reactor_t* reactor, int fd, void* ptr)
+{
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  struct epoll_event event;
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = ptr;
+  if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+  {
+    fprintf(stderr, "Could not register the descriptor of the reactor: %s\n", strerror(errno));
+    exit(1);
+  }
+}
+
+/**
+ * Initialize a reactor (its epoll instance and the handoff pipe)
+ *
+ * @param reactor Reactor to initialize
+ * @param index Number of the reactor
+ * @param listen_sd Listening socket if the reactor accepts by itself, -1 otherwise
+ * @param executor Executor of the requests, NULL to evaluate them in the loop
+*/
+void reactor_ctor(struct reactor_t* reactor, int index, int listen_sd,
+    struct executor_t* executor)
+{
+  reactor->index = index;
+  reactor->listen_sd = listen_sd;
+  atomic_init(&reactor->connections, 0);
+  atomic_init(&reactor->accepted, 0);
+  atomic_init(&reactor->requests, 0);
+  atomic_init(&reactor->bytes_in, 0);
+  atomic_init(&reactor->bytes_out, 0);
+  reactor->released = NULL;
+
+  reactor->epoll_fd = epoll_create1(0);
+  if (reactor->epoll_fd == -1 || pipe(reactor->handoff_fds) == -1)
+  {
+    fprintf(stderr, "Could not create the event loop: %s\n", strerror(errno));
+    exit(1);
+  }
+
+  // The listening socket is registered with a NULL pointer, the pipe with the reactor itself and
+  // the clients with their state (and the eventfd of the executor with a pointer to it)
+  if (listen_sd >= 0)
+  {
+    reactor_register(reactor, listen_sd, NULL);
+  }
+  reactor_register(reactor, reactor->handoff_fds[0], reactor);
+
+  // The executor gives the finished jobs back through a list, and wakes the reactor up with an
+  // eventfd (registered with a pointer to it)
+  reactor->executor = executor;
+  if (executor)
+  {
+    reactor->done_head = NULL;
+    reactor->done_tail = NULL;
+    pthread_mutex_init(&reactor->done_lock, NULL);
+    reactor->done_fd = eventfd(0, EFD_NONBLOCK);
+    if (reactor->done_fd == -1)
+    {
+      fprintf(stderr, "Could not create the event loop: %s\n", strerror(errno));
+      exit(1);
+    }
+    reactor_register(reactor, reactor->done_fd, &reactor->done_fd);
+  }
+}
+
+/**
+ * Loop of a reactor, it never ends
+ *
+ * @param arg Pointer to the reactor_t
+ *
+ * @return NULL
+*/
+void* reactor_loop(void* arg)
+{
+  struct reactor_t* reactor = (struct reactor_t*)arg;
+  struct epoll_event events[MAX_EVENTS];
+  while (1)
+  {
+    int count = epoll_wait(reactor->epoll_fd, events, MAX_EVENTS, -1);
+    if (count == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      fprintf(stderr, "Could not wait for events: %s\n", strerror(errno));
+      exit(1);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+      struct epoll_conn_t* conn = (struct epoll_conn_t*)events[i].data.ptr;
+      if (!conn)
+      {
+        epoll_accept_all(reactor);
+        continue;
+      }
+      if (conn == (struct epoll_conn_t*)reactor)
+      {
+        epoll_take_handoffs(reactor);
+        continue;
+      }
+      if (conn == (struct epoll_conn_t*)&reactor->done_fd)
+      {
+        reactor_take_completions(reactor);
+        continue;
+      }
+
+      // The connection was closed by an event before this one of the batch
+      if (conn->unregistered)
+      {
+        continue;
+      }
+
+      // The socket accepts bytes again, send the pending output and resume the reads
+      if (events[i].events & EPOLLOUT && conn->write_blocked)
+      {
+        conn->write_blocked = 0;
+        epoll_flush_resps(&conn->context);
+        if (conn->context.out_len < RESP_HIGH_WATER)
+        {
+          epoll_conn_read(conn);
+        }
+      }
+      if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+      {
+        epoll_conn_read(conn);
+      }
+      if (conn->closed)
+      {
+        epoll_conn_close(conn);
+      }
+    }
+    reactor_free_released(reactor);
+  }
+  return NULL;
+}
+
+/**
+ * Manage and accept infinite incoming client connections with a single event loop
+ *
+ * @param server_sd Socket related with server
+*/
+void accept_forever_epoll(int server_sd)
+{
+  struct reactor_t reactor;
+  reactor_ctor(&reactor, 0, server_sd, NULL);
+  reactor_loop(&reactor);
+}
+
+// Arguments of the thread that prints the counters of the reactors
+struct reactor_stats_t
+{
+  struct reactor_t* reactors;
+  int count;
+  int interval;
+  struct executor_t* executor;
+};
+
+/**
+ * Print the counters of every reactor periodically (the requests per second since the previous
+ * report, and the totals)
+ *
+ * @param arg Pointer to the reactor_stats_t
+ *
+ * @return NULL
+*/
+void* reactor_stats_loop(void* arg)
+{
+  struct reactor_stats_t* stats = (struct reactor_stats_t*)arg;
+  long* last = (long*)calloc(stats->count, sizeof(long));
+  while (1)
+  {
+    sleep(stats->interval);
+    for (int i = 0; i < stats->count; i++)
+    {
+      struct reactor_t* reactor = &stats->reactors[i];
+      long requests = atomic_load_explicit(&reactor->requests, memory_order_relaxed);
+      fprintf(stderr, "reactor %d: %ld conns (%ld accepted), %ld req/s, %ld requests, "
+          "%ld bytes in, %ld bytes out\n", i,
+          atomic_load_explicit(&reactor->connections, memory_order_relaxed),
+          atomic_load_explicit(&reactor->accepted, memory_order_relaxed),
+          (requests - last[i]) / stats->interval, requests,
+          atomic_load_explicit(&reactor->bytes_in, memory_order_relaxed),
+          atomic_load_explicit(&reactor->bytes_out, memory_order_relaxed));
+      last[i] = requests;
+    }
+    if (stats->executor)
+    {
+      executor_print_stats(stats->executor, stderr);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Choose the reactor for a new connection
+ *
+ * @param reactors Array of reactors
+ * @param count Number of reactors
+ * @param balance Distribution policy
+ * @param next Round robin position (updated)
+ *
+ * @return Reactor chosen
+*/
+struct reactor_t* reactor_choose(struct reactor_t* reactors, int count, balance_t balance,
+    int* next)
+{
+  if (balance == BALANCE_LEAST_CONNECTIONS)
+  {
+    // The counters can be a bit old, which doesn't matter to balance the load
+    struct reactor_t* best = &reactors[0];
+    long best_conns = atomic_load_explicit(&best->connections, memory_order_relaxed);
+    for (int i = 1; i < count; i++)
+    {
+      long conns = atomic_load_explicit(&reactors[i].connections, memory_order_relaxed);
+      if (conns < best_conns)
+      {
+        best = &reactors[i];
+        best_conns = conns;
+      }
+    }
+    return best;
+  }
+  struct reactor_t* reactor = &reactors[*next];
+  *next = (*next + 1) % count;
+  return reactor;
+}
+
+/**
+ * Manage and accept infinite incoming client connections with several event loops, each one in
+ * its own thread. The calling thread only accepts the clients and hands them to the reactors.
+ *
+ * @param server_sd Socket related with server
+ * @param count Number of reactors
+ * @param balance Policy to choose the reactor of every connection
+ * @param stats_interval Seconds between reports of the counters (0 to disable them)
+ * @param exec_threads Threads of the executor of the requests (0 to evaluate them in the loops)
+*/
+void accept_forever_reactors(int server_sd, int count, balance_t balance, int stats_interval,
+    int exec_threads)
+{
+  struct executor_t* executor = NULL;
+  if (exec_threads > 0)
+  {
+    executor = executor_new();
+    executor_ctor(executor, exec_threads);
+  }
+
+  struct reactor_t* reactors = (struct reactor_t*)malloc(count * sizeof(struct reactor_t));
+  for (int i = 0; i < count; i++)
+  {
+    reactor_ctor(&reactors[i], i, -1, executor);
+    if (pthread_create(&reactors[i].thread, NULL, &reactor_loop, &reactors[i]))
+    {
+      close(server_sd);
+      fprintf(stderr, "Could not start the reactor thread.\n");
+      exit(1);
+    }
+  }
+
+  struct reactor_stats_t stats;
+  stats.reactors = reactors;
+  stats.count = count;
+  stats.interval = stats_interval;
+  stats.executor = executor;
+  pthread_t stats_thread;
+  if (stats_interval > 0)
+  {
+    pthread_create(&stats_thread, NULL, &reactor_stats_loop, &stats);
+  }
+
+  int next = 0;
+  while (1)
+  {
+    // Accept incoming connection (blocking, this thread does nothing else)
+    int client_sd = accept4(server_sd, NULL, NULL, SOCK_NONBLOCK);
+    if (client_sd == -1)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+      {
+        continue;
+      }
+      fprintf(stderr, "Could not accept the client: %s\n", strerror(errno));
+      sleep(1);
+      continue;
+    }
+
+    // Hand the socket to its reactor (writes to a pipe of up to PIPE_BUF bytes are atomic). The
+    // connection is counted here, so the next choice already sees it even if the reactor didn't
+    // take it yet.
+    struct reactor_t* reactor = reactor_choose(reactors, count, balance, &next);
+    atomic_fetch_add_explicit(&reactor->connections, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&reactor->accepted, 1, memory_order_relaxed);
+    if (write(reactor->handoff_fds[1], &client_sd, sizeof(client_sd)) != sizeof(client_sd))
+    {
+      fprintf(stderr, "Could not hand the client to the reactor: %s\n", strerror(errno));
+      atomic_fetch_sub_explicit(&reactor->connections, 1, memory_order_relaxed);
+      close(client_sd);
+    }
+  }
+}
@@ -0,0 +1,14 @@
+#ifndef EPOLL_SERVER_CORE_H
+#define EPOLL_SERVER_CORE_H
+
+// Policy to distribute the connections among several reactors
+typedef enum {
+  BALANCE_ROUND_ROBIN,       // One after the other
+  BALANCE_LEAST_CONNECTIONS  // The reactor with less connections open
+} balance_t;
+
+void accept_forever_epoll(int server_sd);
+void accept_forever_reactors(int server_sd, int count, balance_t balance, int stats_interval,
+    int exec_threads);
+
+#endif
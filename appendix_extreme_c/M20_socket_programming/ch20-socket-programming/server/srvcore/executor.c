@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "ws_deque.h"
+#include "executor.h"
+
+/**
+ * Every worker looks for its next task in this order:
+ *
+ * 1. Its own deque, the newest task first (usually one that the previous task submitted).
+ * 2. The shared queue, with the tasks submitted by threads that aren't workers.
+ * 3. The deques of the other workers, stealing the oldest task.
+ *
+ * When there is nothing anywhere, the worker sleeps on a condition variable. A worker that pushes
+ * a task to its deque wakes up one of the sleeping workers (if any), so the task can be stolen
+ * while the pusher is busy with the current one.
+*/
+
+#define DEQUE_CAPACITY 4096
+
+struct ws_worker_t
+{
+  pthread_t thread;
+  struct executor_t* exec;
+  struct ws_deque_t* deque;
+  int index;
+  atomic_long executed; // Tasks run by the worker
+  atomic_long stolen;   // Tasks the worker took from other deques
+};
+
+struct executor_t
+{
+  struct ws_worker_t* workers;
+  int count;
+  pthread_mutex_t lock;    // Protects the shared queue and the stop flag
+  pthread_cond_t wakeup;
+  struct task_t* head;     // Shared queue, for the tasks of the other threads
+  struct task_t* tail;
+  atomic_int queued;       // Tasks in the shared queue
+  atomic_int sleepers;     // Workers waiting on the condition variable
+  int stop;
+};
+
+// Worker that runs on the current thread, NULL on the other threads
+static _Thread_local struct ws_worker_t* current_worker = NULL;
+
+struct executor_t* executor_new()
+{
+  return (struct executor_t*)malloc(sizeof(struct executor_t));
+}
+
+void executor_delete(struct executor_t* exec)
+{
+  free(exec);
+}
+
+/**
+ * Wake up one sleeping worker, if there is any
+ *
+ * @param exec Executor
+*/
+static void executor_wake_one(struct executor_t* exec)
+{
+  // The task pushed must be visible before reading the sleepers (a store can't move after it)
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load(&exec->sleepers) > 0)
+  {
+    pthread_mutex_lock(&exec->lock);
+    pthread_cond_signal(&exec->wakeup);
+    pthread_mutex_unlock(&exec->lock);
+  }
+}
+
+/**
+ * Submit a task. A worker keeps the tasks it submits in its own deque, the other threads put them
+ * in the shared queue.
+ *
+ * @param exec Executor
+ * @param task Task to run
+*/
+void executor_submit(struct executor_t* exec, struct task_t* task)
+{
+  struct ws_worker_t* worker = current_worker;
+  if (worker && worker->exec == exec && ws_deque_push(worker->deque, task) == 0)
+  {
+    executor_wake_one(exec);
+    return;
+  }
+
+  task->next = NULL;
+  pthread_mutex_lock(&exec->lock);
+  if (exec->tail)
+  {
+    exec->tail->next = task;
+  }
+  else
+  {
+    exec->head = task;
+  }
+  exec->tail = task;
+  atomic_fetch_add(&exec->queued, 1);
+  pthread_cond_signal(&exec->wakeup);
+  pthread_mutex_unlock(&exec->lock);
+}
+
+/**
+ * Take the first task of the shared queue (the lock must be held)
+ *
+ * @param exec Executor
+ *
+ * @return The task, or NULL if the queue is empty
+*/
+static struct task_t* executor_dequeue_locked(struct executor_t* exec)
+{
+  struct task_t* task = exec->head;
+  if (task)
+  {
+    exec->head = task->next;
+    if (!exec->head)
+    {
+      exec->tail = NULL;
+    }
+    atomic_fetch_sub(&exec->queued, 1);
+  }
+  return task;
+}
+
+/**
+ * Steal a task from the other workers, starting by the next one
+ *
+ * @param worker Thief
+ *
+ * @return The task, or NULL if no task was found
+*/
+static struct task_t* executor_steal(struct ws_worker_t* worker)
+{
+  struct executor_t* exec = worker->exec;
+  for (int i = 1; i < exec->count; i++)
+  {
+    struct ws_worker_t* victim = &exec->workers[(worker->index + i) % exec->count];
+    struct task_t* task = ws_deque_steal(victim->deque);
+    if (task)
+    {
+      atomic_fetch_add_explicit(&worker->stolen, 1, memory_order_relaxed);
+      return task;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Look for the next task of a worker (see the order at the beginning of the file)
+ *
+ * @param worker Worker
+ *
+ * @return The task, or NULL if there is nothing to do
+*/
+static struct task_t* executor_find_task(struct ws_worker_t* worker)
+{
+  struct executor_t* exec = worker->exec;
+  struct task_t* task = ws_deque_take(worker->deque);
+  if (task)
+  {
+    return task;
+  }
+  if (atomic_load(&exec->queued) > 0)
+  {
+    pthread_mutex_lock(&exec->lock);
+    task = executor_dequeue_locked(exec);
+    pthread_mutex_unlock(&exec->lock);
+    if (task)
+    {
+      return task;
+    }
+  }
+  return executor_steal(worker);
+}
+
+/**
+ * Loop of a worker thread, until the executor is destroyed
+ *
+ * @param arg Pointer to the ws_worker_t
+ *
+ * @return NULL
+*/
+static void* executor_worker_loop(void* arg)
+{
+  struct ws_worker_t* worker = (struct ws_worker_t*)arg;
+  struct executor_t* exec = worker->exec;
+  current_worker = worker;
+  while (1)
+  {
+    struct task_t* task = executor_find_task(worker);
+    if (!task)
+    {
+      pthread_mutex_lock(&exec->lock);
+      if (exec->stop)
+      {
+        pthread_mutex_unlock(&exec->lock);
+        break;
+      }
+
+      // Announce the sleep before the last look, so a worker that pushes a task after it sees
+      // the sleeper and wakes it up
+      atomic_fetch_add(&exec->sleepers, 1);
+      task = executor_dequeue_locked(exec);
+      if (!task)
+      {
+        task = executor_steal(worker);
+      }
+      if (!task)
+      {
+        pthread_cond_wait(&exec->wakeup, &exec->lock);
+      }
+      atomic_fetch_sub(&exec->sleepers, 1);
+      pthread_mutex_unlock(&exec->lock);
+      if (!task)
+      {
+        continue;
+      }
+    }
+    atomic_fetch_add_explicit(&worker->executed, 1, memory_order_relaxed);
+    task->run(task);
+  }
+  return NULL;
+}
+
+void executor_ctor(struct executor_t* exec, int threads)
+{
+  exec->count = threads;
+  exec->head = NULL;
+  exec->tail = NULL;
+  exec->stop = 0;
+  atomic_init(&exec->queued, 0);
+  atomic_init(&exec->sleepers, 0);
+  pthread_mutex_init(&exec->lock, NULL);
+  pthread_cond_init(&exec->wakeup, NULL);
+
+  // All the deques exist before any thread can steal
+  exec->workers = (struct ws_worker_t*)calloc(threads, sizeof(struct ws_worker_t));
+  for (int i = 0; i < threads; i++)
+  {
+    struct ws_worker_t* worker = &exec->workers[i];
+    worker->exec = exec;
+    worker->index = i;
+    worker->deque = ws_deque_new();
+    ws_deque_ctor(worker->deque, DEQUE_CAPACITY);
+    atomic_init(&worker->executed, 0);
+    atomic_init(&worker->stolen, 0);
+  }
+  for (int i = 0; i < threads; i++)
+  {
+    if (pthread_create(&exec->workers[i].thread, NULL, &executor_worker_loop,
+        &exec->workers[i]))
+    {
+      fprintf(stderr, "Could not start the executor threads.\n");
+      exit(1);
+    }
+  }
+}
+
+void executor_dtor(struct executor_t* exec)
+{
+  pthread_mutex_lock(&exec->lock);
+  exec->stop = 1;
+  pthread_cond_broadcast(&exec->wakeup);
+  pthread_mutex_unlock(&exec->lock);
+  for (int i = 0; i < exec->count; i++)
+  {
+    pthread_join(exec->workers[i].thread, NULL);
+  }
+  for (int i = 0; i < exec->count; i++)
+  {
+    ws_deque_dtor(exec->workers[i].deque);
+    ws_deque_delete(exec->workers[i].deque);
+  }
+  free(exec->workers);
+  pthread_cond_destroy(&exec->wakeup);
+  pthread_mutex_destroy(&exec->lock);
+}
+
+/**
+ * Print the counters of every worker
+ *
+ * @param exec Executor
+ * @param out Where the counters are printed
+*/
+void executor_print_stats(struct executor_t* exec, FILE* out)
+{
+  for (int i = 0; i < exec->count; i++)
+  {
+    struct ws_worker_t* worker = &exec->workers[i];
+    fprintf(out, "executor %d: %ld tasks (%ld stolen), %d waiting\n", i,
+        atomic_load_explicit(&worker->executed, memory_order_relaxed),
+        atomic_load_explicit(&worker->stolen, memory_order_relaxed),
+        ws_deque_size(worker->deque));
+  }
+}
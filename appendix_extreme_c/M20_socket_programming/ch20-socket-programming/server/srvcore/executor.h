@@ -0,0 +1,44 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <stdio.h>
+
+/**
+ * Work-stealing executor: a fixed number of threads that run tasks. Every thread keeps its own
+ * deque of tasks (see ws_deque.h), and a thread without tasks steals them from the others, so all
+ * the threads keep busy even if the work arrives to only one of them. The tasks submitted from
+ * other threads (the event loops, for instance) go to a shared queue.
+ *
+ * The tasks don't keep any order between them, a caller that needs an order has to chain its
+ * tasks (see the connections of epoll_server_core.c).
+*/
+
+struct task_t;
+
+// Function that runs a task
+typedef void (*task_func_t)(struct task_t*);
+
+// A task is usually the first member (or a member, see offsetof) of a bigger structure with its
+// data. The memory is owned by the caller, the executor only keeps the pointer.
+struct task_t
+{
+  task_func_t run;
+  struct task_t* next; // Used by the executor while the task waits in the shared queue
+};
+
+// Forward declaration
+struct executor_t;
+
+// Memory management function
+struct executor_t* executor_new();
+void executor_delete(struct executor_t*);
+
+// Constructor (starts the threads) and destructor (runs the tasks left and stops the threads)
+void executor_ctor(struct executor_t*, int threads);
+void executor_dtor(struct executor_t*);
+
+// Methods of the executor
+void executor_submit(struct executor_t*, struct task_t* task);
+void executor_print_stats(struct executor_t*, FILE* out);
+
+#endif
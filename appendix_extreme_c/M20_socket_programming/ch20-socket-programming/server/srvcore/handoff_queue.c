@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "handoff_queue.h"
+
+/**
+ * The queue is a ring of cells, and every cell has a sequence number that tells its state for the
+ * current lap of the ring:
+ *
+ * - seq == pos: the cell is free for the producer that reserves position 'pos'.
+ * - seq == pos + 1: the cell has the value written for position 'pos', ready for a consumer.
+ *
+ * A producer reserves a position moving the tail forward with a compare-and-swap, writes the value
+ * and then publishes it updating the sequence (release). A consumer does the same with the head,
+ * and leaves the cell free for the next lap (seq = pos + capacity). Two threads never write the
+ * same cell at the same time, and no thread waits for another one holding a lock.
+*/
+
+#define CACHE_LINE 64
+
+struct handoff_cell_t
+{
+  atomic_size_t seq;
+  int fd;
+};
+
+struct handoff_queue_t
+{
+  struct handoff_cell_t* cells;
+  size_t mask;
+  // The producers and the consumers touch different cache lines
+  _Alignas(CACHE_LINE) atomic_size_t tail;
+  _Alignas(CACHE_LINE) atomic_size_t head;
+};
+
+struct handoff_queue_t* handoff_queue_new()
+{
+  return (struct handoff_queue_t*)aligned_alloc(CACHE_LINE,
+      sizeof(struct handoff_queue_t));
+}
+
+void handoff_queue_delete(struct handoff_queue_t* queue)
+{
+  free(queue);
+}
+
+void handoff_queue_ctor(struct handoff_queue_t* queue, int capacity)
+{
+  size_t size = 2;
+  while (size < (size_t)capacity)
+  {
+    size *= 2;
+  }
+  queue->cells = (struct handoff_cell_t*)malloc(size * sizeof(struct handoff_cell_t));
+  queue->mask = size - 1;
+  for (size_t i = 0; i < size; i++)
+  {
+    atomic_init(&queue->cells[i].seq, i);
+  }
+  atomic_init(&queue->tail, 0);
+  atomic_init(&queue->head, 0);
+}
+
+void handoff_queue_dtor(struct handoff_queue_t* queue)
+{
+  free(queue->cells);
+}
+
+/**
+ * Add a descriptor at the end of the queue
+ *
+ * @param queue Queue
+ * @param fd Descriptor
+ *
+ * @return 0 on success, -1 if the queue is full
+*/
+int handoff_queue_push(struct handoff_queue_t* queue, int fd)
+{
+  size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  struct handoff_cell_t* cell;
+  while (1)
+  {
+    cell = &queue->cells[pos & queue->mask];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+    if (diff == 0)
+    {
+      // The cell is free, reserve it (if another producer was faster, pos gets its new value)
+      if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+          memory_order_relaxed, memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (diff < 0)
+    {
+      // The cell still has the value of the previous lap
+      return -1;
+    }
+    else
+    {
+      pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    }
+  }
+  cell->fd = fd;
+  atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+  return 0;
+}
+
+/**
+ * Take the descriptor at the beginning of the queue
+ *
+ * @param queue Queue
+ * @param fd Where the descriptor is returned
+ *
+ * @return 0 on success, -1 if the queue is empty
+*/
+int handoff_queue_pop(struct handoff_queue_t* queue, int* fd)
+{
+  size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  struct handoff_cell_t* cell;
+  while (1)
+  {
+    cell = &queue->cells[pos & queue->mask];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + 1);
+    if (diff == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1,
+          memory_order_relaxed, memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (diff < 0)
+    {
+      // Nothing was published in the cell yet
+      return -1;
+    }
+    else
+    {
+      pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    }
+  }
+  *fd = cell->fd;
+  atomic_store_explicit(&cell->seq, pos + queue->mask + 1, memory_order_release);
+  return 0;
+}
+
+int handoff_queue_capacity(struct handoff_queue_t* queue)
+{
+  return (int)(queue->mask + 1);
+}
+
+/**
+ * Number of descriptors in the queue (only an estimation while other threads use it)
+ *
+ * @param queue Queue
+ *
+ * @return Number of descriptors
+*/
+int handoff_queue_size(struct handoff_queue_t* queue)
+{
+  size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  return tail > head ? (int)(tail - head) : 0;
+}
@@ -0,0 +1,30 @@
+#ifndef HANDOFF_QUEUE_H
+#define HANDOFF_QUEUE_H
+
+/**
+ * Bounded queue of descriptors that several threads can use at the same time without locks (any
+ * number of producers and consumers). It is used to hand the accepted clients to the worker
+ * threads, see accept_forever_pool in stream_server_core.c.
+ *
+ * The queue never blocks: a push on a full queue or a pop on an empty one fails, and the caller
+ * decides what to do (wait, retry or give up).
+*/
+
+// Forward declaration
+struct handoff_queue_t;
+
+// Memory management function
+struct handoff_queue_t* handoff_queue_new();
+void handoff_queue_delete(struct handoff_queue_t*);
+
+// Constructor (the capacity is rounded up to a power of two) and destructor
+void handoff_queue_ctor(struct handoff_queue_t*, int capacity);
+void handoff_queue_dtor(struct handoff_queue_t*);
+
+// Methods of the queue, they return 0 on success and -1 if the queue is full (or empty)
+int handoff_queue_push(struct handoff_queue_t*, int fd);
+int handoff_queue_pop(struct handoff_queue_t*, int* fd);
+int handoff_queue_capacity(struct handoff_queue_t*);
+int handoff_queue_size(struct handoff_queue_t*);
+
+#endif
@@ -0,0 +1,421 @@
+#define _GNU_SOURCE // open_memstream
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <calc_proto_ser.h>
+#include <hdr_histogram.h>
+
+#include "server_stats.h"
+#include "server_trace.h"
+
+/**
+ * The blocks of all the threads are kept in a list (the registry). A thread takes a block the
+ * first time it counts something, and gives it back when it ends (the destructor of a thread key),
+ * so the next thread keeps counting on it. The lock of the registry also hands the block from the
+ * old owner to the new one, so the new owner sees the last values written.
+*/
+
+_Thread_local struct server_stats_t* server_stats_current = NULL;
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct server_stats_t* registry = NULL;
+static int registry_size = 0;
+static pthread_key_t release_key;
+static pthread_once_t release_key_once = PTHREAD_ONCE_INIT;
+
+// Names of the ERROR_* codes counted (see error_callback)
+static const char* error_names[STATS_ERRORS] = {
+  "INVALID_REQUEST", "INVALID_REQUEST_ID", "INVALID_REQUEST_METHOD",
+  "INVALID_REQUEST_OPERAND1", "INVALID_REQUEST_OPERAND2", "OTHER"
+};
+
+static const char* time_names[STATS_TIMES] = { "decode", "service", "write" };
+
+/**
+ * Give the block of a thread back to the registry when the thread ends
+ *
+ * @param arg Block of the thread
+*/
+static void server_stats_release(void* arg)
+{
+  struct server_stats_t* stats = (struct server_stats_t*)arg;
+  pthread_mutex_lock(&registry_lock);
+  stats->owned = 0;
+  pthread_mutex_unlock(&registry_lock);
+}
+
+static void server_stats_create_key()
+{
+  pthread_key_create(&release_key, &server_stats_release);
+}
+
+/**
+ * Take a block for the calling thread, a free one of the registry or a new one
+ *
+ * @return Block of the thread
+*/
+struct server_stats_t* server_stats_register()
+{
+  pthread_once(&release_key_once, &server_stats_create_key);
+
+  pthread_mutex_lock(&registry_lock);
+  struct server_stats_t* stats = registry;
+  while (stats && stats->owned)
+  {
+    stats = stats->next;
+  }
+  if (!stats)
+  {
+    stats = (struct server_stats_t*)calloc(1, sizeof(struct server_stats_t));
+    stats->index = registry_size++;
+    stats->next = registry;
+    registry = stats;
+  }
+  stats->owned = 1;
+  stats->timing = 0;
+  pthread_mutex_unlock(&registry_lock);
+
+  pthread_setspecific(release_key, stats);
+  server_stats_current = stats;
+  return stats;
+}
+
+/**
+ * Bucket of a time: the small times have a bucket each, and from STATS_SUB_BUCKETS on, every power
+ * of two is divided in STATS_SUB_BUCKETS buckets of the same width
+ *
+ * @param ns Time in nanoseconds
+ *
+ * @return Bucket (the times too big go to the last one)
+*/
+int server_stats_bucket(long ns)
+{
+  if (ns < STATS_SUB_BUCKETS)
+  {
+    return ns < 0 ? 0 : (int)ns;
+  }
+  int exp = 63 - __builtin_clzl((unsigned long)ns);  // 4 or more
+  int sub = (int)(ns >> (exp - 4)) & (STATS_SUB_BUCKETS - 1);
+  int bucket = (exp - 3) * STATS_SUB_BUCKETS + sub;
+  return bucket < STATS_TIME_BUCKETS ? bucket : STATS_TIME_BUCKETS - 1;
+}
+
+/**
+ * Value that represents the times of a bucket (its middle)
+ *
+ * @param bucket Bucket
+ *
+ * @return Time in nanoseconds
+*/
+long server_stats_bucket_value(int bucket)
+{
+  if (bucket < 2 * STATS_SUB_BUCKETS)
+  {
+    return bucket;
+  }
+  int exp = bucket / STATS_SUB_BUCKETS + 3;
+  int sub = bucket % STATS_SUB_BUCKETS;
+  long width = 1L << (exp - 4);
+  return (STATS_SUB_BUCKETS + sub) * width + width / 2;
+}
+
+/**
+ * Record a time in its distribution
+ *
+ * @param stats Block of the calling thread
+ * @param time Time measured
+ * @param ns Nanoseconds
+*/
+void server_stats_record(struct server_stats_t* stats, stats_time_t time, long ns)
+{
+  server_stats_add(&stats->times[time][server_stats_bucket(ns)], 1);
+}
+
+/**
+ * Record the decode time of the read being timed (everything since the beginning of the read but
+ * the callbacks)
+ *
+ * @param stats Block of the calling thread
+*/
+void server_stats_read_decoded(struct server_stats_t* stats)
+{
+  if (!stats->timing)
+  {
+    return;
+  }
+  long now = server_stats_now();
+  server_stats_record(stats, STATS_TIME_DECODE,
+      now - stats->mark - stats->service_ns - stats->write_ns);
+  stats->mark = now;
+}
+
+/**
+ * Record the service and the write times of the read being timed (the write time includes the
+ * flush of the responses, since the decode)
+ *
+ * @param stats Block of the calling thread
+*/
+void server_stats_read_end(struct server_stats_t* stats)
+{
+  if (!stats->timing)
+  {
+    return;
+  }
+  server_stats_record(stats, STATS_TIME_WRITE,
+      stats->write_ns + server_stats_now() - stats->mark);
+
+  // The reads that only had errors (or that left the requests to an executor) didn't evaluate
+  if (stats->service_ns > 0)
+  {
+    server_stats_record(stats, STATS_TIME_SERVICE, stats->service_ns);
+  }
+  stats->timing = 0;
+}
+
+/**
+ * Add the counters of all the threads in a block that isn't registered
+ *
+ * @param total Block that receives the sums (zeroed by the caller)
+*/
+void server_stats_sum(struct server_stats_t* total)
+{
+  pthread_mutex_lock(&registry_lock);
+  for (struct server_stats_t* stats = registry; stats; stats = stats->next)
+  {
+    for (int i = 0; i < STATS_METHODS; i++)
+    {
+      server_stats_add(&total->requests[i], atomic_load(&stats->requests[i]));
+    }
+    for (int i = 0; i < STATS_ERRORS; i++)
+    {
+      server_stats_add(&total->errors[i], atomic_load(&stats->errors[i]));
+    }
+    server_stats_add(&total->write_errors, atomic_load(&stats->write_errors));
+    server_stats_add(&total->bytes_in, atomic_load(&stats->bytes_in));
+    server_stats_add(&total->bytes_out, atomic_load(&stats->bytes_out));
+    server_stats_add(&total->connections, atomic_load(&stats->connections));
+    server_stats_add(&total->accepted, atomic_load(&stats->accepted));
+    server_stats_add(&total->cache_hits, atomic_load(&stats->cache_hits));
+    server_stats_add(&total->cache_misses, atomic_load(&stats->cache_misses));
+    for (int i = 0; i < STATS_TIMES; i++)
+    {
+      for (int j = 0; j < STATS_TIME_BUCKETS; j++)
+      {
+        server_stats_add(&total->times[i][j], atomic_load(&stats->times[i][j]));
+      }
+    }
+  }
+  pthread_mutex_unlock(&registry_lock);
+}
+
+/**
+ * Call a function with every block of the registry
+ *
+ * @param func Function, it receives the block and the argument
+ * @param arg Argument of the function
+*/
+void server_stats_foreach(void (*func)(struct server_stats_t*, void*), void* arg)
+{
+  pthread_mutex_lock(&registry_lock);
+  for (struct server_stats_t* stats = registry; stats; stats = stats->next)
+  {
+    func(stats, arg);
+  }
+  pthread_mutex_unlock(&registry_lock);
+}
+
+/**
+ * Print a distribution of times in microseconds
+ *
+ * @param out Stream
+ * @param name Name of the time
+ * @param buckets Counts of the buckets
+*/
+static void server_stats_print_time(FILE* out, const char* name, atomic_long* buckets)
+{
+  struct hdr_histogram_t* hist = hdr_histogram_new();
+  hdr_histogram_ctor(hist, 100000000000L, 2);
+  for (int i = 0; i < STATS_TIME_BUCKETS; i++)
+  {
+    long count = atomic_load_explicit(&buckets[i], memory_order_relaxed);
+    if (count > 0)
+    {
+      hdr_histogram_record_n(hist, server_stats_bucket_value(i), count);
+    }
+  }
+  fprintf(out, "%s: %ld timed, us mean %.2f p50 %.2f p90 %.2f p99 %.2f p99.9 %.2f max %.2f\n",
+      name, (long)hdr_histogram_total(hist), hdr_histogram_mean(hist) / 1000.0,
+      hdr_histogram_value_at_percentile(hist, 50.0) / 1000.0,
+      hdr_histogram_value_at_percentile(hist, 90.0) / 1000.0,
+      hdr_histogram_value_at_percentile(hist, 99.0) / 1000.0,
+      hdr_histogram_value_at_percentile(hist, 99.9) / 1000.0,
+      hdr_histogram_max(hist) / 1000.0);
+  hdr_histogram_dtor(hist);
+  hdr_histogram_delete(hist);
+}
+
+/**
+ * Print the counters of all the threads, a line per group
+ *
+ * @param out Stream
+*/
+void server_stats_print(FILE* out)
+{
+  struct server_stats_t* total = (struct server_stats_t*)calloc(1, sizeof(struct server_stats_t));
+  server_stats_sum(total);
+
+  fprintf(out, "connections: %ld open, %ld accepted\n",
+      atomic_load(&total->connections), atomic_load(&total->accepted));
+  fprintf(out, "bytes: %ld in, %ld out\n",
+      atomic_load(&total->bytes_in), atomic_load(&total->bytes_out));
+
+  long requests = 0;
+  fprintf(out, "requests:");
+  for (int i = 0; i < STATS_METHODS; i++)
+  {
+    long count = atomic_load(&total->requests[i]);
+    const char* name = method_to_str((method_t)i);
+    if (count > 0)
+    {
+      fprintf(out, " %s %ld,", name ? name : "NONE", count);
+    }
+    requests += count;
+  }
+  fprintf(out, " total %ld\n", requests);
+
+  fprintf(out, "errors:");
+  for (int i = 0; i < STATS_ERRORS; i++)
+  {
+    long count = atomic_load(&total->errors[i]);
+    if (count > 0)
+    {
+      fprintf(out, " %s %ld,", error_names[i], count);
+    }
+  }
+  fprintf(out, " WRITE %ld\n", atomic_load(&total->write_errors));
+
+  long hits = atomic_load(&total->cache_hits);
+  long misses = atomic_load(&total->cache_misses);
+  if (hits + misses > 0)
+  {
+    fprintf(out, "cache: %ld hits, %ld misses (%.1f%% hits)\n", hits, misses,
+        100.0 * hits / (hits + misses));
+  }
+
+  for (int i = 0; i < STATS_TIMES; i++)
+  {
+    server_stats_print_time(out, time_names[i], total->times[i]);
+  }
+  free(total);
+}
+
+/**
+ * Loop of the thread of the stats socket, it writes the counters to every client and closes it.
+ * A client can ask for the traces instead, sending "trace" (the clients that send nothing for a
+ * moment get the counters).
+ *
+ * @param arg Listening socket
+ *
+ * @return NULL (the loop never ends)
+*/
+static void* server_stats_serve_loop(void* arg)
+{
+  int listen_sd = (int)(long)arg;
+  while (1)
+  {
+    int client_sd = accept(listen_sd, NULL, NULL);
+    if (client_sd == -1)
+    {
+      if (errno != EINTR && errno != ECONNABORTED)
+      {
+        fprintf(stderr, "Could not accept the stats client: %s\n", strerror(errno));
+        sleep(1);
+      }
+      continue;
+    }
+
+    char command[16] = "";
+    struct pollfd pfd;
+    pfd.fd = client_sd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 100) == 1)
+    {
+      ssize_t ret = recv(client_sd, command, sizeof(command) - 1, 0);
+      command[ret > 0 ? ret : 0] = '\0';
+    }
+
+    // The output is built first, so a client that leaves early can't stop the thread in a write
+    char* text = NULL;
+    size_t len = 0;
+    FILE* out = open_memstream(&text, &len);
+    if (!strncmp(command, "trace", 5))
+    {
+      server_trace_print(out);
+    }
+    else
+    {
+      server_stats_print(out);
+    }
+    fclose(out);
+    size_t sent = 0;
+    while (sent < len)
+    {
+      ssize_t ret = send(client_sd, text + sent, len - sent, MSG_NOSIGNAL);
+      if (ret <= 0)
+      {
+        break;
+      }
+      sent += ret;
+    }
+    free(text);
+    close(client_sd);
+  }
+  return NULL;
+}
+
+/**
+ * Serve the counters in a Unix socket, from a thread of its own. Any local tool can read them:
+ *
+ *    $ nc -U /tmp/calc_stats.sock
+ *
+ * @param path Path of the socket file (an old file is replaced)
+ *
+ * @return 0, or -1 if the socket can't be created
+*/
+int server_stats_serve(const char* path)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  int sd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sd == -1)
+  {
+    return -1;
+  }
+  unlink(path);
+  if (bind(sd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(sd, 4) == -1)
+  {
+    close(sd);
+    return -1;
+  }
+
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, &server_stats_serve_loop, (void*)(long)sd))
+  {
+    close(sd);
+    return -1;
+  }
+  pthread_detach(thread);
+  return 0;
+}
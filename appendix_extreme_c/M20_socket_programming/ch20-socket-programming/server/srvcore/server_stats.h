@@ -0,0 +1,131 @@
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+
+#include <stdio.h>
+#include <time.h>
+#include <stdatomic.h>
+
+struct trace_ring_t;
+
+/**
+ * Counters of the servers, to see what they do and where the time goes while they run. Every
+ * thread that serves requests has its own block of counters, so the hot path never shares a
+ * cache line with another thread and never needs an atomic read-modify-write: the owner is the
+ * only writer, and it just stores the new value (a relaxed store is a plain 'mov'). The blocks
+ * are added together only when somebody asks for the counters (server_stats_print).
+ *
+ *    struct server_stats_t* stats = server_stats_thread();  // Block of the calling thread
+ *    server_stats_add(&stats->bytes_in, ret);
+ *
+ * The times (decode, service and write of every read) need two clock readings each, which is too
+ * much for every read of a small request, so only one read of every STATS_SAMPLE_EVERY is timed.
+ * The distributions keep their shape, they just have fewer values.
+ *
+ * The blocks of the threads that end are kept (with their counts) and given to the next threads,
+ * so a thread per client doesn't leave a block per client behind.
+*/
+
+#define STATS_METHODS 11        // Values of method_t (NONE to EVAL)
+#define STATS_ERRORS 6          // ERROR_INVALID_REQUEST to ERROR_INVALID_REQUEST_OPERAND2, others
+#define STATS_SAMPLE_EVERY 32   // Reads of a thread per timed read (power of two)
+#define STATS_SUB_BUCKETS 16    // Buckets of a time per power of two (6% of error)
+#define STATS_TIME_BUCKETS 512  // Buckets of a time, up to 34 s (bigger times go to the last one)
+
+// Times measured for every read
+typedef enum {
+  STATS_TIME_DECODE,   // Deserialization of the requests (without the callbacks)
+  STATS_TIME_SERVICE,  // Evaluation of the requests
+  STATS_TIME_WRITE,    // Serialization of the responses and the system call that sends them
+  STATS_TIMES
+} stats_time_t;
+
+// Counters of a thread. Only the owner writes them (see server_stats_add), other threads can read
+// them at any time.
+struct server_stats_t
+{
+  struct server_stats_t* next;      // Next block of the registry
+  int owned;                        // A thread uses the block
+  int index;                        // Number of the block, in the order they were created
+  struct trace_ring_t* _Atomic trace; // Requests traced by the thread (see server_trace.h)
+
+  atomic_long requests[STATS_METHODS]; // Requests evaluated by method
+  atomic_long errors[STATS_ERRORS];    // Requests rejected by the deserializer by ERROR_* code
+  atomic_long write_errors;            // Writes that failed (the connection is lost)
+  atomic_long bytes_in;
+  atomic_long bytes_out;
+  atomic_long connections;          // Connections opened less the ones closed by the thread
+  atomic_long accepted;             // Connections opened by the thread
+  atomic_long cache_hits;           // Requests answered by the cache of results
+  atomic_long cache_misses;         // Cacheable requests evaluated by the service
+  atomic_long times[STATS_TIMES][STATS_TIME_BUCKETS]; // Nanoseconds of the timed reads
+
+  // State of the read being timed (only used by the owner)
+  unsigned reads;
+  int timing;
+  long mark;
+  long service_ns;
+  long write_ns;
+};
+
+// Block of the calling thread (reserved with the first call of the thread)
+extern _Thread_local struct server_stats_t* server_stats_current;
+struct server_stats_t* server_stats_register();
+
+static inline struct server_stats_t* server_stats_thread()
+{
+  struct server_stats_t* stats = server_stats_current;
+  return stats ? stats : server_stats_register();
+}
+
+// Add to a counter of the block of the calling thread (no other thread writes it)
+static inline void server_stats_add(atomic_long* counter, long value)
+{
+  atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value,
+      memory_order_relaxed);
+}
+
+static inline long server_stats_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// Bucket of a time (logarithmic, with STATS_SUB_BUCKETS linear buckets per power of two)
+int server_stats_bucket(long ns);
+long server_stats_bucket_value(int bucket);
+
+// Record a time in its distribution
+void server_stats_record(struct server_stats_t* stats, stats_time_t time, long ns);
+
+// Timing of a read: begin before the deserialization, decoded after it and end after the flush
+// of the responses. The callbacks add their part to service_ns and write_ns while timing is set.
+void server_stats_read_decoded(struct server_stats_t* stats);
+void server_stats_read_end(struct server_stats_t* stats);
+
+static inline void server_stats_read_begin(struct server_stats_t* stats)
+{
+  stats->timing = (++stats->reads & (STATS_SAMPLE_EVERY - 1)) == 0;
+  if (stats->timing)
+  {
+    stats->service_ns = 0;
+    stats->write_ns = 0;
+    stats->mark = server_stats_now();
+  }
+}
+
+// Add the counters of all the threads in 'total' (a block that isn't registered)
+void server_stats_sum(struct server_stats_t* total);
+
+// Call a function with every block of the registry (the blocks can't be taken meanwhile)
+void server_stats_foreach(void (*func)(struct server_stats_t*, void*), void* arg);
+
+// Print the counters of all the threads
+void server_stats_print(FILE* out);
+
+// Serve the counters in a Unix socket (every client that connects gets the output of
+// server_stats_print, or the one of server_trace_print if it sends "trace"), returns -1 if the
+// socket can't be created
+int server_stats_serve(const char* path);
+
+#endif
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <calc_proto_ser.h>
+
+#include "server_stats.h"
+#include "server_trace.h"
+
+int server_trace_every = 0;
+_Thread_local int server_trace_countdown = 0;
+
+// Intervals between the stamps of a span, printed as the events of the request
+static const char* interval_names[TRACE_STAMPS - 1] = {
+  "decode", "queue", "service", "serialize", "write"
+};
+
+/**
+ * Enable the tracing (before the threads start serving)
+ *
+ * @param every Reads of a thread per sampled read (0 to disable the tracing)
+*/
+void server_trace_enable(int every)
+{
+  server_trace_every = every > 0 ? every : 0;
+}
+
+/**
+ * Start tracing a connection, its last read was sampled
+ *
+ * @param span Span of the connection
+ * @param conn Identifier of the connection in the trace (its socket, for instance)
+*/
+void server_trace_sample(struct trace_span_t* span, int conn)
+{
+  server_trace_countdown = server_trace_every;
+  memset(span->stamps, 0, sizeof(span->stamps));
+  span->conn = conn;
+  span->state = TRACE_SAMPLED;
+  server_trace_stamp(span, TRACE_READ);
+}
+
+/**
+ * The deserializer gave the first request of the sampled read, it is the one traced
+ *
+ * @param span Span of the connection
+ * @param req Request
+*/
+void server_trace_decoded(struct trace_span_t* span, const struct calc_proto_req_t* req)
+{
+  server_trace_stamp(span, TRACE_DECODE);
+  span->req_id = req->id;
+  span->method = req->method;
+  span->state = TRACE_FOLLOWING;
+}
+
+/**
+ * The response of the request traced was sent, the span goes to the ring of the thread
+ *
+ * @param span Span of the connection
+*/
+void server_trace_commit(struct trace_span_t* span)
+{
+  server_trace_stamp(span, TRACE_WRITE);
+  span->state = TRACE_IDLE;
+
+  struct server_stats_t* stats = server_stats_thread();
+  struct trace_ring_t* ring = atomic_load_explicit(&stats->trace, memory_order_relaxed);
+  if (!ring)
+  {
+    ring = (struct trace_ring_t*)calloc(1, sizeof(struct trace_ring_t));
+    atomic_store_explicit(&stats->trace, ring, memory_order_release);
+  }
+
+  // The slot is announced before it is overwritten (see server_trace_collect)
+  long index = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  atomic_store_explicit(&ring->started, index + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  struct trace_slot_t* slot = &ring->slots[index & (TRACE_RING_SIZE - 1)];
+  atomic_store_explicit(&slot->req_id, span->req_id, memory_order_relaxed);
+  atomic_store_explicit(&slot->method, span->method, memory_order_relaxed);
+  atomic_store_explicit(&slot->conn, span->conn, memory_order_relaxed);
+  for (int i = 0; i < TRACE_STAMPS; i++)
+  {
+    atomic_store_explicit(&slot->stamps[i], span->stamps[i], memory_order_relaxed);
+  }
+  atomic_store_explicit(&ring->head, index + 1, memory_order_release);
+}
+
+/**
+ * Copy the spans of a ring while its thread keeps writing. The spans are copied first, and then
+ * 'started' says which slots the writer could have touched meanwhile (the ones of the spans older
+ * than started - TRACE_RING_SIZE), which are left out.
+ *
+ * @param ring Ring of a thread
+ * @param spans Destination, room for TRACE_RING_SIZE spans
+ *
+ * @return Number of spans copied (from the oldest to the newest)
+*/
+int server_trace_collect(struct trace_ring_t* ring, struct trace_span_t* spans)
+{
+  long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  long first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+  for (long index = first; index < head; index++)
+  {
+    struct trace_slot_t* slot = &ring->slots[index & (TRACE_RING_SIZE - 1)];
+    struct trace_span_t* span = &spans[index - first];
+    span->state = TRACE_IDLE;
+    span->req_id = atomic_load_explicit(&slot->req_id, memory_order_relaxed);
+    span->method = atomic_load_explicit(&slot->method, memory_order_relaxed);
+    span->conn = atomic_load_explicit(&slot->conn, memory_order_relaxed);
+    for (int i = 0; i < TRACE_STAMPS; i++)
+    {
+      span->stamps[i] = atomic_load_explicit(&slot->stamps[i], memory_order_relaxed);
+    }
+  }
+  atomic_thread_fence(memory_order_acquire);
+  long started = atomic_load_explicit(&ring->started, memory_order_relaxed);
+
+  long valid = started - TRACE_RING_SIZE;
+  if (valid <= first)
+  {
+    return head - first;
+  }
+  if (valid >= head)
+  {
+    return 0;
+  }
+  memmove(spans, spans + (valid - first), (head - valid) * sizeof(struct trace_span_t));
+  return head - valid;
+}
+
+// State of the printing of the traces
+struct trace_print_t
+{
+  FILE* out;
+  struct trace_span_t* spans;
+  int events;
+};
+
+/**
+ * Print an event of the trace (a "complete" event, with its beginning and its duration)
+ *
+ * @param print State of the printing
+ * @param name Name of the event
+ * @param tid Thread of the event
+ * @param span Span of the event
+ * @param begin Beginning in nanoseconds
+ * @param end End in nanoseconds
+*/
+static void server_trace_print_event(struct trace_print_t* print, const char* name, int tid,
+    const struct trace_span_t* span, long begin, long end)
+{
+  const char* method = method_to_str((method_t)span->method);
+  fprintf(print->out, "%s\n{\"name\":\"%s\",\"cat\":\"calc\",\"ph\":\"X\",\"ts\":%.3f,"
+      "\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"id\":%d,\"method\":\"%s\",\"conn\":%d}}",
+      print->events ? "," : "", name, begin / 1000.0, (end - begin) / 1000.0, tid, span->req_id,
+      method ? method : "NONE", span->conn);
+  print->events++;
+}
+
+/**
+ * Print the spans of the ring of a block, every span is an event for the whole request with an
+ * event inside for every stage
+ *
+ * @param stats Block of a thread
+ * @param arg State of the printing
+*/
+static void server_trace_print_ring(struct server_stats_t* stats, void* arg)
+{
+  struct trace_print_t* print = (struct trace_print_t*)arg;
+  struct trace_ring_t* ring = atomic_load_explicit(&stats->trace, memory_order_acquire);
+  if (!ring)
+  {
+    return;
+  }
+  int count = server_trace_collect(ring, print->spans);
+  for (int i = 0; i < count; i++)
+  {
+    const struct trace_span_t* span = &print->spans[i];
+    server_trace_print_event(print, "request", stats->index, span, span->stamps[TRACE_READ],
+        span->stamps[TRACE_WRITE]);
+    for (int j = 0; j < TRACE_STAMPS - 1; j++)
+    {
+      server_trace_print_event(print, interval_names[j], stats->index, span, span->stamps[j],
+          span->stamps[j + 1]);
+    }
+  }
+}
+
+/**
+ * Print the spans of all the threads in the JSON format of the Chrome traces
+ *
+ * @param out Stream
+*/
+void server_trace_print(FILE* out)
+{
+  struct trace_print_t print;
+  print.out = out;
+  print.spans = (struct trace_span_t*)malloc(TRACE_RING_SIZE * sizeof(struct trace_span_t));
+  print.events = 0;
+  fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  server_stats_foreach(&server_trace_print_ring, &print);
+  fprintf(out, "\n]}\n");
+  free(print.spans);
+}
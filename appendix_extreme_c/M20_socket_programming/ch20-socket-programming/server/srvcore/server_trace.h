@@ -0,0 +1,129 @@
+#ifndef SERVER_TRACE_H
+#define SERVER_TRACE_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+
+#include <calc_proto_ser.h>
+
+#include "server_stats.h"
+
+/**
+ * Sampled tracing of the requests. The counters of server_stats.h say how long the stages take on
+ * average, a trace says what happened to a single request: when it was read, when the
+ * deserializer gave it to the server, when it was evaluated, serialized and sent. One read of
+ * every 'server_trace_every' (per thread) is sampled, and the first request of that read is
+ * followed until its response is sent. The reads that aren't sampled only pay a decrement.
+ *
+ * The finished requests (spans) go to a ring of the thread that sent them, which keeps the last
+ * TRACE_RING_SIZE of them. The ring has a single writer and no lock, the readers check that the
+ * spans weren't overwritten while they copied them (see server_trace_print). The rings are printed
+ * in the JSON format of the Chrome traces, which chrome://tracing and Perfetto open:
+ *
+ *    $ echo trace | nc -U /tmp/calc_stats.sock > trace.json
+*/
+
+#define TRACE_RING_SIZE 256  // Spans kept per thread (power of two)
+
+// Moments of a request
+typedef enum {
+  TRACE_READ,           // The bytes of the request were read
+  TRACE_DECODE,         // The deserializer gave the request to the server
+  TRACE_SERVICE_BEGIN,  // The evaluation started (later than the decode with an executor)
+  TRACE_SERVICE_END,
+  TRACE_SERIALIZE,      // The response is in the output buffer
+  TRACE_WRITE,          // The response was sent
+  TRACE_STAMPS
+} trace_stamp_t;
+
+// State of the trace of a connection
+typedef enum {
+  TRACE_IDLE,        // Nothing is traced
+  TRACE_SAMPLED,     // The read was sampled, the next request is traced
+  TRACE_FOLLOWING,   // The request is being evaluated
+  TRACE_SERIALIZED,  // The response waits in the output buffer
+  TRACE_SENDING      // The response is being sent (io_uring)
+} trace_state_t;
+
+// Request followed through the server (every connection has one, see client_context_t)
+struct trace_span_t
+{
+  trace_state_t state;
+  int req_id;
+  int method;
+  int conn;
+  long stamps[TRACE_STAMPS];  // Nanoseconds (CLOCK_MONOTONIC)
+};
+
+// Spans finished by a thread, the last TRACE_RING_SIZE of them. The fields are only written by the
+// owner, the readers use 'started' and 'head' to know which spans they can trust.
+struct trace_slot_t
+{
+  atomic_long req_id;
+  atomic_long method;
+  atomic_long conn;
+  atomic_long stamps[TRACE_STAMPS];
+};
+
+struct trace_ring_t
+{
+  atomic_long started;  // Spans being written or written
+  atomic_long head;     // Spans written
+  struct trace_slot_t slots[TRACE_RING_SIZE];
+};
+
+// Reads per sampled read of every thread (0 = tracing disabled), set before serving
+extern int server_trace_every;
+extern _Thread_local int server_trace_countdown;
+
+void server_trace_enable(int every);
+
+// Start tracing a connection (its read was sampled)
+void server_trace_sample(struct trace_span_t* span, int conn);
+
+// Stages of the request traced, only called when the state of the span says so
+void server_trace_decoded(struct trace_span_t* span, const struct calc_proto_req_t* req);
+void server_trace_commit(struct trace_span_t* span);
+
+static inline void server_trace_stamp(struct trace_span_t* span, trace_stamp_t stamp)
+{
+  span->stamps[stamp] = server_stats_now();
+}
+
+// A read of the connection: one of every server_trace_every reads of the thread is sampled
+static inline void server_trace_read(struct trace_span_t* span, int conn)
+{
+  if (server_trace_every && --server_trace_countdown <= 0 && span->state == TRACE_IDLE)
+  {
+    server_trace_sample(span, conn);
+  }
+}
+
+// The response of the request traced was written to the output buffer
+static inline void server_trace_serialized(struct trace_span_t* span)
+{
+  server_trace_stamp(span, TRACE_SERIALIZE);
+  span->state = TRACE_SERIALIZED;
+}
+
+// The output buffer was sent (all of it if 'all_sent'). A sampled read without requests is
+// forgotten here.
+static inline void server_trace_flushed(struct trace_span_t* span, int all_sent)
+{
+  if (span->state == TRACE_SERIALIZED && all_sent)
+  {
+    server_trace_commit(span);
+  }
+  else if (span->state == TRACE_SAMPLED)
+  {
+    span->state = TRACE_IDLE;
+  }
+}
+
+// Copy the spans of the ring of a thread that weren't overwritten, returns their number
+int server_trace_collect(struct trace_ring_t* ring, struct trace_span_t* spans);
+
+// Print the spans of all the threads as a Chrome trace (JSON)
+void server_trace_print(FILE* out);
+
+#endif
@@ -4,14 +4,22 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 
+#include <poll.h>
 #include <sys/socket.h>
 
 #include <calc_proto_ser.h>
 #include <calc_service.h>
 
 #include "common_server_core.h"
+#include "handoff_queue.h"
+#include "epoll_server_core.h"
+#include "uring_server_core.h"
 #include "stream_server_core.h"
+#include "server_stats.h"
+#include "server_trace.h"
 
 /**
  * The last thing we talk about was the 'accept_forever' function that was blocking, go and check 
@@ -30,8 +38,17 @@ struct client_addr_t
   int sd;
 };
 
+// State of a connection served by its own thread
+struct stream_conn_t 
+{
+  struct client_context_t context;
+  struct client_addr_t addr;
+  int closed;  // The connection failed, the thread stops serving it
+};
+
 /**
- * Write and upate response in the socket file descriptor
+ * Write and upate response in the output buffer of the context, the response is sent to the
+ * socket with the rest of the responses of the same read (see stream_flush_resps).
  * 
  * @param context Pointer to the client conext to use
  * @param resp Pointer to response calculated
@@ -40,68 +57,124 @@ void stream_write_resp(
         struct client_context_t* context,
         struct calc_proto_resp_t* resp) 
 {
-  // Serialize response and check if it works
-  struct buffer_t buf = 
-      calc_proto_ser_server_serialize(context->ser, resp);
-  if (buf.len == 0) 
+  // Serialize response (in the output buffer, so nothing is reserved per message) and check it
+  if (queue_resp(context, resp) <= 0) 
   {
-    close(context->addr->sd);
     fprintf(stderr, "Internal error while serializing response\n");
-    exit(1);
+    ((struct stream_conn_t*)context)->closed = 1;
   }
+}
 
-  // Write serialized message from the buffer to the socket descriptor and check bytes
-  int ret = write(context->addr->sd, buf.data, buf.len);
-  free(buf.data);
-  if (ret == -1) 
+/**
+ * Write the responses waiting in the output buffer to the socket descriptor. The socket only
+ * takes what fits in its buffer, the rest waits in the output buffer (see stream_wait_readable).
+ * A failed write only ends this connection.
+ * 
+ * @param context Pointer to the client conext to use
+*/
+void stream_flush_resps(struct client_context_t* context) 
+{
+  struct stream_conn_t* conn = (struct stream_conn_t*)context;
+  if (!conn->closed && send_resps(context, conn->addr.sd) == -1) 
   {
     fprintf(stderr, "Could not write to client: %s\n",
             strerror(errno));
-    close(context->addr->sd);
-    exit(1);
-  } 
-  else if (ret < buf.len) 
+    conn->closed = 1;
+  }
+  if (conn->closed) 
   {
-    fprintf(stderr, "WARN: Less bytes were written!\n");
-    exit(1);
+    context->out_len = 0;
   }
+  server_trace_flushed(&context->trace, context->out_len == 0);
 }
 
 /**
- * Function that manages the incoming client's request
+ * Wait until the socket of a client has bytes to read, sending the responses waiting meanwhile.
+ * Without responses waiting the thread just blocks in the read, as before. With them, the thread
+ * waits for the socket to be readable or writable, and it stops waiting for the reads when the
+ * responses reach RESP_HIGH_WATER: the client has to take them before it sends more requests.
  * 
- * @param arg Pointer to the arguments of the request
+ * @param conn Connection
  * 
- * @return NULL if everything goes right
+ * @return 1 if the socket can be read, 0 if the connection failed
 */
-void* client_handler(void *arg) 
+int stream_wait_readable(struct stream_conn_t* conn) 
 {
-  // Create client context, update value and free argument after setting up
-  struct client_context_t context;
-  context.addr = (struct client_addr_t*)
-      malloc(sizeof(struct client_addr_t));
-  context.addr->sd = *((int*)arg);
-  free((int*)arg);
+  struct client_context_t* context = &conn->context;
+  while (context->out_len > 0 && !conn->closed) 
+  {
+    struct pollfd pfd;
+    pfd.fd = conn->addr.sd;
+    pfd.events = context->out_len < RESP_HIGH_WATER ? POLLIN | POLLOUT : POLLOUT;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, -1) == -1) 
+    {
+      if (errno != EINTR) 
+      {
+        conn->closed = 1;
+      }
+      continue;
+    }
+    if (pfd.revents & POLLIN) 
+    {
+      break;
+    }
+    stream_flush_resps(context);
+  }
+  return !conn->closed;
+}
+
+/**
+ * Serve the requests of a client until it leaves, then close its socket
+ * 
+ * @param client_sd Socket of the client
+*/
+void serve_client(int client_sd) 
+{
+  // Create client context
+  struct stream_conn_t conn;
+  struct client_context_t* context = &conn.context;
+  conn.addr.sd = client_sd;
+  conn.closed = 0;
+  context->addr = &conn.addr;
 
   // Instance new serialization object
-  context.ser = calc_proto_ser_new();
-  calc_proto_ser_ctor(context.ser, &context, 256);
-  calc_proto_ser_set_req_callback(context.ser, request_callback);
-  calc_proto_ser_set_error_callback(context.ser, error_callback);
+  context->ser = calc_proto_ser_new();
+  calc_proto_ser_ctor(context->ser, context, 256);
+  calc_proto_ser_set_req_callback(context->ser, request_callback);
+  calc_proto_ser_set_req_batch_callback(context->ser, request_batch_callback);
+  calc_proto_ser_set_error_callback(context->ser, error_callback);
 
   // Instance new calculation service object
-  context.svc = calc_service_new();
-  calc_service_ctor(context.svc);
+  context->svc = calc_service_new();
+  calc_service_ctor(context->svc);
+  attach_mem_register(context->svc);
 
-  context.write_resp = &stream_write_resp;
+  // Responses are kept in the output buffer until the whole read has been processed (and until
+  // the client takes them)
+  context->write_resp = &stream_write_resp;
+  context->flush_resps = &stream_flush_resps;
+  context->negotiated = 0;
+  context->out_cap = RESP_BUFFER_SIZE;
+  context->out = (char*)malloc(context->out_cap);
+  context->out_len = 0;
+  context->trace.state = TRACE_IDLE;
 
-  int ret;
-  char buffer[128];
-  while (1) 
+  // The thread serves only this client, its counters are the ones of the connection
+  struct server_stats_t* stats = server_stats_thread();
+  server_stats_add(&stats->connections, 1);
+  server_stats_add(&stats->accepted, 1);
+
+  char buffer[READ_BUFFER_SIZE];
+  while (stream_wait_readable(&conn)) 
   {
     // Read info in adress specified
     // Note that the same API can be used for file or sockets descriptors.
-    int ret = read(context.addr->sd, buffer, 128);
+    int ret = read(client_sd, buffer, sizeof(buffer));
+    if (ret == -1 && errno == EINTR) 
+    {
+      continue;
+    }
     if (ret == 0 || ret == -1) 
     {
       break;
@@ -112,18 +185,54 @@ void* client_handler(void *arg)
     // full deserialized request
     struct buffer_t buf;
     buf.data = buffer; buf.len = ret;
-    calc_proto_ser_server_deserialize(context.ser, buf, NULL);
+    server_stats_add(&stats->bytes_in, ret);
+    server_stats_read_begin(stats);
+    server_trace_read(&context->trace, client_sd);
+
+    // The first byte of the connection selects the wire format, binary frames are acknowledged
+    // with the same byte (sent before the first responses), so the client knows the server
+    // supports them.
+    if (!context->negotiated && negotiate_wire_mode(context, buf)) 
+    {
+      context->out[context->out_len++] = (char)CALC_PROTO_BINARY_HELLO;
+      buf.data++; buf.len--;
+    }
+    calc_proto_ser_server_deserialize(context->ser, buf, NULL);
+    server_stats_read_decoded(stats);
+
+    // A single write for all the responses of the requests read
+    stream_flush_resps(context);
+    server_stats_read_end(stats);
   }
+  server_stats_add(&stats->connections, -1);
 
   // Delete and free object used
-  calc_service_dtor(context.svc);
-  calc_service_delete(context.svc);
+  calc_service_dtor(context->svc);
+  calc_service_delete(context->svc);
 
-  calc_proto_ser_dtor(context.ser);
-  calc_proto_ser_delete(context.ser);
+  calc_proto_ser_dtor(context->ser);
+  calc_proto_ser_delete(context->ser);
 
-  free(context.addr);
+  close(client_sd);
+  free(context->out);
+}
 
+/**
+ * Function that manages the incoming client's request
+ * 
+ * @param arg Pointer to the arguments of the request
+ * 
+ * @return NULL if everything goes right
+*/
+void* client_handler(void *arg) 
+{
+  // Update value and free argument after setting up
+  int client_sd = *((int*)arg);
+  free((int*)arg);
+
+  // Nobody joins the thread, its resources are released when it ends
+  pthread_detach(pthread_self());
+  serve_client(client_sd);
   return NULL;
 }
 /**
@@ -164,3 +273,304 @@ void accept_forever(int server_sd)
     }
   }
 }
+
+/**
+ * 'accept_forever' creates a thread for every client, with no limit, so a storm of connections
+ * creates thousands of threads, and the accepting thread pays the creation of every one of them.
+ * With a pool, a fixed number of worker threads is started once, and the accepting thread only
+ * hands the sockets to them through a queue (the queue itself doesn't use locks, see
+ * handoff_queue.c, and the threads only sleep on the semaphores when there is nothing to do).
+ * 
+ * Every worker serves a client until it leaves, so at most 'workers' clients are served at the
+ * same time, and the rest wait in the queue. When the queue is full too, the server either stops
+ * accepting until there is room (the new clients wait in the backlog of the listening socket), or
+ * closes the new connections right away, so the clients can try another server.
+*/
+
+// Pool of worker threads and the queue of the clients waiting for them
+struct worker_pool_t 
+{
+  struct handoff_queue_t* queue;
+  sem_t items;          // Clients in the queue
+  sem_t slots;          // Free places in the queue
+  int workers;
+  int interval;         // Seconds between reports of the counters (0 = never)
+  atomic_long busy;     // Workers serving a client now
+  atomic_long accepted; // Clients accepted since the start
+  atomic_long dropped;  // Clients closed because the queue was full
+};
+
+/**
+ * Loop of a worker thread, it takes the clients from the queue and serves them
+ * 
+ * @param arg Pointer to the worker_pool_t
+ * 
+ * @return NULL
+*/
+void* pool_worker_loop(void* arg) 
+{
+  struct worker_pool_t* pool = (struct worker_pool_t*)arg;
+  while (1) 
+  {
+    while (sem_wait(&pool->items) == -1 && errno == EINTR);
+
+    // The semaphore is posted after the push, so there is a client for this worker
+    int client_sd;
+    while (handoff_queue_pop(pool->queue, &client_sd) == -1);
+    sem_post(&pool->slots);
+
+    atomic_fetch_add_explicit(&pool->busy, 1, memory_order_relaxed);
+    serve_client(client_sd);
+    atomic_fetch_sub_explicit(&pool->busy, 1, memory_order_relaxed);
+  }
+  return NULL;
+}
+
+/**
+ * Print the counters of the pool periodically
+ * 
+ * @param arg Pointer to the worker_pool_t
+ * 
+ * @return NULL
+*/
+void* pool_stats_loop(void* arg) 
+{
+  struct worker_pool_t* pool = (struct worker_pool_t*)arg;
+  while (1) 
+  {
+    sleep(pool->interval);
+    fprintf(stderr, "pool: %ld/%d workers busy, %d queued, %ld accepted, %ld closed (queue full)\n",
+        atomic_load_explicit(&pool->busy, memory_order_relaxed), pool->workers,
+        handoff_queue_size(pool->queue),
+        atomic_load_explicit(&pool->accepted, memory_order_relaxed),
+        atomic_load_explicit(&pool->dropped, memory_order_relaxed));
+  }
+  return NULL;
+}
+
+/**
+ * Manage and accept infinite incoming client connections with a fixed number of worker threads
+ * 
+ * @param server_sd Socket related with server
+ * @param workers Number of worker threads
+ * @param queue_size Number of accepted clients that can wait for a worker
+ * @param full What to do with a new client when the queue is full
+ * @param stats_interval Seconds between reports of the counters (0 to disable them)
+*/
+void accept_forever_pool(int server_sd, int workers, int queue_size, pool_full_t full,
+    int stats_interval) 
+{
+  struct worker_pool_t pool;
+  pool.queue = handoff_queue_new();
+  handoff_queue_ctor(pool.queue, queue_size);
+  sem_init(&pool.items, 0, 0);
+  sem_init(&pool.slots, 0, handoff_queue_capacity(pool.queue));
+  pool.workers = workers;
+  pool.interval = stats_interval;
+  atomic_init(&pool.busy, 0);
+  atomic_init(&pool.accepted, 0);
+  atomic_init(&pool.dropped, 0);
+
+  pthread_t thread;
+  for (int i = 0; i < workers; i++) 
+  {
+    if (pthread_create(&thread, NULL, &pool_worker_loop, &pool)) 
+    {
+      close(server_sd);
+      fprintf(stderr, "Could not start the worker threads.\n");
+      exit(1);
+    }
+  }
+  if (stats_interval > 0) 
+  {
+    pthread_create(&thread, NULL, &pool_stats_loop, &pool);
+  }
+
+  while (1) 
+  {
+    // Accept incoming connection (a failure only affects this client)
+    int client_sd = accept(server_sd, NULL, NULL);
+    if (client_sd == -1) 
+    {
+      if (errno != EINTR && errno != ECONNABORTED) 
+      {
+        fprintf(stderr, "Could not accept the client: %s\n", strerror(errno));
+        sleep(1);
+      }
+      continue;
+    }
+    atomic_fetch_add_explicit(&pool.accepted, 1, memory_order_relaxed);
+
+    // Take a free place of the queue, waiting for it or giving up the client
+    if (full == POOL_FULL_CLOSE) 
+    {
+      if (sem_trywait(&pool.slots) == -1) 
+      {
+        atomic_fetch_add_explicit(&pool.dropped, 1, memory_order_relaxed);
+        close(client_sd);
+        continue;
+      }
+    } 
+    else 
+    {
+      while (sem_wait(&pool.slots) == -1 && errno == EINTR);
+    }
+    handoff_queue_push(pool.queue, client_sd);
+    sem_post(&pool.items);
+  }
+}
+
+/**
+ * Print the options of the stream servers and exit
+ * 
+ * @param name Name of the program
+*/
+void stream_usage(const char* name) 
+{
+  fprintf(stderr, "Usage: %s [-m threads|epoll|uring] [-w workers] [-q queue_size] "
+      "[-f wait|close] [-r reactors] [-l rr|lc] [-x exec_threads] [-i stats_seconds] "
+      "[-S stats_socket] [-T trace_every] [-M mem_register] [-C cache_slots]\n", name);
+  exit(1);
+}
+
+/**
+ * Parse the command line options of a stream server (the defaults keep the original behavior, a
+ * thread per client).
+ * 
+ * @param opts Options to fill
+ * @param argc Number of arguments of the program
+ * @param argv Arguments of the program
+*/
+void stream_options_parse(struct stream_options_t* opts, int argc, char** argv) 
+{
+  opts->mode = STREAM_MODE_THREADS;
+  opts->reactors = 1;
+  opts->balance = BALANCE_ROUND_ROBIN;
+  opts->stats_interval = 0;
+  opts->workers = 0;
+  opts->queue_size = 128;
+  opts->pool_full = POOL_FULL_WAIT;
+  opts->exec_threads = 0;
+  opts->stats_path = NULL;
+  opts->trace_every = 0;
+  opts->mem_register = NULL;
+  opts->cache_slots = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:w:q:f:r:l:x:i:S:T:M:C:")) != -1) 
+  {
+    switch (opt) 
+    {
+      case 'm':
+        if (!strcmp(optarg, "threads")) opts->mode = STREAM_MODE_THREADS;
+        else if (!strcmp(optarg, "epoll")) opts->mode = STREAM_MODE_EPOLL;
+        else if (!strcmp(optarg, "uring")) opts->mode = STREAM_MODE_URING;
+        else stream_usage(argv[0]);
+        break;
+      case 'w':
+        opts->workers = atoi(optarg);
+        break;
+      case 'q':
+        opts->queue_size = atoi(optarg);
+        break;
+      case 'f':
+        if (!strcmp(optarg, "wait")) opts->pool_full = POOL_FULL_WAIT;
+        else if (!strcmp(optarg, "close")) opts->pool_full = POOL_FULL_CLOSE;
+        else stream_usage(argv[0]);
+        break;
+      case 'r':
+        opts->reactors = atoi(optarg);
+        break;
+      case 'l':
+        if (!strcmp(optarg, "rr")) opts->balance = BALANCE_ROUND_ROBIN;
+        else if (!strcmp(optarg, "lc")) opts->balance = BALANCE_LEAST_CONNECTIONS;
+        else stream_usage(argv[0]);
+        break;
+      case 'x':
+        opts->exec_threads = atoi(optarg);
+        break;
+      case 'i':
+        opts->stats_interval = atoi(optarg);
+        break;
+      case 'S':
+        opts->stats_path = optarg;
+        break;
+      case 'T':
+        opts->trace_every = atoi(optarg);
+        break;
+      case 'M':
+        opts->mem_register = optarg;
+        break;
+      case 'C':
+        opts->cache_slots = atol(optarg);
+        break;
+      default:
+        stream_usage(argv[0]);
+    }
+  }
+  if (opts->reactors < 1 || opts->reactors > 1024 || opts->stats_interval < 0 ||
+      opts->workers < 0 || opts->workers > 65536 || opts->queue_size < 1 ||
+      opts->queue_size > 1048576 || opts->exec_threads < 0 || opts->exec_threads > 1024 ||
+      opts->trace_every < 0 || opts->cache_slots < 0) 
+  {
+    stream_usage(argv[0]);
+  }
+}
+
+/**
+ * Serve the clients of a listening socket with the concurrency model of the options
+ * 
+ * @param server_sd Socket related with server
+ * @param opts Options of the server
+*/
+void serve_stream(int server_sd, const struct stream_options_t* opts) 
+{
+  // The counters are always collected, the socket only shows them (and the traces, if enabled)
+  server_trace_enable(opts->trace_every);
+  if (opts->mem_register && share_mem_register(opts->mem_register) == -1) 
+  {
+    fprintf(stderr, "Invalid register name: %s\n", opts->mem_register);
+    exit(1);
+  }
+  if (opts->cache_slots > 0 && enable_result_cache(opts->cache_slots) == -1) 
+  {
+    fprintf(stderr, "Invalid size of the cache: %ld\n", opts->cache_slots);
+    exit(1);
+  }
+  if (opts->stats_path && server_stats_serve(opts->stats_path) == -1) 
+  {
+    fprintf(stderr, "WARN: Could not serve the counters in %s: %s\n", opts->stats_path,
+            strerror(errno));
+  }
+
+  switch (opts->mode) 
+  {
+    case STREAM_MODE_EPOLL:
+      // A single loop accepts by itself, several loops receive the clients from this thread
+      if (opts->reactors == 1 && opts->stats_interval == 0 && opts->exec_threads == 0) 
+      {
+        accept_forever_epoll(server_sd);
+      } 
+      else 
+      {
+        accept_forever_reactors(server_sd, opts->reactors, opts->balance,
+            opts->stats_interval, opts->exec_threads);
+      }
+      break;
+    case STREAM_MODE_URING:
+      // A single ring (the reactor options only apply to epoll)
+      accept_forever_uring(server_sd);
+      break;
+    case STREAM_MODE_THREADS:
+    default:
+      // A thread per client, or a fixed number of them with -w
+      if (opts->workers > 0) 
+      {
+        accept_forever_pool(server_sd, opts->workers, opts->queue_size, opts->pool_full,
+            opts->stats_interval);
+      } 
+      else 
+      {
+        accept_forever(server_sd);
+      }
+  }
+}
@@ -1,6 +1,43 @@
 #ifndef STREAM_SERVER_CORE_H
 #define STREAM_SERVER_CORE_H
 
+#include "epoll_server_core.h"
+
+// Concurrency model of the stream servers, selected at startup with '-m threads|epoll|uring'
+typedef enum {
+  STREAM_MODE_THREADS, // A thread per client (accept_forever)
+  STREAM_MODE_EPOLL,   // Edge-triggered epoll event loops (accept_forever_epoll/_reactors)
+  STREAM_MODE_URING    // A single io_uring loop, or epoll without io_uring (accept_forever_uring)
+} stream_mode_t;
+
+// What the thread pool does with a new client when its queue is full (-f wait|close)
+typedef enum {
+  POOL_FULL_WAIT,  // Stop accepting until a worker takes a client from the queue
+  POOL_FULL_CLOSE  // Close the new connection
+} pool_full_t;
+
+// Options of the stream servers, common to the TCP and Unix servers
+struct stream_options_t {
+  stream_mode_t mode;
+  int reactors;        // Number of event loops in epoll mode (-r N)
+  balance_t balance;   // Distribution of the connections among the event loops (-l rr|lc)
+  int stats_interval;  // Seconds between reports of the counters of the loops (-i N, 0 = never)
+  int workers;         // Worker threads in threads mode (-w N, 0 = a new thread per client)
+  int queue_size;      // Clients that can wait for a worker (-q N)
+  pool_full_t pool_full; // What to do with a new client when the queue is full (-f wait|close)
+  int exec_threads;    // Threads that evaluate the requests in epoll mode (-x N, 0 = the loops)
+  const char* stats_path; // Unix socket that serves the counters (-S path, NULL = none)
+  int trace_every;     // Reads per sampled read of the tracing (-T N, 0 = no tracing)
+  const char* mem_register; // Register shared by the memory methods (-M name, NULL = per client)
+  long cache_slots;    // Results kept by the cache of results (-C N, 0 = no cache)
+};
+
+void stream_options_parse(struct stream_options_t* opts, int argc, char** argv);
+
+void serve_client(int client_sd);
 void accept_forever(int server_sd);
+void accept_forever_pool(int server_sd, int workers, int queue_size, pool_full_t full,
+    int stats_interval);
+void serve_stream(int server_sd, const struct stream_options_t* opts);
 
 #endif
@@ -0,0 +1,96 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cmocka.h>
+
+#include <common_server_core.h>
+#include <datagram_server_core.h>
+
+int server_sd;
+int client_sd;
+
+struct sockaddr* sockaddr_new() {
+  return malloc(sizeof(struct sockaddr_in));
+}
+
+socklen_t sockaddr_sizeof() {
+  return sizeof(struct sockaddr_in);
+}
+
+void* serve_loop(void* arg) {
+  serve_forever(server_sd);
+  return NULL;
+}
+
+void* serve_loop_batched(void* arg) {
+  serve_forever_batched(server_sd, 8);
+  return NULL;
+}
+
+// Send a datagram and wait for its response
+void exchange(const char* req, const char* expected) {
+  assert_int_equal(send(client_sd, req, strlen(req), 0), strlen(req));
+  char resp[64];
+  int len = recv(client_sd, resp, sizeof(resp) - 1, 0);
+  assert_true(len > 0);
+  resp[len] = '\0';
+  assert_string_equal(resp, expected);
+}
+
+void check_register_kept(void* (*serve)(void*)) {
+  // The server runs until the end of the process
+  pthread_t server;
+  pthread_create(&server, NULL, serve, NULL);
+  pthread_detach(server);
+
+  // Every datagram has its own context, the register keeps the total of all of them
+  exchange("1#RESMEM#0#0$", "1#0#0$");
+  exchange("2#ADDM#5#0$", "2#0#5$");
+  exchange("3#ADDM#5#0$", "3#0#10$");
+  exchange("4#GETMEM#0#0$", "4#0#10$");
+}
+
+void datagram_server__shared_register(void** state) {
+  check_register_kept(serve_loop);
+}
+
+void datagram_server__shared_register_batched(void** state) {
+  check_register_kept(serve_loop_batched);
+}
+
+int setup(void** state) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  server_sd = socket(AF_INET, SOCK_DGRAM, 0);
+  assert_int_equal(bind(server_sd, (struct sockaddr*)&addr, sizeof(addr)), 0);
+  socklen_t addr_len = sizeof(addr);
+  getsockname(server_sd, (struct sockaddr*)&addr, &addr_len);
+  client_sd = socket(AF_INET, SOCK_DGRAM, 0);
+  assert_int_equal(connect(client_sd, (struct sockaddr*)&addr, sizeof(addr)), 0);
+  return 0;
+}
+
+int teardown(void** state) {
+  close(client_sd);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  assert_int_equal(share_mem_register("total"), 0);
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(datagram_server__shared_register, setup, teardown),
+    cmocka_unit_test_setup_teardown(datagram_server__shared_register_batched, setup, teardown)
+  };
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
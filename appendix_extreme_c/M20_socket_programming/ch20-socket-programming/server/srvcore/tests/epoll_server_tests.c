@@ -0,0 +1,111 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cmocka.h>
+
+#include <epoll_server_core.h>
+
+#define CLIENTS 8
+#define CONNECTIONS 200
+#define REQUESTS 256
+
+struct sockaddr_in server_addr;
+
+struct sockaddr* sockaddr_new() {
+  return malloc(sizeof(struct sockaddr_in));
+}
+
+socklen_t sockaddr_sizeof() {
+  return sizeof(struct sockaddr_in);
+}
+
+void* serve_loop(void* arg) {
+  // Two reactors and an executor, the completions of a reactor close the connections of others
+  accept_forever_reactors(*(int*)arg, 2, BALANCE_ROUND_ROBIN, 0, 4);
+  return NULL;
+}
+
+int connect_server() {
+  int sd = socket(AF_INET, SOCK_STREAM, 0);
+  assert_true(sd >= 0);
+  assert_int_equal(connect(sd, (struct sockaddr*)&server_addr, sizeof(server_addr)), 0);
+  return sd;
+}
+
+// Send many requests and reset the connection (SO_LINGER with 0 seconds sends a RST) while the
+// executor still has some of them
+void* reset_loop(void* arg) {
+  char* msgs = (char*)malloc(REQUESTS * 32);
+  int len = 0;
+  for (int i = 0; i < REQUESTS; i++) {
+    len += sprintf(msgs + len, "%d#ADD#%d#1$", i, i);
+  }
+  for (int i = 0; i < CONNECTIONS; i++) {
+    int sd = connect_server();
+    send(sd, msgs, len, MSG_NOSIGNAL);
+    if (i % 2) {
+      char buffer[64];
+      recv(sd, buffer, sizeof(buffer), 0);
+    }
+    struct linger linger = {1, 0};
+    setsockopt(sd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    close(sd);
+  }
+  free(msgs);
+  return NULL;
+}
+
+void epoll_server__clients_reset(void** state) {
+  int listen_sd = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  server_addr.sin_port = 0;
+  assert_int_equal(bind(listen_sd, (struct sockaddr*)&server_addr, sizeof(server_addr)), 0);
+  socklen_t addr_len = sizeof(server_addr);
+  getsockname(listen_sd, (struct sockaddr*)&server_addr, &addr_len);
+  assert_int_equal(listen(listen_sd, 128), 0);
+
+  // The server runs until the end of the process
+  pthread_t server;
+  pthread_create(&server, NULL, serve_loop, &listen_sd);
+  pthread_detach(server);
+
+  pthread_t clients[CLIENTS];
+  for (int i = 0; i < CLIENTS; i++) {
+    pthread_create(&clients[i], NULL, reset_loop, NULL);
+  }
+  for (int i = 0; i < CLIENTS; i++) {
+    pthread_join(clients[i], NULL);
+  }
+
+  // The server is still alive and answers
+  int sd = connect_server();
+  char req[] = "7#MUL#6#7$";
+  assert_int_equal(send(sd, req, strlen(req), MSG_NOSIGNAL), strlen(req));
+  char resp[64];
+  int len = 0;
+  while (len == 0 || resp[len - 1] != '$') {
+    int ret = recv(sd, resp + len, sizeof(resp) - 1 - len, 0);
+    assert_true(ret > 0);
+    len += ret;
+  }
+  resp[len] = '\0';
+  assert_string_equal(resp, "7#0#42$");
+  close(sd);
+}
+
+int main(int argc, char** argv) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(epoll_server__clients_reset)
+  };
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,179 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <cmocka.h>
+
+#include <ws_deque.h>
+#include <executor.h>
+
+#define TASKS 100000
+#define THIEVES 3
+
+struct ws_deque_t* deque = NULL;
+struct task_t tasks[TASKS];
+
+void ws_deque__owner_is_lifo(void** state) {
+  ws_deque_ctor(deque, 8);
+  assert_null(ws_deque_take(deque));
+  for (int i = 0; i < 3; i++) {
+    assert_int_equal(ws_deque_push(deque, &tasks[i]), 0);
+  }
+  assert_int_equal(ws_deque_size(deque), 3);
+  assert_ptr_equal(ws_deque_take(deque), &tasks[2]);
+  assert_ptr_equal(ws_deque_take(deque), &tasks[1]);
+  assert_ptr_equal(ws_deque_take(deque), &tasks[0]);
+  assert_null(ws_deque_take(deque));
+  ws_deque_dtor(deque);
+}
+
+void ws_deque__thieves_are_fifo(void** state) {
+  ws_deque_ctor(deque, 8);
+  assert_null(ws_deque_steal(deque));
+  for (int i = 0; i < 3; i++) {
+    assert_int_equal(ws_deque_push(deque, &tasks[i]), 0);
+  }
+  assert_ptr_equal(ws_deque_steal(deque), &tasks[0]);
+  assert_ptr_equal(ws_deque_take(deque), &tasks[2]);
+  assert_ptr_equal(ws_deque_steal(deque), &tasks[1]);
+  assert_null(ws_deque_steal(deque));
+  assert_null(ws_deque_take(deque));
+  ws_deque_dtor(deque);
+}
+
+void ws_deque__full(void** state) {
+  ws_deque_ctor(deque, 4);
+  for (int i = 0; i < 4; i++) {
+    assert_int_equal(ws_deque_push(deque, &tasks[i]), 0);
+  }
+  assert_int_equal(ws_deque_push(deque, &tasks[4]), -1);
+  assert_ptr_equal(ws_deque_steal(deque), &tasks[0]);
+  assert_int_equal(ws_deque_push(deque, &tasks[4]), 0);
+  ws_deque_dtor(deque);
+}
+
+atomic_int taken[TASKS];
+atomic_int done;
+
+void* thief(void* arg) {
+  while (!atomic_load(&done)) {
+    struct task_t* task = ws_deque_steal(deque);
+    if (task) {
+      atomic_fetch_add(&taken[task - tasks], 1);
+    } else {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+void ws_deque__concurrent(void** state) {
+  ws_deque_ctor(deque, 64);
+  atomic_init(&done, 0);
+  for (int i = 0; i < TASKS; i++) {
+    atomic_init(&taken[i], 0);
+  }
+  pthread_t thieves[THIEVES];
+  for (int i = 0; i < THIEVES; i++) {
+    pthread_create(&thieves[i], NULL, thief, NULL);
+  }
+
+  // The owner pushes everything and takes some, the thieves take the rest
+  for (int i = 0; i < TASKS; i++) {
+    while (ws_deque_push(deque, &tasks[i]) == -1) {
+      sched_yield();
+    }
+    if (i % 3 == 0) {
+      struct task_t* task = ws_deque_take(deque);
+      if (task) {
+        atomic_fetch_add(&taken[task - tasks], 1);
+      }
+    }
+  }
+  struct task_t* task;
+  while ((task = ws_deque_take(deque))) {
+    atomic_fetch_add(&taken[task - tasks], 1);
+  }
+  atomic_store(&done, 1);
+  for (int i = 0; i < THIEVES; i++) {
+    pthread_join(thieves[i], NULL);
+  }
+
+  // Every task was taken exactly once
+  for (int i = 0; i < TASKS; i++) {
+    assert_int_equal(atomic_load(&taken[i]), 1);
+  }
+  ws_deque_dtor(deque);
+}
+
+// Task that counts its runs, and submits its children (a tree of tasks)
+struct counted_task_t {
+  struct task_t task;
+  struct executor_t* exec;
+  int depth;
+};
+
+atomic_int runs;
+
+void counted_task_run(struct task_t* task) {
+  struct counted_task_t* counted = (struct counted_task_t*)task;
+  atomic_fetch_add(&runs, 1);
+  if (counted->depth > 0) {
+    for (int i = 0; i < 2; i++) {
+      struct counted_task_t* child = (struct counted_task_t*)malloc(sizeof(struct counted_task_t));
+      child->task.run = counted_task_run;
+      child->exec = counted->exec;
+      child->depth = counted->depth - 1;
+      executor_submit(counted->exec, &child->task);
+    }
+  }
+  free(counted);
+}
+
+void executor__runs_every_task(void** state) {
+  struct executor_t* exec = executor_new();
+  executor_ctor(exec, 4);
+  atomic_init(&runs, 0);
+
+  // 16 trees of 2^11 - 1 tasks, submitted from a thread that isn't a worker
+  for (int i = 0; i < 16; i++) {
+    struct counted_task_t* root = (struct counted_task_t*)malloc(sizeof(struct counted_task_t));
+    root->task.run = counted_task_run;
+    root->exec = exec;
+    root->depth = 10;
+    executor_submit(exec, &root->task);
+  }
+  while (atomic_load(&runs) < 16 * 2047) {
+    usleep(1000);
+  }
+  executor_dtor(exec);
+  executor_delete(exec);
+  assert_int_equal(atomic_load(&runs), 16 * 2047);
+}
+
+int setup(void** state) {
+  deque = ws_deque_new();
+  return 0;
+}
+
+int teardown(void** state) {
+  ws_deque_delete(deque);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(ws_deque__owner_is_lifo, setup, teardown),
+    cmocka_unit_test_setup_teardown(ws_deque__thieves_are_fifo, setup, teardown),
+    cmocka_unit_test_setup_teardown(ws_deque__full, setup, teardown),
+    cmocka_unit_test_setup_teardown(ws_deque__concurrent, setup, teardown),
+    cmocka_unit_test(executor__runs_every_task)
+  };
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
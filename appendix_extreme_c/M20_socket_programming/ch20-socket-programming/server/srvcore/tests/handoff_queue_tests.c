@@ -0,0 +1,169 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <cmocka.h>
+
+#include <handoff_queue.h>
+
+#define PRODUCERS 4
+#define CONSUMERS 4
+#define ITEMS_PER_PRODUCER 50000
+
+struct handoff_queue_t* queue = NULL;
+
+void handoff_queue__capacity(void** state) {
+  handoff_queue_ctor(queue, 100);
+  assert_int_equal(handoff_queue_capacity(queue), 128);
+  handoff_queue_dtor(queue);
+  handoff_queue_ctor(queue, 64);
+  assert_int_equal(handoff_queue_capacity(queue), 64);
+  handoff_queue_dtor(queue);
+}
+
+void handoff_queue__fifo(void** state) {
+  handoff_queue_ctor(queue, 8);
+  int fd = -1;
+  assert_int_equal(handoff_queue_pop(queue, &fd), -1);
+  for (int i = 0; i < 5; i++) {
+    assert_int_equal(handoff_queue_push(queue, i), 0);
+  }
+  assert_int_equal(handoff_queue_size(queue), 5);
+  for (int i = 0; i < 5; i++) {
+    assert_int_equal(handoff_queue_pop(queue, &fd), 0);
+    assert_int_equal(fd, i);
+  }
+  assert_int_equal(handoff_queue_pop(queue, &fd), -1);
+  assert_int_equal(handoff_queue_size(queue), 0);
+  handoff_queue_dtor(queue);
+}
+
+void handoff_queue__full(void** state) {
+  handoff_queue_ctor(queue, 4);
+  for (int i = 0; i < 4; i++) {
+    assert_int_equal(handoff_queue_push(queue, i), 0);
+  }
+  assert_int_equal(handoff_queue_push(queue, 4), -1);
+
+  // A pop makes room for exactly one more
+  int fd = -1;
+  assert_int_equal(handoff_queue_pop(queue, &fd), 0);
+  assert_int_equal(fd, 0);
+  assert_int_equal(handoff_queue_push(queue, 4), 0);
+  assert_int_equal(handoff_queue_push(queue, 5), -1);
+  handoff_queue_dtor(queue);
+}
+
+void handoff_queue__many_laps(void** state) {
+  handoff_queue_ctor(queue, 4);
+  int fd = -1;
+  for (int i = 0; i < 1000; i++) {
+    assert_int_equal(handoff_queue_push(queue, i), 0);
+    assert_int_equal(handoff_queue_push(queue, i + 1), 0);
+    assert_int_equal(handoff_queue_pop(queue, &fd), 0);
+    assert_int_equal(fd, i);
+    assert_int_equal(handoff_queue_pop(queue, &fd), 0);
+    assert_int_equal(fd, i + 1);
+  }
+  handoff_queue_dtor(queue);
+}
+
+atomic_int consumed;
+atomic_int seen[PRODUCERS * ITEMS_PER_PRODUCER];
+
+void* producer(void* arg) {
+  int base = *(int*)arg * ITEMS_PER_PRODUCER;
+  for (int i = 0; i < ITEMS_PER_PRODUCER; i++) {
+    // The queue is full, let the consumers run (the machine can have a single core)
+    while (handoff_queue_push(queue, base + i) == -1) {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+void* consumer(void* arg) {
+  // Every producer pushes its values in order, so a consumer sees them in order too
+  int last[PRODUCERS];
+  int* disorder = (int*)arg;
+  for (int i = 0; i < PRODUCERS; i++) {
+    last[i] = -1;
+  }
+  while (atomic_load(&consumed) < PRODUCERS * ITEMS_PER_PRODUCER) {
+    int fd;
+    if (handoff_queue_pop(queue, &fd) == -1) {
+      sched_yield();
+      continue;
+    }
+    atomic_fetch_add(&seen[fd], 1);
+    atomic_fetch_add(&consumed, 1);
+    int p = fd / ITEMS_PER_PRODUCER;
+    if (fd <= last[p]) {
+      (*disorder)++;
+    }
+    last[p] = fd;
+  }
+  return NULL;
+}
+
+void handoff_queue__concurrent(void** state) {
+  handoff_queue_ctor(queue, 64);
+  atomic_init(&consumed, 0);
+  for (int i = 0; i < PRODUCERS * ITEMS_PER_PRODUCER; i++) {
+    atomic_init(&seen[i], 0);
+  }
+
+  pthread_t producers[PRODUCERS];
+  pthread_t consumers[CONSUMERS];
+  int ids[PRODUCERS];
+  int disorder[CONSUMERS];
+  for (int i = 0; i < CONSUMERS; i++) {
+    disorder[i] = 0;
+    pthread_create(&consumers[i], NULL, consumer, &disorder[i]);
+  }
+  for (int i = 0; i < PRODUCERS; i++) {
+    ids[i] = i;
+    pthread_create(&producers[i], NULL, producer, &ids[i]);
+  }
+  for (int i = 0; i < PRODUCERS; i++) {
+    pthread_join(producers[i], NULL);
+  }
+  for (int i = 0; i < CONSUMERS; i++) {
+    pthread_join(consumers[i], NULL);
+    assert_int_equal(disorder[i], 0);
+  }
+
+  // Every value was taken exactly once
+  for (int i = 0; i < PRODUCERS * ITEMS_PER_PRODUCER; i++) {
+    assert_int_equal(atomic_load(&seen[i]), 1);
+  }
+  int fd;
+  assert_int_equal(handoff_queue_pop(queue, &fd), -1);
+  handoff_queue_dtor(queue);
+}
+
+int setup(void** state) {
+  queue = handoff_queue_new();
+  return 0;
+}
+
+int teardown(void** state) {
+  handoff_queue_delete(queue);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(handoff_queue__capacity, setup, teardown),
+    cmocka_unit_test_setup_teardown(handoff_queue__fifo, setup, teardown),
+    cmocka_unit_test_setup_teardown(handoff_queue__full, setup, teardown),
+    cmocka_unit_test_setup_teardown(handoff_queue__many_laps, setup, teardown),
+    cmocka_unit_test_setup_teardown(handoff_queue__concurrent, setup, teardown)
+  };
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,150 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <cmocka.h>
+
+#include <calc_proto_ser.h>
+#include <server_stats.h>
+
+#define THREADS 4
+#define ADDS_PER_THREAD 10000
+#define SOCK_FILE "/tmp/server_stats_tests.sock"
+
+struct server_stats_t* total = NULL;
+
+// The counters of all the threads, zeroed first
+struct server_stats_t* sum() {
+  memset(total, 0, sizeof(struct server_stats_t));
+  server_stats_sum(total);
+  return total;
+}
+
+long timed(stats_time_t time) {
+  long count = 0;
+  for (int i = 0; i < STATS_TIME_BUCKETS; i++) {
+    count += atomic_load(&total->times[time][i]);
+  }
+  return count;
+}
+
+void server_stats__buckets(void** state) {
+  assert_int_equal(server_stats_bucket(-5), 0);
+  assert_int_equal(server_stats_bucket(7), 7);
+  assert_int_equal(server_stats_bucket(100000000000L), STATS_TIME_BUCKETS - 1);
+
+  // The buckets keep the order of the times, and their value is close to the times they have
+  int last = 0;
+  for (long ns = 1; ns < 10000000000L; ns = ns * 5 / 4 + 1) {
+    int bucket = server_stats_bucket(ns);
+    assert_true(bucket >= last);
+    long value = server_stats_bucket_value(bucket);
+    assert_true(labs(value - ns) <= ns / STATS_SUB_BUCKETS + 1);
+    last = bucket;
+  }
+}
+
+void* add_loop(void* arg) {
+  struct server_stats_t* stats = server_stats_thread();
+  for (int i = 0; i < ADDS_PER_THREAD; i++) {
+    server_stats_add(&stats->requests[ADD], 1);
+    server_stats_add(&stats->bytes_in, 10);
+  }
+  return NULL;
+}
+
+void run_threads() {
+  pthread_t threads[THREADS];
+  for (int i = 0; i < THREADS; i++) {
+    pthread_create(&threads[i], NULL, add_loop, NULL);
+  }
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+}
+
+void server_stats__sums_threads(void** state) {
+  long adds = atomic_load(&sum()->requests[ADD]);
+  long bytes = atomic_load(&total->bytes_in);
+
+  // The blocks of the threads that ended keep their counts for the next threads
+  run_threads();
+  run_threads();
+  assert_int_equal(atomic_load(&sum()->requests[ADD]) - adds, 2 * THREADS * ADDS_PER_THREAD);
+  assert_int_equal(atomic_load(&total->bytes_in) - bytes, 2 * THREADS * ADDS_PER_THREAD * 10);
+}
+
+void server_stats__samples_reads(void** state) {
+  sum();
+  long decodes = timed(STATS_TIME_DECODE);
+  long services = timed(STATS_TIME_SERVICE);
+  long writes = timed(STATS_TIME_WRITE);
+
+  // Only one read of every STATS_SAMPLE_EVERY is timed, and the service only if it evaluated
+  struct server_stats_t* stats = server_stats_thread();
+  for (int i = 0; i < 4 * STATS_SAMPLE_EVERY; i++) {
+    server_stats_read_begin(stats);
+    if (stats->timing && i < 2 * STATS_SAMPLE_EVERY) {
+      stats->service_ns += 1000;
+    }
+    server_stats_read_decoded(stats);
+    server_stats_read_end(stats);
+  }
+  sum();
+  assert_int_equal(timed(STATS_TIME_DECODE) - decodes, 4);
+  assert_int_equal(timed(STATS_TIME_SERVICE) - services, 2);
+  assert_int_equal(timed(STATS_TIME_WRITE) - writes, 4);
+}
+
+void server_stats__serves_socket(void** state) {
+  server_stats_add(&server_stats_thread()->requests[DIV], 3);
+  assert_int_equal(server_stats_serve(SOCK_FILE), 0);
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, SOCK_FILE, sizeof(addr.sun_path) - 1);
+  int sd = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert_int_equal(connect(sd, (struct sockaddr*)&addr, sizeof(addr)), 0);
+
+  // The server closes the connection after the counters
+  char text[4096];
+  int len = 0;
+  int ret;
+  while ((ret = read(sd, text + len, sizeof(text) - 1 - len)) > 0) {
+    len += ret;
+  }
+  text[len] = '\0';
+  close(sd);
+  unlink(SOCK_FILE);
+  assert_non_null(strstr(text, "connections: "));
+  assert_non_null(strstr(text, " DIV "));
+  assert_non_null(strstr(text, "decode: "));
+  assert_non_null(strstr(text, "write: "));
+}
+
+int setup(void** state) {
+  total = (struct server_stats_t*)malloc(sizeof(struct server_stats_t));
+  return 0;
+}
+
+int teardown(void** state) {
+  free(total);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(server_stats__buckets, setup, teardown),
+    cmocka_unit_test_setup_teardown(server_stats__sums_threads, setup, teardown),
+    cmocka_unit_test_setup_teardown(server_stats__samples_reads, setup, teardown),
+    cmocka_unit_test_setup_teardown(server_stats__serves_socket, setup, teardown)
+  };
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,151 @@
+#define _GNU_SOURCE // open_memstream
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <calc_proto_ser.h>
+#include <calc_service.h>
+#include <common_server_core.h>
+#include <server_trace.h>
+
+struct client_context_t context;
+struct trace_span_t* spans = NULL;
+int written = 0;
+
+void count_resp(struct client_context_t* context, struct calc_proto_resp_t* resp) {
+  written++;
+}
+
+// The spans of the ring of the calling thread
+int collect() {
+  struct trace_ring_t* ring = atomic_load(&server_stats_thread()->trace);
+  assert_non_null(ring);
+  return server_trace_collect(ring, spans);
+}
+
+void server_trace__samples_every(void** state) {
+  server_trace_enable(4);
+  int sampled = 0;
+  for (int i = 0; i < 4 * 10; i++) {
+    server_trace_read(&context.trace, 1);
+    sampled += context.trace.state == TRACE_SAMPLED;
+
+    // A read without requests doesn't keep the sample
+    server_trace_flushed(&context.trace, 1);
+    assert_int_equal(context.trace.state, TRACE_IDLE);
+  }
+  assert_int_equal(sampled, 10);
+
+  server_trace_enable(0);
+  server_trace_read(&context.trace, 1);
+  assert_int_equal(context.trace.state, TRACE_IDLE);
+}
+
+void server_trace__follows_request(void** state) {
+  server_trace_enable(1);
+  server_trace_read(&context.trace, 42);
+  assert_int_equal(context.trace.state, TRACE_SAMPLED);
+
+  // The first request of the read is traced through the callbacks of the server
+  struct calc_proto_req_t reqs[3];
+  for (int i = 0; i < 3; i++) {
+    reqs[i].id = 10 + i;
+    reqs[i].method = i == 0 ? MUL : ADD;
+    reqs[i].operand1 = i;
+    reqs[i].operand2 = 2;
+  }
+  request_batch_callback(&context, reqs, 3);
+  assert_int_equal(written, 3);
+  assert_int_equal(context.trace.state, TRACE_SERIALIZED);
+
+  // Only a complete write finishes the span
+  server_trace_flushed(&context.trace, 0);
+  assert_int_equal(context.trace.state, TRACE_SERIALIZED);
+  server_trace_flushed(&context.trace, 1);
+  assert_int_equal(context.trace.state, TRACE_IDLE);
+
+  int count = collect();
+  assert_true(count > 0);
+  struct trace_span_t* span = &spans[count - 1];
+  assert_int_equal(span->req_id, 10);
+  assert_int_equal(span->method, MUL);
+  assert_int_equal(span->conn, 42);
+  for (int i = 1; i < TRACE_STAMPS; i++) {
+    assert_true(span->stamps[i] >= span->stamps[i - 1]);
+  }
+  assert_true(span->stamps[TRACE_READ] > 0);
+  server_trace_enable(0);
+}
+
+void server_trace__ring_keeps_last(void** state) {
+  struct trace_span_t span;
+  memset(&span, 0, sizeof(span));
+  for (int i = 0; i < TRACE_RING_SIZE + 10; i++) {
+    span.req_id = 1000 + i;
+    span.method = ADD;
+    span.conn = 1;
+    server_trace_commit(&span);
+  }
+  assert_int_equal(collect(), TRACE_RING_SIZE);
+  assert_int_equal(spans[0].req_id, 1010);
+  assert_int_equal(spans[TRACE_RING_SIZE - 1].req_id, 1000 + TRACE_RING_SIZE + 9);
+
+  // A span being written overwrites the oldest one, which is left out
+  struct trace_ring_t* ring = atomic_load(&server_stats_thread()->trace);
+  atomic_fetch_add(&ring->started, 1);
+  assert_int_equal(collect(), TRACE_RING_SIZE - 1);
+  assert_int_equal(spans[0].req_id, 1011);
+  atomic_fetch_sub(&ring->started, 1);
+}
+
+void server_trace__prints_chrome_json(void** state) {
+  struct trace_span_t span;
+  memset(&span, 0, sizeof(span));
+  span.req_id = 77;
+  span.method = DIV;
+  server_trace_commit(&span);
+
+  char* text = NULL;
+  size_t len = 0;
+  FILE* out = open_memstream(&text, &len);
+  server_trace_print(out);
+  fclose(out);
+  assert_int_equal(strncmp(text, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 39), 0);
+  assert_non_null(strstr(text, "\"name\":\"service\""));
+  assert_non_null(strstr(text, "\"id\":77,\"method\":\"DIV\""));
+  assert_string_equal(text + len - 3, "]}\n");
+  free(text);
+}
+
+int setup(void** state) {
+  memset(&context, 0, sizeof(context));
+  context.svc = calc_service_new();
+  calc_service_ctor(context.svc);
+  context.write_resp = &count_resp;
+  context.trace.state = TRACE_IDLE;
+  spans = (struct trace_span_t*)malloc(TRACE_RING_SIZE * sizeof(struct trace_span_t));
+  written = 0;
+  return 0;
+}
+
+int teardown(void** state) {
+  calc_service_dtor(context.svc);
+  calc_service_delete(context.svc);
+  free(spans);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(server_trace__samples_every, setup, teardown),
+    cmocka_unit_test_setup_teardown(server_trace__follows_request, setup, teardown),
+    cmocka_unit_test_setup_teardown(server_trace__ring_keeps_last, setup, teardown),
+    cmocka_unit_test_setup_teardown(server_trace__prints_chrome_json, setup, teardown)
+  };
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,103 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <cmocka.h>
+
+#include <stream_server_core.h>
+
+#define REQUESTS 50000
+
+int sv[2];
+
+void* serve_loop(void* arg) {
+  serve_client(sv[1]);
+  return NULL;
+}
+
+// Send all the requests without reading any response
+void* send_loop(void* arg) {
+  char msg[64];
+  for (int i = 0; i < REQUESTS; i++) {
+    int len = sprintf(msg, "%d#ADD#%d#1$", i, i);
+    int sent = 0;
+    while (sent < len) {
+      int ret = send(sv[0], msg + sent, len - sent, MSG_NOSIGNAL);
+      if (ret <= 0) {
+        return NULL;
+      }
+      sent += ret;
+    }
+  }
+  return NULL;
+}
+
+void stream_server__slow_client(void** state) {
+  // The server can't send all the responses at once, and the client reads them late
+  int sndbuf = 4096;
+  setsockopt(sv[1], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+  pthread_t server, sender;
+  pthread_create(&server, NULL, serve_loop, NULL);
+  pthread_create(&sender, NULL, send_loop, NULL);
+  usleep(100000);
+
+  // All the responses arrive, in order
+  char buffer[4096];
+  int next = 0;
+  int id = 0;
+  int field = 0;
+  while (next < REQUESTS) {
+    int ret = read(sv[0], buffer, sizeof(buffer));
+    assert_true(ret > 0);
+    for (int i = 0; i < ret; i++) {
+      char c = buffer[i];
+      if (c == '$') {
+        assert_int_equal(id, next);
+        next++;
+        id = 0;
+        field = 0;
+      } else if (c == '#') {
+        field++;
+      } else if (field == 0) {
+        id = id * 10 + c - '0';
+      }
+    }
+  }
+  pthread_join(sender, NULL);
+  shutdown(sv[0], SHUT_WR);
+  pthread_join(server, NULL);
+}
+
+void stream_server__client_leaves(void** state) {
+  // The client leaves without reading its responses, only its connection ends
+  pthread_t server, sender;
+  pthread_create(&server, NULL, serve_loop, NULL);
+  pthread_create(&sender, NULL, send_loop, NULL);
+  usleep(50000);
+  shutdown(sv[0], SHUT_RDWR);
+  pthread_join(sender, NULL);
+  pthread_join(server, NULL);
+}
+
+int setup(void** state) {
+  assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  return 0;
+}
+
+int teardown(void** state) {
+  close(sv[0]);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(stream_server__slow_client, setup, teardown),
+    cmocka_unit_test_setup_teardown(stream_server__client_leaves, setup, teardown)
+  };
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
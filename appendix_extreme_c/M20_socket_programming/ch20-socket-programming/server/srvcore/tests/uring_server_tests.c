@@ -0,0 +1,237 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <cmocka.h>
+
+#include <calc_proto_ser.h>
+#include <uring_server_core.h>
+
+#define REQUESTS 20000
+#define CLIENTS 8
+#define CONNECTIONS 200
+#define RESET_REQUESTS 256
+
+struct sockaddr_in server_addr;
+atomic_int uring_blocked;
+
+struct sockaddr* sockaddr_new() {
+  return malloc(sizeof(struct sockaddr_in));
+}
+
+socklen_t sockaddr_sizeof() {
+  return sizeof(struct sockaddr_in);
+}
+
+void* serve_loop(void* arg) {
+  accept_forever_uring(*(int*)arg);
+  return NULL;
+}
+
+// The filter only applies to this thread: io_uring_setup fails with ENOSYS, as in the kernels
+// without io_uring or in the containers that forbid it
+void* serve_loop_without_uring(void* arg) {
+  struct sock_filter filter[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_io_uring_setup, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | ENOSYS),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW)
+  };
+  struct sock_fprog prog = {sizeof(filter) / sizeof(filter[0]), filter};
+  prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+  prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog);
+  atomic_store(&uring_blocked, syscall(__NR_io_uring_setup, 8, NULL) == -1 && errno == ENOSYS);
+  accept_forever_uring(*(int*)arg);
+  return NULL;
+}
+
+// Listen on an ephemeral port of the loopback, the server runs until the end of the process
+void start_server(void* (*loop)(void*)) {
+  static int listen_sds[8];
+  static int servers = 0;
+  int* listen_sd = &listen_sds[servers++];
+  *listen_sd = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  server_addr.sin_port = 0;
+  assert_int_equal(bind(*listen_sd, (struct sockaddr*)&server_addr, sizeof(server_addr)), 0);
+  socklen_t addr_len = sizeof(server_addr);
+  getsockname(*listen_sd, (struct sockaddr*)&server_addr, &addr_len);
+  assert_int_equal(listen(*listen_sd, 128), 0);
+  pthread_t server;
+  pthread_create(&server, NULL, loop, listen_sd);
+  pthread_detach(server);
+}
+
+int connect_server() {
+  int sd = socket(AF_INET, SOCK_STREAM, 0);
+  assert_true(sd >= 0);
+  assert_int_equal(connect(sd, (struct sockaddr*)&server_addr, sizeof(server_addr)), 0);
+
+  // A server that stops answering fails the test instead of blocking it
+  struct timeval timeout = {10, 0};
+  setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  return sd;
+}
+
+struct sender_t {
+  int sd;
+  char* msgs;
+  int len;
+};
+
+// Send all the requests without reading any response
+void* send_loop(void* arg) {
+  struct sender_t* sender = (struct sender_t*)arg;
+  int sent = 0;
+  while (sent < sender->len) {
+    int ret = send(sender->sd, sender->msgs + sent, sender->len - sent, MSG_NOSIGNAL);
+    if (ret <= 0) {
+      return NULL;
+    }
+    sent += ret;
+  }
+  return NULL;
+}
+
+int next_resp;
+
+void resp_cb(void* obj, struct calc_proto_resp_t resp) {
+  // The responses arrive in the order of the requests
+  assert_int_equal(resp.req_id, next_resp);
+  assert_int_equal(resp.status, STATUS_OK);
+  assert_int_equal((int)resp.result, resp.req_id + 1);
+  next_resp++;
+}
+
+// Send REQUESTS pipelined additions (i + 1) in the given mode, and check all the responses
+void exchange(calc_proto_mode_t mode) {
+  struct calc_proto_ser_t* ser = calc_proto_ser_new();
+  calc_proto_ser_ctor(ser, NULL, 4096);
+  calc_proto_ser_set_mode(ser, mode);
+  calc_proto_ser_set_resp_callback(ser, resp_cb);
+
+  struct sender_t sender;
+  sender.sd = connect_server();
+  sender.msgs = (char*)malloc(REQUESTS * CALC_PROTO_MAX_MSG_LEN + 1);
+  sender.len = 0;
+  if (mode == CALC_PROTO_BINARY) {
+    sender.msgs[sender.len++] = (char)CALC_PROTO_BINARY_HELLO;
+  }
+  for (int i = 0; i < REQUESTS; i++) {
+    struct calc_proto_req_t req;
+    req.id = i;
+    req.method = ADD;
+    req.operand1 = i;
+    req.operand2 = 1;
+    int len = calc_proto_ser_client_serialize_to(ser, &req, sender.msgs + sender.len,
+        CALC_PROTO_MAX_MSG_LEN);
+    assert_true(len > 0);
+    sender.len += len;
+  }
+  pthread_t thread;
+  pthread_create(&thread, NULL, send_loop, &sender);
+
+  char buffer[4096];
+  int hello = mode == CALC_PROTO_BINARY;
+  next_resp = 0;
+  while (next_resp < REQUESTS) {
+    int ret = recv(sender.sd, buffer, sizeof(buffer), 0);
+    assert_true(ret > 0);
+    struct buffer_t buf;
+    buf.data = buffer;
+    buf.len = ret;
+    if (hello) {
+      assert_int_equal((unsigned char)buffer[0], CALC_PROTO_BINARY_HELLO);
+      buf.data++;
+      buf.len--;
+      hello = 0;
+    }
+    calc_proto_ser_client_deserialize(ser, buf, NULL);
+  }
+  pthread_join(thread, NULL);
+  close(sender.sd);
+  free(sender.msgs);
+  calc_proto_ser_dtor(ser);
+  calc_proto_ser_delete(ser);
+}
+
+// Send many requests and reset the connection (SO_LINGER with 0 seconds sends a RST) while the
+// server still has responses to send
+void* reset_loop(void* arg) {
+  char* msgs = (char*)malloc(RESET_REQUESTS * 32);
+  int len = 0;
+  for (int i = 0; i < RESET_REQUESTS; i++) {
+    len += sprintf(msgs + len, "%d#ADD#%d#1$", i, i);
+  }
+  for (int i = 0; i < CONNECTIONS; i++) {
+    int sd = connect_server();
+    send(sd, msgs, len, MSG_NOSIGNAL);
+    if (i % 2) {
+      char buffer[64];
+      recv(sd, buffer, sizeof(buffer), 0);
+    }
+    struct linger linger = {1, 0};
+    setsockopt(sd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    close(sd);
+  }
+  free(msgs);
+  return NULL;
+}
+
+void uring_server__pipelined_text(void** state) {
+  start_server(serve_loop);
+  exchange(CALC_PROTO_TEXT);
+}
+
+void uring_server__pipelined_binary(void** state) {
+  start_server(serve_loop);
+  exchange(CALC_PROTO_BINARY);
+}
+
+void uring_server__clients_reset(void** state) {
+  start_server(serve_loop);
+  pthread_t clients[CLIENTS];
+  for (int i = 0; i < CLIENTS; i++) {
+    pthread_create(&clients[i], NULL, reset_loop, NULL);
+  }
+  for (int i = 0; i < CLIENTS; i++) {
+    pthread_join(clients[i], NULL);
+  }
+
+  // The server is still alive and answers
+  exchange(CALC_PROTO_TEXT);
+}
+
+void uring_server__epoll_fallback(void** state) {
+  atomic_init(&uring_blocked, 0);
+  start_server(serve_loop_without_uring);
+  exchange(CALC_PROTO_TEXT);
+  exchange(CALC_PROTO_BINARY);
+  assert_true(atomic_load(&uring_blocked));
+}
+
+int main(int argc, char** argv) {
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(uring_server__pipelined_text),
+    cmocka_unit_test(uring_server__pipelined_binary),
+    cmocka_unit_test(uring_server__clients_reset),
+    cmocka_unit_test(uring_server__epoll_fallback)
+  };
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
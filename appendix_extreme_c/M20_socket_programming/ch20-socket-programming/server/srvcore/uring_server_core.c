@@ -0,0 +1,652 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include <calc_proto_ser.h>
+#include <calc_service.h>
+
+#include "common_server_core.h"
+#include "epoll_server_core.h"
+#include "uring_server_core.h"
+#include "server_stats.h"
+
+/**
+ * The epoll loop still makes a system call for every operation: epoll_wait tells which sockets
+ * are ready, and then every socket needs its own read and send. io_uring turns it around, the
+ * operations themselves are queued in a ring shared with the kernel (the submission queue), and
+ * the kernel puts their results in another ring (the completion queue). A single io_uring_enter
+ * submits all the operations queued and waits for the results, whatever the number of clients.
+ *
+ * Three features keep the number of operations low:
+ *
+ * 1. Multishot accept: a single accept operation produces a completion for every new client, it
+ *    isn't submitted again per client.
+ * 2. Provided buffers: the reads don't reserve a buffer per connection, the kernel takes one of a
+ *    shared ring of buffers when the bytes arrive, and the loop gives it back once the requests
+ *    are parsed. An idle connection doesn't hold any buffer.
+ * 3. Linked operations: the send of the responses and the next read of the connection are
+ *    submitted together, linked, so the kernel starts the read only when the send is done. The
+ *    responses of a connection keep their order, and a client that doesn't take its responses
+ *    stops being read (the same backpressure as the epoll loop).
+ *
+ * There is no liburing here, the rings are set up with the raw system calls (io_uring_setup,
+ * io_uring_enter and io_uring_register) and mmap. If the kernel doesn't support io_uring (or it is
+ * disabled, which is common in containers), the server falls back to the epoll loop.
+ *
+ * This loop uses a single thread, see 'accept_forever_reactors' to use several cores.
+*/
+
+#define RING_ENTRIES 4096
+#define BUF_COUNT 1024      // Provided buffers of READ_BUFFER_SIZE bytes (power of two)
+#define BUF_GROUP 0
+#define MAX_CQES_PER_LOOP (RING_ENTRIES / 4)  // Every completion queues 2 operations at most
+
+// Operation of a completion, stored in the lowest bits of its user data (the rest is the pointer
+// to the connection, which is aligned)
+#define OP_ACCEPT 0
+#define OP_RECV 1
+#define OP_SEND 2
+#define OP_MASK 3
+
+// Client adress attributes only related with the socket descriptor
+struct client_addr_t
+{
+  int sd;
+};
+
+// Submission and completion rings mapped from the kernel, and the ring of provided buffers
+struct uring_t
+{
+  int fd;
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  struct io_uring_sqe* sqes;
+  unsigned sq_local_tail; // Tail including the entries not published to the kernel yet
+  unsigned to_submit;     // Entries queued since the last io_uring_enter
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe* cqes;
+  void* ring_ptr;
+  size_t ring_size;
+  size_t sqes_size;
+  struct io_uring_buf_ring* buf_ring;
+  unsigned short buf_tail;
+  char* bufs;
+  int listen_sd;
+};
+
+// State of a connection served by the ring
+struct uring_conn_t
+{
+  struct client_context_t context;
+  struct client_addr_t addr;
+  struct uring_t* ring;  // Ring that owns the connection
+  char* wbuf;            // Responses being sent (the kernel reads them until the send completes)
+  int wbuf_cap;
+  int wlen;              // Bytes to send in wbuf
+  int wsent;             // Bytes of wbuf already sent
+  unsigned send_seq;     // Position of the last send in the submission queue
+  int sending;           // A send is in progress, the kernel owns wbuf
+  int recv_armed;        // A read is in progress
+  int closed;            // The connection failed, it is released when no operation is pending
+  int shut;              // The socket was shut down to finish the pending operations
+};
+
+/**
+ * Wrappers of the io_uring system calls (glibc doesn't provide them)
+*/
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* params)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args)
+{
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * Give a provided buffer back to the kernel
+ *
+ * @param ring Ring that owns the buffers
+ * @param bid Identifier of the buffer
+*/
+static void uring_recycle_buf(struct uring_t* ring, unsigned short bid)
+{
+  struct io_uring_buf* buf = &ring->buf_ring->bufs[ring->buf_tail & (BUF_COUNT - 1)];
+  buf->addr = (uint64_t)(uintptr_t)(ring->bufs + (size_t)bid * READ_BUFFER_SIZE);
+  buf->len = READ_BUFFER_SIZE;
+  buf->bid = bid;
+  ring->buf_tail++;
+
+  // The kernel must see the buffer before the new tail
+  __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * Create the rings and register the provided buffers
+ *
+ * @param ring Ring to initialize
+ * @param listen_sd Listening socket
+ *
+ * @return 0 on success, -1 if io_uring can't be used (errno tells why)
+*/
+static int uring_ctor(struct uring_t* ring, int listen_sd)
+{
+  memset(ring, 0, sizeof(*ring));
+  ring->listen_sd = listen_sd;
+
+  // Only this thread submits, and the completions are processed when it waits for them. Older
+  // kernels don't know these flags, so they are dropped if the setup fails.
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN |
+      IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+  params.cq_entries = RING_ENTRIES * 4;
+  ring->fd = sys_io_uring_setup(RING_ENTRIES, &params);
+  if (ring->fd == -1 && errno == EINVAL)
+  {
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = RING_ENTRIES * 4;
+    ring->fd = sys_io_uring_setup(RING_ENTRIES, &params);
+  }
+  if (ring->fd == -1)
+  {
+    return -1;
+  }
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP))
+  {
+    close(ring->fd);
+    errno = ENOSYS;
+    return -1;
+  }
+
+  // Both rings are in the same mapping, the entries of the submission queue in another one
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+  ring->ring_ptr = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->ring_ptr == MAP_FAILED || ring->sqes == MAP_FAILED)
+  {
+    close(ring->fd);
+    return -1;
+  }
+
+  char* ptr = (char*)ring->ring_ptr;
+  ring->sq_head = (unsigned*)(ptr + params.sq_off.head);
+  ring->sq_tail = (unsigned*)(ptr + params.sq_off.tail);
+  ring->sq_mask = *(unsigned*)(ptr + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->sq_local_tail = *ring->sq_tail;
+  ring->cq_head = (unsigned*)(ptr + params.cq_off.head);
+  ring->cq_tail = (unsigned*)(ptr + params.cq_off.tail);
+  ring->cq_mask = *(unsigned*)(ptr + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)(ptr + params.cq_off.cqes);
+
+  // The entries are always used in order, so the indirection array is the identity
+  unsigned* array = (unsigned*)(ptr + params.sq_off.array);
+  for (unsigned i = 0; i < params.sq_entries; i++)
+  {
+    array[i] = i;
+  }
+
+  // Ring of provided buffers (the kernel reads the ring, so it is page aligned)
+  ring->buf_ring = (struct io_uring_buf_ring*)mmap(NULL,
+      BUF_COUNT * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring->buf_ring == MAP_FAILED)
+  {
+    close(ring->fd);
+    return -1;
+  }
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)ring->buf_ring;
+  reg.ring_entries = BUF_COUNT;
+  reg.bgid = BUF_GROUP;
+  if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+  {
+    // Kernels older than 5.19, they don't have multishot accept either
+    close(ring->fd);
+    return -1;
+  }
+  ring->bufs = (char*)malloc((size_t)BUF_COUNT * READ_BUFFER_SIZE);
+  for (unsigned short bid = 0; bid < BUF_COUNT; bid++)
+  {
+    uring_recycle_buf(ring, bid);
+  }
+  return 0;
+}
+
+/**
+ * Submit the operations queued (and run the completions pending)
+ *
+ * @param ring Ring
+ * @param wait Number of completions to wait for
+*/
+static void uring_submit(struct uring_t* ring, unsigned wait)
+{
+  // The entries must be written before the kernel sees the new tail
+  __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+  while (1)
+  {
+    int ret = sys_io_uring_enter(ring->fd, ring->to_submit, wait, IORING_ENTER_GETEVENTS);
+    if (ret >= 0)
+    {
+      ring->to_submit -= ret;
+      return;
+    }
+    if (errno == EINTR)
+    {
+      continue;
+    }
+
+    // The completion queue is full (the completions are kept by the kernel), they are processed
+    // first and the entries are submitted in the next call
+    if (errno == EBUSY || errno == EAGAIN)
+    {
+      return;
+    }
+    fprintf(stderr, "Could not submit to the ring: %s\n", strerror(errno));
+    exit(1);
+  }
+}
+
+/**
+ * Take a free entry of the submission queue (the queue is submitted first if it is full)
+ *
+ * @param ring Ring
+ *
+ * @return Entry, filled with zeros
+*/
+static struct io_uring_sqe* uring_get_sqe(struct uring_t* ring)
+{
+  while (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >=
+      ring->sq_entries)
+  {
+    uring_submit(ring, 0);
+  }
+  struct io_uring_sqe* sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sq_local_tail++;
+  ring->to_submit++;
+  return sqe;
+}
+
+/**
+ * Queue the multishot accept of the listening socket
+ *
+ * @param ring Ring
+*/
+static void uring_arm_accept(struct uring_t* ring)
+{
+  struct io_uring_sqe* sqe = uring_get_sqe(ring);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = ring->listen_sd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->user_data = OP_ACCEPT;
+}
+
+/**
+ * Queue a read of the connection into one of the provided buffers
+ *
+ * @param conn Connection
+*/
+static void uring_arm_recv(struct uring_conn_t* conn)
+{
+  struct io_uring_sqe* sqe = uring_get_sqe(conn->ring);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = conn->addr.sd;
+  sqe->len = READ_BUFFER_SIZE;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUF_GROUP;
+  sqe->user_data = (uint64_t)(uintptr_t)conn | OP_RECV;
+  conn->recv_armed = 1;
+}
+
+/**
+ * Queue the send of the rest of wbuf. With MSG_WAITALL the kernel retries the short sends by
+ * itself, so the completion means that everything was sent (or that the connection failed).
+ *
+ * @param conn Connection
+*/
+static void uring_submit_send(struct uring_conn_t* conn)
+{
+  struct io_uring_sqe* sqe = uring_get_sqe(conn->ring);
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = conn->addr.sd;
+  sqe->addr = (uint64_t)(uintptr_t)(conn->wbuf + conn->wsent);
+  sqe->len = conn->wlen - conn->wsent;
+  sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+  sqe->user_data = (uint64_t)(uintptr_t)conn | OP_SEND;
+  conn->send_seq = conn->ring->sq_local_tail - 1;
+  conn->sending = 1;
+}
+
+/**
+ * Send the responses of the output buffer. The buffer is given to the kernel (swapped with wbuf),
+ * so new responses can be written while it is sent. If a send is already in progress, the
+ * responses wait in the output buffer until it completes.
+ *
+ * @param context Pointer to the client context of the connection
+*/
+static void uring_flush_resps(struct client_context_t* context)
+{
+  struct uring_conn_t* conn = (struct uring_conn_t*)context;
+  if (conn->closed)
+  {
+    context->out_len = 0;
+    return;
+  }
+  if (conn->sending)
+  {
+    // The responses of the requests already read wait (the buffer grows if needed, see queue_resp)
+    return;
+  }
+  if (context->out_len == 0)
+  {
+    server_trace_flushed(&context->trace, 0);
+    return;
+  }
+
+  char* out = context->out;
+  int out_cap = context->out_cap;
+  context->out = conn->wbuf;
+  context->out_cap = conn->wbuf_cap;
+  conn->wbuf = out;
+  conn->wbuf_cap = out_cap;
+  conn->wlen = context->out_len;
+  conn->wsent = 0;
+  context->out_len = 0;
+  if (context->trace.state == TRACE_SERIALIZED)
+  {
+    context->trace.state = TRACE_SENDING;
+  }
+  uring_submit_send(conn);
+}
+
+/**
+ * Write a response in the output buffer of the connection
+ *
+ * @param context Pointer to the client context of the connection
+ * @param resp Pointer to response calculated
+*/
+static void uring_write_resp(struct client_context_t* context, struct calc_proto_resp_t* resp)
+{
+  struct uring_conn_t* conn = (struct uring_conn_t*)context;
+  if (queue_resp(context, resp) <= 0)
+  {
+    fprintf(stderr, "Internal error while serializing response\n");
+    conn->closed = 1;
+  }
+}
+
+/**
+ * Queue the next read of a connection if it isn't in progress. While a send is in progress the
+ * read is linked to it, or, if the send was already submitted, it is queued when the send
+ * completes.
+ *
+ * @param conn Connection
+*/
+static void uring_conn_rearm(struct uring_conn_t* conn)
+{
+  struct uring_t* ring = conn->ring;
+  if (conn->closed || conn->recv_armed)
+  {
+    return;
+  }
+  if (conn->sending)
+  {
+    // Only an entry not submitted yet can be linked, and the read must be the next entry
+    if (ring->to_submit == 0 || conn->send_seq != ring->sq_local_tail - 1)
+    {
+      return;
+    }
+    ring->sqes[conn->send_seq & ring->sq_mask].flags |= IOSQE_IO_LINK;
+  }
+  uring_arm_recv(conn);
+}
+
+/**
+ * Release a closed connection once the kernel has finished its operations. The pending ones are
+ * finished by shutting the socket down.
+ *
+ * @param conn Connection
+*/
+static void uring_conn_release(struct uring_conn_t* conn)
+{
+  if (!conn->closed)
+  {
+    return;
+  }
+  if (conn->recv_armed || conn->sending)
+  {
+    if (!conn->shut)
+    {
+      shutdown(conn->addr.sd, SHUT_RDWR);
+      conn->shut = 1;
+    }
+    return;
+  }
+  close(conn->addr.sd);
+  server_stats_add(&server_stats_thread()->connections, -1);
+
+  calc_service_dtor(conn->context.svc);
+  calc_service_delete(conn->context.svc);
+  calc_proto_ser_dtor(conn->context.ser);
+  calc_proto_ser_delete(conn->context.ser);
+  free(conn->context.out);
+  free(conn->wbuf);
+  free(conn);
+}
+
+/**
+ * Create the state of a new connection and queue its first read
+ *
+ * @param ring Ring that owns the connection
+ * @param sd Socket of the client
+*/
+static void uring_conn_open(struct uring_t* ring, int sd)
+{
+  struct uring_conn_t* conn = (struct uring_conn_t*)calloc(1, sizeof(struct uring_conn_t));
+  struct client_context_t* context = &conn->context;
+  conn->addr.sd = sd;
+  conn->ring = ring;
+  context->addr = &conn->addr;
+  struct server_stats_t* stats = server_stats_thread();
+  server_stats_add(&stats->connections, 1);
+  server_stats_add(&stats->accepted, 1);
+
+  // Instance new serialization object
+  context->ser = calc_proto_ser_new();
+  calc_proto_ser_ctor(context->ser, context, 256);
+  calc_proto_ser_set_req_callback(context->ser, request_callback);
+  calc_proto_ser_set_req_batch_callback(context->ser, request_batch_callback);
+  calc_proto_ser_set_error_callback(context->ser, error_callback);
+
+  // Instance new calculation service object
+  context->svc = calc_service_new();
+  calc_service_ctor(context->svc);
+  attach_mem_register(context->svc);
+
+  context->write_resp = &uring_write_resp;
+  context->flush_resps = &uring_flush_resps;
+  context->negotiated = 0;
+  context->out_cap = RESP_BUFFER_SIZE;
+  context->out = (char*)malloc(context->out_cap);
+  context->out_len = 0;
+  conn->wbuf_cap = RESP_BUFFER_SIZE;
+  conn->wbuf = (char*)malloc(conn->wbuf_cap);
+
+  uring_arm_recv(conn);
+}
+
+/**
+ * Process the completion of a read: the requests are answered, the buffer is given back, and the
+ * responses are sent with the next read linked.
+ *
+ * @param conn Connection
+ * @param res Result of the read
+ * @param flags Flags of the completion (with the identifier of the buffer used)
+*/
+static void uring_handle_recv(struct uring_conn_t* conn, int res, unsigned flags)
+{
+  struct client_context_t* context = &conn->context;
+  conn->recv_armed = 0;
+  if (res > 0 && (flags & IORING_CQE_F_BUFFER))
+  {
+    unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    struct buffer_t buf;
+    buf.data = conn->ring->bufs + (size_t)bid * READ_BUFFER_SIZE;
+    buf.len = res;
+    struct server_stats_t* stats = server_stats_thread();
+    server_stats_add(&stats->bytes_in, res);
+    server_stats_read_begin(stats);
+    server_trace_read(&context->trace, conn->addr.sd);
+
+    // The first byte of the connection selects the wire format (see client_handler)
+    if (!context->negotiated && negotiate_wire_mode(context, buf))
+    {
+      context->out[context->out_len++] = (char)CALC_PROTO_BINARY_HELLO;
+      buf.data++; buf.len--;
+    }
+    calc_proto_ser_server_deserialize(context->ser, buf, NULL);
+    server_stats_read_decoded(stats);
+    uring_recycle_buf(conn->ring, bid);
+
+    // The send is only queued here, the write time doesn't include the kernel sending it
+    uring_flush_resps(context);
+    server_stats_read_end(stats);
+  }
+  else if (res != -ENOBUFS && res != -ECANCELED)
+  {
+    // The client left (0) or the connection failed. Without free buffers (ENOBUFS) the read is
+    // just queued again, and a read canceled by its linked send is queued when the send finishes.
+    conn->closed = 1;
+  }
+  uring_conn_rearm(conn);
+  uring_conn_release(conn);
+}
+
+/**
+ * Process the completion of a send
+ *
+ * @param conn Connection
+ * @param res Result of the send
+*/
+static void uring_handle_send(struct uring_conn_t* conn, int res)
+{
+  conn->sending = 0;
+  if (res < 0)
+  {
+    server_stats_add(&server_stats_thread()->write_errors, 1);
+    conn->closed = 1;
+  }
+  else
+  {
+    server_stats_add(&server_stats_thread()->bytes_out, res);
+    conn->wsent += res;
+    if (conn->wsent < conn->wlen && !conn->closed)
+    {
+      uring_submit_send(conn);
+      return;
+    }
+
+    // The response traced was in the send that finished
+    if (conn->context.trace.state == TRACE_SENDING)
+    {
+      server_trace_commit(&conn->context.trace);
+    }
+
+    // The responses written while the send was in progress go now
+    uring_flush_resps(&conn->context);
+  }
+  uring_conn_rearm(conn);
+  uring_conn_release(conn);
+}
+
+/**
+ * Manage and accept infinite incoming client connections with io_uring (see the comments at the
+ * beginning of this file). Falls back to accept_forever_epoll when io_uring can't be used.
+ *
+ * @param server_sd Socket related with server
+*/
+void accept_forever_uring(int server_sd)
+{
+  struct uring_t ring;
+  if (uring_ctor(&ring, server_sd) == -1)
+  {
+    fprintf(stderr, "io_uring is not available (%s), using epoll\n", strerror(errno));
+    accept_forever_epoll(server_sd);
+    return;
+  }
+  uring_arm_accept(&ring);
+
+  while (1)
+  {
+    uring_submit(&ring, 1);
+
+    // A bounded number of completions per round, so the operations they queue fit in the
+    // submission queue
+    unsigned head = *ring.cq_head;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    for (int i = 0; head != tail && i < MAX_CQES_PER_LOOP; i++, head++)
+    {
+      struct io_uring_cqe* cqe = &ring.cqes[head & ring.cq_mask];
+      uint64_t user_data = cqe->user_data;
+      int res = cqe->res;
+      unsigned flags = cqe->flags;
+      __atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+
+      struct uring_conn_t* conn =
+          (struct uring_conn_t*)(uintptr_t)(user_data & ~(uint64_t)OP_MASK);
+      switch (user_data & OP_MASK)
+      {
+        case OP_ACCEPT:
+          if (res >= 0)
+          {
+            uring_conn_open(&ring, res);
+          }
+          else
+          {
+            // Running out of descriptors, for instance, shouldn't stop the connected clients
+            fprintf(stderr, "Could not accept the client: %s\n", strerror(-res));
+          }
+          if (!(flags & IORING_CQE_F_MORE))
+          {
+            uring_arm_accept(&ring);
+          }
+          break;
+        case OP_RECV:
+          uring_handle_recv(conn, res, flags);
+          break;
+        case OP_SEND:
+          uring_handle_send(conn, res);
+          break;
+      }
+    }
+  }
+}
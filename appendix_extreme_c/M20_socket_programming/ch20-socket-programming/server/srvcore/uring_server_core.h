@@ -0,0 +1,6 @@
+#ifndef URING_SERVER_CORE_H
+#define URING_SERVER_CORE_H
+
+void accept_forever_uring(int server_sd);
+
+#endif
@@ -0,0 +1,150 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "ws_deque.h"
+
+/**
+ * The tasks live in a ring between 'top' (the oldest one) and 'bottom' (where the next push goes).
+ * Only the owner moves 'bottom', and the thieves move 'top' with a compare-and-swap. The only race
+ * is for the last task: the owner announces the take lowering 'bottom' first, and then, like the
+ * thieves, it has to win the compare-and-swap on 'top' to keep it.
+ *
+ * The memory orders follow "Correct and Efficient Work-Stealing for Weak Memory Models" (Le, Pop,
+ * Cohen and Zappa Nardelli, 2013).
+*/
+
+#define CACHE_LINE 64
+
+struct ws_deque_t
+{
+  _Atomic(struct task_t*)* tasks;
+  long mask;
+  // The owner and the thieves touch different cache lines
+  _Alignas(CACHE_LINE) atomic_long top;
+  _Alignas(CACHE_LINE) atomic_long bottom;
+};
+
+struct ws_deque_t* ws_deque_new()
+{
+  return (struct ws_deque_t*)aligned_alloc(CACHE_LINE, sizeof(struct ws_deque_t));
+}
+
+void ws_deque_delete(struct ws_deque_t* deque)
+{
+  free(deque);
+}
+
+void ws_deque_ctor(struct ws_deque_t* deque, int capacity)
+{
+  long size = 2;
+  while (size < capacity)
+  {
+    size *= 2;
+  }
+  deque->tasks = (_Atomic(struct task_t*)*)malloc(size * sizeof(_Atomic(struct task_t*)));
+  deque->mask = size - 1;
+  for (long i = 0; i < size; i++)
+  {
+    atomic_init(&deque->tasks[i], NULL);
+  }
+  atomic_init(&deque->top, 0);
+  atomic_init(&deque->bottom, 0);
+}
+
+void ws_deque_dtor(struct ws_deque_t* deque)
+{
+  free(deque->tasks);
+}
+
+/**
+ * Add a task at the bottom (only the owner)
+ *
+ * @param deque Deque
+ * @param task Task
+ *
+ * @return 0 on success, -1 if the deque is full
+*/
+int ws_deque_push(struct ws_deque_t* deque, struct task_t* task)
+{
+  long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+  if (b - t > deque->mask)
+  {
+    return -1;
+  }
+  atomic_store_explicit(&deque->tasks[b & deque->mask], task, memory_order_relaxed);
+
+  // The task must be visible before the thieves see the new bottom (a release store instead of
+  // the release fence of the paper, the same on x86 and understood by ThreadSanitizer)
+  atomic_store_explicit(&deque->bottom, b + 1, memory_order_release);
+  return 0;
+}
+
+/**
+ * Take the task at the bottom, the newest one (only the owner)
+ *
+ * @param deque Deque
+ *
+ * @return The task, or NULL if the deque is empty
+*/
+struct task_t* ws_deque_take(struct ws_deque_t* deque)
+{
+  long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+  struct task_t* task = NULL;
+  if (t <= b)
+  {
+    task = atomic_load_explicit(&deque->tasks[b & deque->mask], memory_order_relaxed);
+    if (t == b)
+    {
+      // The last task, a thief can be taking it at the same time
+      if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+          memory_order_seq_cst, memory_order_relaxed))
+      {
+        task = NULL;
+      }
+      atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    }
+  }
+  else
+  {
+    atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+  }
+  return task;
+}
+
+/**
+ * Take the task at the top, the oldest one (any thread)
+ *
+ * @param deque Deque
+ *
+ * @return The task, or NULL if the deque is empty or another thread was faster
+*/
+struct task_t* ws_deque_steal(struct ws_deque_t* deque)
+{
+  long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+  if (t >= b)
+  {
+    return NULL;
+  }
+  struct task_t* task = atomic_load_explicit(&deque->tasks[t & deque->mask],
+      memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+      memory_order_seq_cst, memory_order_relaxed))
+  {
+    return NULL;
+  }
+  return task;
+}
+
+int ws_deque_size(struct ws_deque_t* deque)
+{
+  long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  long t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+  return b > t ? (int)(b - t) : 0;
+}
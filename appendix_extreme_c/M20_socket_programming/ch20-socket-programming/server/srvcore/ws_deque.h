@@ -0,0 +1,34 @@
+#ifndef WS_DEQUE_H
+#define WS_DEQUE_H
+
+/**
+ * Work-stealing deque (Chase-Lev). Its owner thread pushes and takes tasks at the bottom, like a
+ * stack, so the last task it created (whose data is still in its cache) runs first. The other
+ * threads steal from the top, the oldest task, so the owner and the thieves rarely meet at the same
+ * end. None of the operations uses locks, see executor.c for the scheduler built on top of it.
+*/
+
+struct task_t;
+
+// Forward declaration
+struct ws_deque_t;
+
+// Memory management function
+struct ws_deque_t* ws_deque_new();
+void ws_deque_delete(struct ws_deque_t*);
+
+// Constructor (the capacity is rounded up to a power of two) and destructor
+void ws_deque_ctor(struct ws_deque_t*, int capacity);
+void ws_deque_dtor(struct ws_deque_t*);
+
+// Methods of the owner thread: push returns -1 if the deque is full, take NULL if it is empty
+int ws_deque_push(struct ws_deque_t*, struct task_t* task);
+struct task_t* ws_deque_take(struct ws_deque_t*);
+
+// Method of the other threads: NULL if the deque is empty or another thread took the task first
+struct task_t* ws_deque_steal(struct ws_deque_t*);
+
+// Number of tasks (only an estimation while other threads use the deque)
+int ws_deque_size(struct ws_deque_t*);
+
+#endif
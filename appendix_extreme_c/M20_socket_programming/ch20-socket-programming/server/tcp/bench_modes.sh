@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# Head-to-head benchmark of the concurrency models of the stream servers: for every mode (a
+# thread per client, epoll and io_uring) and every number of client connections, it starts the
+# server with '-m <mode>' and measures it with 'calc_bench', printing the requests per second.
+#
+# Usage (from the build directory):
+#
+#    ../server/tcp/bench_modes.sh [seconds] [connections...]
+#
+# TRANSPORT=unix runs the same benchmark against the Unix stream server. Keep in mind that the
+# load generator runs on the same machine, so it takes part of the CPUs.
+
+BUILD_DIR=${BUILD_DIR:-.}
+TRANSPORT=${TRANSPORT:-tcp}
+if [ "$TRANSPORT" = "unix" ]; then
+  SERVER="$BUILD_DIR/server/unix/stream/unix_stream_calc_server"
+else
+  SERVER="$BUILD_DIR/server/tcp/tcp_calc_server"
+fi
+BENCH="$BUILD_DIR/client/bench/calc_bench"
+
+SECONDS_PER_RUN=${1:-5}
+shift 1 2>/dev/null
+CONNECTIONS=${*:-1 16 256}
+
+if [ ! -x "$SERVER" ] || [ ! -x "$BENCH" ]; then
+  echo "Build the project first (or set BUILD_DIR)" >&2
+  exit 1
+fi
+
+for conns in $CONNECTIONS; do
+  for mode in threads epoll uring; do
+    "$SERVER" -m "$mode" &
+    server_pid=$!
+    sleep 0.5
+
+    printf "%-8s " "$mode"
+    "$BENCH" -t "$TRANSPORT" -c "$conns" -d 16 -s "$SECONDS_PER_RUN" | tail -n 1
+
+    kill "$server_pid"
+    wait "$server_pid" 2>/dev/null
+
+    # The kernel releases the rings of io_uring (and the listening socket they hold) after the
+    # process exits, so the next server could find the address still in use
+    sleep 0.5
+  done
+done
@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# Benchmark of the multi-reactor mode of the TCP server: for R = 1, 2, 4... up to the number of
+# CPUs, it starts 'tcp_calc_server -m epoll -r R' and measures it with 'calc_bench' (four client
+# connections per reactor), printing the requests per second of every reactor count.
+#
+# Usage (from the build directory):
+#
+#    ../server/tcp/bench_reactors.sh [max_reactors] [seconds] [extra server options, like -l lc]
+#
+# Keep in mind that the load generator runs on the same machine, so it takes part of the CPUs.
+
+BUILD_DIR=${BUILD_DIR:-.}
+SERVER="$BUILD_DIR/server/tcp/tcp_calc_server"
+BENCH="$BUILD_DIR/client/bench/calc_bench"
+
+MAX_REACTORS=${1:-$(nproc)}
+SECONDS_PER_RUN=${2:-5}
+shift 2 2>/dev/null
+SERVER_OPTS="$*"
+
+if [ ! -x "$SERVER" ] || [ ! -x "$BENCH" ]; then
+  echo "Build the project first (or set BUILD_DIR)" >&2
+  exit 1
+fi
+
+reactors=1
+while [ "$reactors" -le "$MAX_REACTORS" ]; do
+  "$SERVER" -m epoll -r "$reactors" $SERVER_OPTS &
+  server_pid=$!
+  sleep 0.5
+
+  printf "reactors=%-3d " "$reactors"
+  "$BENCH" -t tcp -c $((reactors * 4)) -d 16 -s "$SECONDS_PER_RUN" | tail -n 1
+
+  kill "$server_pid"
+  wait "$server_pid" 2>/dev/null
+  reactors=$((reactors * 2))
+done
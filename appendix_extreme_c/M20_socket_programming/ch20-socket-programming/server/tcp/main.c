@@ -18,6 +18,15 @@
  * AF_INET, and have a different socket adresses requirement. But for the rest
  * is almost the same implementation.
  * 
+ * Like the Unix stream server, it serves every client with its own thread by default, or all of
+ * them with a single event loop when it is started with '-m epoll' (or '-m uring', the same with
+ * io_uring instead of epoll). With '-w N' the clients are served by a pool of N threads instead.
+ * With '-S path' the counters of the server are served in a Unix socket (see server_stats.h), and
+ * with '-T N' one read of every N is traced (see server_trace.h). With '-M name' the memory
+ * methods of all the clients share the register name (see calc_registers.h), for running totals
+ * across clients, and with '-C N' the results of the ADD, SUB, MUL and DIV requests are kept in a
+ * cache of N slots (see calc_cache.h), so the requests repeated by the clients skip the service.
+ * 
  * WHEN READY: Go to the code /client/tcp/main.c
 */
 
@@ -43,6 +52,9 @@ socklen_t sockaddr_sizeof()
 
 int main(int argc, char** argv) 
 {
+  // ----------- 0. Parse the options (-m threads|epoll|uring) ----------------------
+  struct stream_options_t opts;
+  stream_options_parse(&opts, argc, argv);
 
   // ----------- 1. Create socket object --------------------------------------
   // Focus your attetion in the change of AF_UNIX to AF_INET
@@ -85,7 +97,7 @@ int main(int argc, char** argv)
   }
 
   // ----------- 4. Start accepting clients -----------------------------------
-  accept_forever(server_sd);
+  serve_stream(server_sd, &opts);
 
   return 0;
 }
@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# Scaling benchmark of the sharded UDP server: for K = 1, 2, 4... up to the number of CPUs, it
+# starts 'udp_calc_server -w K' and measures it with 'calc_bench' (two client connections per
+# worker, so SO_REUSEPORT has several client addresses to spread).
+#
+# Usage (from the build directory):
+#
+#    ../server/udp/bench_scaling.sh [max_workers] [seconds] [extra server options, like -P -b 32]
+#
+# Keep in mind that the load generator runs on the same machine, so it takes part of the CPUs.
+
+BUILD_DIR=${BUILD_DIR:-.}
+SERVER="$BUILD_DIR/server/udp/udp_calc_server"
+BENCH="$BUILD_DIR/client/bench/calc_bench"
+
+MAX_WORKERS=${1:-$(nproc)}
+SECONDS_PER_RUN=${2:-5}
+shift 2 2>/dev/null
+SERVER_OPTS="$*"
+
+if [ ! -x "$SERVER" ] || [ ! -x "$BENCH" ]; then
+  echo "Build the project first (or set BUILD_DIR)" >&2
+  exit 1
+fi
+
+workers=1
+while [ "$workers" -le "$MAX_WORKERS" ]; do
+  "$SERVER" -w "$workers" $SERVER_OPTS &
+  server_pid=$!
+  sleep 0.5
+
+  printf "workers=%-3d " "$workers"
+  "$BENCH" -t udp -c $((workers * 2)) -d 16 -s "$SECONDS_PER_RUN" | tail -n 1
+
+  kill "$server_pid"
+  wait "$server_pid" 2>/dev/null
+  workers=$((workers * 2))
+done
@@ -8,7 +8,10 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 
+#include <common_server_core.h>
 #include <datagram_server_core.h>
+#include <server_stats.h>
+#include <server_trace.h>
 
 /**
  * UDP sockets are network sockets (and datagram sockets), so the socket type
@@ -17,6 +20,24 @@
  * As the datagram are still in use, the UDS is still valid here, and it is
  * the reason to keep the same implementation of serve forever on the UDS.
  * 
+ * The server accepts an optional batch size (-b N, 1 by default). With N > 1 the datagrams are
+ * received with 'recvmmsg' and answered with 'sendmmsg', up to N at a time:
+ * 
+ *    ./udp_calc_server -b 32
+ * 
+ * A single loop uses a single core. With -w K, K worker threads are started, each one with its own
+ * socket bound to the same port thanks to SO_REUSEPORT, so the kernel spreads the datagrams among
+ * them (by the address of the client). The datagrams are independent, so the workers don't share
+ * anything. With -P every worker is pinned to its own CPU:
+ * 
+ *    ./udp_calc_server -w 4 -P -b 32
+ * 
+ * With -S path the counters of the server (datagrams, bytes, times...) are served in a Unix
+ * socket, see server_stats.h. With -T N one datagram of every N is traced (see server_trace.h).
+ * With -M name the memory methods of all the clients share the register name (see
+ * calc_registers.h) instead of a memory per client. With -C N the results of the ADD, SUB, MUL and
+ * DIV requests are kept in a cache of N slots shared by the workers (see calc_cache.h).
+ * 
  * WHEN READY: Go to the client/udp/main.c file.
 */
 
@@ -40,9 +61,27 @@ socklen_t sockaddr_sizeof()
   return sizeof(struct sockaddr_in);
 }
 
-int main(int argc, char** argv) 
+/**
+ * Print the options of the server and exit
+ * 
+ * @param name Name of the program
+*/
+void usage(const char* name)
 {
+  fprintf(stderr, "Usage: %s [-b batch_size] [-w workers] [-P] [-S stats_socket] "
+      "[-T trace_every] [-M mem_register] [-C cache_slots]\n", name);
+  exit(1);
+}
 
+/**
+ * Create the socket of the server and bind it to the port of the calculator
+ * 
+ * @param reuse_port Non zero to let other sockets (of the other workers) bind the same port
+ * 
+ * @return Socket descriptor
+*/
+int open_server_socket(int reuse_port)
+{
   // ----------- 1. Create socket object -----------------------------------
   // Domain is still AF_INET, but the type is nwo for datagrams
   int server_sd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -53,6 +92,18 @@ int main(int argc, char** argv)
     exit(1);
   }
 
+  // All the sockets that set SO_REUSEPORT can bind the same port, and the kernel balances the
+  // datagrams among them
+  int one = 1;
+  if (reuse_port &&
+      setsockopt(server_sd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1) 
+  {
+    close(server_sd);
+    fprintf(stderr, "Could not set SO_REUSEPORT: %s\n",
+            strerror(errno));
+    exit(1);
+  }
+
   // ----------- 2. Bind the socket file ----------------------------------
 
   // Prepare the address (and configure it properly for the socket)
@@ -71,9 +122,62 @@ int main(int argc, char** argv)
             strerror(errno));
     exit(1);
   }
+  return server_sd;
+}
+
+int main(int argc, char** argv) 
+{
+  // ----------- 0. Parse the options --------------------------------------
+  int batch_size = 1;
+  int workers = 1;
+  int pin_cpus = 0;
+  const char* stats_path = NULL;
+  int trace_every = 0;
+  const char* mem_register = NULL;
+  long cache_slots = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:w:PS:T:M:C:")) != -1) 
+  {
+    switch (opt) 
+    {
+      case 'b': batch_size = atoi(optarg); break;
+      case 'w': workers = atoi(optarg); break;
+      case 'P': pin_cpus = 1; break;
+      case 'S': stats_path = optarg; break;
+      case 'T': trace_every = atoi(optarg); break;
+      case 'M': mem_register = optarg; break;
+      case 'C': cache_slots = atol(optarg); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (batch_size < 1 || batch_size > 1024 || workers < 1 || workers > 256 ||
+      trace_every < 0 || (mem_register && share_mem_register(mem_register) == -1) ||
+      cache_slots < 0 || (cache_slots > 0 && enable_result_cache(cache_slots) == -1)) 
+  {
+    usage(argv[0]);
+  }
+  server_trace_enable(trace_every);
+  if (stats_path && server_stats_serve(stats_path) == -1) 
+  {
+    fprintf(stderr, "WARN: Could not serve the counters in %s: %s\n", stats_path,
+            strerror(errno));
+  }
 
-  // ----------- 3. Start serving requests ---------
-  serve_forever(server_sd);
+  // ----------- 1/2. Create the sockets, and 3. Start serving requests ---------
+  if (workers > 1 || pin_cpus) 
+  {
+    serve_forever_sharded(open_server_socket, workers, batch_size, pin_cpus);
+    return 0;
+  }
+  int server_sd = open_server_socket(0);
+  if (batch_size > 1) 
+  {
+    serve_forever_batched(server_sd, batch_size);
+  } 
+  else 
+  {
+    serve_forever(server_sd);
+  }
 
   return 0;
 }
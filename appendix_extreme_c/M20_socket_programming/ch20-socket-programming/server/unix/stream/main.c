@@ -27,6 +27,10 @@
 
 int main(int argc, char** argv) 
 {
+  // Options of the server (-m threads|epoll|uring, -w workers...), see stream_server_core.h
+  struct stream_options_t opts;
+  stream_options_parse(&opts, argc, argv);
+
   // Name of socket file (absolute path)
   char sock_file[] = "/tmp/calc_svc.sock";
 
@@ -77,7 +81,7 @@ int main(int argc, char** argv)
   }
 
   // ----------- 4. Start accepting clients -------------------------------------------
-  accept_forever(server_sd);
+  serve_stream(server_sd, &opts);
   //NOTE: accept_forever is a blocking function, so the main would never stop
 
   // If you need to accept clients one by one, you can follow the next implementation: